@@ -1,3 +1,7 @@
+//the SyncAddress interrupt belongs to the packet read when it is at most this old:
+//66 bytes at 17241 bps plus the polling delay
+#define SYNC_MAX_AGE_US 60000
+
 //template <typename SPI>
 class SX1276ws : public SX1276fsk
 {
@@ -8,9 +12,14 @@ class SX1276ws : public SX1276fsk
     };
 
 public:
+    int64_t rxUs;            //arrival, esp_timer_get_time() at SyncAddress or else PayloadReady, monotonic
+    uint32_t syncStamped;    //packets timestamped by the SyncAddress interrupt
+    volatile int64_t syncUs; //esp_timer_get_time() at the last SyncAddress interrupt
+
     SX1276ws(SPIClass &spi_, int8_t ss_, int8_t reset_ = -1)
-        : SX1276fsk(spi_, ss_, reset_){};
+        : SX1276fsk(spi_, ss_, reset_), rxUs(0), syncStamped(0), syncUs(0){};
     void init(uint8_t id, uint8_t group, int freq);
+    void setSyncPin(int8_t pin);
     int receive(void *ptr, int len);
     int readPacket(void *ptr, int len);
 };
@@ -61,6 +70,25 @@ void SX1276ws::init(uint8_t id, uint8_t group, int freq)
     printf("SX1276ws init done\n");
 }
 
+//DIO2 on SyncAddress gives the arrival time of a packet to the us, at the end of its
+//sync word, without the polling delay of receive(). Not wired on every board.
+static SX1276ws *syncRadio = nullptr;
+
+static void IRAM_ATTR syncISR()
+{
+    syncRadio->syncUs = esp_timer_get_time();
+}
+
+void SX1276ws::setSyncPin(int8_t pin)
+{
+    if (pin < 0)
+        return;
+    syncRadio = this;
+    this->writeReg(REG_DIOMAPPING1, (this->readReg(REG_DIOMAPPING1) & ~0x0C) | 0x0C); // DIO2 = SyncAddress
+    pinMode(pin, INPUT);
+    attachInterrupt(pin, syncISR, RISING);
+}
+
 int SX1276ws::receive(void *ptr, int len)
 {
     if (mode != MODE_RECEIVE)
@@ -71,8 +99,7 @@ int SX1276ws::receive(void *ptr, int len)
         snr = 0;
         lna = 0;
         afc = 0;
-        rxAt.tv_sec = 0;
-        rxAt.tv_usec = 0;
+        rxUs = 0;
         setMode(MODE_RECEIVE);
         return -1;
     }
@@ -151,12 +178,18 @@ int SX1276ws::receive(void *ptr, int len)
 int SX1276ws::readPacket(void *ptr, int len)
 {
     //uint32_t dt = micros() - intr0At;
-    gettimeofday(&rxAt, 0);
-    if (rxAt.tv_sec < 1500000000)
+    //the wall clock is applied when the packet is published, see WSBase::setWallClock()
+    rxUs = esp_timer_get_time();
+    //a 64 bit read is not atomic, read again when the interrupt wrote in between
+    int64_t sync;
+    do
+    {
+        sync = syncUs;
+    } while (sync != syncUs);
+    if (sync && rxUs - sync < SYNC_MAX_AGE_US)
     {
-        // we don't seem to have the real time :-(
-        rxAt.tv_sec = 0;
-        rxAt.tv_usec = 0;
+        rxUs = sync;
+        syncStamped++;
     }
 
     //printf("ÏRQ2 %02x", (this->readReg(this->REG_IRQFLAGS2)));
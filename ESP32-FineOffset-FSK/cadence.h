@@ -0,0 +1,178 @@
+// Transmit cadence and crystal drift of a weather station
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// A Fine Offset station transmits a burst at a fixed interval, e.g. 16s or 48s,
+// timed by its own crystal. From the arrival times of the bursts the period is
+// estimated with a least squares fit, which includes the drift of the station
+// crystal against the gateway clock. Missed bursts are handled: each arrival is
+// numbered by the multiple of the period since the oldest arrival. While every
+// interval received spans an even number of periods, the fit finds twice the
+// period; it is corrected by the first interval that does not.
+// The phase error of a new arrival against the prediction tells a second
+// transmitter with the same ID apart from the tracked station.
+//
+// No Arduino dependencies: arrival times in us are fed by the caller, so the
+// module can be run on a host with recorded timestamps.
+
+#ifndef CADENCE_H
+#define CADENCE_H
+
+#include <stdint.h>
+
+#define CADENCE_HISTORY 16
+//arrivals closer together than this belong to one burst, only the first is used
+#define CADENCE_BURST_US 500000
+//minimum number of bursts before the period is trusted
+#define CADENCE_LOCK 4
+//a station silent for longer than this starts over
+#define CADENCE_GAP_US 3600000000LL
+//the shortest interval is tried divided by up to this many missed bursts
+#define CADENCE_DIVISOR_MAX 8
+
+class Cadence
+{
+public:
+    Cadence() { reset(); }
+
+    void reset()
+    {
+        count = 0;
+        next = 0;
+        lastUs = 0;
+        periodNs = 0;
+        jitter = 0;
+    }
+
+    //arrival time in us of a packet, from a monotonic clock
+    void add(int64_t us)
+    {
+        if (count && us - lastUs < CADENCE_BURST_US)
+            return;
+        if (count && us - lastUs > CADENCE_GAP_US)
+            reset();
+        lastUs = us;
+        history[next] = us;
+        next = (next + 1) % CADENCE_HISTORY;
+        if (count < CADENCE_HISTORY)
+            count++;
+        fit();
+    }
+
+    bool locked() const { return count >= CADENCE_LOCK && periodNs > 0; }
+    uint8_t bursts() const { return count; }
+
+    //estimated period in us, 0 while not locked
+    uint32_t periodUs() const { return locked() ? (uint32_t)((periodNs + 500) / 1000) : 0; }
+
+    //mean absolute deviation of the arrivals from the fit in us
+    uint32_t jitterUs() const { return jitter; }
+
+    //drift of the station clock against the gateway clock in ppm, for a nominal period in us.
+    //positive when the station transmits later than nominal
+    int32_t driftPpm(uint32_t nominalUs) const
+    {
+        if (!locked() || nominalUs == 0)
+            return 0;
+        return (int32_t)((periodNs - (int64_t)nominalUs * 1000) * 1000 / nominalUs);
+    }
+
+    //deviation of an arrival in us from the nearest predicted burst, 0 while not locked
+    int32_t phaseErrorUs(int64_t us) const
+    {
+        if (!locked())
+            return 0;
+        int64_t dtNs = (us - lastUs) * 1000;
+        int64_t k = (dtNs + (dtNs >= 0 ? periodNs / 2 : -periodNs / 2)) / periodNs;
+        return (int32_t)((dtNs - k * periodNs) / 1000);
+    }
+
+private:
+    int64_t history[CADENCE_HISTORY]; //burst arrivals in us, ring buffer
+    uint8_t count;
+    uint8_t next;
+    int64_t lastUs;
+    int64_t periodNs;
+    uint32_t jitter;
+
+    int64_t at(uint8_t i) const
+    {
+        //i = 0 is the oldest arrival
+        return history[(next + CADENCE_HISTORY - count + i) % CADENCE_HISTORY];
+    }
+
+    //every interval between the arrivals is a whole number of periods p, within p/8
+    bool multiples(int64_t p) const
+    {
+        if (p <= 0)
+            return false;
+        for (int i = 1; i < count; i++)
+        {
+            int64_t r = (at(i) - at(i - 1)) % p;
+            if (r > p / 8 && r < p - p / 8)
+                return false;
+        }
+        return true;
+    }
+
+    void fit()
+    {
+        if (count < 2)
+            return;
+        //first guess: shortest interval, the others may contain missed bursts
+        int64_t guess = INT64_MAX;
+        for (int i = 1; i < count; i++)
+        {
+            int64_t d = at(i) - at(i - 1);
+            if (d < guess)
+                guess = d;
+        }
+        if (periodNs > 0 && periodNs / 1000 < guess)
+            guess = periodNs / 1000;
+        if (guess <= 0)
+            return;
+        //the shortest interval may span missed bursts, e.g. 32s and 48s for a 16s station:
+        //the period is the largest divisor of it that every interval is a multiple of
+        for (int m = 1; m <= CADENCE_DIVISOR_MAX; m++)
+        {
+            if (multiples(guess / m))
+            {
+                guess /= m;
+                break;
+            }
+        }
+
+        //least squares t = a + b * k, t relative to the oldest arrival in us
+        int64_t t0 = at(0);
+        int64_t n = count, sk = 0, st = 0, skk = 0, skt = 0;
+        for (int i = 0; i < count; i++)
+        {
+            int64_t t = at(i) - t0;
+            int64_t k = (t + guess / 2) / guess;
+            sk += k;
+            st += t;
+            skk += k * k;
+            skt += k * t;
+        }
+        int64_t den = n * skk - sk * sk;
+        if (den == 0)
+            return;
+        int64_t num = n * skt - sk * st;
+        periodNs = num / den * 1000 + num % den * 1000 / den;
+        if (periodNs <= 0)
+            return;
+
+        //jitter: residuals against the fit, a = (st - b * sk) / n
+        int64_t aNs = (st * 1000 - periodNs * sk) / n;
+        int64_t sum = 0;
+        for (int i = 0; i < count; i++)
+        {
+            int64_t t = (at(i) - t0) * 1000;
+            int64_t k = (t + periodNs / 2) / periodNs;
+            int64_t r = t - aNs - k * periodNs;
+            sum += r < 0 ? -r : r;
+        }
+        jitter = (uint32_t)(sum / n / 1000);
+    }
+};
+
+#endif
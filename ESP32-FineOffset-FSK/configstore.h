@@ -0,0 +1,162 @@
+// Crash-safe record store on SPIFFS
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Each slot (weather station) is stored on its own, so a configuration change
+// only rewrites the record of that slot. A slot has two files, A and B. A write
+// goes to the file that does not hold the newest record, with a higher sequence
+// number. Every record carries a CRC32 of its data, so a write that is cut short
+// by a power loss is detected at load and the previous record is used instead.
+// A record equal to the newest one is not written again.
+
+#ifndef CONFIGSTORE_H
+#define CONFIGSTORE_H
+
+#include <Arduino.h>
+#include <SPIFFS.h>
+#include "fmtbuf.h"
+
+#define CS_MAGIC 0x31435357 //"WSC1"
+#define CS_PATH_MAX 24
+
+struct ConfigRecordHeader
+{
+    uint32_t magic;
+    uint32_t seq; //newest record has the highest sequence number
+    uint32_t len; //bytes of data following the header
+    uint32_t crc; //CRC32 of the data
+};
+
+//CRC-32 (IEEE 802.3), bitwise to keep it small, records are only checked at boot
+static inline uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc = 0)
+{
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *data++;
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+template <uint16_t N>
+class ConfigStore
+{
+public:
+    ConfigStore(const char *directory) : dir(directory)
+    {
+        memset(seq, 0, sizeof(seq));
+        memset(inB, 0, sizeof(inB));
+        memset(crc, 0, sizeof(crc));
+        memset(len, 0, sizeof(len));
+    }
+
+    //Read the newest valid record of slot into buf, zero terminated.
+    //Returns the length, or -1 when the slot has no valid record.
+    int read(uint16_t slot, char *buf, size_t size)
+    {
+        ConfigRecordHeader a, b;
+        bool validA = check(slot, false, a, size - 1);
+        bool validB = check(slot, true, b, size - 1);
+        if (!validA && !validB)
+            return -1;
+        bool useB = validB && (!validA || (int32_t)(b.seq - a.seq) > 0);
+        seq[slot] = useB ? b.seq : a.seq;
+        inB[slot] = useB;
+        crc[slot] = useB ? b.crc : a.crc;
+        len[slot] = useB ? b.len : a.len;
+
+        char path[CS_PATH_MAX];
+        File f = SPIFFS.open(filename(slot, useB, path), FILE_READ);
+        if (!f)
+            return -1;
+        f.seek(sizeof(ConfigRecordHeader));
+        size_t n = f.read((uint8_t *)buf, len[slot]);
+        f.close();
+        if (n != len[slot])
+            return -1;
+        buf[n] = 0;
+        return n;
+    }
+
+    //Write a new record for slot, the newest record is kept until this one is complete
+    bool write(uint16_t slot, const char *data, size_t size)
+    {
+        ConfigRecordHeader h;
+        h.magic = CS_MAGIC;
+        h.seq = seq[slot] + 1;
+        h.len = size;
+        h.crc = crc32((const uint8_t *)data, size);
+        if (seq[slot] && h.len == len[slot] && h.crc == crc[slot])
+            return true; //unchanged, no flash wear
+
+        bool toB = !inB[slot];
+        char path[CS_PATH_MAX];
+        File f = SPIFFS.open(filename(slot, toB, path), FILE_WRITE);
+        if (!f)
+        {
+            printf("ConfigStore: failed to open %s\n", path);
+            return false;
+        }
+        bool ok = f.write((const uint8_t *)&h, sizeof(h)) == sizeof(h) &&
+                  f.write((const uint8_t *)data, size) == size;
+        f.close();
+        if (!ok)
+        {
+            printf("ConfigStore: failed to write %s\n", path);
+            return false;
+        }
+        seq[slot] = h.seq;
+        inB[slot] = toB;
+        crc[slot] = h.crc;
+        len[slot] = h.len;
+        return true;
+    }
+
+private:
+    const char *dir;
+    uint32_t seq[N]; //sequence number of the newest record
+    bool inB[N];     //newest record is in file B
+    uint32_t crc[N]; //of the newest record
+    uint32_t len[N];
+
+    const char *filename(uint16_t slot, bool b, char *path)
+    {
+        FmtBuf name(path, CS_PATH_MAX);
+        name.str(dir).chr('/').u32(slot).str(b ? ".b" : ".a");
+        return path;
+    }
+
+    //validate the header and CRC of a record file without keeping its data
+    bool check(uint16_t slot, bool b, ConfigRecordHeader &h, size_t maxLen)
+    {
+        char path[CS_PATH_MAX];
+        filename(slot, b, path);
+        if (!SPIFFS.exists(path))
+            return false;
+        File f = SPIFFS.open(path, FILE_READ);
+        if (!f)
+            return false;
+        bool valid = f.read((uint8_t *)&h, sizeof(h)) == sizeof(h) &&
+                     h.magic == CS_MAGIC && h.len <= maxLen && f.size() == sizeof(h) + h.len;
+        uint32_t crc = 0;
+        uint8_t chunk[64];
+        for (uint32_t left = h.len; valid && left > 0;)
+        {
+            size_t n = f.read(chunk, left < sizeof(chunk) ? left : sizeof(chunk));
+            if (n == 0)
+                valid = false;
+            crc = crc32(chunk, n, crc);
+            left -= n;
+        }
+        f.close();
+        if (valid && crc != h.crc)
+        {
+            printf("ConfigStore: %s has a bad CRC, ignored\n", path);
+            valid = false;
+        }
+        return valid;
+    }
+};
+
+#endif
@@ -0,0 +1,165 @@
+// Cycle benchmark of the decoders and the station update
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Counts the CPU cycles per BR1800/WH1080 decode and per WSSetting::update,
+// next to the double arithmetic the fixed-point decoders replaced, so the cost
+// of soft-float on the ESP32 shows in one table. Enabled with -DCYCLE_BENCH,
+// setup() then prints the table once at boot. tools/bench.cpp runs the same
+// double decoders on the host, with the cycles of the time stamp counter.
+
+#ifndef CYCLEBENCH_H
+#define CYCLEBENCH_H
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <stdio.h>
+//#include "weather.h"
+//#include "stationconfig.h"
+
+#define CB_ITERATIONS 1000
+#define CB_REPS 7
+
+//CPU cycle counter, 32 bits wrap in 17 s at 240 MHz, a repetition takes ms
+static inline uint32_t cbCycles()
+{
+#if defined(ESP_PLATFORM)
+    return ESP.getCycleCount();
+#elif defined(__x86_64__) || defined(__i386__)
+    return (uint32_t)__builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+//the compiler must assume buf changed, so a decode of it is not hoisted out of the loop
+static inline void cbClobber(const void *buf)
+{
+    asm volatile("" : : "r"(buf) : "memory");
+}
+
+//readings in the double units of the firmware before the fixed-point decode
+struct CbDoubleReading
+{
+    double temperature; //in Celsius
+    double windspeed;   //in km/h
+    double windgust;    //in km/h
+    double rain;        //in mm
+    double lightlux;    //in Lux
+};
+
+//BR1800::decode with double arithmetic, for comparison only
+static inline void cbDecodeBR1800Double(const uint8_t *buf, CbDoubleReading &r)
+{
+    int16_t temp = (((buf[3] & 0x07) << 8) | buf[4]) - 400;
+    r.temperature = temp * 0.1;
+    r.windspeed = (((buf[3] & 0x10) << 4) | buf[6]) * 1.12 * 0.125 * 3.6;
+    r.windgust = buf[7] * 1.12 * 3.6;
+    r.rain = ((buf[8] << 8) | buf[9]) * 0.3;
+    r.lightlux = ((buf[12] << 16) | (buf[13] << 8) | buf[14]) / 10.0;
+}
+
+//WH1080::decode with double arithmetic, for comparison only
+static inline void cbDecodeWH1080Double(const uint8_t *sbuf, CbDoubleReading &r)
+{
+    uint8_t sign = (sbuf[1] >> 3) & 1;
+    int16_t temp = ((sbuf[1] & 0x07) << 8) | sbuf[2];
+    if (sign)
+        temp = (~temp) + sign;
+    r.temperature = temp * 0.1;
+    r.windspeed = sbuf[4] * 0.34 * 3.6;
+    r.windgust = sbuf[5] * 0.34 * 3.6;
+    r.rain = (((sbuf[6] & 0x0F) << 8) | sbuf[7]) * 0.3;
+    r.lightlux = 0.0;
+}
+
+//median cycles per call of f over CB_REPS repetitions of CB_ITERATIONS calls
+template <typename F>
+static uint32_t cbMeasure(F f)
+{
+    uint32_t reps[CB_REPS];
+    for (int r = 0; r < CB_REPS; r++)
+    {
+        uint32_t c0 = cbCycles();
+        for (int i = 0; i < CB_ITERATIONS; i++)
+            f(i);
+        reps[r] = (cbCycles() - c0) / CB_ITERATIONS;
+    }
+    //insertion sort, CB_REPS is small
+    for (int i = 1; i < CB_REPS; i++)
+    {
+        for (int j = i; j > 0 && reps[j] < reps[j - 1]; j--)
+        {
+            uint32_t t = reps[j];
+            reps[j] = reps[j - 1];
+            reps[j - 1] = t;
+        }
+    }
+    return reps[CB_REPS / 2];
+}
+
+//print the cycles per call of each case
+static void cycleBench()
+{
+    //frames of tools/corpus/packet
+    static uint8_t wh24[LEN_WH2300 + 1] = {0x24, 0xB4, 0x24, 0x82, 0x77, 0x36, 0x2E, 0x3F, 0x05, 0x09, 0x08, 0x5C, 0x01, 0x3D, 0x62, 0x82, 0x2C};
+    static uint8_t ws3000[LEN_WH2300 + 1] = {0x5A, 0x10, 0xB8, 0x48, 0x0E, 0x17, 0x04, 0xD2, 0xC2};
+    static uint8_t ws4000[LEN_WH2300 + 1] = {0xA5, 0xA0, 0x70, 0x58, 0x61, 0x8F, 0x01, 0x36, 0x0D, 0xA9};
+    volatile int32_t sink = 0; //keeps the results of the decoders
+    CbDoubleReading r;
+
+    printf("cycle bench, median of %d x %d calls\n", CB_REPS, CB_ITERATIONS);
+    BR1800 br1800;
+    WH1080 wh1080;
+    printf("%-28s %8u\n", "BR1800::decode", cbMeasure([&](int i) {
+               cbClobber(wh24);
+               br1800.decode(MSG_WH2300, wh24, LEN_WH2300);
+               sink = br1800.temperature + br1800.windspeed + br1800.windgust + br1800.rain + br1800.lightlux;
+           }));
+    printf("%-28s %8u\n", "BR1800::decode/double", cbMeasure([&](int i) {
+               cbClobber(wh24);
+               cbDecodeBR1800Double(wh24, r);
+               sink = r.temperature + r.windspeed + r.windgust + r.rain + r.lightlux;
+           }));
+    printf("%-28s %8u\n", "WH1080::decode/ws3000", cbMeasure([&](int i) {
+               cbClobber(ws3000);
+               wh1080.decode(MSG_WS3000, ws3000, LEN_WS3000);
+               sink = wh1080.temperature + wh1080.windspeed + wh1080.windgust + wh1080.rain;
+           }));
+    printf("%-28s %8u\n", "WH1080::decode/ws4000", cbMeasure([&](int i) {
+               cbClobber(ws4000);
+               wh1080.decode(MSG_WS4000, ws4000, LEN_WS4000);
+               sink = wh1080.temperature + wh1080.windspeed + wh1080.windgust + wh1080.rain;
+           }));
+    printf("%-28s %8u\n", "WH1080::decode/double", cbMeasure([&](int i) {
+               cbClobber(ws3000);
+               cbDecodeWH1080Double(ws3000, r);
+               sink = r.temperature + r.windspeed + r.windgust + r.rain;
+           }));
+
+    //a packet every 16 s, the rain history fills up to an hour
+    br1800.msgformat = MSG_WH2300;
+    br1800.decode(MSG_WH2300, wh24, LEN_WH2300);
+    br1800.rxUs = 0;
+    WSSetting *st = WSConfig::create(MSG_WH2300);
+    printf("%-28s %8u\n", "WSSetting::update", cbMeasure([&](int i) {
+               br1800.rxUs += 16000000;
+               st->update(&br1800, wh24);
+           }));
+    delete st->wsp;
+    delete st;
+
+    //bursts of 6 repeats 60 ms apart, every 48 s
+    wh1080.msgformat = MSG_WS3000;
+    wh1080.decode(MSG_WS3000, ws3000, LEN_WS3000);
+    wh1080.rxUs = 0;
+    st = WSConfig::create(MSG_WS3000);
+    printf("%-28s %8u\n", "WSWH1080::update", cbMeasure([&](int i) {
+               wh1080.rxUs += i % 6 ? 60000 : 47700000;
+               st->update(&wh1080, ws3000);
+           }));
+    delete st->wsp;
+    delete st;
+    (void)sink;
+}
+
+#endif
@@ -0,0 +1,219 @@
+// OLED dashboard pages and field table
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// A station page shows a configurable list of fields, set per station over
+// MQTT /wsconfig as a comma separated list of keys, e.g. "oled":"wind,temp,rain1h".
+// The row positions and fonts of a page are computed once when the page is
+// shown, per frame only the values are formatted.
+
+#ifndef DASHBOARD_H
+#define DASHBOARD_H
+
+#include <stdint.h>
+#include <string.h>
+//#include "weather.h"
+#include "fmtbuf.h"
+
+#define DASH_FIELDS_MAX 4
+#define DASH_TITLE_HEIGHT 13
+#define DASH_PAGE_MS 5000
+//stations not heard from for this long get no page
+#define DASH_STALE_MS (300 * 1000)
+
+enum DashField
+{
+    DF_NONE,
+    DF_WIND,
+    DF_GUST,
+    DF_WIND1M,
+    DF_GUST1M,
+    DF_KNOTS,
+    DF_BFT,
+    DF_DIR,
+    DF_TEMP,
+    DF_HUM,
+    DF_RAIN,
+    DF_RAIN1H,
+    DF_UV,
+    DF_LUX,
+    DF_RSSI,
+    DF_BATT,
+    DF_COUNT
+};
+
+struct DashFieldDef
+{
+    const char *key;   //key in the "oled" configuration
+    const char *label; //label on the display
+};
+
+static const DashFieldDef dashFields[DF_COUNT] = {
+    {"", ""},
+    {"wind", "wind km/h"},
+    {"gust", "gust km/h"},
+    {"wind1m", "wind 1m km/h"},
+    {"gust1m", "gust 1m km/h"},
+    {"knots", "wind kn"},
+    {"bft", "wind bft"},
+    {"dir", "dir"},
+    {"temp", "temp °C"},
+    {"hum", "hum %"},
+    {"rain", "rain mm"},
+    {"rain1h", "rain 1h mm"},
+    {"uv", "UV index"},
+    {"lux", "light lux"},
+    {"rssi", "rssi dBm"},
+    {"batt", "battery"},
+};
+
+//labels of the pages, other than the field labels of dashFields
+enum DashLabel
+{
+    DL_KMH, //station screen
+    DL_KNOTS,
+    DL_BFT,
+    DL_LAST_UPDATE, //stale screen
+    DL_STATION,     //title of a fields screen, followed by the station
+    DL_RF,          //RF page title, then its rows
+    DL_NOISE,
+    DL_PACKETS,
+    DL_CRCFAIL,
+    DL_DROPPED,
+    DL_NETWORK, //network page title, then its rows
+    DL_WIFI,
+    DL_IP,
+    DL_MQTT,
+    DL_RSSI,
+    DL_COUNT
+};
+
+static const char *const dashLabels[DL_COUNT] = {
+    "km / h", "knots", "bft",
+    "last update at",
+    "station ",
+    "RF", "noise dBm", "packets/min", "crc fail %", "dropped",
+    "network", "wifi", "ip", "mqtt", "rssi dBm"};
+
+//rows of the RF and network pages
+#define DASH_RF_ROWS 4
+#define DASH_NETWORK_ROWS 4
+
+//compass points per 22.5 degrees, padded to 3 characters
+static const char *const dashCompass[16] = {"n  ", "nne", "ne ", "ene", "e  ", "ese", "se ", "sse",
+                                            "s  ", "ssw", "sw ", "wsw", "w  ", "wnw", "nw ", "nnw"};
+
+static inline const char *dashCompassPoint(uint16_t winddir)
+{
+    return dashCompass[((4 * winddir + 45) / 90) & 0x0F];
+}
+
+//windspeed in 0.1 km/h
+static inline int beaufort(uint16_t windspeed)
+{
+    static const uint16_t bft_kmh[] = {9, 55, 115, 195, 285, 385, 495, 615, 745, 885, 1025, 1175, 10000};
+
+    int bft = 0;
+    while (bft < 13 && bft_kmh[bft] < windspeed)
+        ++bft;
+    return bft;
+}
+
+//parse a comma separated list of field keys, unknown keys are skipped, returns the number of fields
+static inline uint8_t dashParseFields(const char *list, uint8_t *fields)
+{
+    uint8_t n = 0;
+    memset(fields, DF_NONE, DASH_FIELDS_MAX);
+    while (*list && n < DASH_FIELDS_MAX)
+    {
+        const char *end = strchr(list, ',');
+        size_t len = end ? end - list : strlen(list);
+        for (uint8_t f = 1; f < DF_COUNT; f++)
+        {
+            if (strlen(dashFields[f].key) == len && strncmp(dashFields[f].key, list, len) == 0)
+            {
+                fields[n++] = f;
+                break;
+            }
+        }
+        if (!end)
+            break;
+        list = end + 1;
+    }
+    return n;
+}
+
+//inverse of dashParseFields
+static inline void dashFormatFields(const uint8_t *fields, FmtBuf &out)
+{
+    for (int i = 0; i < DASH_FIELDS_MAX && fields[i] != DF_NONE; i++)
+    {
+        if (i)
+            out.chr(',');
+        out.str(dashFields[fields[i]].key);
+    }
+}
+
+//format the value of a field, wind and rain in 0.1 units as in WSBase
+static inline void dashFormatValue(uint8_t field, const WSBase &ws, FmtBuf &out)
+{
+    switch (field)
+    {
+    case DF_WIND:
+        out.fixed(ws.windspeed, 1);
+        break;
+    case DF_GUST:
+        out.fixed(ws.windgust, 1);
+        break;
+    case DF_WIND1M:
+        out.fixed(ws.windspeed1m, 1);
+        break;
+    case DF_GUST1M:
+        out.fixed(ws.windgust1m, 1);
+        break;
+    case DF_KNOTS:
+        out.fixed(fxMulDiv(ws.windspeed, KMH_TO_KNOTS_NUM, KMH_TO_KNOTS_DEN), 1);
+        break;
+    case DF_BFT:
+        out.i32(beaufort(ws.windspeed));
+        break;
+    case DF_DIR:
+        out.u32(ws.winddir);
+        break;
+    case DF_TEMP:
+        out.fixed(ws.temperature, 1);
+        break;
+    case DF_HUM:
+        out.u32(ws.humidity);
+        break;
+    case DF_RAIN:
+        out.fixed(ws.rain, 1);
+        break;
+    case DF_RAIN1H:
+        out.fixed(ws.rain1h, 1);
+        break;
+    case DF_UV:
+        out.u32(ws.UVI);
+        break;
+    case DF_LUX:
+        out.u32(ws.lightlux);
+        break;
+    case DF_RSSI:
+        out.fixed(-5 * ws.rssi, 1);
+        break;
+    case DF_BATT:
+        out.str(ws.low_battery ? "low" : "ok");
+        break;
+    default:
+        break;
+    }
+}
+
+//station snapshot handed to the UI task, with the page layout of the station
+struct DashStation
+{
+    WSBase ws;
+    uint8_t fields[DASH_FIELDS_MAX]; //DF_NONE terminated when less than DASH_FIELDS_MAX
+    uint32_t receivedAt;             //millis() when received by the UI task, 0 for a free slot
+};
+
+#endif
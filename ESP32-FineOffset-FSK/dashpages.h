@@ -0,0 +1,258 @@
+// Screens of the OLED dashboard pages
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// A page is an OledView screen. Its layout is added once when the page is
+// shown, per frame only the values are set. The values are passed in by the
+// UI task, so the pages render the same into the host framebuffer of
+// tools/host/heltec.h for the snapshot test, tools/dashsnap.cpp.
+// All text of the pages is in dashLabels and dashFields of dashboard.h.
+
+#ifndef DASHPAGES_H
+#define DASHPAGES_H
+
+#include <stdint.h>
+#include <time.h>
+#include "oledview.h"
+//#include "weather.h"
+//#include "dashboard.h"
+
+enum OledScreen
+{
+    SCREEN_NONE,
+    SCREEN_STATION, //wind screen of a station without configured fields
+    SCREEN_FIELDS,  //configured fields of a station
+    SCREEN_STALE,
+    SCREEN_RF,
+    SCREEN_NETWORK
+};
+
+//fields of the station screen, in the order they are added
+enum
+{
+    F_WIND,
+    F_KNOTS,
+    F_BFT,
+    F_TEMP,
+    F_COMPASS,
+    F_WINDDIR,
+    F_STATUS
+};
+
+//fields of the stale screen
+enum
+{
+    F_STALE_TIME,
+    F_STALE_STATUS
+};
+
+//fields of the row screens, F_ROW + row is the value of a row
+enum
+{
+    F_TITLE,
+    F_ROW
+};
+
+class DashPages
+{
+public:
+    DashPages(OledView &view) : oled(view), screen(SCREEN_NONE), station(-1) {}
+
+    //wind screen of a station, station is its dashStations index
+    void wind(const WSBase &ws, int8_t st, bool wifi, bool mqtt)
+    {
+        showScreen(SCREEN_STATION, st);
+
+        //wind in 0.1 km/h and 0.1 knots
+        char oledmsg[OLED_TEXT_MAX];
+        FmtBuf text(oledmsg, sizeof(oledmsg));
+        speed(text, ws.windspeed);
+        oled.set(F_WIND, oledmsg);
+
+        text.clear();
+        speed(text, fxMulDiv(ws.windspeed, KMH_TO_KNOTS_NUM, KMH_TO_KNOTS_DEN));
+        oled.set(F_KNOTS, oledmsg);
+
+        text.clear();
+        text.i32(beaufort(ws.windspeed));
+        oled.set(F_BFT, oledmsg);
+
+        text.clear();
+        text.fixed(ws.temperature, 1).str("°C");
+        oled.set(F_TEMP, oledmsg);
+
+        oled.set(F_COMPASS, dashCompassPoint(ws.winddir));
+
+        text.clear();
+        text.str("«");
+        size_t from = text.length();
+        text.u32(ws.winddir).pad(from, 3).str("»");
+        oled.set(F_WINDDIR, oledmsg);
+
+        text.clear();
+        text.str(wifi ? "wifi ok mq " : "wifi -- mq ");
+        if (mqtt)
+            text.hex2(ws.msgformat & 0xFF).hex2(ws.stationID & 0xFF).chr(' ');
+        else
+            text.str("xxxx");
+        oled.set(F_STATUS, oledmsg);
+    }
+
+    //configured fields of a station
+    void fields(const DashStation &ds, int8_t st)
+    {
+        const char *labels[DASH_FIELDS_MAX];
+        uint8_t n = 0;
+        while (n < DASH_FIELDS_MAX && ds.fields[n] != DF_NONE)
+        {
+            labels[n] = dashFields[ds.fields[n]].label;
+            n++;
+        }
+        char title[OLED_TEXT_MAX];
+        FmtBuf text(title, sizeof(title));
+        text.str(dashLabels[DL_STATION]).hex2(ds.ws.msgformat & 0xFF).hex2(ds.ws.stationID & 0xFF);
+        showRows(SCREEN_FIELDS, st, title, labels, n);
+
+        char value[OLED_TEXT_MAX];
+        for (int i = 0; i < n; i++)
+        {
+            FmtBuf v(value, sizeof(value));
+            dashFormatValue(ds.fields[i], ds.ws, v);
+            oled.set(F_ROW + i, value);
+        }
+    }
+
+    //no station heard from recently, lastTs is the time of the last packet
+    void stale(time_t lastTs, bool wifi, bool mqtt)
+    {
+        showScreen(SCREEN_STALE);
+
+        char tmbuf[OLED_TEXT_MAX];
+        strftime(tmbuf, sizeof tmbuf, "%Y-%m-%d %H:%M:%S", localtime(&lastTs));
+        oled.set(F_STALE_TIME, tmbuf);
+
+        char statusmsg[OLED_TEXT_MAX];
+        FmtBuf status(statusmsg, sizeof(statusmsg));
+        status.str(wifi ? "wifi ok " : "wifi -- ");
+        status.str(mqtt ? "mq ok  " : "mq --  ");
+        oled.set(F_STALE_STATUS, statusmsg);
+    }
+
+    //noise in dBm, crc failures in 0.1 %
+    void rf(int16_t noise, uint32_t perMin, uint32_t crcFail, uint32_t dropped)
+    {
+        showRows(SCREEN_RF, -1, dashLabels[DL_RF], &dashLabels[DL_RF + 1], DASH_RF_ROWS);
+
+        char value[OLED_TEXT_MAX];
+        FmtBuf text(value, sizeof(value));
+        text.i32(noise);
+        oled.set(F_ROW, value);
+
+        text.clear();
+        text.u32(perMin);
+        oled.set(F_ROW + 1, value);
+
+        text.clear();
+        text.fixed(crcFail, 1);
+        oled.set(F_ROW + 2, value);
+
+        text.clear();
+        text.u32(dropped);
+        oled.set(F_ROW + 3, value);
+    }
+
+    //ssid and ip are nullptr when WiFi is not connected
+    void network(const char *ssid, const char *ip, bool mqtt, int rssi)
+    {
+        showRows(SCREEN_NETWORK, -1, dashLabels[DL_NETWORK], &dashLabels[DL_NETWORK + 1], DASH_NETWORK_ROWS);
+
+        oled.set(F_ROW, ssid ? ssid : "---");
+        oled.set(F_ROW + 1, ip ? ip : "---");
+        oled.set(F_ROW + 2, mqtt ? "ok" : "---");
+
+        char value[OLED_TEXT_MAX];
+        FmtBuf text(value, sizeof(value));
+        if (ssid)
+            text.i32(rssi);
+        else
+            text.str("---");
+        oled.set(F_ROW + 3, value);
+    }
+
+    //station screen with fixed values, shown at boot
+    void test(bool wifi)
+    {
+        showScreen(SCREEN_STATION);
+        oled.set(F_WIND, "144");
+        oled.set(F_KNOTS, "100");
+        oled.set(F_BFT, "12");
+        oled.set(F_TEMP, "-2.5°C");
+        oled.set(F_COMPASS, dashCompassPoint(292));
+        oled.set(F_WINDDIR, "«360»");
+        oled.set(F_STATUS, wifi ? "wifi ok mq 2435" : "wifi -- mq 2435");
+    }
+
+private:
+    OledView &oled;
+    OledScreen screen;
+    int8_t station; //dashStations index on screen
+
+    //speed in 0.1 units, whole units from 20
+    static void speed(FmtBuf &text, int32_t value)
+    {
+        if (value >= 200)
+            text.i32((value + 5) / 10);
+        else
+            text.fixed(value, 1);
+    }
+
+    void showScreen(OledScreen s, int8_t st = -1)
+    {
+        if (s == screen && st == station)
+            return;
+        screen = s;
+        station = st;
+        oled.reset();
+        if (s == SCREEN_STATION)
+        {
+            oled.add(43, 0, ArialMT_Plain_24, TEXT_ALIGN_RIGHT);
+            oled.add(94, 0, ArialMT_Plain_24, TEXT_ALIGN_RIGHT);
+            oled.add(128, 0, ArialMT_Plain_24, TEXT_ALIGN_RIGHT);
+            oled.add(128, 32, ArialMT_Plain_24, TEXT_ALIGN_RIGHT);
+            oled.add(0, 27, ArialMT_Plain_24, TEXT_ALIGN_LEFT);
+            oled.add(0, 49, ArialMT_Plain_16, TEXT_ALIGN_LEFT);
+            oled.add(128, 54, ArialMT_Plain_10, TEXT_ALIGN_RIGHT);
+            //labels
+            oled.add(41, 22, ArialMT_Plain_10, TEXT_ALIGN_RIGHT, dashLabels[DL_KMH]);
+            oled.add(92, 22, ArialMT_Plain_10, TEXT_ALIGN_RIGHT, dashLabels[DL_KNOTS]);
+            oled.add(126, 22, ArialMT_Plain_10, TEXT_ALIGN_RIGHT, dashLabels[DL_BFT]);
+        }
+        else if (s == SCREEN_STALE)
+        {
+            oled.add(0, 10, ArialMT_Plain_10, TEXT_ALIGN_LEFT);
+            oled.add(0, 54, ArialMT_Plain_10, TEXT_ALIGN_LEFT);
+            //labels
+            oled.add(0, 0, ArialMT_Plain_10, TEXT_ALIGN_LEFT, dashLabels[DL_LAST_UPDATE]);
+        }
+    }
+
+    //screen with a title and n rows of a label and a right aligned value
+    //the font of the values is the largest that fits the row height
+    void showRows(OledScreen s, int8_t st, const char *title, const char *const *labels, uint8_t n)
+    {
+        if (s == screen && st == station)
+            return;
+        screen = s;
+        station = st;
+        oled.reset();
+        oled.add(0, 0, ArialMT_Plain_10, TEXT_ALIGN_LEFT, title);
+        uint8_t rowHeight = (OLED_HEIGHT - DASH_TITLE_HEIGHT) / (n ? n : 1);
+        const uint8_t *font = rowHeight >= 28 ? ArialMT_Plain_24 : rowHeight >= 19 ? ArialMT_Plain_16 : ArialMT_Plain_10;
+        for (int i = 0; i < n; i++)
+            oled.add(OLED_WIDTH, DASH_TITLE_HEIGHT + i * rowHeight, font, TEXT_ALIGN_RIGHT);
+        //labels, at the bottom of the row
+        for (int i = 0; i < n; i++)
+            oled.add(0, DASH_TITLE_HEIGHT + (i + 1) * rowHeight - 13, ArialMT_Plain_10, TEXT_ALIGN_LEFT, labels[i]);
+    }
+};
+
+#endif
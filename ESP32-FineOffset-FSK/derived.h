@@ -0,0 +1,154 @@
+// Derived meteorological quantities
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Computed once per packet on the gateway, so MQTT consumers and the upload
+// targets do not each derive them. Inputs and results are in the fixed-point
+// units of WSBase: temperature in 0.1 Celsius, wind in 0.1 km/h, humidity in %.
+// The exp() and log() of the usual formulas are replaced by tables over the
+// integer humidity and temperature, the polynomials run in single precision on
+// the FPU of the ESP32, there is no double soft-float.
+//
+// No Arduino dependencies.
+
+#ifndef DERIVED_H
+#define DERIVED_H
+
+#include <stdint.h>
+#include <math.h>
+
+//ln(RH / 100) * 10000 for RH 0..100 %, 0 % as 1 %
+static const int32_t lnHumE4[101] = {
+    -46052, -46052, -39120, -35066, -32189, -29957, -28134, -26593, -25257, -24079,
+    -23026, -22073, -21203, -20402, -19661, -18971, -18326, -17720, -17148, -16607,
+    -16094, -15606, -15141, -14697, -14271, -13863, -13471, -13093, -12730, -12379,
+    -12040, -11712, -11394, -11087, -10788, -10498, -10217, -9943, -9676, -9416,
+    -9163, -8916, -8675, -8440, -8210, -7985, -7765, -7550, -7340, -7133,
+    -6931, -6733, -6539, -6349, -6162, -5978, -5798, -5621, -5447, -5276,
+    -5108, -4943, -4780, -4620, -4463, -4308, -4155, -4005, -3857, -3711,
+    -3567, -3425, -3285, -3147, -3011, -2877, -2744, -2614, -2485, -2357,
+    -2231, -2107, -1985, -1863, -1744, -1625, -1508, -1393, -1278, -1165,
+    -1054, -943, -834, -726, -619, -513, -408, -305, -202, -101,
+    0};
+
+//saturation vapour pressure in 0.01 hPa for -40..60 Celsius: 6.105 * exp(17.27 T / (237.7 + T))
+#define ES_T_MIN -40
+#define ES_T_MAX 60
+static const uint16_t esHPaE2[ES_T_MAX - ES_T_MIN + 1] = {
+    19, 21, 23, 25, 28, 31, 34, 38, 42, 46,
+    50, 55, 61, 67, 73, 80, 88, 96, 105, 115,
+    125, 136, 148, 161, 176, 191, 207, 225, 244, 264,
+    286, 309, 335, 362, 390, 421, 454, 490, 527, 568,
+    610, 656, 705, 757, 812, 871, 934, 1001, 1071, 1146,
+    1226, 1310, 1400, 1495, 1595, 1702, 1814, 1933, 2059, 2192,
+    2332, 2480, 2637, 2801, 2975, 3158, 3351, 3554, 3768, 3992,
+    4229, 4477, 4738, 5012, 5300, 5602, 5918, 6250, 6599, 6963,
+    7346, 7746, 8165, 8603, 9061, 9541, 10042, 10565, 11112, 11683,
+    12279, 12901, 13550, 14227, 14933, 15669, 16435, 17233, 18064, 18930,
+    19830};
+
+//V^0.16 * 1000 for V 0..150 km/h, the wind term of the wind chill
+#define WC_V_MAX 150
+static const uint16_t windPowE3[WC_V_MAX + 1] = {
+    0, 1000, 1117, 1192, 1248, 1294, 1332, 1365, 1395, 1421, 1445, 1468, 1488,
+    1507, 1525, 1542, 1558, 1574, 1588, 1602, 1615, 1628, 1640, 1651, 1663, 1674,
+    1684, 1694, 1704, 1714, 1723, 1732, 1741, 1750, 1758, 1766, 1774, 1782, 1790,
+    1797, 1804, 1812, 1819, 1825, 1832, 1839, 1845, 1852, 1858, 1864, 1870, 1876,
+    1882, 1887, 1893, 1899, 1904, 1910, 1915, 1920, 1925, 1930, 1935, 1940, 1945,
+    1950, 1955, 1960, 1964, 1969, 1973, 1978, 1982, 1987, 1991, 1995, 2000, 2004,
+    2008, 2012, 2016, 2020, 2024, 2028, 2032, 2036, 2039, 2043, 2047, 2051, 2054,
+    2058, 2062, 2065, 2069, 2072, 2076, 2079, 2083, 2086, 2089, 2093, 2096, 2099,
+    2102, 2106, 2109, 2112, 2115, 2118, 2121, 2124, 2128, 2131, 2134, 2137, 2140,
+    2142, 2145, 2148, 2151, 2154, 2157, 2160, 2162, 2165, 2168, 2171, 2173, 2176,
+    2179, 2182, 2184, 2187, 2189, 2192, 2195, 2197, 2200, 2202, 2205, 2207, 2210,
+    2212, 2215, 2217, 2220, 2222, 2225, 2227, 2229};
+
+//Domoticz humidity status
+enum HumStat
+{
+    HUM_NORMAL = 0,
+    HUM_COMFORTABLE = 1,
+    HUM_DRY = 2,
+    HUM_WET = 3
+};
+
+//dew point in 0.1 Celsius, Magnus formula with b = 17.62, c = 243.12 C
+static inline int16_t dewPoint(int16_t t10, uint16_t rh)
+{
+    if (rh > 100)
+        rh = 100;
+    //gamma = ln(RH / 100) + b T / (c + T), in 1/10000
+    int32_t t100 = t10 * 10;
+    int64_t gamma = lnHumE4[rh] + 176200LL * t100 / (24312 + t100);
+    //Td = c gamma / (b - gamma)
+    return (int16_t)(24312 * gamma / (10 * (176200 - gamma)));
+}
+
+//vapour pressure in 0.01 hPa from the saturation table, interpolated per 0.1 Celsius
+static inline uint32_t vaporPressure(int16_t t10, uint16_t rh)
+{
+    if (t10 < ES_T_MIN * 10)
+        t10 = ES_T_MIN * 10;
+    if (t10 >= ES_T_MAX * 10)
+        t10 = ES_T_MAX * 10 - 1;
+    int i = (t10 - ES_T_MIN * 10) / 10;
+    int f = (t10 - ES_T_MIN * 10) % 10;
+    uint32_t es = esHPaE2[i] + (esHPaE2[i + 1] - esHPaE2[i]) * f / 10;
+    return es * rh / 100;
+}
+
+//heat index in 0.1 Celsius, NWS: Steadman below 80 F, else Rothfusz with its adjustments
+static inline int16_t heatIndex(int16_t t10, uint16_t rh)
+{
+    float t = t10 * 0.18f + 32.0f; //Fahrenheit
+    float r = rh;
+    float hi = 0.5f * (t + 61.0f + (t - 68.0f) * 1.2f + r * 0.094f);
+    if ((hi + t) * 0.5f >= 80.0f)
+    {
+        hi = -42.379f + 2.04901523f * t + 10.14333127f * r - 0.22475541f * t * r -
+             0.00683783f * t * t - 0.05481717f * r * r + 0.00122874f * t * t * r +
+             0.00085282f * t * r * r - 0.00000199f * t * t * r * r;
+        if (r < 13.0f && t >= 80.0f && t <= 112.0f)
+        {
+            float d = 17.0f - (t > 95.0f ? t - 95.0f : 95.0f - t);
+            hi -= (13.0f - r) * 0.25f * sqrtf(d / 17.0f);
+        }
+        else if (r > 85.0f && t >= 80.0f && t <= 87.0f)
+            hi += (r - 85.0f) * 0.1f * (87.0f - t) * 0.2f;
+    }
+    return (int16_t)lroundf((hi - 32.0f) / 0.18f);
+}
+
+//wind chill in 0.1 Celsius, the temperature above 10 C or below 4.8 km/h where it is not defined
+static inline int16_t windChill(int16_t t10, uint16_t wind10)
+{
+    if (t10 > 100 || wind10 < 48)
+        return t10;
+    //V^0.16 interpolated per 0.1 km/h
+    uint16_t v = wind10 / 10 < WC_V_MAX ? wind10 / 10 : WC_V_MAX - 1;
+    uint16_t f = wind10 / 10 < WC_V_MAX ? wind10 % 10 : 10;
+    float p = (windPowE3[v] + (windPowE3[v + 1] - windPowE3[v]) * f * 0.1f) * 0.001f;
+    float t = t10 * 0.1f;
+    float wc = 13.12f + 0.6215f * t - 11.37f * p + 0.3965f * t * p;
+    return (int16_t)lroundf(wc * 10.0f);
+}
+
+//apparent temperature in 0.1 Celsius (Steadman, shade): T + 0.33 e - 0.70 ws - 4.00, e in hPa, ws in m/s
+static inline int16_t apparentTemperature(int16_t t10, uint16_t rh, uint16_t wind10)
+{
+    int32_t e = vaporPressure(t10, rh);
+    return (int16_t)(t10 + (33 * e + 500) / 1000 - (7 * (int32_t)wind10 + 18) / 36 - 40);
+}
+
+//humidity status of Domoticz: dry below 30 %, wet above 70 %, comfortable at 22..26 C and 35..65 %
+static inline uint8_t humStat(int16_t t10, uint16_t rh)
+{
+    if (rh < 30)
+        return HUM_DRY;
+    if (rh > 70)
+        return HUM_WET;
+    if (rh >= 35 && rh <= 65 && t10 >= 220 && t10 <= 260)
+        return HUM_COMFORTABLE;
+    return HUM_NORMAL;
+}
+
+#endif
@@ -0,0 +1,133 @@
+// Station fingerprint for re-pairing and ID collision detection
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Fine Offset stations pick a new random ID at a battery change, and two
+// stations nearby may pick the same ID. A fingerprint of what does not change
+// with the ID tells them apart:
+//  - transmit cadence: period and phase of the bursts, see cadence.h
+//  - AFC: frequency offset of the station crystal
+//  - RSSI: distance and antenna of the station
+//  - readings: temperature and humidity continue where they were
+// Updating and matching cost O(1), so checking a packet against all stations
+// is O(stations).
+//
+// No Arduino dependencies, the samples are filled by the caller.
+
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <stdint.h>
+#include "cadence.h"
+
+//tolerances of a match
+#define FP_PHASE_US 250000 //arrival against the predicted burst, includes drift over missed bursts
+#define FP_PERIOD_US 500   //difference of the periods of two crystals
+#define FP_AFC_HZ 3000
+#define FP_RSSI 20     //in 0.5 dB steps
+#define FP_TEMP 30     //in 0.1 Celsius
+#define FP_HUM 10      //relative %
+//readings of a station silent for longer are not compared
+#define FP_READINGS_US 3600000000LL
+//minimum bursts before the AFC and RSSI averages are used
+#define FP_MIN_BURSTS 3
+
+//RF and readings of one packet
+struct FpSample
+{
+    int64_t rxUs; //monotonic arrival
+    int32_t afc;  //in Hz
+    uint8_t rssi; //in 0.5 dB steps, as read from the radio
+    int16_t temperature;
+    uint16_t humidity;
+};
+
+class Fingerprint
+{
+public:
+    Cadence cadence;
+
+    Fingerprint() : bursts(0), lastUs(0), afc(0), rssi(0), temperature(0), humidity(0) {}
+
+    //add a packet of this station, only the first packet of a burst is used
+    void add(const FpSample &s)
+    {
+        if (bursts && s.rxUs - lastUs < CADENCE_BURST_US)
+            return;
+        //a phase jump of the station itself, e.g. a restart, starts a new cadence
+        if (cadence.locked() && diff(cadence.phaseErrorUs(s.rxUs), 0) > FP_PHASE_US)
+            cadence.reset();
+        cadence.add(s.rxUs);
+        //exponential averages, weight 1/4, in 1/16 units
+        if (bursts == 0)
+        {
+            afc = s.afc * 16;
+            rssi = s.rssi * 16;
+        }
+        else
+        {
+            afc += (s.afc * 16 - afc) / 4;
+            rssi += (s.rssi * 16 - rssi) / 4;
+        }
+        if (bursts < 255)
+            bursts++;
+        lastUs = s.rxUs;
+        temperature = s.temperature;
+        humidity = s.humidity;
+    }
+
+    bool known() const { return bursts >= FP_MIN_BURSTS; }
+    uint8_t burstCount() const { return bursts; }
+    int64_t lastArrival() const { return lastUs; }
+
+    //Number of properties of another fingerprint that match this one, of the checked ones,
+    //e.g. of a new ID against a silent station. A property is not checked while one of
+    //them does not know it yet. The phase changes when a station restarts, the period not.
+    uint8_t match(const Fingerprint &o, uint8_t &checked) const
+    {
+        uint8_t score = 0;
+        checked = 0;
+        if (!known() || !o.known())
+            return 0;
+        checked += 2;
+        score += diff(o.afc / 16, afc / 16) <= FP_AFC_HZ;
+        score += diff(o.rssi / 16, rssi / 16) <= FP_RSSI;
+        if (o.lastUs - lastUs < FP_READINGS_US)
+        {
+            checked++;
+            score += diff(o.temperature, temperature) <= FP_TEMP && diff(o.humidity, humidity) <= FP_HUM;
+        }
+        if (cadence.locked() && o.cadence.locked())
+        {
+            checked++;
+            score += diff(o.cadence.periodUs(), cadence.periodUs()) <= FP_PERIOD_US;
+        }
+        return score;
+    }
+
+    //A packet with the ID of this station but not from it: a new burst off the
+    //cadence of the station, with a different crystal, while the station itself
+    //is still heard. Readings and RSSI may match by chance for a neighbour, so
+    //these are not required to differ.
+    bool collides(const FpSample &s) const
+    {
+        if (!known() || !cadence.locked() || s.rxUs - lastUs < CADENCE_BURST_US ||
+            s.rxUs - lastUs > 2 * (int64_t)cadence.periodUs())
+            return false;
+        return diff(cadence.phaseErrorUs(s.rxUs), 0) > FP_PHASE_US && diff(s.afc, afc / 16) > FP_AFC_HZ;
+    }
+
+private:
+    uint8_t bursts;
+    int64_t lastUs;
+    int32_t afc;  //average in 1/16 Hz
+    int32_t rssi; //average in 1/16 steps
+    int16_t temperature;
+    uint16_t humidity;
+
+    static int32_t diff(int32_t a, int32_t b)
+    {
+        return a > b ? a - b : b - a;
+    }
+};
+
+#endif
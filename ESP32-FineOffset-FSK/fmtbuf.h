@@ -0,0 +1,181 @@
+// Fixed-point number formatting into a caller provided buffer
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// All URL, JSON, serial and OLED text is produced through FmtBuf. Values are
+// integers with an explicit number of decimals, so there is no floating point,
+// no locale handling and no heap allocation involved.
+
+#ifndef FMTBUF_H
+#define FMTBUF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+static const uint32_t fmtPow10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+//multiply a fixed-point value by num/den with rounding half away from zero
+static inline int32_t fxMulDiv(int32_t v, int32_t num, int32_t den)
+{
+    int32_t p = v * num;
+    return (p >= 0) ? (p + den / 2) / den : (p - den / 2) / den;
+}
+
+//number of decimal digits of v, 1 for 0
+static inline int fmtDigits(uint32_t v)
+{
+    int n = 1;
+    while (n < 10 && v >= fmtPow10[n])
+        n++;
+    return n;
+}
+
+//write the decimal digits of v at p, returns pointer after the last digit
+static inline char *fmtU32(char *p, uint32_t v)
+{
+    char tmp[10];
+    int n = 0;
+    do
+    {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n)
+        *p++ = tmp[--n];
+    return p;
+}
+
+class FmtBuf
+{
+    char *buf;
+    size_t size;
+    size_t len;
+    bool full;
+
+    //reserve n bytes plus terminating zero, returns write position or nullptr
+    char *reserve(size_t n)
+    {
+        if (full || len + n >= size)
+        {
+            full = true;
+            return nullptr;
+        }
+        return buf + len;
+    }
+
+public:
+    FmtBuf(char *buffer, size_t bufsize) : buf(buffer), size(bufsize), len(0), full(bufsize == 0)
+    {
+        if (size)
+            buf[0] = 0;
+    }
+
+    const char *c_str() const { return buf; }
+    size_t length() const { return len; }
+    //true when output has been truncated
+    bool overflow() const { return full; }
+
+    void clear()
+    {
+        len = 0;
+        full = size == 0;
+        if (size)
+            buf[0] = 0;
+    }
+
+    FmtBuf &str(const char *s, size_t n)
+    {
+        char *p = reserve(n);
+        if (p)
+        {
+            memcpy(p, s, n);
+            len += n;
+            buf[len] = 0;
+        }
+        return *this;
+    }
+
+    FmtBuf &str(const char *s)
+    {
+        return str(s, strlen(s));
+    }
+
+    FmtBuf &chr(char c)
+    {
+        return str(&c, 1);
+    }
+
+    FmtBuf &u32(uint32_t v)
+    {
+        char *p = reserve(fmtDigits(v));
+        if (p)
+        {
+            len = fmtU32(p, v) - buf;
+            buf[len] = 0;
+        }
+        return *this;
+    }
+
+    FmtBuf &i32(int32_t v)
+    {
+        if (v < 0)
+        {
+            chr('-');
+            return u32(-(uint32_t)v);
+        }
+        return u32(v);
+    }
+
+    //v is a fixed-point value scaled by 10^decimals, e.g. fixed(-25, 1) gives "-2.5"
+    FmtBuf &fixed(int32_t v, uint8_t decimals)
+    {
+        if (decimals == 0)
+            return i32(v);
+        if (decimals > 9)
+            decimals = 9;
+        uint32_t a = v < 0 ? -(uint32_t)v : v;
+        //sign, integer digits, point and decimals
+        char *p = reserve((v < 0) + fmtDigits(a / fmtPow10[decimals]) + 1 + decimals);
+        if (!p)
+            return *this;
+        if (v < 0)
+            *p++ = '-';
+        p = fmtU32(p, a / fmtPow10[decimals]);
+        *p++ = '.';
+        uint32_t frac = a % fmtPow10[decimals];
+        for (int d = decimals - 1; d >= 0; d--)
+        {
+            *p++ = '0' + (frac / fmtPow10[d]) % 10;
+        }
+        len = p - buf;
+        buf[len] = 0;
+        return *this;
+    }
+
+    //right align the text written since position from to width characters, padding with c
+    FmtBuf &pad(size_t from, size_t width, char c = ' ')
+    {
+        size_t n = len - from;
+        if (n >= width)
+            return *this;
+        size_t fill = width - n;
+        char *p = reserve(fill);
+        if (p)
+        {
+            memmove(buf + from + fill, buf + from, n);
+            memset(buf + from, c, fill);
+            len += fill;
+            buf[len] = 0;
+        }
+        return *this;
+    }
+
+    FmtBuf &hex2(uint8_t v)
+    {
+        static const char hexdigit[] = "0123456789ABCDEF";
+        char h[2] = {hexdigit[v >> 4], hexdigit[v & 0x0F]};
+        return str(h, 2);
+    }
+};
+
+#endif
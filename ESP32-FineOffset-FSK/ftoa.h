@@ -1,141 +0,0 @@
-/**
- *  stm32tpl --  STM32 C++ Template Peripheral Library
- *  Visit https://github.com/antongus/stm32tpl for new versions
- *
- *  Copyright (c) 2011-2020 Anton B. Gusev aka AHTOXA
- *
- *  Permission is hereby granted, free of charge, to any person obtaining a copy
- *  of this software and associated documentation files (the "Software"), to deal
- *  in the Software without restriction, including without limitation the rights
- *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
- *  copies of the Software, and to permit persons to whom the Software is
- *  furnished to do so, subject to the following conditions:
- *
- *  The above copyright notice and this permission notice shall be included in
- *  all copies or substantial portions of the Software.
- *
- *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
- *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
- *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
- *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
- *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
- *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
- *  THE SOFTWARE.
- *
- *
- *  file         : ftoa.c
- *  description  : convert double to string
- *
- */
-
-#define MAX_PRECISION (10)
-static const double rounders[MAX_PRECISION + 1] =
-    {
-        0.5,          // 0
-        0.05,         // 1
-        0.005,        // 2
-        0.0005,       // 3
-        0.00005,      // 4
-        0.000005,     // 5
-        0.0000005,    // 6
-        0.00000005,   // 7
-        0.000000005,  // 8
-        0.0000000005, // 9
-        0.00000000005 // 10
-};
-
-char *ftoa(double f, char *buf, int precision)
-{
-    char *ptr = buf;
-    char *p = ptr;
-    char *p1;
-    char c;
-    long intPart;
-
-    // check precision bounds
-    if (precision > MAX_PRECISION)
-        precision = MAX_PRECISION;
-
-    // sign stuff
-    if (f < 0)
-    {
-        f = -f;
-        *ptr++ = '-';
-    }
-
-    if (precision < 0) // negative precision == automatic precision guess
-    {
-        if (f < 1.0)
-            precision = 6;
-        else if (f < 10.0)
-            precision = 5;
-        else if (f < 100.0)
-            precision = 4;
-        else if (f < 1000.0)
-            precision = 3;
-        else if (f < 10000.0)
-            precision = 2;
-        else if (f < 100000.0)
-            precision = 1;
-        else
-            precision = 0;
-    }
-
-    // round value according the precision
-    if (precision)
-        f += rounders[precision];
-
-    // integer part...
-    intPart = f;
-    f -= intPart;
-
-    if (!intPart)
-        *ptr++ = '0';
-    else
-    {
-        // save start pointer
-        p = ptr;
-
-        // convert (reverse order)
-        while (intPart)
-        {
-            *p++ = '0' + intPart % 10;
-            intPart /= 10;
-        }
-
-        // save end pos
-        p1 = p;
-
-        // reverse result
-        while (p > ptr)
-        {
-            c = *--p;
-            *p = *ptr;
-            *ptr++ = c;
-        }
-
-        // restore end pos
-        ptr = p1;
-    }
-
-    // decimal part
-    if (precision)
-    {
-        // place decimal point
-        *ptr++ = '.';
-
-        // convert
-        while (precision--)
-        {
-            f *= 10.0;
-            c = f;
-            *ptr++ = '0' + c;
-            f -= c;
-        }
-    }
-
-    // terminating zero
-    *ptr = 0;
-
-    return buf;
-}
@@ -0,0 +1,248 @@
+// Streaming HTTP/1.1 response parser
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Bytes are fed in as they are received, in chunks of any size. The parser keeps
+// a bounded line buffer for the status line and headers, and counts the body
+// bytes (Content-Length, chunked or until close) without storing them.
+// Interim 1xx responses, e.g. 100 Continue, are skipped, status is the final one.
+// It has no Arduino dependencies, so it can be compiled and fed on a host.
+
+#ifndef HTTPRESPONSE_H
+#define HTTPRESPONSE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+//longer status and header lines are truncated, only their start is interpreted
+#define HTTP_LINE_MAX 96
+
+class HttpResponse
+{
+public:
+    enum State
+    {
+        ST_STATUS,
+        ST_HEADER,
+        ST_BODY,
+        ST_CHUNK_SIZE,
+        ST_CHUNK_DATA,
+        ST_CHUNK_END,
+        ST_TRAILER,
+        ST_DONE,
+        ST_ERROR
+    };
+
+    State state;
+    int status;            //HTTP status code, 0 until the status line is parsed
+    int32_t contentLength; //-1 when not given
+    bool chunked;
+    uint32_t bodyBytes; //body bytes received, excluding chunk framing
+
+    HttpResponse()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        state = ST_STATUS;
+        status = 0;
+        contentLength = -1;
+        chunked = false;
+        bodyBytes = 0;
+        lineLen = 0;
+        chunkLeft = 0;
+    }
+
+    bool done() const { return state == ST_DONE; }
+    bool error() const { return state == ST_ERROR; }
+
+    //Feed received bytes. Returns the number of bytes consumed, which is less
+    //than len only when the response is complete or in error.
+    size_t feed(const uint8_t *data, size_t len)
+    {
+        size_t i = 0;
+        while (i < len && state != ST_DONE && state != ST_ERROR)
+        {
+            switch (state)
+            {
+            case ST_BODY:
+            case ST_CHUNK_DATA:
+            {
+                //skip body bytes in bulk
+                size_t n = len - i;
+                if (state == ST_CHUNK_DATA || contentLength >= 0)
+                {
+                    uint32_t left = (state == ST_CHUNK_DATA) ? chunkLeft : contentLength - bodyBytes;
+                    if (n > left)
+                        n = left;
+                }
+                i += n;
+                bodyBytes += n;
+                if (state == ST_CHUNK_DATA)
+                {
+                    chunkLeft -= n;
+                    if (chunkLeft == 0)
+                        state = ST_CHUNK_END;
+                }
+                else if (contentLength >= 0 && bodyBytes >= (uint32_t)contentLength)
+                {
+                    state = ST_DONE;
+                }
+                break;
+            }
+            default:
+            {
+                char c = data[i++];
+                if (c == '\n')
+                {
+                    line[lineLen] = 0;
+                    if (lineLen > 0 && line[lineLen - 1] == '\r')
+                        line[--lineLen] = 0;
+                    onLine();
+                    lineLen = 0;
+                }
+                else if (lineLen < HTTP_LINE_MAX - 1)
+                {
+                    line[lineLen++] = c;
+                }
+                break;
+            }
+            }
+        }
+        return i;
+    }
+
+    //The connection was closed by the server: completes a body without length.
+    void finish()
+    {
+        if (state == ST_BODY && contentLength < 0)
+            state = ST_DONE;
+        else if (state != ST_DONE)
+            state = ST_ERROR;
+    }
+
+private:
+    char line[HTTP_LINE_MAX];
+    uint16_t lineLen;
+    uint32_t chunkLeft;
+
+    void onLine()
+    {
+        switch (state)
+        {
+        case ST_STATUS:
+            //HTTP/1.x SSS reason
+            if (strncmp(line, "HTTP/1.", 7) != 0 || lineLen < 12 || line[8] != ' ')
+            {
+                state = ST_ERROR;
+                return;
+            }
+            status = 0;
+            for (int k = 9; k < 12; k++)
+            {
+                if (line[k] < '0' || line[k] > '9')
+                {
+                    state = ST_ERROR;
+                    return;
+                }
+                status = status * 10 + (line[k] - '0');
+            }
+            if (status < 100)
+            {
+                state = ST_ERROR;
+                return;
+            }
+            state = ST_HEADER;
+            break;
+        case ST_HEADER:
+            if (lineLen == 0)
+            {
+                //end of headers, an interim 1xx response is skipped up to the final status
+                if (status >= 100 && status < 200 && status != 101)
+                {
+                    status = 0;
+                    contentLength = -1;
+                    chunked = false;
+                    state = ST_STATUS;
+                }
+                //no body for 101, 204 and 304
+                else if (status == 101 || status == 204 || status == 304)
+                    state = ST_DONE;
+                else if (chunked)
+                    state = ST_CHUNK_SIZE;
+                else if (contentLength == 0)
+                    state = ST_DONE;
+                else
+                    state = ST_BODY;
+            }
+            else if (strncasecmp(line, "Content-Length:", 15) == 0)
+            {
+                contentLength = parseDec(line + 15);
+            }
+            else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+            {
+                chunked = containsNoCase(line + 18, "chunked");
+            }
+            break;
+        case ST_CHUNK_SIZE:
+        {
+            //hex size, optionally followed by ;extensions
+            uint32_t size = 0;
+            int k = 0;
+            for (; k < lineLen; k++)
+            {
+                char c = line[k];
+                int v = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+                if (v < 0 || size > 0x0FFFFFFF)
+                    break;
+                size = (size << 4) | v;
+            }
+            if (k == 0)
+            {
+                state = ST_ERROR;
+                return;
+            }
+            chunkLeft = size;
+            state = (size == 0) ? ST_TRAILER : ST_CHUNK_DATA;
+            break;
+        }
+        case ST_CHUNK_END:
+            state = (lineLen == 0) ? ST_CHUNK_SIZE : ST_ERROR;
+            break;
+        case ST_TRAILER:
+            if (lineLen == 0)
+                state = ST_DONE;
+            break;
+        default:
+            break;
+        }
+    }
+
+    static bool containsNoCase(const char *p, const char *word)
+    {
+        size_t n = strlen(word);
+        for (; *p; p++)
+        {
+            if (strncasecmp(p, word, n) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    static int32_t parseDec(const char *p)
+    {
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p < '0' || *p > '9')
+            return -1;
+        int32_t v = 0;
+        while (*p >= '0' && *p <= '9' && v < 100000000)
+            v = v * 10 + (*p++ - '0');
+        return v;
+    }
+};
+
+#endif
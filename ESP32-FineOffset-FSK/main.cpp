@@ -20,14 +20,29 @@
 #include <ESPSecureBase.h>
 #include <libb64/cencode.h>
 #include <lwip/apps/sntp.h>
+#include <atomic>
 #include "analog.h"
 #include "weather.h"
-#include <WiFiClientSecure.h>
+#include "tlsclient.h"
 #include "stationconfig.h"
+#include "httpresponse.h"
+#include "spscqueue.h"
+#include "mqttrouter.h"
+#include "profiler.h"
 #include "SX1276ws.h"
+#ifdef CYCLE_BENCH
+#include "cyclebench.h"
+#endif
 
 #if defined BOARD_HELTEC
 #include "heltec.h"
+#include "oledview.h"
+#include "dashpages.h"
+#endif
+
+//Prometheus text endpoint, enable with -DMETRICS_HTTP_PORT=9100
+#ifdef METRICS_HTTP_PORT
+#include <ESPAsyncWebServer.h>
 #endif
 
 //===== I/O pins/devices
@@ -41,6 +56,7 @@
 #define RF_MOSI 33
 #define RF_DIO0 26
 #define RF_DIO4 22
+#define RF_DIO2 -1 //not wired
 
 #define LED_MQTT 4 // pulsed for each MQTT message received
 #define LED_RF 2   // pulsed for each RF packet received
@@ -59,6 +75,7 @@
 #define RF_MOSI 33
 #define RF_DIO0 26
 #define RF_DIO4 39
+#define RF_DIO2 -1 //not wired
 
 #define LED_WIFI 16 // lit while there is no Wifi/MQTT connection
 #define LED_RF 17   // pulsed for each MQTT message received
@@ -98,11 +115,151 @@ uint8_t rfGroup = 42;
 uint32_t rfFreq = 868300000;
 int8_t rfPow = 17;
 
-uint32_t rfLed = 0;
-uint32_t mqttLed = 0;
+volatile uint32_t rfLed = 0;
+volatile uint32_t mqttLed = 0;
 uint32_t vBatt = 1;
 
-time_t lastWSts = 0;
+std::atomic<time_t> lastWSts(0); //written by the network task, read by the UI task
+
+//===== Boot
+// The radio starts first, its packets are queued while the display, WiFi, SNTP
+// and the station configuration come up. Packets received before the clock is
+// set are timestamped from their age once SNTP syncs.
+#define BOOT_SNTP_WAIT_MS 30000 //packets wait at most this long after reset for SNTP
+int64_t clockSetUs = 0;         //monotonic time the wall clock was first found set, network task only
+
+//===== Tasks
+// radio task:   polls the radio, decodes packets and hands them to the network task
+// network task: station updates, MQTT publish, uploads, stats, MQTT ping and CLI
+// UI task:      the Arduino loop(), OLED display, LEDs and battery voltage
+
+#define RADIO_CORE 1
+#define RADIO_PRIO 5
+#define RADIO_STACK 4096
+#define NETWORK_CORE 0
+#define NETWORK_PRIO 2
+#define NETWORK_STACK 12288 //TLS handshakes need a deep stack
+#define WATCHDOG_CORE 0
+#define WATCHDOG_PRIO 10
+#define WATCHDOG_STACK 2048
+
+//===== Profiling
+// A loop taking longer than its budget is recorded as a stall and published on /stall
+
+#define LOOP_BUDGET_US 50000
+
+enum RadioSection
+{
+    RS_LOOP,
+    RS_RECEIVE,
+    RS_DECODE,
+    RS_QUEUE
+};
+static const char *const radioSections[] = {"radio", "receive", "decode", "queue"};
+Profiler radioProf(radioSections, 4, LOOP_BUDGET_US);
+
+//followed by a section per upload target, NS_TARGET + t
+enum NetworkSection
+{
+    NS_LOOP,
+    NS_WIFI,
+    NS_CONFIG,
+    NS_PACKETS,
+    NS_REPORT,
+    NS_UPLOAD,
+    NS_STATS,
+    NS_MQTT,
+    NS_CLI,
+    NS_CONNECT,
+    NS_RESPONSE,
+    NS_TARGET
+};
+static const char *const networkSections[] = {"network", "wifi", "config", "packets", "report", "upload",
+                                              "stats", "mqtt", "cli", "connect", "response"};
+Profiler networkProf(networkSections, NS_TARGET, LOOP_BUDGET_US);
+
+//configuration message handed from the MQTT callback to the network task, which frees json
+struct WSCommand
+{
+    enum
+    {
+        WS_ADD,
+        WS_REMOVE,
+        WS_HISTORY,
+        WS_DUMP,
+        WS_STATS,
+        WS_TLSPIN
+    } cmd;
+    char *json;
+};
+
+SPSCQueue<WSRecord, 32> wsQueue;    //radio -> network, holds the packets received during boot
+SPSCQueue<DashStation, 4> displayQueue; //network -> UI, station snapshots to display
+SPSCQueue<WSCommand, 4> cmdQueue;   //MQTT callback -> network
+Counter rfDropNum;                  //decoded packets dropped because wsQueue was full
+
+//===== Metrics
+
+MetricRegistry metrics;
+
+//loop durations in us, uploads in ms
+static const uint32_t loopUsBuckets[] = {100, 1000, 10000, 100000, 1000000, 10000000};
+static const uint32_t uploadMsBuckets[] = {100, 250, 500, 1000, 2000, 5000};
+static const uint32_t burstBuckets[] = {1, 2, 3, 4, 5, 6};
+
+Histogram uiLoopUs;
+
+Gauge uptime;
+Gauge wifiRssi;
+Gauge heapFree;
+Gauge heapMin;      //minimum free heap since boot
+Gauge heapMaxBlock; //largest allocatable block
+Gauge rfNoise;
+
+//boot sequence, in ms since reset
+Gauge bootRadioMs;       //radio receiving
+Gauge bootConfigMs;      //station configuration loaded
+Gauge bootFirstPacketMs; //first decoded packet
+Counter retroStamped;    //packets timestamped after the clock was set
+
+Counter fpRebind;    //stations rebound to a new ID
+Counter fpCollision; //packets of another transmitter with the ID of a station
+Counter qfReplaced;  //packets with readings replaced by the plausibility filter
+
+//reports sent and suppressed by the deadbands and heartbeat
+Counter reportSent;       //MQTT reports of configured stations
+Counter reportSuppressed;
+Counter unconfSent;       //MQTT packets of stations that are not configured
+Counter unconfSuppressed;
+Counter uploadSuppressed; //uploads of a station to all its targets
+
+Counter uploadOk[WT_COUNT];
+Counter uploadFail[WT_COUNT];
+Histogram uploadMs[WT_COUNT];
+
+//packets closer together than this belong to one burst
+#define WS_BURST_MS 500
+
+//per configured station slot, labeled with the wsConfig index
+struct StationMetrics
+{
+    Counter rx;         //decoded packets
+    Counter reported;   //MQTT reports
+    Counter duplicates; //packets equal to the previous one in a burst
+    Histogram burst;    //packets per burst
+    Gauge id;           //msgformat << 16 | stationID
+    Gauge periodUs;     //transmit period, including the drift of the station crystal
+    Gauge jitterUs;     //deviation of the bursts from the period
+
+    //burst tracking, network task only
+    uint8_t burstLen;
+    int64_t lastUs; //monotonic arrival of the previous packet
+    uint8_t last[LEN_WH2300 + 1];
+};
+static const char *const wsLabels[] = {"0", "1", "2", "3", "4", "5", "6", "7"};
+//per station metrics of the first slots only, the registry is fixed size
+#define WS_METRICS_MAX (MAX_WS < 8 ? MAX_WS : 8)
+StationMetrics stationMetrics[WS_METRICS_MAX];
 
 ESBConfig config;
 CommandParser cmdP(&Serial);
@@ -119,42 +276,118 @@ WSConfig wsConfig;
 WeatherStationProcessor wsProcessor;
 
 //Global http clients to avoid opening many times
+//HTTPSClient keeps TLS sessions and pinned keys per host across uploads
 WiFiClient HTTPClient;
-WiFiClientSecure HTTPSClient;
+TLSClient HTTPSClient;
 
 // MQTT message handling
 
 uint32_t mqttTxNum = 0,
          mqttRxNum = 0;
 
-void onMqttMessage(char *topic, char *payload, MqttProps properties,
-                   size_t len, size_t index, size_t total)
+//copy a (not zero terminated) MQTT payload and queue it for the network task
+void queueCommand(decltype(WSCommand::cmd) cmd, const char *payload, size_t len)
 {
-    mqttRxNum++;
-
-    // Handle over-the-air update messages
-    if (strlen(topic) == mqTopicLen + 4 && len == total &&
-        strncmp(topic, mqTopic, mqTopicLen) == 0 &&
-        strcmp(topic + mqTopicLen, "/ota") == 0)
+    WSCommand command;
+    command.cmd = cmd;
+    command.json = (char *)malloc(len + 1);
+    if (!command.json)
+        return;
+    memcpy(command.json, payload, len);
+    command.json[len] = 0;
+    if (!cmdQueue.push(command))
     {
-        ESBOTA::begin(payload, len);
+        printf("Config message dropped, queue full\n");
+        free(command.json);
     }
+}
 
-    // Handle weather station config messages
-    if (strlen(topic) == mqTopicLen + 9 && len == total &&
-        strncmp(topic, mqTopic, mqTopicLen) == 0 &&
-        strcmp(topic + mqTopicLen, "/wsconfig") == 0)
-    {
-        wsConfig.add(payload);
-    }
+void onOta(const char *payload, size_t len)
+{
+    ESBOTA::begin(payload, len);
+}
 
-    // Handle weather station config messages
-    if (strlen(topic) == mqTopicLen + 9 && len == total &&
-        strncmp(topic, mqTopic, mqTopicLen) == 0 &&
-        strcmp(topic + mqTopicLen, "/wsdelete") == 0)
-    {
-        wsConfig.remove(payload);
-    }
+//wsConfig is owned by the network task, so the station commands are queued for it
+void onWsConfig(const char *payload, size_t len)
+{
+    queueCommand(WSCommand::WS_ADD, payload, len);
+}
+
+void onWsDelete(const char *payload, size_t len)
+{
+    queueCommand(WSCommand::WS_REMOVE, payload, len);
+}
+
+void onGetHistory(const char *payload, size_t len)
+{
+    queueCommand(WSCommand::WS_HISTORY, payload, len);
+}
+
+void onGetDump(const char *payload, size_t len)
+{
+    queueCommand(WSCommand::WS_DUMP, payload, len);
+}
+
+void onGetStats(const char *payload, size_t len)
+{
+    queueCommand(WSCommand::WS_STATS, payload, len);
+}
+
+//the TLS cache is owned by the network task, which uploads
+void onTLSPin(const char *payload, size_t len)
+{
+    queueCommand(WSCommand::WS_TLSPIN, payload, len);
+}
+
+//subscribed command topics, the replies of /get/<name> are published on /<name>
+enum GatewayCommand
+{
+    GC_OTA,
+    GC_WSCONFIG,
+    GC_WSDELETE,
+    GC_HISTORY,
+    GC_DUMP,
+    GC_STATS,
+    GC_TLSPIN,
+    GC_COUNT
+};
+static const MqttRoute commandRoutes[GC_COUNT] = {
+    {"/ota", onOta, "OTA"},
+    {"/wsconfig", onWsConfig, "configuration of report out of weather stations"},
+    {"/wsdelete", onWsDelete, "deleting a reporting weather station"},
+    {"/get/history", onGetHistory, "the wind and rain history of the stations"},
+    {"/get/dump", onGetDump, "the configuration and state of the stations"},
+    {"/get/stats", onGetStats, "the stats"},
+    {"/tlspin", onTLSPin, "pinning the public key of an upload host"},
+};
+MqttRouter<GC_COUNT> commands(commandRoutes);
+
+//published topics
+enum GatewayTopic
+{
+    GT_WS,
+    GT_EVENT,
+    GT_STATS,
+    GT_STALL,
+    GT_HISTORY,
+    GT_DUMP,
+    GT_COUNT
+};
+static const MqttRoute topicRoutes[GT_COUNT] = {
+    {"/ws", nullptr, ""},
+    {"/event", nullptr, ""},
+    {"/stats", nullptr, ""},
+    {"/stall", nullptr, ""},
+    {"/history", nullptr, ""},
+    {"/dump", nullptr, ""},
+};
+MqttRouter<GT_COUNT> topics(topicRoutes);
+
+void onMqttMessage(char *topic, char *payload, MqttProps properties,
+                   size_t len, size_t index, size_t total)
+{
+    mqttRxNum++;
+    commands.dispatch(topic, payload, len, index, total);
 
     digitalWrite(LED_MQTT, LED_ON);
     mqttLed = millis();
@@ -163,310 +396,626 @@ void onMqttMessage(char *topic, char *payload, MqttProps properties,
 void onMqttConnect(bool sessionPresent)
 {
     printf("Connected to MQTT, session %spresent\n", sessionPresent ? "" : "not ");
-    char topic[128];
+    //mqTopic may have been changed since boot, nothing is rewritten when it is the same
+    commands.begin(mqTopic);
+    topics.begin(mqTopic);
+    for (uint8_t i = 0; i < GC_COUNT; i++)
+    {
+        mqttClient.subscribe(commands.topic(i), 1);
+        printf("Subscribed to %s for %s\n", commands.topic(i), commands.route(i).help);
+    }
+}
 
-    strncpy(topic, mqTopic, 32);
-    strcat(topic, "/ota");
-    mqttClient.subscribe(topic, 1);
-    printf("Subscribed to %s for OTA\n", topic);
+void publishWS(const char *payload)
+{
+    uint16_t id = mqttClient.publish(topics.topic(GT_WS), 1, false, payload);
+    printf("MQTT %d %s %s\n", id, topics.topic(GT_WS), payload);
+    mqttTxNum++;
+}
 
-    strncpy(topic, mqTopic, 32);
-    strcat(topic, "/wsconfig");
-    mqttClient.subscribe(topic, 1);
-    printf("Subscribed to %s for configuration of report out of weather stations\n", topic);
+//retained topic per field of a station that changed beyond its deadband, preceded by
+//the Home Assistant discovery config of the field on its first publish
+void publishFields(WSSetting *st)
+{
+    MqttFields &mf = st->mqttFields;
+    if (!mf.ready(mqTopic, st->wsType, st->wsID))
+        mf.begin(mqTopic, st->wsType, st->wsID);
+    uint32_t mask = mqttFieldMask(st->wsType);
+    //all fields at the heartbeat, a retained topic of a silent station would look current
+    bool beat = st->heartbeat == 0 || st->wsp->rxUs - mf.beatUs >= (int64_t)st->heartbeat * 1000000;
+    for (uint8_t f = 0; f < MF_COUNT; f++)
+    {
+        if (!(mask & (1UL << f)))
+            continue;
+        if (!(mf.announced & (1UL << f)))
+        {
+            char topic[MF_DISCOVERY_TOPIC_MAX];
+            char config[MF_DISCOVERY_MAX];
+            size_t len = mf.discovery(f, topic, sizeof(topic), config, sizeof(config));
+            //a full client queue leaves the rest for the next report
+            if (len && !mqttClient.publish(topic, 1, true, config, len, false))
+                return;
+            mf.announced |= 1UL << f;
+            mqttTxNum++;
+        }
+        int32_t v = mqttFieldValue(f, *st->wsp);
+        if (!beat && !mf.changed(f, v, st->deadband[f]))
+            continue;
+        char value[MF_VALUE_MAX];
+        FmtBuf out(value, sizeof(value));
+        out.fixed(v, mqttFieldDefs[f].decimals);
+        if (!mqttClient.publish(mf.fieldTopic(f), 1, true, value, out.length(), false))
+            return;
+        mf.sent(f, v);
+        mqttTxNum++;
+    }
+    if (beat)
+        mf.beatUs = st->wsp->rxUs;
+}
 
-    strncpy(topic, mqTopic, 32);
-    strcat(topic, "/wsdelete");
-    mqttClient.subscribe(topic, 1);
-    printf("Subscribed to %s for deleting a reporting weather stations\n", topic);
+//change filter of the stations that are not configured, by type and ID
+#define WS_UNCONFIGURED_MAX 8
+struct UnconfiguredStation
+{
+    uint16_t wsType;
+    uint16_t wsID;
+    ChangeFilter filter;
+};
+UnconfiguredStation unconfigured[WS_UNCONFIGURED_MAX];
+uint8_t unconfiguredNext = 0;
+uint16_t unconfiguredDeadband[MF_COUNT];
+
+//true when the packet of a station that is not configured is to be published,
+//a packet that can not be decoded always is
+bool unconfiguredDue(const WSBase *ws)
+{
+    if (!mqttDecoded(ws->msgformat))
+        return true;
+    UnconfiguredStation *u = nullptr;
+    for (int i = 0; i < WS_UNCONFIGURED_MAX; i++)
+    {
+        if (unconfigured[i].wsType == ws->msgformat && unconfigured[i].wsID == ws->stationID)
+            u = &unconfigured[i];
+    }
+    if (!u)
+    {
+        //replace the oldest
+        u = &unconfigured[unconfiguredNext];
+        unconfiguredNext = (unconfiguredNext + 1) % WS_UNCONFIGURED_MAX;
+        u->wsType = ws->msgformat;
+        u->wsID = ws->stationID;
+        u->filter = ChangeFilter();
+    }
+    if (!u->filter.due(*ws, unconfiguredDeadband, MF_CHANGE_MASK & mqttFieldMask(ws->msgformat), WS_HEARTBEAT_SEC * 1000000LL))
+        return false;
+    u->filter.commit(*ws);
+    return true;
 }
 
-void publishWS(const char *payload)
+//station event: {"event":"rebind","slot":1,"wsType":40,"wsID":123}
+void publishEvent(const char *event, uint8_t slot, const WSBase *ws)
 {
-    char topic[41 + 6];
-    strcpy(topic, mqTopic);
-    strcat(topic, "/ws");
-    uint16_t id = mqttClient.publish(topic, 1, false, payload);
-    printf("MQTT %d %s %s\n", id, topic, payload);
+    char buf[96];
+    FmtBuf json(buf, sizeof(buf));
+    json.str("{\"event\":\"").str(event).str("\",\"slot\":").u32(slot);
+    json.str(",\"wsType\":").u32(ws->msgformat).str(",\"wsID\":").u32(ws->stationID).chr('}');
+    printf("MQTT TX event %s\n", buf);
+    mqttClient.publish(topics.topic(GT_EVENT), 1, false, buf, json.length(), false);
     mqttTxNum++;
 }
 
-uint32_t rfRxNum = 0;
+Counter rfRxNum; //written by the radio task, read by the UI task
 
-boolean UploadToWebAPI(const char *host, int httpsPort, bool secure, const char *url)
-{
-    WiFiClient *client;
-    // if (secure)
-    // {
-    //     client = new WiFiClientSecure();
-    // }
-    // else
-    // {
-    //     client = new WiFiClient();
-    // }
+//time budget for a complete upload: connect, request and response
+#define HTTP_TIMEOUT_MS 5000
 
-    if (secure)
+boolean UploadToWebAPI(WebTarget &target, const char *request, size_t len)
+{
+    Client *client;
+    uint32_t t0 = millis();
+    networkProf.begin(NS_CONNECT);
+    //the connect gets the whole budget, the response loop below the rest of it
+    bool connected;
+    if (target.secure)
     {
         client = &HTTPSClient;
+        connected = HTTPSClient.connect(target.host, target.port, HTTP_TIMEOUT_MS);
     }
     else
     {
         client = &HTTPClient;
+        connected = HTTPClient.connect(target.host, target.port, HTTP_TIMEOUT_MS);
     }
-
-    // Use WiFiClientSecure class to create SSL connection
-    printf("Connecting to   : %s\n", host);
-    if (!client->connect(host, httpsPort))
+    networkProf.end(NS_CONNECT);
+    if (!connected)
     {
-        Serial.println("Connection failed");
+        target.stats.record(0, millis() - t0, t0);
+        printf("Upload %s: connection failed\n", target.host);
         return false;
     }
-    printf("Requesting      : %s\n", url);
-    client->print(String("GET ") + url + " HTTP/1.1\r\n" +
-                  "Host: " + host + "\r\n" +
-                  "User-Agent: G6EJDFailureDetectionFunction\r\n" +
-                  "Connection: close\r\n\r\n");
-    printf("Request sent    : ");
-    while (client->connected())
+
+    ProfSection section(networkProf, NS_RESPONSE);
+    client->write((const uint8_t *)request, len);
+
+    //parse the response as it streams in, the body is counted but not stored
+    HttpResponse response;
+    uint8_t rxbuf[256];
+    while (!response.done() && !response.error())
     {
-        String line = client->readStringUntil('\n');
-        if (line == "\r")
+        int n = client->available();
+        if (n > 0)
+        {
+            n = client->read(rxbuf, n < (int)sizeof(rxbuf) ? n : sizeof(rxbuf));
+            if (n > 0)
+                response.feed(rxbuf, n);
+        }
+        else if (!client->connected())
+        {
+            response.finish();
+        }
+        else if (millis() - t0 > HTTP_TIMEOUT_MS)
         {
-           printf("Headers received\n");
             break;
         }
+        else
+        {
+            delay(1);
+        }
     }
-
-    // if there are incoming bytes available
-    // from the server, read them and print them:
-    while (client->available())
-    {
-        char c = client->read();
-        printf("%c", c);
-    }
-    printf("\n");
-
     client->stop();
-    //delete client;
-    return true;
-}
-
-void displayTest()
-{
-#if defined BOARD_HELTEC
-    //clear full display
-    Heltec.display->clear();
-
-    ////partial clear display
-    //Heltec.display->setColor(BLACK);
-    //Heltec.display->fillRect(0, 0, 128, 20);
-    //Heltec.display->setColor(WHITE);
-
-    Heltec.display->setTextAlignment(TEXT_ALIGN_RIGHT);
-    Heltec.display->setFont(ArialMT_Plain_24);
-
-    Heltec.display->drawString(43, 0, "144");
-    Heltec.display->drawString(94, 0, "100");
-    Heltec.display->drawString(128, 0, "12");
-
-    Heltec.display->setFont(ArialMT_Plain_10);
-
-    Heltec.display->drawString(41, 22, "km/h");
-    Heltec.display->drawString(92, 22, "knots");
-    Heltec.display->drawString(126, 22, "bft");
 
-    Heltec.display->setFont(ArialMT_Plain_24);
-
-    Heltec.display->drawString(128, 32, "-2.5°C");
-
-    Heltec.display->setTextAlignment(TEXT_ALIGN_LEFT);
+    uint32_t ms = millis() - t0;
+    int16_t status = response.done() ? response.status : 0;
+    target.stats.record(status, ms, t0);
+    printf("Upload %s: HTTP %d in %dms, %d body bytes%s\n", target.host, response.status, ms, response.bodyBytes,
+           response.done() ? "" : (response.error() ? ", invalid response" : ", timeout"));
+    return status >= 200 && status < 300;
+}
 
-    Heltec.display->drawString(0, 27, "www");
+//===== OLED display
 
-    Heltec.display->setFont(ArialMT_Plain_16);
-    Heltec.display->drawString(0, 49, "«360»");
+//last data of each station, in the UI task
+DashStation dashStations[MAX_WS];
+uint8_t dashPage = 0;
+uint32_t dashPageAt = 0;
 
-    Heltec.display->setTextAlignment(TEXT_ALIGN_RIGHT);
+//dashboard pages other than the station pages
+#define PAGE_STALE -1
+#define PAGE_RF -2
+#define PAGE_NETWORK -3
 
-    bool conn = WiFi.isConnected();
-    bool mqConn = mqttClient.connected();
-
-    char statusmsg[64];
-    statusmsg[0]=0;
-    if (conn)
-        strcat(statusmsg, "wifi ok ");
-    else
-        strcat(statusmsg, "wifi nk ");
-    if (mqConn)
-        strcat(statusmsg, "mq 2435");
-    else
-        strcat(statusmsg, "mq 2435");
+#if defined BOARD_HELTEC
+OledView oled;
+DashPages screens(oled);
+#endif
 
-    Heltec.display->setFont(ArialMT_Plain_10);
-    Heltec.display->drawString(128, 54, statusmsg);
-    Heltec.display->display();
+void displayTest()
+{
+#if defined BOARD_HELTEC
+    screens.test(WiFi.isConnected());
+    oled.flush(Heltec.display, true);
 #endif
 }
 
 void displayStale()
 {
 #if defined BOARD_HELTEC
-    //clear full display
-    Heltec.display->clear();
-
-    ////partial clear display
-    //Heltec.display->setColor(BLACK);
-    //Heltec.display->fillRect(0, 0, 128, 20);
-    //Heltec.display->setColor(WHITE);
-
-    struct timeval tv;
-    struct tm *nowtm;
-    char tmbuf[64];
-
-    gettimeofday(&tv, NULL);
-    nowtm = localtime(&lastWSts);
-    strftime(tmbuf, sizeof tmbuf, "%Y-%m-%d %H:%M:%S", nowtm);
-
-    Heltec.display->drawString(0, 0, "laatste update op ");
-    Heltec.display->drawString(0, 10, tmbuf);
-
-    bool conn = WiFi.isConnected();
-    bool mqConn = mqttClient.connected();
+    screens.stale(lastWSts.load(std::memory_order_relaxed), WiFi.isConnected(), mqttClient.connected());
+#endif
+}
 
-    char statusmsg[64];
-    statusmsg[0] = 0;
-    if (conn)
-        strcat(statusmsg, "wifi ok ");
-    else
-        strcat(statusmsg, "wifi -- ");
-    if (mqConn)
-        strcat(statusmsg, "mq ok  ");
+//station page: the configured fields, or the wind screen
+void display(int8_t station)
+{
+#if defined BOARD_HELTEC
+    DashStation &ds = dashStations[station];
+    if (ds.fields[0] != DF_NONE)
+        screens.fields(ds, station);
     else
-        strcat(statusmsg, "mq --  ");
-
-    Heltec.display->setFont(ArialMT_Plain_10);
-    Heltec.display->drawString(0, 54, statusmsg);
-    Heltec.display->display();
+        screens.wind(ds.ws, station, WiFi.isConnected(), mqttClient.connected());
 #endif
 }
 
-int beaufort(double windspeed)
-{
-    double bft_kmh[] = {0.999, 5.5, 11.5, 19.5, 28.5, 38.5, 49.5, 61.5, 74.5, 88.5, 102.5, 117.5, 1000};
+uint32_t rfRxPerMin = 0; //packets received in the last full minute
 
-    int bft = 0;
-    while (bft < 13 && bft_kmh[bft] < windspeed)
-        ++bft;
-    return bft;
+void displayRF()
+{
+#if defined BOARD_HELTEC
+    //failed crc checks in 0.1 %
+    uint32_t n = wsProcessor.nWsSignals.get();
+    uint32_t ok = wsProcessor.nWsSignalsOK.get();
+    uint32_t crcFail = n ? ((uint64_t)(n - ok) * 1000 + n / 2) / n : 0;
+    screens.rf(-(radio.bgRssi >> 5), rfRxPerMin, crcFail, rfDropNum.get());
+#endif
 }
 
-void display(WSBase *wsp)
+void displayNetwork()
 {
 #if defined BOARD_HELTEC
-    //clear full display
-    Heltec.display->clear();
+    if (WiFi.isConnected())
+        screens.network(WiFi.SSID().c_str(), WiFi.localIP().toString().c_str(), mqttClient.connected(), WiFi.RSSI());
+    else
+        screens.network(nullptr, nullptr, mqttClient.connected(), 0);
+#endif
+}
 
-    ////partial clear display
-    //Heltec.display->setColor(BLACK);
-    //Heltec.display->fillRect(0, 0, 128, 20);
-    //Heltec.display->setColor(WHITE);
+//rotate the dashboard pages, values are refreshed once per second or on new data
+void dashLoop()
+{
+    bool changed = false;
+    DashStation ds;
+    while (displayQueue.pop(ds))
+    {
+        //slot of the station, else a free or the least recently received slot
+        int slot = 0;
+        for (int i = 0; i < MAX_WS; i++)
+        {
+            if (dashStations[i].receivedAt && dashStations[i].ws.msgformat == ds.ws.msgformat &&
+                dashStations[i].ws.stationID == ds.ws.stationID)
+            {
+                slot = i;
+                break;
+            }
+            if (dashStations[i].receivedAt < dashStations[slot].receivedAt)
+                slot = i;
+        }
+        ds.receivedAt = millis() | 1; //0 marks a free slot
+        dashStations[slot] = ds;
+        changed = true;
+    }
 
-    Heltec.display->setTextAlignment(TEXT_ALIGN_RIGHT);
-    Heltec.display->setFont(ArialMT_Plain_24);
+    static uint32_t minuteAt = 0;
+    static uint32_t rxAtMinute = 0;
+    if (millis() - minuteAt >= 60000)
+    {
+        uint32_t rx = rfRxNum.get();
+        rfRxPerMin = rx - rxAtMinute;
+        rxAtMinute = rx;
+        minuteAt = millis();
+    }
 
-    char oledmsg[60];
-    double value = wsp->windspeed;
-    if (value > 19.95)
-        sprintf(oledmsg, "%ld", lround(value));
-    else
-        sprintf(oledmsg, "%2.1f", value);
-    Heltec.display->drawString(43, 0, oledmsg);
+    //pages: stations heard from recently or the stale screen, then RF and network
+    int8_t pages[MAX_WS + 2];
+    uint8_t n = 0;
+    for (int i = 0; i < MAX_WS; i++)
+    {
+        if (dashStations[i].receivedAt && millis() - dashStations[i].receivedAt < DASH_STALE_MS)
+            pages[n++] = i;
+    }
+    if (n == 0)
+        pages[n++] = PAGE_STALE;
+    pages[n++] = PAGE_RF;
+    pages[n++] = PAGE_NETWORK;
+
+    if (millis() - dashPageAt > DASH_PAGE_MS)
+    {
+        dashPage++;
+        dashPageAt = millis();
+        changed = true;
+    }
+    static uint32_t renderedAt = 0;
+    if (!changed && millis() - renderedAt < 1000)
+        return;
+    renderedAt = millis();
 
-    value = 0.540 * wsp->windspeed;
-    if (value > 19.95)
-        sprintf(oledmsg, "%ld", lround(value));
+    int8_t page = pages[dashPage % n];
+    if (page == PAGE_STALE)
+        displayStale();
+    else if (page == PAGE_RF)
+        displayRF();
+    else if (page == PAGE_NETWORK)
+        displayNetwork();
     else
-        sprintf(oledmsg, "%2.1f", value);
-    Heltec.display->drawString(94, 0, oledmsg);
+        display(page);
+}
 
-    sprintf(oledmsg, "%d", beaufort(wsp->windspeed));
-    Heltec.display->drawString(128, 0, oledmsg);
+//===== Radio task
+
+void rfLoop()
+{
+    static uint8_t pktbuf[70];
+    radioProf.begin(RS_RECEIVE);
+    int len = radio.receive(pktbuf, sizeof(pktbuf));
+    radioProf.end(RS_RECEIVE);
+    if (len <= 0)
+        return;
+    rfRxNum.inc();
+    digitalWrite(LED_RF, LED_ON);
+    rfLed = millis();
 
-    Heltec.display->setFont(ArialMT_Plain_10);
+    radioProf.begin(RS_DECODE);
+    WSBase *ws = wsProcessor.processWSPacket(pktbuf, len, radio.rxUs, radio.rssi, radio.snr, radio.lna, radio.afc);
+    radioProf.end(RS_DECODE);
+    if (ws)
+    {
+        ProfSection section(radioProf, RS_QUEUE);
+        WSRecord record;
+        record.ws = ws;
+        memcpy(record.pkt, pktbuf, sizeof(record.pkt));
+        if (bootFirstPacketMs.get() == 0)
+            bootFirstPacketMs.set(millis());
+        if (!wsQueue.push(record))
+        {
+            rfDropNum.inc();
+            delete ws;
+        }
+    }
+}
 
-    Heltec.display->drawString(41, 22, "km / h");
-    Heltec.display->drawString(92, 22, "knopen");
-    Heltec.display->drawString(126, 22, "bft");
+void radioTask(void *arg)
+{
+    for (;;)
+    {
+        radioProf.loopBegin();
+        rfLoop();
+        radioProf.loopEnd();
+        //yield to the UI task on this core, the radio FIFO holds a complete packet
+        vTaskDelay(1);
+    }
+}
 
-    Heltec.display->setFont(ArialMT_Plain_24);
+//===== Network task
 
-    sprintf(oledmsg, "%2.1f°C", wsp->temperature);
-    Heltec.display->drawString(128, 32, oledmsg);
+//message length of a decoded format, for comparing packets in a burst
+uint8_t packetLength(uint16_t msgformat)
+{
+    switch (msgformat)
+    {
+    case MSG_WS3000:
+        return LEN_WS3000;
+    case MSG_WS4000:
+        return LEN_WS4000;
+    default:
+        return LEN_WH2300 + 1;
+    }
+}
 
-    Heltec.display->setTextAlignment(TEXT_ALIGN_LEFT);
+//count the packet of station slot idx, its burst size and duplicates
+void countPacket(uint8_t idx, const WSRecord &record)
+{
+    if (idx >= WS_METRICS_MAX)
+        return;
+    StationMetrics &m = stationMetrics[idx];
+    m.rx.inc();
+    m.id.set((uint32_t)record.ws->msgformat << 16 | record.ws->stationID);
 
-    const char *compass[] = {"n  ", "nno", "no ", "ono", "o  ", "ozo", "zo ", "zzo", "z  ", "zzw", "zw ", "wzw", "w  ", "wnw", "nw ", "nnw"};
-    sprintf(oledmsg, "%3s", compass[((4 * wsp->winddir + 45) / 90) & 0x0F]);
-    Heltec.display->drawString(0, 27, oledmsg);
+    int64_t now = record.ws->rxUs;
+    if (m.burstLen && now - m.lastUs < WS_BURST_MS * 1000)
+    {
+        if (memcmp(m.last, record.pkt, packetLength(record.ws->msgformat)) == 0)
+            m.duplicates.inc();
+        m.burstLen++;
+    }
+    else
+    {
+        if (m.burstLen)
+            m.burst.observe(m.burstLen);
+        m.burstLen = 1;
+    }
+    memcpy(m.last, record.pkt, sizeof(m.last));
+    m.lastUs = now;
+}
 
-    Heltec.display->setFont(ArialMT_Plain_16);
-    sprintf(oledmsg, "«%3d»", wsp->winddir);
-    Heltec.display->drawString(0, 49, oledmsg);
+//Set the wall clock time of a packet from its monotonic arrival time.
+//Returns false while the packet should wait in wsQueue for SNTP.
+bool stampRecord(WSRecord &record)
+{
+    if (!record.ws->setWallClock())
+        return millis() > BOOT_SNTP_WAIT_MS; //give up, process without time
+    if (clockSetUs == 0)
+        clockSetUs = esp_timer_get_time();
+    if (record.ws->rxUs < clockSetUs)
+        retroStamped.inc();
+    return true;
+}
 
-    Heltec.display->setTextAlignment(TEXT_ALIGN_RIGHT);
-    Heltec.display->setFont(ArialMT_Plain_10);
+#define HISTORY_JSON_MAX 4096
 
-    sprintf(oledmsg, "%02X%02X ", (wsp->msgformat & 0xFF), (wsp->stationID & 0xFF));
-    bool conn = WiFi.isConnected();
-    bool mqConn = mqttClient.connected();
+//Publish the rain, wind and gust history of the stations on /history, one message per
+//station, {"wsType":40,"wsID":123} selects one. Entries are [age in s, value].
+void publishHistory(const char *payload)
+{
+    DynamicJsonDocument doc(256);
+    deserializeJson(doc, payload);
+    uint16_t wsType = doc["wsType"] | 0xffff;
+    uint16_t wsID = doc["wsID"] | 0xffff;
+    time_t now = esp_timer_get_time() / 1000000;
+
+    //network task only
+    static char buf[HISTORY_JSON_MAX];
+    for (int i = 0; i < MAX_WS; i++)
+    {
+        WSSetting *st = wsConfig.stations[i];
+        if (!st || (wsType != 0xffff && st->wsType != wsType) || (wsID != 0xffff && st->wsID != wsID))
+            continue;
+        FmtBuf json(buf, sizeof(buf));
+        json.str("{\"slot\":").u32(i).str(",\"wsType\":").u32(st->wsType).str(",\"wsID\":").u32(st->wsID);
+        json.str(",\"rain\":[");
+        for (std::map<time_t, uint32_t>::iterator it = st->rainhist.begin(); it != st->rainhist.end(); ++it)
+        {
+            if (it != st->rainhist.begin())
+                json.chr(',');
+            json.chr('[').i32(now - it->first).chr(',').fixed(it->second, 1).chr(']');
+        }
+        json.str("],\"wind\":[");
+        for (std::map<time_t, uint16_t>::iterator it = st->windhist.begin(); it != st->windhist.end(); ++it)
+        {
+            if (it != st->windhist.begin())
+                json.chr(',');
+            json.chr('[').i32(now - it->first).chr(',').fixed(it->second, 1).chr(']');
+        }
+        json.str("],\"gust\":[");
+        for (std::map<time_t, uint16_t>::iterator it = st->gusthist.begin(); it != st->gusthist.end(); ++it)
+        {
+            if (it != st->gusthist.begin())
+                json.chr(',');
+            json.chr('[').i32(now - it->first).chr(',').fixed(it->second, 1).chr(']');
+        }
+        json.str("]}");
+        if (json.overflow())
+        {
+            printf("History of station %d truncated, increase HISTORY_JSON_MAX\n", i);
+            continue;
+        }
+        mqttClient.publish(topics.topic(GT_HISTORY), 1, false, buf, json.length(), false);
+        mqttTxNum++;
+    }
+}
 
-    char statusmsg[64];
-    statusmsg[0] = 0;
-    if (conn)
-        strcat(statusmsg, "wifi ok mq ");
-    else
-        strcat(statusmsg, "wifi -- mq ");
-    if (mqConn)
-        strcat(statusmsg, oledmsg);
-    else
-        strcat(statusmsg, "xxxx");
-    Heltec.display->drawString(128, 54, statusmsg);
-    Heltec.display->display();
-#endif
+//Publish the configuration and state of every station on /dump, one message per station.
+//The passwords are left out, a dump sent back on /wsconfig is merged and keeps them.
+void publishDump()
+{
+    //network task only
+    static char buf[WS_RECORD_MAX];
+    for (int i = 0; i < MAX_WS; i++)
+    {
+        WSSetting *st = wsConfig.stations[i];
+        if (!st)
+            continue;
+        DynamicJsonDocument json(WS_JSON_DOC);
+        JsonObject ojson = json.to<JsonObject>();
+        st->serialize(ojson);
+        ojson.remove("wuPW");
+        ojson.remove("dzPW");
+        ojson.remove("wgPW");
+        ojson["slot"] = i;
+        ojson["lastSeenS"] = (millis() - st->lastSeen) / 1000;
+        ojson["known"] = st->fp.known();
+        size_t len = serializeJson(json, buf, sizeof(buf));
+        if (len == 0 || len >= sizeof(buf) - 1)
+        {
+            printf("Dump of station %d does not fit\n", i);
+            continue;
+        }
+        mqttClient.publish(topics.topic(GT_DUMP), 1, false, buf, len, false);
+        mqttTxNum++;
+    }
 }
 
-void rfLoop(bool mqConn)
+void report();
+
+//"host[:port] <sha256>" pins the SHA-256 of the public key of host, 64 hex digits, as
+//printed on a mismatch; "host[:port]" clears the pin, the next full handshake pins
+void setTLSPin(char *msg)
 {
-    static uint8_t pktbuf[70];
-    int len = radio.receive(pktbuf, sizeof(pktbuf));
-    if (len <= 0)
+    char *key = strchr(msg, ' ');
+    if (key)
+        *key++ = 0;
+    uint16_t port = 443;
+    char *colon = strchr(msg, ':');
+    if (colon)
+    {
+        *colon = 0;
+        port = atoi(colon + 1);
+    }
+    uint8_t pin[32];
+    if (!msg[0] || port == 0 || (key && !TLSClient::parsePin(key, pin)))
+    {
+        printf("TLS pin: expected host[:port] [sha256 in hex], got %s\n", msg);
         return;
-    rfRxNum++;
-    digitalWrite(LED_RF, LED_ON);
-    rfLed = millis();
+    }
+    TLSClient::setPin(msg, port, key ? pin : nullptr);
+}
 
-    WSBase *ws = wsProcessor.processWSPacket(pktbuf, len, radio.rxAt, radio.rssi, radio.snr, radio.lna, radio.afc);
-    if (ws)
+void wsLoop()
+{
+    //apply configuration messages
+    WSCommand command;
+    while (cmdQueue.pop(command))
+    {
+        ProfSection section(networkProf, NS_CONFIG);
+        switch (command.cmd)
+        {
+        case WSCommand::WS_ADD:
+            wsConfig.add(command.json);
+            break;
+        case WSCommand::WS_REMOVE:
+            wsConfig.remove(command.json);
+            break;
+        case WSCommand::WS_HISTORY:
+            publishHistory(command.json);
+            break;
+        case WSCommand::WS_DUMP:
+            publishDump();
+            break;
+        case WSCommand::WS_STATS:
+            report();
+            break;
+        case WSCommand::WS_TLSPIN:
+            setTLSPin(command.json);
+            break;
+        }
+        free(command.json);
+    }
+    //one write per changed station for all configuration messages
+    wsConfig.flush();
+
+    //process decoded packets, in order of reception
+    WSRecord record;
+    while (wsQueue.peek(record))
     {
+        if (!stampRecord(record))
+            break;
+        wsQueue.pop(record);
+        ProfSection section(networkProf, NS_PACKETS);
+        WSBase *ws = record.ws;
         ws->print();
 
-        WSSetting *thisStation = wsConfig.lookup(ws->msgformat, ws->stationID);
+        uint8_t idx = wsConfig.ilookup(ws->msgformat, ws->stationID);
+        if (idx >= MAX_WS)
+        {
+            //a configured station with a new ID after a battery change
+            idx = wsConfig.repair(ws);
+            if (idx < MAX_WS)
+            {
+                fpRebind.inc();
+                publishEvent("rebind", idx, ws);
+            }
+        }
+        WSSetting *thisStation = (idx < MAX_WS) ? wsConfig.stations[idx] : nullptr;
+
+        if (thisStation && thisStation->fp.collides(WSSetting::sample(ws)))
+        {
+            //another transmitter with the same ID, not merged into the station
+            fpCollision.inc();
+            if (ws->rxUs - thisStation->collisionUs > 60000000)
+                publishEvent("collision", idx, ws);
+            thisStation->collisionUs = ws->rxUs;
+            thisStation = nullptr;
+        }
 
         if (thisStation)
         {
-            thisStation->update(ws, pktbuf);
+            countPacket(idx, record);
+            thisStation->update(ws, record.pkt);
+            if (ws->quality)
+                qfReplaced.inc();
+            if (idx < WS_METRICS_MAX)
+            {
+                stationMetrics[idx].periodUs.set(thisStation->fp.cadence.periodUs());
+                stationMetrics[idx].jitterUs.set(thisStation->fp.cadence.jitterUs());
+            }
 
             //for OLED display: last configured good packet.
             struct timeval tvnow;
             gettimeofday(&tvnow, NULL);
-            lastWSts = tvnow.tv_sec;
+            lastWSts.store(tvnow.tv_sec, std::memory_order_relaxed);
         }
         else
         {
             //It is a weather station, but not configured.
             //It may be decoded or unknown but with succesful CRC check
             //report succesful and unknown packets on MQTT. Note: WH1080 burst of upto 6 repeating signals.
-            publishWS(ws->mqttPayload().c_str());
+            if (unconfiguredDue(ws))
+            {
+                char payload[WS_PAYLOAD_MAX];
+                ws->mqttPayload(payload, sizeof(payload));
+                publishWS(payload);
+                unconfSent.inc();
+            }
+            else
+                unconfSuppressed.inc();
         }
         delete ws;
     };
@@ -478,103 +1027,324 @@ void rfLoop(bool mqConn)
         WSSetting *thisStation = wsConfig.stations[i];
         if (thisStation && thisStation->reportable())
         {
+            ProfSection section(networkProf, NS_REPORT);
             //report succesful packets on MQTT, but at most one per WH1080 burst of upto 6 repeating signals
-            if ((millis() - thisStation->lastReported > 500) && thisStation->wsp)
+            WSBase *wsp = thisStation->wsp;
+            int64_t heartbeatUs = (int64_t)thisStation->heartbeat * 1000000;
+            uint32_t changeMask = MF_CHANGE_MASK & mqttFieldMask(thisStation->wsType);
+            if ((millis() - thisStation->lastReported > 500) && wsp)
             {
-                publishWS(thisStation->wsp->mqttPayload().c_str());
-                display(thisStation->wsp);
+                //only a change beyond the deadbands or the heartbeat, the per-field topics have their own
+                if (thisStation->reportFilter.due(*wsp, thisStation->deadband, changeMask, heartbeatUs))
+                {
+                    thisStation->reportFilter.commit(*wsp);
+                    reportSent.inc();
+                    if (thisStation->mqttMode & MQ_JSON)
+                    {
+                        char payload[WS_PAYLOAD_MAX];
+                        wsp->mqttPayload(payload, sizeof(payload));
+                        publishWS(payload);
+                    }
+                    if (i < WS_METRICS_MAX)
+                        stationMetrics[i].reported.inc();
+                }
+                else
+                    reportSuppressed.inc();
+                if (thisStation->mqttMode & MQ_FIELDS)
+                    publishFields(thisStation);
+                DashStation ds;
+                ds.ws = *wsp;
+                memcpy(ds.fields, thisStation->oledFields, sizeof(ds.fields));
+                displayQueue.push(ds);
             }
 
-            //report to API's at most once per 60 seconds
+            //report to API's at most once per 60 seconds, and only a change or the heartbeat
             if (millis() - thisStation->lastReported > 60000)
             {
                 thisStation->lastReported = millis();
-                if (thisStation->wunderground)
+                if (wsp && !thisStation->uploadFilter.due(*wsp, thisStation->deadband, changeMask, heartbeatUs))
                 {
-                    UploadToWebAPI("weatherstation.wunderground.com", 443, true,
-                                   thisStation->urlWunderground(thisStation->wuID, thisStation->wuPW).c_str());
-                    //printf("%s\n", ws->urlWunderground().c_str());
-                };
-                if (thisStation->domoticz)
+                    uploadSuppressed.inc();
+                    continue;
+                }
+                if (wsp)
+                    thisStation->uploadFilter.commit(*wsp);
+                ProfSection upload(networkProf, NS_UPLOAD);
+                char request[WT_REQUEST_MAX];
+                for (int t = 0; t < WT_COUNT; t++)
                 {
-                    if (thisStation->dzTHidx > 0)
+                    if (thisStation->targets[t].enabled)
                     {
-                        UploadToWebAPI(thisStation->dzURL, thisStation->dzPort, thisStation->dzSecure,
-                                       thisStation->urlDomoticzTemp(thisStation->dzTHidx, thisStation->dzID, thisStation->dzPW).c_str());
-                        //printf("%s\n", ws->urlDomoticzTemp(thisStation->dzTHidx, thisStation->dzID, thisStation->dzPW).c_str());
+                        ProfSection target(networkProf, NS_TARGET + t);
+                        size_t len = thisStation->request(t, request, sizeof(request));
+                        if (UploadToWebAPI(thisStation->targets[t], request, len))
+                            uploadOk[t].inc();
+                        else
+                            uploadFail[t].inc();
+                        uploadMs[t].observe(thisStation->targets[t].stats.lastMs);
                     }
-                    if (thisStation->dzWidx > 0)
-                    {
-                        UploadToWebAPI(thisStation->dzURL, thisStation->dzPort, thisStation->dzSecure,
-                                       thisStation->urlDomoticzWind(thisStation->dzWidx, thisStation->dzID, thisStation->dzPW).c_str());
-                        //printf("%s\n", ws->urlDomoticzWind(thisStation->dzWidx, thisStation->dzID, thisStation->dzPW).c_str());
-                    }
-                    if (thisStation->dzRidx > 0)
-                    {
-                        UploadToWebAPI(thisStation->dzURL, thisStation->dzPort, thisStation->dzSecure,
-                                       thisStation->urlDomoticzRain(thisStation->dzRidx, thisStation->dzID, thisStation->dzPW).c_str());
-                        //printf("%s\n", ws->urlDomoticzRain(thisStation->dzRidx, thisStation->dzID, thisStation->dzPW).c_str());
-                    }
-                    if (thisStation->dzLidx > 0)
-                    {
-                        UploadToWebAPI(thisStation->dzURL, thisStation->dzPort, thisStation->dzSecure,
-                                       thisStation->urlDomoticzLight(thisStation->dzLidx, thisStation->dzID, thisStation->dzPW).c_str());
-                        //printf("%s\n", ws->urlDomoticzLight (thisStation->dzLidx, thisStation->dzID, thisStation->dzPW).c_str());
-                    }
-                    if (thisStation->dzUVidx > 0)
-                    {
-                        UploadToWebAPI(thisStation->dzURL, thisStation->dzPort, thisStation->dzSecure,
-                                       thisStation->urlDomoticzUV(thisStation->dzUVidx, thisStation->dzID, thisStation->dzPW).c_str());
-                        //printf("%s\n", ws->urlDomoticzUV(thisStation->dzUVidx, thisStation->dzID, thisStation->dzPW).c_str());
-                    }
-                }
-                if (thisStation->windguru)
-                {
-                    UploadToWebAPI("www.windguru.cz", 80, false, thisStation->urlWindguru(thisStation->wgUID, thisStation->wgPW).c_str());
-                    //printf("%s\n", thisStation->urlWindguru(thisStation->wgUID, thisStation->wgPW).c_str());
                 }
             }
         }
     }
     //TODO:
     //publish failed packets to MQTT
-
-    //clear display when no recent data is received.
-    struct timeval tvnow;
-    gettimeofday(&tvnow, NULL);
-    if (tvnow.tv_sec - lastWSts > 300)
-    {
-        displayStale();
-    }
 }
 
 extern uint32_t mqPingMs;
 
+//gauges that are sampled instead of updated
+void metricsUpdate()
+{
+    uptime.set(esp_timer_get_time() / 1000000);
+    wifiRssi.set(WiFi.RSSI());
+    heapFree.set(ESP.getFreeHeap());
+    heapMin.set(ESP.getMinFreeHeap());
+    heapMaxBlock.set(ESP.getMaxAllocHeap());
+    rfNoise.set(-(radio.bgRssi >> 5));
+}
+
+#define METRICS_JSON_MAX 8192
+
 void report()
 {
     // printf("vBatt = %dmV\n", vBatt);
-
-    char buf[256];
-    int len = snprintf(buf, sizeof(buf),
-                       "{\"uptime\":%d,\"rssi\":%d,\"heap\":%d,\"mVbatt\":%d,\"version\":\"%s\"",
-                       uint32_t(esp_timer_get_time() / 1000000), WiFi.RSSI(), ESP.getFreeHeap(), vBatt, __DATE__);
-    len += snprintf(buf + len, sizeof(buf) - len, ",\"rfRx\":%d,\"rfNoise\":%d",
-                    rfRxNum, -(radio.bgRssi >> 5));
-    len += snprintf(buf + len, sizeof(buf) - len,
-                    ",\"mqttTx\":%d,\"mqttRx\":%d,\"ping\":%d",
-                    mqttTxNum, mqttRxNum, mqPingMs);
-    buf[len++] = '}';
-    buf[len] = 0;
+    metricsUpdate();
+
+    //network task only
+    static char buf[METRICS_JSON_MAX];
+    FmtBuf json(buf, sizeof(buf));
+    json.str("{\"version\":\"").str(__DATE__).chr('"');
+    metrics.json(json);
+    json.chr('}');
+    if (json.overflow())
+    {
+        printf("Stats JSON truncated, increase METRICS_JSON_MAX\n");
+        return;
+    }
+    int len = json.length();
 
     // send off the packet
-    char topic[41 + 6];
-    strcpy(topic, mqTopic);
-    strcat(topic, "/stats");
     printf("MQTT TX stats len=%d\n", len);
-    mqttClient.publish(topic, 1, false, buf, len, false);
+    mqttClient.publish(topics.topic(GT_STATS), 1, false, buf, len, false);
     //printf("JSON: %s\n", buf);
 }
 
+#ifdef METRICS_HTTP_PORT
+AsyncWebServer metricsServer(METRICS_HTTP_PORT);
+#endif
+
+//register all metrics, before the tasks are started
+void metricsSetup()
+{
+    metrics.gauge("uptime", uptime);
+    metrics.gauge("rssi", wifiRssi);
+    metrics.gauge("heap", heapFree);
+    metrics.gauge("heapMin", heapMin);
+    metrics.gauge("heapMaxBlock", heapMaxBlock);
+    metrics.gauge("mVbatt", vBatt);
+    metrics.counter("rfRx", rfRxNum);
+    metrics.counter("rfDrop", rfDropNum);
+    metrics.counter("rfSyncStamped", radio.syncStamped);
+    metrics.gauge("rfNoise", rfNoise);
+    metrics.gauge("bootRadioMs", bootRadioMs);
+    metrics.gauge("bootConfigMs", bootConfigMs);
+    metrics.gauge("bootFirstPacketMs", bootFirstPacketMs);
+    metrics.counter("retroStamped", retroStamped);
+    metrics.counter("fpRebind", fpRebind);
+    metrics.counter("fpCollision", fpCollision);
+    metrics.counter("qfReplaced", qfReplaced);
+    metrics.counter("reportSent", reportSent);
+    metrics.counter("reportSuppressed", reportSuppressed);
+    metrics.counter("unconfSent", unconfSent);
+    metrics.counter("unconfSuppressed", unconfSuppressed);
+    metrics.counter("uploadSuppressed", uploadSuppressed);
+    for (int f = 0; f < WSF_COUNT; f++)
+        metrics.counter("crcFail", wsProcessor.crcFail[f], "family", wsFamilyNames[f]);
+    metrics.counter("mqttTx", mqttTxNum);
+    metrics.counter("mqttRx", mqttRxNum);
+    metrics.gauge("ping", mqPingMs);
+    metrics.counter("tlsFull", TLSClient::stats.full);
+    metrics.counter("tlsResumed", TLSClient::stats.resumed);
+    metrics.counter("tlsFail", TLSClient::stats.failed);
+    metrics.counter("tlsPinMismatch", TLSClient::stats.pinMismatch);
+    metrics.gauge("tlsMs", TLSClient::stats.lastMs);
+    metrics.gauge("tlsMaxFullMs", TLSClient::stats.maxFullMs);
+    metrics.gauge("tlsMaxResumedMs", TLSClient::stats.maxResumedMs);
+
+    for (int i = 0; i < WS_METRICS_MAX; i++)
+        metrics.gauge("wsId", stationMetrics[i].id, "ws", wsLabels[i]);
+    for (int i = 0; i < WS_METRICS_MAX; i++)
+        metrics.counter("wsRx", stationMetrics[i].rx, "ws", wsLabels[i]);
+    for (int i = 0; i < WS_METRICS_MAX; i++)
+        metrics.counter("wsReported", stationMetrics[i].reported, "ws", wsLabels[i]);
+    for (int i = 0; i < WS_METRICS_MAX; i++)
+        metrics.counter("wsDuplicates", stationMetrics[i].duplicates, "ws", wsLabels[i]);
+    for (int i = 0; i < WS_METRICS_MAX; i++)
+        metrics.histogram("wsBurst", stationMetrics[i].burst, burstBuckets, 6, "ws", wsLabels[i]);
+    for (int i = 0; i < WS_METRICS_MAX; i++)
+        metrics.gauge("wsPeriodUs", stationMetrics[i].periodUs, "ws", wsLabels[i]);
+    for (int i = 0; i < WS_METRICS_MAX; i++)
+        metrics.gauge("wsJitterUs", stationMetrics[i].jitterUs, "ws", wsLabels[i]);
+
+    for (int t = 0; t < WT_COUNT; t++)
+        metrics.counter("uploadOk", uploadOk[t], "target", webTargetNames[t]);
+    for (int t = 0; t < WT_COUNT; t++)
+        metrics.counter("uploadFail", uploadFail[t], "target", webTargetNames[t]);
+    for (int t = 0; t < WT_COUNT; t++)
+        metrics.histogram("uploadMs", uploadMs[t], uploadMsBuckets, 6, "target", webTargetNames[t]);
+
+    Profiler *profilers[] = {&radioProf, &networkProf};
+    for (Profiler *prof : profilers)
+        metrics.counter("stalls", prof->stallCount, "task", prof->task);
+    for (Profiler *prof : profilers)
+        for (int i = 0; i < prof->sections(); i++)
+            metrics.histogram("sectionUs", prof->sectionUs[i], loopUsBuckets, 6, "section", prof->name(i));
+    for (Profiler *prof : profilers)
+        for (int i = 0; i < prof->sections(); i++)
+            metrics.gauge("sectionMaxUs", prof->maxUs[i], "section", prof->name(i));
+    for (Profiler *prof : profilers)
+        for (int i = 0; i < prof->sections(); i++)
+            metrics.counter("sectionSamples", prof->samples[i], "section", prof->name(i));
+    metrics.histogram("uiLoopUs", uiLoopUs, loopUsBuckets, 6);
+#if defined BOARD_HELTEC
+    metrics.counter("oledBytes", oled.i2cBytes);
+    metrics.counter("oledFlush", oled.flushes);
+#endif
+
+#ifdef METRICS_HTTP_PORT
+    metricsServer.on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request) {
+        metricsUpdate();
+        AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+        char lines[640];
+        for (int i = 0; i < metrics.size(); i++)
+        {
+            FmtBuf out(lines, sizeof(lines));
+            metrics.prometheus(i, out);
+            response->write((const uint8_t *)lines, out.length());
+        }
+        request->send(response);
+    });
+    metricsServer.begin();
+#endif
+}
+
+//===== Network task loop
+
+uint32_t lastWiFiConn = millis();
+uint32_t lastInfo = -1000000;
+bool wifiConn = false;
+uint32_t lastReport = -50 * 1000;
+
+//publish the stall records of a profiler, they are kept until MQTT is connected
+void publishStalls(Profiler &prof)
+{
+    if (!mqttClient.connected())
+        return;
+    StallRecord r;
+    while (prof.stalls.pop(r))
+    {
+        char buf[160];
+        FmtBuf json(buf, sizeof(buf));
+        prof.stallJson(r, json);
+        printf("MQTT TX stall %s\n", buf);
+        mqttClient.publish(topics.topic(GT_STALL), 1, false, buf, json.length(), false);
+    }
+}
+
+void networkLoop()
+{
+    networkProf.begin(NS_WIFI);
+    // print wifi/mqtt info every now and then
+    bool conn = WiFi.isConnected();
+    bool mqConn = mqttClient.connected();
+    if (conn != wifiConn || mqConn != mqttConn || millis() - lastInfo > 20000)
+    {
+        //WiFi.printDiag(Serial);
+        printf("* Wifi:%s %s | MQTT:%s\n",
+               conn ? WiFi.SSID().c_str() : "---",
+               WiFi.localIP().toString().c_str(),
+               mqConn ? config.mqtt_server : "---");
+        if (conn != wifiConn && conn)
+        {
+            // when we connect we set the SNTP server #0 to the IP address of the gateway, which
+            // tends to be the NTP server on the LAN in 99% of cases. It would be nice if
+            // arduino-esp32 supported DHCP discovery of the NTP serevr, but it doesn't...
+            // NOTE: commented this out to investigate unexpected wifi disconnects.
+            // ip_addr_t sntpip = IPADDR4_INIT((uint32_t)(WiFi.gatewayIP()));
+            // sntp_setserver(1, &sntpip);
+        }
+        lastInfo = millis();
+        wifiConn = conn;
+        mqttConn = mqConn;
+        if (mqttLed == 0)
+            digitalWrite(LED_WIFI, (wifiConn && mqConn) ? LED_OFF : LED_ON);
+    }
+    //handle WiFi reconnect
+    if (conn)
+    {
+        lastWiFiConn = millis();
+    }
+    else
+    {
+        if (millis() - lastWiFiConn > 20000)
+        {
+            //reconnect code
+
+            //at least wait another 20 secs before retry
+            lastWiFiConn = millis();
+        }
+    }
+    networkProf.end(NS_WIFI);
+
+    wsLoop();
+    if (mqConn && millis() - lastReport > 20 * 1000)
+    {
+        ProfSection section(networkProf, NS_STATS);
+        report();
+        lastReport = millis();
+    }
+    publishStalls(radioProf);
+    publishStalls(networkProf);
+
+    //mqtt ping
+    networkProf.begin(NS_MQTT);
+    mqttLoop();
+    networkProf.end(NS_MQTT);
+    //process CLI commands
+    networkProf.begin(NS_CLI);
+    cmd.loop();
+    networkProf.end(NS_CLI);
+}
+
+//samples the active profiler sections and reports hanging loops
+void watchdogTask(void *arg)
+{
+    for (;;)
+    {
+        radioProf.sample();
+        networkProf.sample();
+        vTaskDelay(PROF_SAMPLE_MS / portTICK_PERIOD_MS);
+    }
+}
+
+void networkTask(void *arg)
+{
+    //Load the weather station configuration from flash memory, this may format
+    //SPIFFS on first boot. Packets received meanwhile wait in wsQueue.
+    wsConfig.load();
+    bootConfigMs.set(millis());
+
+    for (;;)
+    {
+        networkProf.loopBegin();
+        networkLoop();
+        networkProf.loopEnd();
+        //let the idle task on core 0 run, it feeds the task watchdog
+        vTaskDelay(1);
+    }
+}
+
 //DEBUG wifi disconnects
 void WiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info)
 {
@@ -630,19 +1400,44 @@ void WiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info)
 
 void setup()
 {
-    Heltec.begin(true /*DisplayEnable Enable*/, false /*LoRa Enable*/, true /*Serial Enable*/);
-
     Serial.begin(115200);
 
     printf("\n===== ESP32 RF Gateway =====\n");
     printf("Running ESP-IDF %s\n", ESP.getSdkVersion());
     printf("Board type: %s\n", ARDUINO_BOARD);
+#ifdef CYCLE_BENCH
+    cycleBench();
+#endif
 
+    pinMode(LED_MQTT, OUTPUT);
+    digitalWrite(LED_MQTT, LED_OFF);
+    pinMode(LED_RF, OUTPUT);
+    digitalWrite(LED_RF, LED_OFF);
+    pinMode(LED_WIFI, OUTPUT);
+    digitalWrite(LED_WIFI, LED_ON);
+
+    // radio init first, so no burst is lost while the rest starts
+    printf("Initializing radio\n");
+    spi.begin(RF_CLK, RF_MISO, RF_MOSI);
+    radio.init(rfId, rfGroup, rfFreq);
+    //Do not use interrupts for weatherstation application
+    //radio.setIntrPins(RF_DIO0, RF_DIO4);
+    radio.setIntrPins(-1, -1);
+    //except for the arrival time of packets
+    radio.setSyncPin(RF_DIO2);
+    radio.txPower(rfPow);
+    radio.setMode(SX1276fsk::MODE_STANDBY);
+    xTaskCreatePinnedToCore(radioTask, "radio", RADIO_STACK, NULL, RADIO_PRIO, NULL, RADIO_CORE);
+    bootRadioMs.set(millis());
+
+    Heltec.begin(true /*DisplayEnable Enable*/, false /*LoRa Enable*/, false /*Serial Enable*/);
     displayTest();
 
     config.read(); // read config file from flash
     cmd.init();    // init CLI
     mqttSetup(config);
+    commands.begin(mqTopic);
+    topics.begin(mqTopic);
     mqttClient.onConnect(onMqttConnect);
     mqttClient.onMessage(onMqttMessage);
     //mqttClient.onPublish(onMqttPublish);
@@ -665,82 +1460,26 @@ void setup()
     sntp_setservername(0, (char *)"pool.ntp.org"); // esp-idf compiled with max 1 NTP server...
     sntp_init();
 
-    // radio init
-    printf("Initializing radio\n");
-    spi.begin(RF_CLK, RF_MISO, RF_MOSI);
-    radio.init(rfId, rfGroup, rfFreq);
-    //Do not use interrupts for weatherstation application
-    //radio.setIntrPins(RF_DIO0, RF_DIO4);
-    radio.setIntrPins(-1, -1);
-    radio.txPower(rfPow);
-    radio.setMode(SX1276fsk::MODE_STANDBY);
-
-    pinMode(LED_MQTT, OUTPUT);
-    digitalWrite(LED_MQTT, LED_OFF);
-    pinMode(LED_RF, OUTPUT);
-    digitalWrite(LED_RF, LED_OFF);
-    pinMode(LED_WIFI, OUTPUT);
-    digitalWrite(LED_WIFI, LED_ON);
-
 #ifdef VBATT
     analogSetup(VBATT);
 #endif
 
-    delay(200);
+    networkProf.addSections(webTargetNames, WT_COUNT);
+    metricsSetup();
+    mqttDefaultDeadbands(unconfiguredDeadband);
 
-    //Load the weather station configuration from flash memory
-    wsConfig.load();
+    //the network task loads the station configuration, the UI runs in loop()
+    xTaskCreatePinnedToCore(networkTask, "network", NETWORK_STACK, NULL, NETWORK_PRIO, NULL, NETWORK_CORE);
+    xTaskCreatePinnedToCore(watchdogTask, "watchdog", WATCHDOG_STACK, NULL, WATCHDOG_PRIO, NULL, WATCHDOG_CORE);
 
     printf("===== Setup complete\n");
 }
 
-uint32_t lastWiFiConn = millis();
-uint32_t lastInfo = -1000000;
-bool wifiConn = false;
-uint32_t lastReport = -50 * 1000;
+//===== UI task
 
 void loop()
 {
-    // print wifi/mqtt info every now and then
-    bool conn = WiFi.isConnected();
-    bool mqConn = mqttClient.connected();
-    if (conn != wifiConn || mqConn != mqttConn || millis() - lastInfo > 20000)
-    {
-        //WiFi.printDiag(Serial);
-        printf("* Wifi:%s %s | MQTT:%s\n",
-               conn ? WiFi.SSID().c_str() : "---",
-               WiFi.localIP().toString().c_str(),
-               mqConn ? config.mqtt_server : "---");
-        if (conn != wifiConn && conn)
-        {
-            // when we connect we set the SNTP server #0 to the IP address of the gateway, which
-            // tends to be the NTP server on the LAN in 99% of cases. It would be nice if
-            // arduino-esp32 supported DHCP discovery of the NTP serevr, but it doesn't...
-            // NOTE: commented this out to investigate unexpected wifi disconnects.
-            // ip_addr_t sntpip = IPADDR4_INIT((uint32_t)(WiFi.gatewayIP()));
-            // sntp_setserver(1, &sntpip);
-        }
-        lastInfo = millis();
-        wifiConn = conn;
-        mqttConn = mqConn;
-        if (mqttLed == 0)
-            digitalWrite(LED_WIFI, (wifiConn && mqConn) ? LED_OFF : LED_ON);
-    }
-    //handle WiFi reconnect
-    if (conn)
-    {
-        lastWiFiConn = millis();
-    }
-    else
-    {
-        if (millis() - lastWiFiConn > 20000)
-        {
-            //reconnect code
-
-            //at least wait another 20 secs before retry
-            lastWiFiConn = millis();
-        }
-    }
+    uint32_t t0 = micros();
 
 #ifdef VBATT
     uint32_t vB = 2 * analogSample(VBATT);
@@ -748,12 +1487,12 @@ void loop()
     vBatt = (vBatt * 15 + vB) / 16;
 #endif
 
-    rfLoop(mqConn);
-    if (mqConn && millis() - lastReport > 20 * 1000)
-    {
-        report();
-        lastReport = millis();
-    }
+    dashLoop();
+
+#if defined BOARD_HELTEC
+    //redraw changed fields, rate limited
+    oled.flush(Heltec.display);
+#endif
 
     if (mqttLed != 0 && millis() - mqttLed > 200)
     {
@@ -767,8 +1506,6 @@ void loop()
         rfLed = 0;
     }
 
-    //mqtt ping
-    mqttLoop();
-    //process CLI commands
-    cmd.loop();
+    uiLoopUs.observe(micros() - t0);
+    delay(10);
 }
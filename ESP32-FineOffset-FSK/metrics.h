@@ -0,0 +1,280 @@
+// Runtime metrics: counters, gauges and fixed-bucket histograms
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Counters, gauges and histograms are updated lock-free from any task. The
+// registry is filled once in setup() and then only read, by the MQTT stats
+// report (compact JSON) and the optional Prometheus text endpoint.
+// Plain uint32_t statistics that have a single writer, like the TLS stats,
+// are registered by reference instead of being converted.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include "fmtbuf.h"
+
+#define METRICS_MAX 192
+#define METRIC_BUCKETS_MAX 8
+#define METRICS_PREFIX "wsgw_"
+
+class Counter
+{
+    std::atomic<uint32_t> v;
+
+public:
+    Counter() : v(0) {}
+    void inc(uint32_t n = 1) { v.fetch_add(n, std::memory_order_relaxed); }
+    uint32_t get() const { return v.load(std::memory_order_relaxed); }
+};
+
+class Gauge
+{
+    std::atomic<int32_t> v;
+
+public:
+    Gauge() : v(0) {}
+    void set(int32_t n) { v.store(n, std::memory_order_relaxed); }
+    int32_t get() const { return v.load(std::memory_order_relaxed); }
+};
+
+//bucket i counts the observations <= bounds[i], the last bucket the rest (+Inf)
+//the sum wraps like a counter
+class Histogram
+{
+    const uint32_t *bounds;
+    uint8_t nb;
+    std::atomic<uint32_t> counts[METRIC_BUCKETS_MAX + 1];
+    std::atomic<uint32_t> total;
+
+public:
+    Histogram() : bounds(nullptr), nb(0), total(0)
+    {
+        for (int i = 0; i <= METRIC_BUCKETS_MAX; i++)
+            counts[i].store(0, std::memory_order_relaxed);
+    }
+
+    //set before the first observation, bounds in increasing order
+    void setBuckets(const uint32_t *b, uint8_t n)
+    {
+        bounds = b;
+        nb = n < METRIC_BUCKETS_MAX ? n : METRIC_BUCKETS_MAX;
+    }
+
+    void observe(uint32_t v)
+    {
+        uint8_t i = 0;
+        while (i < nb && v > bounds[i])
+            i++;
+        counts[i].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(v, std::memory_order_relaxed);
+    }
+
+    uint8_t buckets() const { return nb; }
+    uint32_t bound(uint8_t i) const { return bounds[i]; }
+    uint32_t count(uint8_t i) const { return counts[i].load(std::memory_order_relaxed); }
+    uint32_t sum() const { return total.load(std::memory_order_relaxed); }
+};
+
+enum MetricType
+{
+    MT_COUNTER,
+    MT_GAUGE,
+    MT_HISTOGRAM
+};
+
+enum MetricSource
+{
+    MS_COUNTER,   //Counter
+    MS_GAUGE,     //Gauge
+    MS_HISTOGRAM, //Histogram
+    MS_U32,       //plain uint32_t with a single writer
+    MS_I32        //plain int32_t with a single writer
+};
+
+struct MetricEntry
+{
+    const char *name;
+    const char *labelKey; //nullptr when not labeled
+    const char *labelValue;
+    uint8_t type;
+    uint8_t source;
+    const void *metric;
+};
+
+class MetricRegistry
+{
+public:
+    MetricRegistry() : count(0) {}
+
+    uint8_t size() const { return count; }
+
+    //Entries of the same name must be registered consecutively, with different label values.
+    void counter(const char *name, const Counter &c, const char *labelKey = nullptr, const char *labelValue = nullptr)
+    {
+        add(name, labelKey, labelValue, MT_COUNTER, MS_COUNTER, &c);
+    }
+
+    void counter(const char *name, const uint32_t &v, const char *labelKey = nullptr, const char *labelValue = nullptr)
+    {
+        add(name, labelKey, labelValue, MT_COUNTER, MS_U32, &v);
+    }
+
+    void gauge(const char *name, const Gauge &g, const char *labelKey = nullptr, const char *labelValue = nullptr)
+    {
+        add(name, labelKey, labelValue, MT_GAUGE, MS_GAUGE, &g);
+    }
+
+    void gauge(const char *name, const uint32_t &v, const char *labelKey = nullptr, const char *labelValue = nullptr)
+    {
+        add(name, labelKey, labelValue, MT_GAUGE, MS_U32, &v);
+    }
+
+    void gauge(const char *name, const int32_t &v, const char *labelKey = nullptr, const char *labelValue = nullptr)
+    {
+        add(name, labelKey, labelValue, MT_GAUGE, MS_I32, &v);
+    }
+
+    void histogram(const char *name, Histogram &h, const uint32_t *bounds, uint8_t n,
+                   const char *labelKey = nullptr, const char *labelValue = nullptr)
+    {
+        h.setBuckets(bounds, n);
+        add(name, labelKey, labelValue, MT_HISTOGRAM, MS_HISTOGRAM, &h);
+    }
+
+    //Compact JSON members, each preceded by a comma:
+    //  ,"name":1  ,"name":{"label":1,...}  ,"name":{"n":[bucket counts],"sum":s}
+    //A histogram with a label is nested one level deeper under the label value.
+    void json(FmtBuf &out) const
+    {
+        for (int i = 0; i < count; i++)
+        {
+            const MetricEntry &e = entries[i];
+            bool first = i == 0 || strcmp(entries[i - 1].name, e.name) != 0;
+            bool last = i == count - 1 || strcmp(entries[i + 1].name, e.name) != 0;
+            if (first)
+            {
+                out.str(",\"").str(e.name).str("\":");
+                if (e.labelKey)
+                    out.chr('{');
+            }
+            else
+            {
+                out.chr(',');
+            }
+            if (e.labelKey)
+                out.chr('"').str(e.labelValue).str("\":");
+            if (e.type == MT_HISTOGRAM)
+            {
+                const Histogram *h = (const Histogram *)e.metric;
+                out.str("{\"n\":[");
+                for (int b = 0; b <= h->buckets(); b++)
+                {
+                    if (b)
+                        out.chr(',');
+                    out.u32(h->count(b));
+                }
+                out.str("],\"sum\":").u32(h->sum()).chr('}');
+            }
+            else
+            {
+                value(e, out);
+            }
+            if (last && e.labelKey)
+                out.chr('}');
+        }
+    }
+
+    //Prometheus text format lines of entry i
+    void prometheus(uint8_t i, FmtBuf &out) const
+    {
+        const MetricEntry &e = entries[i];
+        if (i == 0 || strcmp(entries[i - 1].name, e.name) != 0)
+        {
+            static const char *const types[] = {"counter", "gauge", "histogram"};
+            out.str("# TYPE " METRICS_PREFIX).str(e.name).chr(' ').str(types[e.type]).chr('\n');
+        }
+        if (e.type != MT_HISTOGRAM)
+        {
+            out.str(METRICS_PREFIX).str(e.name);
+            labels(e, nullptr, out);
+            out.chr(' ');
+            value(e, out);
+            out.chr('\n');
+            return;
+        }
+        const Histogram *h = (const Histogram *)e.metric;
+        uint32_t cumulative = 0;
+        char le[12];
+        for (int b = 0; b <= h->buckets(); b++)
+        {
+            cumulative += h->count(b);
+            FmtBuf bound(le, sizeof(le));
+            if (b < h->buckets())
+                bound.u32(h->bound(b));
+            else
+                bound.str("+Inf");
+            out.str(METRICS_PREFIX).str(e.name).str("_bucket");
+            labels(e, le, out);
+            out.chr(' ').u32(cumulative).chr('\n');
+        }
+        out.str(METRICS_PREFIX).str(e.name).str("_sum");
+        labels(e, nullptr, out);
+        out.chr(' ').u32(h->sum()).chr('\n');
+        out.str(METRICS_PREFIX).str(e.name).str("_count");
+        labels(e, nullptr, out);
+        out.chr(' ').u32(cumulative).chr('\n');
+    }
+
+private:
+    MetricEntry entries[METRICS_MAX];
+    uint8_t count;
+
+    void add(const char *name, const char *labelKey, const char *labelValue, uint8_t type, uint8_t source, const void *metric)
+    {
+        if (count >= METRICS_MAX)
+        {
+            printf("MetricRegistry: no room for %s\n", name);
+            return;
+        }
+        entries[count++] = {name, labelKey, labelValue, type, source, metric};
+    }
+
+    static void value(const MetricEntry &e, FmtBuf &out)
+    {
+        switch (e.source)
+        {
+        case MS_COUNTER:
+            out.u32(((const Counter *)e.metric)->get());
+            break;
+        case MS_GAUGE:
+            out.i32(((const Gauge *)e.metric)->get());
+            break;
+        case MS_U32:
+            out.u32(*(const volatile uint32_t *)e.metric);
+            break;
+        case MS_I32:
+            out.i32(*(const volatile int32_t *)e.metric);
+            break;
+        }
+    }
+
+    static void labels(const MetricEntry &e, const char *le, FmtBuf &out)
+    {
+        if (!e.labelKey && !le)
+            return;
+        out.chr('{');
+        if (e.labelKey)
+        {
+            out.str(e.labelKey).str("=\"").str(e.labelValue).chr('"');
+            if (le)
+                out.chr(',');
+        }
+        if (le)
+            out.str("le=\"").str(le).chr('"');
+        out.chr('}');
+    }
+};
+
+#endif
@@ -0,0 +1,353 @@
+// Per-field MQTT topics and Home Assistant discovery
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Besides the JSON object on <mqTopic>/ws, a station can publish each reading
+// on its own retained topic, <mqTopic>/ws/<wsType>_<wsID>/<key>, e.g.
+// rfgw/ws/36_123/temp. A field is published when it changed by at least its
+// deadband since the last published value. Set per station over MQTT
+// /wsconfig, "mqtt":"fields" or "mqtt":"json,fields", the default is "json".
+//
+// The first time a field is published, its Home Assistant discovery config is
+// published retained on homeassistant/sensor/<node>/<key>/config, so the
+// station shows up as a device without configuration.
+//
+// The topic prefix of a station is written once, per publish only the key is
+// copied behind it.
+//
+// The deadbands also decide whether a report is due at all: the JSON object
+// and the uploads of a station are sent when a field changed by its deadband
+// since the last one, or when the heartbeat expired. Set per station,
+// "deadband":{"temp":0.2,"wind":1.0} in the units of the payload and
+// "heartbeat":300 in seconds, 0 reports every burst as before.
+
+#ifndef MQTTFIELDS_H
+#define MQTTFIELDS_H
+
+#include <stdint.h>
+#include <string.h>
+//#include "weather.h"
+#include "fmtbuf.h"
+
+#define MF_TOPIC_MAX 72            //<mqTopic>/ws/<wsType>_<wsID>/<key>, mqTopic is at most 40
+#define MF_DISCOVERY_TOPIC_MAX 128 //HASS_PREFIX/sensor/<node>/<key>/config
+#define MF_DISCOVERY_MAX 512       //discovery config JSON of one field
+#define MF_VALUE_MAX 16
+#define HASS_PREFIX "homeassistant"
+#define WS_HEARTBEAT_SEC 300       //default heartbeat
+
+//MQTT output of a configured station
+enum MqttMode
+{
+    MQ_JSON = 1 << 0,   //JSON object on <mqTopic>/ws
+    MQ_FIELDS = 1 << 1, //retained topic per field and discovery
+};
+
+enum MqttField
+{
+    MF_TEMP,
+    MF_HUM,
+    MF_DEWPOINT,
+    MF_FEELSLIKE,
+    MF_WINDDIR,
+    MF_WIND,
+    MF_GUST,
+    MF_WIND1M,
+    MF_GUST1M,
+    MF_RAIN,
+    MF_RAIN1H,
+    MF_RAINDAY,
+    MF_RAINRATE,
+    MF_LUX,
+    MF_SOLAR,
+    MF_UVI,
+    MF_BATTERY,
+    MF_RSSI,
+    MF_COUNT
+};
+
+//fields of the light sensor, WH2300 only
+#define MF_LIGHT_MASK ((1UL << MF_LUX) | (1UL << MF_SOLAR) | (1UL << MF_UVI))
+#define MF_ALL_MASK ((1UL << MF_COUNT) - 1)
+//fields that make a report due, the signal strength differs for every packet
+#define MF_CHANGE_MASK (MF_ALL_MASK & ~(1UL << MF_RSSI))
+
+struct MqttFieldDef
+{
+    const char *key;         //last level of the topic
+    const char *name;        //entity name in Home Assistant
+    const char *deviceClass; //Home Assistant device_class, "" for none
+    const char *unit;
+    uint8_t decimals; //of the fixed-point value
+    uint16_t deadband; //default minimum change to publish, in the fixed-point value
+};
+
+static const MqttFieldDef mqttFieldDefs[MF_COUNT] = {
+    {"temp", "Temperature", "temperature", "°C", 1, 2},
+    {"hum", "Humidity", "humidity", "%", 0, 2},
+    {"dewpoint", "Dew point", "temperature", "°C", 1, 2},
+    {"feelslike", "Feels like", "temperature", "°C", 1, 2},
+    {"winddir", "Wind direction", "", "°", 0, 23},
+    {"wind", "Wind speed", "wind_speed", "km/h", 1, 20},
+    {"gust", "Wind gust", "wind_speed", "km/h", 1, 20},
+    {"wind1m", "Wind speed 1m", "wind_speed", "km/h", 1, 20},
+    {"gust1m", "Wind gust 1m", "wind_speed", "km/h", 1, 20},
+    {"rain", "Rain", "precipitation", "mm", 1, 1},
+    {"rain1h", "Rain 1h", "precipitation", "mm", 1, 1},
+    {"rainday", "Rain today", "precipitation", "mm", 1, 1},
+    {"rainrate", "Rain rate", "precipitation_intensity", "mm/h", 1, 1},
+    {"lux", "Illuminance", "illuminance", "lx", 0, 100},
+    {"solar", "Solar radiation", "irradiance", "W/m²", 1, 50},
+    {"uvi", "UV index", "", "", 0, 1},
+    {"battery", "Battery", "battery", "%", 0, 1},
+    {"rssi", "Signal strength", "signal_strength", "dBm", 1, 30},
+};
+
+//fixed-point value of a field, with the decimals of mqttFieldDefs
+static inline int32_t mqttFieldValue(uint8_t field, const WSBase &ws)
+{
+    switch (field)
+    {
+    case MF_TEMP:
+        return ws.temperature;
+    case MF_HUM:
+        return ws.humidity;
+    case MF_DEWPOINT:
+        return ws.dewpoint;
+    case MF_FEELSLIKE:
+        return ws.feelslike;
+    case MF_WINDDIR:
+        return ws.winddir;
+    case MF_WIND:
+        return ws.windspeed;
+    case MF_GUST:
+        return ws.windgust;
+    case MF_WIND1M:
+        return ws.windspeed1m;
+    case MF_GUST1M:
+        return ws.windgust1m;
+    case MF_RAIN:
+        return ws.rain;
+    case MF_RAIN1H:
+        return ws.rain1h;
+    case MF_RAINDAY:
+        return ws.rainday;
+    case MF_RAINRATE:
+        return ws.rainrate;
+    case MF_LUX:
+        return ws.lightlux;
+    case MF_SOLAR:
+        return ws.solar;
+    case MF_UVI:
+        return ws.UVI;
+    case MF_BATTERY:
+        return ws.low_battery ? 0 : 100;
+    case MF_RSSI:
+        return -5 * ws.rssi;
+    default:
+        return 0;
+    }
+}
+
+//fields the station type has
+static inline uint32_t mqttFieldMask(uint16_t wsType)
+{
+    return wsType == MSG_WH2300 ? MF_ALL_MASK : MF_ALL_MASK & ~MF_LIGHT_MASK;
+}
+
+//station types with decoded readings, other packets are published as raw bytes
+static inline bool mqttDecoded(uint16_t wsType)
+{
+    return wsType == MSG_WH2300 || wsType == MSG_WS4000 || wsType == MSG_WS3000;
+}
+
+//true when v differs from last by at least the deadband, any change for a deadband of 0
+static inline bool mqttChanged(int32_t v, int32_t last, uint16_t deadband)
+{
+    int32_t d = v > last ? v - last : last - v;
+    return d && d >= deadband;
+}
+
+static inline void mqttDefaultDeadbands(uint16_t *deadband)
+{
+    for (uint8_t f = 0; f < MF_COUNT; f++)
+        deadband[f] = mqttFieldDefs[f].deadband;
+}
+
+static inline const char *mqttModel(uint16_t wsType)
+{
+    switch (wsType)
+    {
+    case MSG_WH2300:
+        return "WH2300";
+    case MSG_WS4000:
+        return "WS4000";
+    case MSG_WS3000:
+        return "WS3000";
+    default:
+        return "Fine Offset";
+    }
+}
+
+//parse "json", "fields" or "json,fields", the default is MQ_JSON
+static inline uint8_t mqttParseMode(const char *list)
+{
+    uint8_t mode = 0;
+    while (*list)
+    {
+        const char *end = strchr(list, ',');
+        size_t len = end ? end - list : strlen(list);
+        if (len == 4 && strncmp(list, "json", 4) == 0)
+            mode |= MQ_JSON;
+        else if (len == 6 && strncmp(list, "fields", 6) == 0)
+            mode |= MQ_FIELDS;
+        if (!end)
+            break;
+        list = end + 1;
+    }
+    return mode ? mode : MQ_JSON;
+}
+
+//inverse of mqttParseMode
+static inline void mqttFormatMode(uint8_t mode, FmtBuf &out)
+{
+    if (mode & MQ_JSON)
+        out.str("json");
+    if ((mode & MQ_JSON) && (mode & MQ_FIELDS))
+        out.chr(',');
+    if (mode & MQ_FIELDS)
+        out.str("fields");
+}
+
+//per-field publish state of a station, network task only
+struct MqttFields
+{
+    char topic[MF_TOPIC_MAX]; //the prefix, the key of the field is written behind it
+    uint8_t baseLen;          //mqTopic
+    uint8_t prefixLen;        //0 before begin()
+    uint16_t wsType;          //of the prefix, a rebound station gets a new one
+    uint16_t wsID;
+    uint32_t announced; //fields with a published discovery config
+    uint32_t published; //fields with a published value
+    int32_t last[MF_COUNT];
+    int64_t beatUs; //arrival of the packet of the last complete publish
+
+    MqttFields() : baseLen(0), prefixLen(0), wsType(0xffff), wsID(0xffff), announced(0), published(0), beatUs(0)
+    {
+        topic[0] = 0;
+    }
+
+    //write the topic prefix, everything is published again
+    void begin(const char *base, uint16_t type, uint16_t id)
+    {
+        FmtBuf prefix(topic, sizeof(topic));
+        prefix.str(base);
+        baseLen = prefix.length();
+        prefix.str("/ws/").u32(type).chr('_').u32(id).chr('/');
+        prefixLen = prefix.length();
+        wsType = type;
+        wsID = id;
+        announced = 0;
+        published = 0;
+    }
+
+    //true when the prefix is the one of base and the station, mqTopic can change on a reconnect
+    bool ready(const char *base, uint16_t type, uint16_t id) const
+    {
+        return prefixLen && wsType == type && wsID == id && strncmp(topic, base, baseLen) == 0 && base[baseLen] == 0;
+    }
+
+    //topic of a field, valid until the next call
+    const char *fieldTopic(uint8_t field)
+    {
+        const char *key = mqttFieldDefs[field].key;
+        size_t n = strlen(key);
+        if (prefixLen + n >= sizeof(topic))
+            n = sizeof(topic) - 1 - prefixLen;
+        memcpy(topic + prefixLen, key, n);
+        topic[prefixLen + n] = 0;
+        return topic;
+    }
+
+    //true when the value is to be published
+    bool changed(uint8_t field, int32_t v, uint16_t deadband) const
+    {
+        return !(published & (1UL << field)) || mqttChanged(v, last[field], deadband);
+    }
+
+    void sent(uint8_t field, int32_t v)
+    {
+        published |= 1UL << field;
+        last[field] = v;
+    }
+
+    //discovery topic and config of a field, returns the length of the config or 0 when truncated
+    size_t discovery(uint8_t field, char *dtopic, size_t tsize, char *payload, size_t psize)
+    {
+        const MqttFieldDef &def = mqttFieldDefs[field];
+        //node id: mqTopic with the characters Home Assistant does not allow replaced
+        char node[MF_TOPIC_MAX];
+        FmtBuf id(node, sizeof(node));
+        for (int i = 0; i < baseLen; i++)
+        {
+            char c = topic[i];
+            bool ok = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-';
+            id.chr(ok ? c : '_');
+        }
+        id.chr('_').u32(wsType).chr('_').u32(wsID);
+
+        FmtBuf t(dtopic, tsize);
+        t.str(HASS_PREFIX "/sensor/").str(node).chr('/').str(def.key).str("/config");
+
+        FmtBuf json(payload, psize);
+        json.str("{\"name\":\"").str(def.name);
+        json.str("\",\"uniq_id\":\"").str(node).chr('_').str(def.key);
+        json.str("\",\"stat_t\":\"").str(fieldTopic(field)).chr('"');
+        if (def.unit[0])
+            json.str(",\"unit_of_meas\":\"").str(def.unit).chr('"');
+        if (def.deviceClass[0])
+            json.str(",\"dev_cla\":\"").str(def.deviceClass).chr('"');
+        //the rain counters only grow; Home Assistant takes the midnight reset of rainday as a new cycle
+        bool total = field == MF_RAIN || field == MF_RAINDAY;
+        json.str(",\"stat_cla\":\"").str(total ? "total_increasing" : "measurement");
+        json.str("\",\"dev\":{\"ids\":[\"").str(node);
+        json.str("\"],\"name\":\"").str(mqttModel(wsType)).chr(' ').u32(wsID);
+        json.str("\",\"mf\":\"Fine Offset\",\"mdl\":\"").str(mqttModel(wsType)).str("\"}}");
+
+        if (t.overflow() || json.overflow())
+            return 0;
+        return json.length();
+    }
+};
+
+//Change detection over the readings of a station: a report is due when a field
+//changed by its deadband since the last report, or the heartbeat expired.
+struct ChangeFilter
+{
+    int32_t last[MF_COUNT];
+    int64_t lastUs; //arrival of the packet of the last report
+    bool valid;
+
+    ChangeFilter() : lastUs(0), valid(false) {}
+
+    bool due(const WSBase &ws, const uint16_t *deadband, uint32_t mask, int64_t heartbeatUs) const
+    {
+        if (!valid || heartbeatUs == 0 || ws.rxUs - lastUs >= heartbeatUs)
+            return true;
+        for (uint8_t f = 0; f < MF_COUNT; f++)
+        {
+            if ((mask & (1UL << f)) && mqttChanged(mqttFieldValue(f, ws), last[f], deadband[f]))
+                return true;
+        }
+        return false;
+    }
+
+    void commit(const WSBase &ws)
+    {
+        for (uint8_t f = 0; f < MF_COUNT; f++)
+            last[f] = mqttFieldValue(f, ws);
+        lastUs = ws.rxUs;
+        valid = true;
+    }
+};
+
+#endif
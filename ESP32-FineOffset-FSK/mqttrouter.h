@@ -0,0 +1,162 @@
+// MQTT topics of the gateway and dispatch of the command topics
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// All topics of the gateway are <mqTopic><suffix>. They are written once per
+// mqTopic, publish and subscribe use them as they are. A command is added as a
+// line in a route table with its handler.
+//
+// An incoming topic is matched on its length first, only the routes with that
+// length compare their suffix. The mqTopic prefix is the same for all routes
+// and is compared once.
+//
+// A payload larger than the receive buffer of the MQTT client arrives in parts,
+// with index the offset of the part and total the length of the payload. The
+// parts are collected and the handler gets the complete payload, up to
+// MR_PAYLOAD_MAX. Parts of one message arrive in order, a new message drops an
+// incomplete one.
+//
+// No Arduino dependencies.
+
+#ifndef MQTTROUTER_H
+#define MQTTROUTER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define MR_BASE_MAX 40       //mqTopic
+#define MR_TOPIC_MAX 56      //mqTopic and suffix
+#define MR_PAYLOAD_MAX 16384 //largest payload collected from parts
+
+//handler of a command, payload is zero terminated
+typedef void (*MqttHandler)(const char *payload, size_t len);
+
+struct MqttRoute
+{
+    const char *suffix; //e.g. "/wsconfig"
+    MqttHandler handler;
+    const char *help; //printed when subscribed
+};
+
+template <uint8_t N>
+class MqttRouter
+{
+public:
+    MqttRouter(const MqttRoute *routeTable) : routes(routeTable), baseLen(0), part(nullptr), partRoute(0), partLen(0)
+    {
+        base[0] = 0;
+        for (uint8_t i = 0; i < N; i++)
+            topics[i][0] = 0;
+    }
+
+    ~MqttRouter()
+    {
+        free(part);
+    }
+
+    //Write the topics for mqTopic, nothing changes when it is the same
+    void begin(const char *mqTopic)
+    {
+        size_t n = strlen(mqTopic);
+        if (n > MR_BASE_MAX)
+        {
+            printf("MqttRouter: topic %s longer than %d\n", mqTopic, MR_BASE_MAX);
+            n = MR_BASE_MAX;
+        }
+        if (n == baseLen && strncmp(base, mqTopic, n) == 0 && topics[0][0])
+            return;
+        memcpy(base, mqTopic, n);
+        base[n] = 0;
+        baseLen = n;
+        for (uint8_t i = 0; i < N; i++)
+        {
+            size_t s = strlen(routes[i].suffix);
+            if (n + s >= MR_TOPIC_MAX)
+                s = MR_TOPIC_MAX - 1 - n;
+            memcpy(topics[i], base, n);
+            memcpy(topics[i] + n, routes[i].suffix, s);
+            topics[i][n + s] = 0;
+            topicLen[i] = n + s;
+        }
+    }
+
+    const char *topic(uint8_t route) const { return topics[route]; }
+    const MqttRoute &route(uint8_t i) const { return routes[i]; }
+
+    //index of the route of topic, N when there is none
+    uint8_t match(const char *topic) const
+    {
+        size_t n = strlen(topic);
+        if (n <= baseLen || memcmp(topic, base, baseLen) != 0)
+            return N;
+        for (uint8_t i = 0; i < N; i++)
+        {
+            if (topicLen[i] == n && memcmp(topic + baseLen, topics[i] + baseLen, n - baseLen) == 0)
+                return i;
+        }
+        return N;
+    }
+
+    //Dispatch a part of a message to the handler of its route.
+    //Returns false when the topic has no route.
+    bool dispatch(const char *topic, const char *payload, size_t len, size_t index, size_t total)
+    {
+        uint8_t r = match(topic);
+        if (r >= N)
+            return false;
+        if (!routes[r].handler)
+            return true;
+        if (index == 0 && len == total)
+        {
+            //in one part, the client buffer is not zero terminated
+            char *buf = (char *)malloc(len + 1);
+            if (!buf)
+                return true;
+            memcpy(buf, payload, len);
+            buf[len] = 0;
+            routes[r].handler(buf, len);
+            free(buf);
+            return true;
+        }
+
+        if (index == 0)
+        {
+            free(part);
+            part = total <= MR_PAYLOAD_MAX ? (char *)malloc(total + 1) : nullptr;
+            if (!part)
+            {
+                printf("MqttRouter: payload of %u bytes on %s dropped\n", (unsigned)total, topic);
+                return true;
+            }
+            partRoute = r;
+            partLen = 0;
+        }
+        if (!part || partRoute != r || index != partLen || index + len > total)
+            return true; //part of a dropped message
+        memcpy(part + index, payload, len);
+        partLen += len;
+        if (partLen == total)
+        {
+            part[total] = 0;
+            routes[r].handler(part, total);
+            free(part);
+            part = nullptr;
+        }
+        return true;
+    }
+
+private:
+    const MqttRoute *routes;
+    char base[MR_BASE_MAX + 1];
+    size_t baseLen;
+    char topics[N][MR_TOPIC_MAX];
+    size_t topicLen[N];
+
+    //message being collected from parts
+    char *part;
+    uint8_t partRoute;
+    size_t partLen;
+};
+
+#endif
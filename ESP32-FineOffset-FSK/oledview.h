@@ -0,0 +1,242 @@
+// Retained-mode text fields on the Heltec OLED
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// A screen is a set of text fields at fixed positions. Setting a field only
+// marks it dirty when its text changes. flush() erases and redraws the dirty
+// fields, plus the fields they overlap, and pushes the frame at most once per
+// OLED_FLUSH_MS. Nothing is drawn or sent when nothing changed.
+
+#ifndef OLEDVIEW_H
+#define OLEDVIEW_H
+
+#include <heltec.h>
+#include "fmtbuf.h"
+
+#define OLED_WIDTH 128
+#define OLED_HEIGHT 64
+#define OLED_FIELDS_MAX 16
+#define OLED_TEXT_MAX 24
+#define OLED_FLUSH_MS 250
+//control bytes of a partial frame transfer: column and page address commands
+#define OLED_I2C_OVERHEAD 8
+
+struct OledField
+{
+    int16_t x, y;
+    const uint8_t *font;
+    OLEDDISPLAY_TEXT_ALIGNMENT align;
+    char text[OLED_TEXT_MAX];
+    //area covered by the text on screen, width 0 when nothing is drawn
+    int16_t left;
+    uint16_t width;
+    bool dirty;
+
+    uint8_t height() const
+    {
+        return font[1]; //font header: width, height, first char, char count
+    }
+};
+
+class OledView
+{
+public:
+    uint32_t flushes;  //frames pushed to the display
+    uint32_t i2cBytes; //estimated bytes sent over I2C
+
+    OledView() : flushes(0), i2cBytes(0), count(0), lastFlush(0)
+    {
+        clean();
+    }
+
+    //remove all fields and blank the display at the next flush
+    void reset()
+    {
+        count = 0;
+        cleared = true;
+        markArea(0, OLED_WIDTH, 0, OLED_HEIGHT);
+    }
+
+    //add a field, returns its index
+    uint8_t add(int16_t x, int16_t y, const uint8_t *font, OLEDDISPLAY_TEXT_ALIGNMENT align, const char *text = "")
+    {
+        if (count >= OLED_FIELDS_MAX)
+            return OLED_FIELDS_MAX - 1;
+        OledField &f = fields[count];
+        f.x = x;
+        f.y = y;
+        f.font = font;
+        f.align = align;
+        f.left = x;
+        f.width = 0;
+        f.text[0] = 0;
+        f.dirty = false;
+        set(count, text);
+        return count++;
+    }
+
+    void set(uint8_t i, const char *text)
+    {
+        OledField &f = fields[i];
+        if (strncmp(f.text, text, sizeof(f.text) - 1) == 0)
+            return;
+        //a loop, strnlen of a short literal with the bound of f.text trips -Wstringop-overread
+        size_t n = 0;
+        while (n < sizeof(f.text) - 1 && text[n])
+            n++;
+        FmtBuf(f.text, sizeof(f.text)).str(text, n);
+        f.dirty = true;
+    }
+
+    bool dirty() const
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (fields[i].dirty)
+                return true;
+        }
+        return cleared;
+    }
+
+    //redraw the dirty fields and push the changed area, at most once per OLED_FLUSH_MS
+    bool flush(SSD1306Wire *display, bool force = false)
+    {
+        if (!dirty() || (!force && millis() - lastFlush < OLED_FLUSH_MS))
+            return false;
+        lastFlush = millis();
+
+        if (cleared)
+        {
+            display->clear();
+            for (int i = 0; i < count; i++)
+                fields[i].dirty = true;
+        }
+
+        //measure the new text of the dirty fields
+        int16_t newLeft[OLED_FIELDS_MAX];
+        uint16_t newWidth[OLED_FIELDS_MAX];
+        for (int i = 0; i < count; i++)
+        {
+            OledField &f = fields[i];
+            if (!f.dirty)
+                continue;
+            display->setFont(f.font);
+            newWidth[i] = display->getStringWidth(f.text, strlen(f.text));
+            newLeft[i] = f.align == TEXT_ALIGN_RIGHT ? f.x - newWidth[i] : f.align == TEXT_ALIGN_CENTER ? f.x - newWidth[i] / 2 : f.x;
+        }
+
+        //a clean field overlapping an erased or redrawn area is redrawn as well
+        bool grown = true;
+        while (grown)
+        {
+            grown = false;
+            for (int i = 0; i < count; i++)
+            {
+                OledField &c = fields[i];
+                if (c.dirty)
+                    continue;
+                for (int j = 0; j < count; j++)
+                {
+                    OledField &d = fields[j];
+                    if (d.dirty && (overlaps(c, c.left, c.width, d.left, d.width, d.y, d.height()) ||
+                                    overlaps(c, c.left, c.width, newLeft[j], newWidth[j], d.y, d.height())))
+                    {
+                        c.dirty = true;
+                        newLeft[i] = c.left;
+                        newWidth[i] = c.width;
+                        grown = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        //erase the old text, then draw the new text
+        display->setColor(BLACK);
+        for (int i = 0; i < count; i++)
+        {
+            OledField &f = fields[i];
+            if (f.dirty && f.width)
+            {
+                display->fillRect(f.left, f.y, f.width, f.height());
+                markArea(f.left, f.width, f.y, f.height());
+            }
+        }
+        display->setColor(WHITE);
+        for (int i = 0; i < count; i++)
+        {
+            OledField &f = fields[i];
+            if (!f.dirty)
+                continue;
+            display->setFont(f.font);
+            display->setTextAlignment(f.align);
+            display->drawString(f.x, f.y, f.text);
+            f.left = newLeft[i];
+            f.width = newWidth[i];
+            f.dirty = false;
+            markArea(f.left, f.width, f.y, f.height());
+        }
+
+        //the display driver only sends the bounding box of the changed pages
+        if (x1 > x0 && page1 >= page0)
+        {
+            display->display();
+            flushes++;
+            i2cBytes += (x1 - x0) * (page1 - page0 + 1) + OLED_I2C_OVERHEAD;
+        }
+        clean();
+        return true;
+    }
+
+private:
+    OledField fields[OLED_FIELDS_MAX];
+    uint8_t count;
+    bool cleared;
+    uint32_t lastFlush;
+    //changed area since the last flush: columns x0..x1-1, pages page0..page1
+    int16_t x0, x1;
+    int8_t page0, page1;
+
+    void clean()
+    {
+        cleared = false;
+        x0 = OLED_WIDTH;
+        x1 = 0;
+        page0 = OLED_HEIGHT / 8;
+        page1 = -1;
+    }
+
+    void markArea(int16_t left, uint16_t width, int16_t top, uint16_t height)
+    {
+        int16_t right = left + width;
+        int16_t bottom = top + height - 1;
+        if (left < 0)
+            left = 0;
+        if (right > OLED_WIDTH)
+            right = OLED_WIDTH;
+        if (top < 0)
+            top = 0;
+        if (bottom >= OLED_HEIGHT)
+            bottom = OLED_HEIGHT - 1;
+        if (right <= left || bottom < top)
+            return;
+        if (left < x0)
+            x0 = left;
+        if (right > x1)
+            x1 = right;
+        if (top / 8 < page0)
+            page0 = top / 8;
+        if (bottom / 8 > page1)
+            page1 = bottom / 8;
+    }
+
+    //does the area of clean field c intersect the area left,width at top,height
+    static bool overlaps(const OledField &c, int16_t cleft, uint16_t cwidth, int16_t left, uint16_t width, int16_t top, uint16_t height)
+    {
+        if (cwidth == 0 || width == 0)
+            return false;
+        return cleft < left + (int16_t)width && left < cleft + (int16_t)cwidth &&
+               c.y < top + (int16_t)height && top < c.y + (int16_t)c.height();
+    }
+};
+
+#endif
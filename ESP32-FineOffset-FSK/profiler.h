@@ -0,0 +1,199 @@
+// Loop section profiler and stall detector
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// The loop of a task is divided in named, possibly nested, sections. Each section
+// keeps a duration histogram and its maximum. A loop that runs longer than its
+// budget produces a stall record with the stack of section names that used up
+// the time, e.g. "network > upload > windguru > connect". The records are queued
+// and published when the network task is running again.
+// A watchdog task samples the innermost active section of every profiler every
+// PROF_SAMPLE_MS, and prints a warning while a loop hangs.
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "metrics.h"
+#include "spscqueue.h"
+
+#define PROF_SECTIONS_MAX 20
+#define PROF_DEPTH_MAX 5
+#define PROF_SAMPLE_MS 10
+//a hanging loop is reported on the console once it takes longer than this
+#define PROF_HANG_US 2000000
+
+struct StallRecord
+{
+    uint32_t at; //millis() at the start of the loop
+    uint32_t us; //duration of the loop
+    uint8_t depth;
+    uint8_t stack[PROF_DEPTH_MAX]; //section ids, outermost first
+};
+
+class Profiler
+{
+public:
+    const char *task;
+    uint32_t budgetUs;
+    SPSCQueue<StallRecord, 8> stalls; //owning task -> publisher
+
+    Counter stallCount;
+    Histogram sectionUs[PROF_SECTIONS_MAX];
+    uint32_t maxUs[PROF_SECTIONS_MAX];
+    Counter samples[PROF_SECTIONS_MAX];
+
+    //section 0 is the loop itself, named after the task
+    Profiler(const char *const *names, uint8_t n, uint32_t budget)
+        : task(names[0]), budgetUs(budget), count(0), depth(0), loopAt(0), loopMs(0), inLoop(false), captured(false), warned(false)
+    {
+        memset(maxUs, 0, sizeof(maxUs));
+        addSections(names, n);
+    }
+
+    //sections get consecutive ids in the order they are added
+    void addSections(const char *const *names, uint8_t n)
+    {
+        for (int i = 0; i < n && count < PROF_SECTIONS_MAX; i++)
+            sectionNames[count++] = names[i];
+    }
+
+    uint8_t sections() const { return count; }
+    const char *name(uint8_t id) const { return sectionNames[id]; }
+
+    void loopBegin()
+    {
+        loopAt = micros();
+        loopMs = millis();
+        captured = false;
+        warned = false;
+        stack[0] = 0;
+        stackAt[0] = loopAt;
+        depth.store(1, std::memory_order_release);
+        inLoop.store(true, std::memory_order_release);
+    }
+
+    void loopEnd()
+    {
+        uint32_t us = micros() - loopAt;
+        inLoop.store(false, std::memory_order_release);
+        end(0, us);
+        if (us > budgetUs)
+        {
+            if (!captured)
+            {
+                //time spent outside the sections
+                stall.depth = 1;
+                stall.stack[0] = 0;
+            }
+            stall.at = loopMs;
+            stall.us = us;
+            stallCount.inc();
+            stalls.push(stall);
+        }
+    }
+
+    void begin(uint8_t id)
+    {
+        uint8_t d = depth.load(std::memory_order_relaxed);
+        if (d >= PROF_DEPTH_MAX)
+            return;
+        stack[d] = id;
+        stackAt[d] = micros();
+        depth.store(d + 1, std::memory_order_release);
+    }
+
+    void end(uint8_t id)
+    {
+        uint8_t d = depth.load(std::memory_order_relaxed);
+        if (d <= 1 || stack[d - 1] != id)
+            return;
+        end(d - 1, micros() - stackAt[d - 1]);
+    }
+
+    //Called from the watchdog task: count a sample for the innermost active
+    //section and warn once about a loop that hangs.
+    void sample()
+    {
+        if (!inLoop.load(std::memory_order_acquire))
+            return;
+        uint8_t d = depth.load(std::memory_order_acquire);
+        if (d == 0)
+            return;
+        samples[stack[d - 1]].inc();
+        if (!warned && micros() - loopAt > PROF_HANG_US)
+        {
+            warned = true;
+            printf("Profiler: %s loop hangs in", task);
+            for (int i = 1; i < d; i++)
+                printf(" > %s", sectionNames[stack[i]]);
+            printf("\n");
+        }
+    }
+
+    //stall record as JSON: {"task":"network","ms":1234,"at":567,"stack":["network","upload","windguru"]}
+    void stallJson(const StallRecord &r, FmtBuf &out) const
+    {
+        out.str("{\"task\":\"").str(task).str("\",\"ms\":").u32(r.us / 1000);
+        out.str(",\"at\":").u32(r.at).str(",\"stack\":[");
+        for (int i = 0; i < r.depth; i++)
+        {
+            if (i)
+                out.chr(',');
+            out.chr('"').str(sectionNames[r.stack[i]]).chr('"');
+        }
+        out.str("]}");
+    }
+
+private:
+    const char *sectionNames[PROF_SECTIONS_MAX];
+    uint8_t count;
+
+    //active sections, written by the owning task, sampled by the watchdog task
+    std::atomic<uint8_t> depth;
+    uint8_t stack[PROF_DEPTH_MAX];
+    uint32_t stackAt[PROF_DEPTH_MAX];
+    uint32_t loopAt;
+    uint32_t loopMs;
+    std::atomic<bool> inLoop;
+
+    //stall of the current loop, the innermost section over budget
+    StallRecord stall;
+    bool captured;
+    bool warned;
+
+    //pop stack level d, which took us
+    void end(uint8_t d, uint32_t us)
+    {
+        uint8_t id = stack[d];
+        sectionUs[id].observe(us);
+        if (us > maxUs[id])
+            maxUs[id] = us;
+        if (us > budgetUs && !captured && d > 0)
+        {
+            captured = true;
+            stall.depth = d + 1;
+            memcpy(stall.stack, stack, d + 1);
+        }
+        depth.store(d, std::memory_order_release);
+    }
+};
+
+//Scoped section: ProfSection s(prof, id); ends when s goes out of scope
+class ProfSection
+{
+    Profiler &prof;
+    uint8_t id;
+
+public:
+    ProfSection(Profiler &p, uint8_t section) : prof(p), id(section)
+    {
+        prof.begin(id);
+    }
+    ~ProfSection()
+    {
+        prof.end(id);
+    }
+};
+
+#endif
@@ -0,0 +1,248 @@
+// Plausibility filter of the readings of a weather station
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// A CRC-8 passes 1 in 256 damaged frames, and sensors glitch, e.g. a -40 C
+// temperature or a 250 km/h gust. Such a value would end up in rain1h and
+// windgust1m for an hour and be uploaded. Per station, before the update:
+//  - temperature and humidity: range and rate of change against the previous
+//    burst, a new level is accepted when it persists for QF_CONFIRM bursts
+//  - wind speed and gust: range and spikes above the median of the last
+//    QF_MEDIAN bursts
+//  - rain counter: continued over the wrap of the counter field (12 bits for
+//    WH1080, 16 bits for BR1800) and over a reset at a battery change, a jump
+//    above the maximum rain rate is rejected
+// A rejected value is replaced by the previous one and flagged.
+//
+// All repeats of a burst are checked against the state of the previous burst,
+// so checking a packet of a burst again gives the same result. The state is
+// committed when the next burst starts. O(QF_MEDIAN) per packet.
+//
+// No Arduino dependencies, the samples are filled by the caller.
+
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include <stdint.h>
+#include "cadence.h"
+
+#define QF_TEMP_MIN -400 //in 0.1 Celsius, range of the sensors
+#define QF_TEMP_MAX 700
+#define QF_TEMP_STEP 30    //change allowed at any interval
+#define QF_TEMP_PER_MIN 10 //and per minute since the previous burst
+#define QF_HUM_STEP 15     //relative %
+#define QF_HUM_PER_MIN 5
+#define QF_WIND_MAX 2000   //in 0.1 km/h
+#define QF_WIND_SPIKE 400  //above the median of the previous bursts
+#define QF_GUST_SPIKE 800
+#define QF_MEDIAN 5
+#define QF_RAIN_STEP 20    //in 0.1 mm
+#define QF_RAIN_PER_MIN 50 //5 mm/min, above the record rain rates
+#define QF_CONFIRM 3       //bursts a new level must persist
+
+//flags of the checks that replaced a value
+enum QualityFlag
+{
+    QF_TEMP = 1 << 0,
+    QF_HUM = 1 << 1,
+    QF_WIND = 1 << 2,
+    QF_GUST = 1 << 3,
+    QF_RAIN_JUMP = 1 << 4,  //counter jump rejected
+    QF_RAIN_RESET = 1 << 5, //counter restarted, e.g. battery change, the total continues
+};
+
+//readings of one packet, rain is the counter of the packet in 0.1 mm
+struct QfSample
+{
+    int64_t rxUs;
+    int16_t temperature;
+    uint16_t humidity;
+    uint16_t windspeed;
+    uint16_t windgust;
+    uint32_t rain;
+};
+
+class QualityFilter
+{
+public:
+    QualityFilter() : burstUs(0) {}
+
+    //Check the sample and replace the rejected values. Rain is replaced by the
+    //running total. rainWrap is the first value the rain counter can not hold.
+    //Returns the QualityFlag of the replaced values.
+    uint8_t apply(QfSample &s, uint32_t rainWrap)
+    {
+        if (!work.valid || s.rxUs - burstUs >= CADENCE_BURST_US)
+        {
+            committed = work;
+            burstUs = s.rxUs;
+        }
+        work = committed;
+        return work.apply(s, rainWrap);
+    }
+
+private:
+    //level of a reading with a candidate for a new level
+    struct Level
+    {
+        int32_t value;
+        int32_t candidate;
+        uint8_t persisted;
+
+        int32_t check(int32_t v, int32_t limit, uint8_t flag, uint8_t &flags)
+        {
+            if (diff(v, value) <= limit)
+            {
+                persisted = 0;
+                return value = v;
+            }
+            if (persisted && diff(v, candidate) <= limit)
+                persisted++;
+            else
+                persisted = 1;
+            candidate = v;
+            if (persisted >= QF_CONFIRM)
+            {
+                persisted = 0;
+                return value = v;
+            }
+            flags |= flag;
+            return value;
+        }
+    };
+
+    //median of the values of the previous bursts
+    struct Window
+    {
+        uint16_t v[QF_MEDIAN];
+        uint8_t count;
+        uint8_t next;
+
+        uint16_t check(uint16_t x, uint16_t spike, uint8_t flag, uint8_t &flags)
+        {
+            if (x > QF_WIND_MAX || (count >= 3 && x > median() + spike))
+            {
+                flags |= flag;
+                x = count ? median() : 0;
+            }
+            v[next] = x;
+            next = (next + 1) % QF_MEDIAN;
+            if (count < QF_MEDIAN)
+                count++;
+            return x;
+        }
+
+        uint16_t median() const
+        {
+            uint16_t s[QF_MEDIAN];
+            for (int i = 0; i < count; i++)
+            {
+                //insertion sort, QF_MEDIAN is small
+                int j = i;
+                for (; j > 0 && s[j - 1] > v[i]; j--)
+                    s[j] = s[j - 1];
+                s[j] = v[i];
+            }
+            return s[count / 2];
+        }
+    };
+
+    struct State
+    {
+        bool valid;
+        int64_t lastUs;
+        Level temperature;
+        Level humidity;
+        Window wind;
+        Window gust;
+        uint32_t rainRaw;   //counter of the last accepted packet
+        uint32_t rainTotal; //running total reported as rain
+        uint32_t resetCandidate; //counter of a restarted sensor
+        uint8_t resetPersisted;
+
+        State() : valid(false), lastUs(0), temperature(), humidity(), wind(), gust(),
+                  rainRaw(0), rainTotal(0), resetCandidate(0), resetPersisted(0) {}
+
+        uint8_t apply(QfSample &s, uint32_t rainWrap)
+        {
+            uint8_t flags = 0;
+            int64_t dtUs = s.rxUs - lastUs;
+            if (!valid)
+            {
+                //first packet: only the range, it is the reference of the next
+                temperature.value = s.temperature;
+                humidity.value = s.humidity;
+                rainRaw = s.rain;
+                rainTotal = s.rain;
+                dtUs = 0;
+            }
+            if (s.temperature < QF_TEMP_MIN || s.temperature > QF_TEMP_MAX)
+            {
+                flags |= QF_TEMP;
+                s.temperature = valid ? temperature.value : 0;
+            }
+            else
+                s.temperature = temperature.check(s.temperature, QF_TEMP_STEP + perMinute(QF_TEMP_PER_MIN, dtUs), QF_TEMP, flags);
+            if (s.humidity < 1 || s.humidity > 100)
+            {
+                flags |= QF_HUM;
+                s.humidity = valid ? humidity.value : 0;
+            }
+            else
+                s.humidity = humidity.check(s.humidity, QF_HUM_STEP + perMinute(QF_HUM_PER_MIN, dtUs), QF_HUM, flags);
+            s.windspeed = wind.check(s.windspeed, QF_WIND_SPIKE, QF_WIND, flags);
+            s.windgust = gust.check(s.windgust, QF_GUST_SPIKE, QF_GUST, flags);
+
+            //rain counter, a wrap is a small step forward over the end of the field
+            uint32_t raw = s.rain % rainWrap;
+            uint32_t delta = (raw + rainWrap - rainRaw) % rainWrap;
+            int32_t limit = QF_RAIN_STEP + perMinute(QF_RAIN_PER_MIN, dtUs);
+            if (delta <= (uint32_t)limit)
+            {
+                rainTotal += delta;
+                rainRaw = raw;
+                resetPersisted = 0;
+            }
+            else
+            {
+                //a restarted counter stays near its new value, the total continues from there
+                if (resetPersisted && diff(raw, resetCandidate) <= limit)
+                    resetPersisted++;
+                else
+                    resetPersisted = 1;
+                resetCandidate = raw;
+                if (resetPersisted >= QF_CONFIRM)
+                {
+                    flags |= QF_RAIN_RESET;
+                    rainRaw = raw;
+                    resetPersisted = 0;
+                }
+                else
+                    flags |= QF_RAIN_JUMP;
+            }
+            s.rain = rainTotal;
+
+            valid = true;
+            lastUs = s.rxUs;
+            return flags;
+        }
+    };
+
+    State committed; //after the previous burst
+    State work;      //after the current burst
+    int64_t burstUs; //first packet of the current burst
+
+    static int32_t diff(int32_t a, int32_t b)
+    {
+        return a > b ? a - b : b - a;
+    }
+
+    //change allowed at rate per minute over dtUs, capped at a day
+    static int32_t perMinute(int32_t rate, int64_t dtUs)
+    {
+        if (dtUs > 86400000000LL)
+            dtUs = 86400000000LL;
+        return (int32_t)(dtUs * rate / 60000000);
+    }
+};
+
+#endif
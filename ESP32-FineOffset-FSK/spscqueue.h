@@ -0,0 +1,82 @@
+// Lock-free single producer, single consumer queue
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Used to hand records from one task to exactly one other task, e.g. decoded
+// packets from the radio task on core 1 to the network task on core 0.
+// push() is only called by the producer, pop() only by the consumer.
+// The head index is written by the producer only and the tail index by the
+// consumer only. Acquire/release ordering makes the slot contents visible
+// before the index that publishes them.
+
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+template <typename T, size_t N>
+class SPSCQueue
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SPSCQueue size must be a power of 2");
+
+    T slots[N];
+    std::atomic<uint32_t> head; //next slot to write, owned by the producer
+    std::atomic<uint32_t> tail; //next slot to read, owned by the consumer
+
+public:
+    SPSCQueue() : head(0), tail(0) {}
+
+    //producer: returns false when the queue is full
+    bool push(const T &item)
+    {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= N)
+            return false;
+        slots[h & (N - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    //consumer: returns false when the queue is empty
+    bool pop(T &item)
+    {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (head.load(std::memory_order_acquire) == t)
+            return false;
+        item = slots[t & (N - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    //consumer: copy of the oldest item without removing it, false when the queue is empty
+    bool peek(T &item) const
+    {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (head.load(std::memory_order_acquire) == t)
+            return false;
+        item = slots[t & (N - 1)];
+        return true;
+    }
+
+    //number of queued items, exact for the producer and consumer, a snapshot for others
+    size_t size() const
+    {
+        //tail before head: a tail read after head can pass it and wrap the difference
+        uint32_t t = tail.load(std::memory_order_acquire);
+        uint32_t n = head.load(std::memory_order_acquire) - t;
+        return n < N ? n : N;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    static constexpr size_t capacity()
+    {
+        return N;
+    }
+};
+
+#endif
@@ -6,19 +6,69 @@
 #include <ArduinoJson.h>
 #include <map>
 //#include "weather.h"
+#include "webtarget.h"
+#include "dashboard.h"
+#include "mqttfields.h"
+#include "configstore.h"
+#include "fingerprint.h"
+#include "quality.h"
+#include "derived.h"
 
 #ifndef MAX_WS
 #define MAX_WS 4
 #endif
 
+//station records on SPIFFS: /ws/<slot>.a and /ws/<slot>.b
+#define WS_STORE_DIR "/ws"
+//single file of all stations, written by previous firmware
+#define WS_LEGACY_FILE "/stationconfig.json"
+//serialized station and its JSON document
+#define WS_RECORD_MAX 1024
+#define WS_JSON_DOC 1024
+//a station with a partial update merged in
+#define WS_MERGE_DOC (2 * WS_JSON_DOC)
+
+//re-pairing of a station with a new ID: unknown IDs tracked, bursts that must
+//match the same silent station, and how long a station must be silent
+#define FP_PENDING_MAX 4
+#define FP_REBIND_BURSTS 3
+#define FP_SILENT_US 180000000LL
+
+//WH1080 burst timing on the monotonic arrival time: a gap starts a new burst,
+//the burst is reported after this long without a packet
+#define WH1080_BURST_GAP_US 500000
+#define WH1080_BURST_END_US 200000
+
+//fixed-point scale of the wind calibration factor
+#define WS_FACTOR_SCALE 1000
+
+//Windguru salt is fixed width, so the MD5 key buffer can be compiled once
+#define WG_SALT_PREFIX "@ABC"
+#define WG_SALT_DIGITS 10
+#define WG_SALT_SUFFIX "XYZ@"
+#define WG_SALT_LEN (sizeof(WG_SALT_PREFIX) - 1 + WG_SALT_DIGITS + sizeof(WG_SALT_SUFFIX) - 1)
+
+//window of the rain rate in seconds
+#define WS_RAINRATE_SEC 600
+//rainDay before the first packet of a station
+#define WS_RAINDAY_NONE -2
+
 struct WSSetting
 {
     unsigned long lastReported; //not serialized
     unsigned long lastSeen;     //not serialized
     WSBase *wsp;
-    std::map<time_t, double> rainhist;
-    std::map<time_t, double> windhist;
-    std::map<time_t, double> gusthist;
+    std::map<time_t, uint32_t> rainhist;
+    std::map<time_t, uint16_t> windhist;
+    std::map<time_t, uint16_t> gusthist;
+    Fingerprint fp;      //cadence, RF and readings of the station, not serialized
+    int64_t collisionUs; //last reported packet of another transmitter with this ID
+    QualityFilter quality; //plausibility of the readings, not serialized
+    int16_t rainDay;       //local day of the year of rainDayStart, -1 while the clock is not set
+    uint32_t rainDayStart; //rain total at the first packet of the day
+    MqttFields mqttFields; //per-field topics and their last published values, not serialized
+    ChangeFilter reportFilter; //values of the last MQTT report, not serialized
+    ChangeFilter uploadFilter; //values of the last upload, not serialized
 
     //burst handling for WSWH1080 derived class
     bool mreportable;
@@ -27,6 +77,7 @@ struct WSSetting
     uint16_t wsID;
     uint16_t wsType;
     double windfactor;
+    uint16_t windscale; //windfactor in 1/WS_FACTOR_SCALE, not serialized
     bool wunderground;
     char wuID[10];
     char wuPW[10];
@@ -45,14 +96,29 @@ struct WSSetting
     char wgSalt[40];
     char wgUID[40];
     char wgPW[40];
-
-    WSSetting() : mreportable(false),
+    uint8_t oledFields[DASH_FIELDS_MAX]; //station page on the OLED, "oled":"wind,temp" in JSON
+    uint8_t mqttMode;                    //MqttMode, "mqtt":"json,fields" in JSON
+    uint16_t deadband[MF_COUNT];         //per MqttField, "deadband":{"temp":0.2} in JSON
+    uint16_t heartbeat;                  //in seconds, 0 reports every burst
+
+    //upload request templates, compiled from the above on deserialize
+    WebTarget targets[WT_COUNT];
+    //windguru salt + wgUID + wgPW, only the salt digits change per upload
+    char wgKey[WG_SALT_LEN + sizeof(wgUID) + sizeof(wgPW)];
+    uint8_t wgKeyLen;
+
+    WSSetting() : collisionUs(0),
+                  rainDay(WS_RAINDAY_NONE), rainDayStart(0),
+                  mreportable(false),
                   wsID(0xffff), wsType(0xffff),
-                  windfactor(1.0),
+                  windfactor(1.0), windscale(WS_FACTOR_SCALE),
                   wunderground(false),
                   domoticz(false),
                   dzPort(0),
-                  windguru(false)
+                  windguru(false),
+                  mqttMode(MQ_JSON),
+                  heartbeat(WS_HEARTBEAT_SEC),
+                  wgKeyLen(0)
     {
         // clear entire arrays, this way we can use strncpy with sizeof-1 and be guaranteed a
         // terminating zero
@@ -64,6 +130,9 @@ struct WSSetting
         memset(wgSalt, 0, sizeof(wgSalt));
         memset(wgUID, 0, sizeof(wgUID));
         memset(wgPW, 0, sizeof(wgPW));
+        memset(wgKey, 0, sizeof(wgKey));
+        memset(oledFields, DF_NONE, sizeof(oledFields));
+        mqttDefaultDeadbands(deadband);
 
         dzPort = 0;
         dzSecure = true;
@@ -87,6 +156,55 @@ struct WSSetting
         // }
     }
 
+    //fingerprint sample of a packet
+    static FpSample sample(const WSBase *ws)
+    {
+        FpSample s;
+        s.rxUs = ws->rxUs;
+        s.afc = ws->afc;
+        s.rssi = ws->rssi;
+        s.temperature = ws->temperature;
+        s.humidity = ws->humidity;
+        return s;
+    }
+
+    //Replace implausible readings of ws by the previous ones and continue the
+    //rain counter over a wrap or reset. A packet can be checked again within its burst.
+    void checkQuality(WSBase *ws)
+    {
+        QfSample q;
+        q.rxUs = ws->rxUs;
+        q.temperature = ws->temperature;
+        q.humidity = ws->humidity;
+        q.windspeed = ws->windspeed;
+        q.windgust = ws->windgust;
+        q.rain = ws->rain;
+        ws->quality = quality.apply(q, ws->msgformat == MSG_WH2300 ? BR1800_RAIN_WRAP : WH1080_RAIN_WRAP);
+        ws->temperature = q.temperature;
+        ws->humidity = q.humidity;
+        ws->windspeed = q.windspeed;
+        ws->windgust = q.windgust;
+        ws->rain = q.rain;
+    }
+
+    //Calibration factors of the station, applied to the decoded readings in wsp
+    void calibrate()
+    {
+        wsp->windspeed = (wsp->windspeed * windscale + WS_FACTOR_SCALE / 2) / WS_FACTOR_SCALE;
+        wsp->windgust = (wsp->windgust * windscale + WS_FACTOR_SCALE / 2) / WS_FACTOR_SCALE;
+    }
+
+    //Derived quantities of the readings in wsp, once per packet for all consumers
+    void derive()
+    {
+        wsp->dewpoint = dewPoint(wsp->temperature, wsp->humidity);
+        wsp->heatindex = heatIndex(wsp->temperature, wsp->humidity);
+        wsp->windchill = windChill(wsp->temperature, wsp->windspeed);
+        wsp->feelslike = apparentTemperature(wsp->temperature, wsp->humidity, wsp->windspeed);
+        wsp->solar = fxMulDiv(wsp->lightlux, LUX_TO_WM2_NUM, LUX_TO_WM2_DEN);
+        wsp->rainday = wsp->rain - rainDayStart;
+    }
+
     virtual bool reportable()
     {
         //printf("WSSetting::reportable()\n");
@@ -100,27 +218,50 @@ struct WSSetting
 
     void deserialize(JsonObject ojson)
     {
+        //strings are cut to sizeof - 1, the last byte stays the zero of the constructor
         wsID = ojson["wsID"] | 0xffff;
         wsType = ojson["wsType"] | 0xffff;
         windfactor = ojson["windfactor"] | 1.0;
+        //a factor beyond the range of windscale is clamped, lround() of it is unspecified
+        double scale = windfactor * WS_FACTOR_SCALE;
+        windscale = scale <= 0 ? 0 : scale >= 65535 ? 65535 : lround(scale);
         wunderground = ojson["wunderground"] | false;
-        strncpy(wuID, ojson["wuID"] | "", sizeof(wuID));
-        strncpy(wuPW, ojson["wuPW"] | "", sizeof(wuPW));
+        strncpy(wuID, ojson["wuID"] | "", sizeof(wuID) - 1);
+        strncpy(wuPW, ojson["wuPW"] | "", sizeof(wuPW) - 1);
         domoticz = ojson["domoticz"] | false;
-        strncpy(dzURL, ojson["dzURL"] | "", sizeof(dzURL));
+        strncpy(dzURL, ojson["dzURL"] | "", sizeof(dzURL) - 1);
         dzPort = ojson["dzPort"];
         dzSecure = ojson["dzSecure"];
-        strncpy(dzID, ojson["dzID"] | "", sizeof(dzID));
-        strncpy(dzPW, ojson["dzPW"] | "", sizeof(dzPW));
+        strncpy(dzID, ojson["dzID"] | "", sizeof(dzID) - 1);
+        strncpy(dzPW, ojson["dzPW"] | "", sizeof(dzPW) - 1);
         dzTHidx = ojson["dzTHidx"];
         dzWidx = ojson["dzWidx"];
         dzRidx = ojson["dzRidx"];
         dzLidx = ojson["dzLidx"];
         dzUVidx = ojson["dzUVidx"];
         windguru = ojson["windguru"] | false;
-        strncpy(wgSalt, ojson["wgSalt"] | "", sizeof(wgSalt));
-        strncpy(wgUID, ojson["wgUID"] | "", sizeof(wgUID));
-        strncpy(wgPW, ojson["wgPW"] | "", sizeof(wgPW));
+        strncpy(wgSalt, ojson["wgSalt"] | "", sizeof(wgSalt) - 1);
+        strncpy(wgUID, ojson["wgUID"] | "", sizeof(wgUID) - 1);
+        strncpy(wgPW, ojson["wgPW"] | "", sizeof(wgPW) - 1);
+        dashParseFields(ojson["oled"] | "", oledFields);
+        mqttMode = mqttParseMode(ojson["mqtt"] | "");
+        //deadbands in the units of the payload, missing fields keep the default
+        mqttDefaultDeadbands(deadband);
+        JsonObject db = ojson["deadband"].as<JsonObject>();
+        for (JsonPair kv : db)
+        {
+            for (uint8_t f = 0; f < MF_COUNT; f++)
+            {
+                if (strcmp(kv.key().c_str(), mqttFieldDefs[f].key) == 0)
+                {
+                    double v = kv.value() | 0.0;
+                    v *= fmtPow10[mqttFieldDefs[f].decimals];
+                    deadband[f] = v <= 0 ? 0 : v >= 65535 ? 65535 : lround(v);
+                }
+            }
+        }
+        heartbeat = ojson["heartbeat"] | WS_HEARTBEAT_SEC;
+        compileTargets();
         return;
     }
 
@@ -159,6 +300,31 @@ struct WSSetting
         ojson["wgSalt"] = wgSalt;
         ojson["wgUID"] = wgUID;
         ojson["wgPW"] = wgPW;
+        if (oledFields[0] != DF_NONE)
+        {
+            char oled[DASH_FIELDS_MAX * 8];
+            FmtBuf list(oled, sizeof(oled));
+            dashFormatFields(oledFields, list);
+            ojson["oled"] = (char *)oled; //copied by ArduinoJson
+        }
+        if (mqttMode != MQ_JSON)
+        {
+            char mode[16];
+            FmtBuf list(mode, sizeof(mode));
+            mqttFormatMode(mqttMode, list);
+            ojson["mqtt"] = (char *)mode;
+        }
+        //only the deadbands that differ from the default
+        JsonObject db;
+        for (uint8_t f = 0; f < MF_COUNT; f++)
+        {
+            if (deadband[f] == mqttFieldDefs[f].deadband)
+                continue;
+            if (db.isNull())
+                db = ojson.createNestedObject("deadband");
+            db[mqttFieldDefs[f].key] = (double)deadband[f] / fmtPow10[mqttFieldDefs[f].decimals];
+        }
+        ojson["heartbeat"] = heartbeat;
 
         return;
     }
@@ -175,130 +341,185 @@ struct WSSetting
         return sjson;
     }
 
-    virtual std::string urlWunderground(const char *wuID, const char *wuPW)
-    {
-        //https://support.weather.com/s/article/PWS-Upload-Protocol?language=en_US
-        //https://weatherstation.wunderground.com/weatherstation/updateweatherstation.php?ID=<StationID>>&PASSWORD=<StationPW>&dateutc=now&tempf=37.8&humidity=1&action=updateraw
-        std::string s;
-        return s + "/weatherstation/updateweatherstation.php?ID=" + wuID +
-               "&PASSWORD=" + wuPW +
-               "&dateutc=now" +
-               "&tempf=" + std::to_string((wsp->temperature * 9.0) / 5.0 + 32.0) +
-               "&humidity=" + std::to_string(wsp->humidity) +
-               "&rainin=" + std::to_string(wsp->rain1h / 25.4) +
-               "&winddir=" + std::to_string(wsp->winddir) +
-               "&windspeedmph=" + std::to_string(wsp->windspeed1m * 0.621371) +
-               "&windgustmph=" + std::to_string(wsp->windgust1m * 0.621371) +
-               "&UV=" + std::to_string(wsp->UVI) +
-               "&action=updateraw";
-    }
-
-    //https://www.domoticz.com/wiki/Domoticz_API/JSON_URL's
-    virtual std::string urlDomoticzTemp(uint32_t idx, const char *dzID, const char *dzPW)
+    //Compile the request templates of the upload targets. Called when the configuration changes.
+    void compileTargets()
     {
-        //Note: idx is different for temp/hum and wind and uv.....
-        //user and PW needs to be base64 enncoded.
-        //
-        ///json.htm?type=command&param=udevice&idx=IDX&nvalue=0&svalue=TEMP;HUM;HUM_STAT
-        std::string s = "/json.htm?";
-        if (strlen(dzID) > 0)
+        for (int t = 0; t < WT_COUNT; t++)
+            targets[t].enabled = false;
+
+        if (wunderground)
         {
-            s = s + "username=" + dzID + "&password=" + dzPW;
+            //https://support.weather.com/s/article/PWS-Upload-Protocol?language=en_US
+            //https://weatherstation.wunderground.com/weatherstation/updateweatherstation.php?ID=<StationID>>&PASSWORD=<StationPW>&dateutc=now&tempf=37.8&humidity=1&action=updateraw
+            WebTarget &wt = targets[WT_WUNDERGROUND];
+            FmtBuf head = wt.begin("weatherstation.wunderground.com", 443, true);
+            head.str("/weatherstation/updateweatherstation.php?ID=").str(wuID);
+            head.str("&PASSWORD=").str(wuPW);
+            head.str("&dateutc=now");
+            wt.end(head, "&action=updateraw");
         }
-        return s + "type=command&param=udevice&idx=" + std::to_string(idx) + "&nvalue=0&svalue=" + std::to_string(wsp->temperature) + ";" + std::to_string(wsp->humidity) + ";0";
-    }
 
-    virtual std::string urlDomoticzWind(uint32_t idx, const char *dzID, const char *dzPW)
-    {
-        //Note: idx is different for temp/hum and wind and uv.....
-        //user and PW needs to be base64 enncoded.
-        //
-        ///json.htm?type=command&param=udevice&idx=IDX&nvalue=0&svalue=WB;WD;WS;WG;22;24
-        std::string s = "/json.htm?";
-        if (strlen(dzID) > 0)
+        if (domoticz)
         {
-            s = s + "username=" + dzID + "&password=" + dzPW;
+            //https://www.domoticz.com/wiki/Domoticz_API/JSON_URL's
+            //Note: idx is different for temp/hum and wind and uv.....
+            //user and PW needs to be base64 enncoded.
+            const uint32_t idx[] = {dzTHidx, dzWidx, dzRidx, dzLidx, dzUVidx};
+            for (int t = WT_DZ_TEMP; t <= WT_DZ_UV; t++)
+            {
+                if (idx[t - WT_DZ_TEMP] == 0)
+                    continue;
+                WebTarget &wt = targets[t];
+                FmtBuf head = wt.begin(dzURL, dzPort, dzSecure);
+                head.str("/json.htm?");
+                if (strlen(dzID) > 0)
+                {
+                    head.str("username=").str(dzID).str("&password=").str(dzPW).chr('&');
+                }
+                head.str("type=command&param=udevice&idx=").u32(idx[t - WT_DZ_TEMP]).str("&nvalue=0&svalue=");
+                wt.end(head);
+            }
         }
-        return s + "type=command&param=udevice&idx=" + std::to_string(idx) +
-               "&nvalue=0&svalue=" + std::to_string(wsp->winddir) + ";;" + std::to_string(wsp->windspeed * 10 / 3.6) + ";" + std::to_string(wsp->windgust * 10 / 3.6) + ";" +
-               std::to_string(wsp->temperature) + ";0";
-    }
 
-    virtual std::string urlDomoticzRain(uint32_t idx, const char *dzID, const char *dzPW)
-    {
-        //Note: idx is different for temp/hum and wind and uv.....
-        //user and PW needs to be base64 enncoded.
-        //
-        ///json.htm?type=command&param=udevice&idx=IDX&nvalue=0&svalue=RAINRATE;RAINCOUNTER
-        std::string s = "/json.htm?";
-        if (strlen(dzID) > 0)
+        if (windguru)
         {
-            s = s + "username=" + dzID + "&password=" + dzPW;
+            ///upload/api.php?uid=stationXY&salt=20180214171400&hash=c9441d30280f4f6f4946fe2b2d360df5&wind_avg=12.5&wind_dir=165&temperature=20.5
+            //salt = "20180214171400";
+            //key =  "20180214171400stationXYsupersecret"; //test string gives MD5: c9441d30280f4f6f4946fe2b2d360df5
+            FmtBuf key(wgKey, sizeof(wgKey));
+            key.str(WG_SALT_PREFIX);
+            for (int i = 0; i < WG_SALT_DIGITS; i++)
+                key.chr('0');
+            key.str(WG_SALT_SUFFIX).str(wgUID).str(wgPW);
+            wgKeyLen = key.length();
+
+            WebTarget &wt = targets[WT_WINDGURU];
+            FmtBuf head = wt.begin("www.windguru.cz", 80, false);
+            head.str("/upload/api.php?uid=").str(wgUID);
+            head.str("&interval=60");
+            wt.end(head);
         }
-        return s + "type=command&param=udevice&idx=" + std::to_string(idx) + "&nvalue=0&svalue=" + std::to_string(wsp->rain1h * 100) + ";" + std::to_string(wsp->rain);
     }
 
-    virtual std::string urlDomoticzLight(uint32_t idx, const char *dzID, const char *dzPW)
+    //Write the request of upload target t with the current measurements into buf, returns the length
+    size_t request(uint8_t t, char *buf, size_t size)
     {
-        //Note: idx is different for temp/hum and wind and uv.....
-        //user and PW needs to be base64 enncoded.
-        //
-        ///json.htm?type=command&param=udevice&idx=IDX&nvalue=0&svalue=VALUE
-        std::string s = "/json.htm?";
-        if (strlen(dzID) > 0)
+        FmtBuf req(buf, size);
+        targets[t].head(req);
+        switch (t)
+        {
+        case WT_WUNDERGROUND:
+            fieldsWunderground(req);
+            break;
+        case WT_DZ_TEMP:
+            fieldsDomoticzTemp(req);
+            break;
+        case WT_DZ_WIND:
+            fieldsDomoticzWind(req);
+            break;
+        case WT_DZ_RAIN:
+            fieldsDomoticzRain(req);
+            break;
+        case WT_DZ_LIGHT:
+            fieldsDomoticzLight(req);
+            break;
+        case WT_DZ_UV:
+            fieldsDomoticzUV(req);
+            break;
+        case WT_WINDGURU:
+            fieldsWindguru(req);
+            break;
+        }
+        targets[t].tail(req);
+        if (req.overflow())
         {
-            s = s + "username=" + dzID + "&password=" + dzPW;
+            printf("WSSetting: request for %s too long\n", targets[t].host);
         }
-        return s + "type=command&param=udevice&idx=" + std::to_string(idx) + "&nvalue=0&svalue=" + std::to_string(wsp->lightlux);
+        return req.length();
     }
 
-    virtual std::string urlDomoticzUV(uint32_t idx, const char *dzID, const char *dzPW)
+    virtual void fieldsWunderground(FmtBuf &url)
     {
-        //Note: idx is different for temp/hum and wind and uv.....
-        //user and PW needs to be base64 enncoded.
-        //
-        ///json.htm?type=command&param=udevice&idx=IDX&nvalue=0&svalue=UV;TEMP
-        std::string s = "/json.htm?";
-        if (strlen(dzID) > 0)
-        {
-            s = s + "username=" + dzID + "&password=" + dzPW;
-        }
-        return s + "type=command&param=udevice&idx=" + std::to_string(idx) + "&nvalue=0&svalue=" + std::to_string(wsp->UVI) + ";" + std::to_string(wsp->temperature);
+        url.str("&tempf=").fixed(fxMulDiv(wsp->temperature, 9, 5) + 320, 1);
+        url.str("&humidity=").u32(wsp->humidity);
+        url.str("&dewptf=").fixed(fxMulDiv(wsp->dewpoint, 9, 5) + 320, 1);
+        url.str("&rainin=").fixed(fxMulDiv(wsp->rain1h, 1000, 254), 3);
+        url.str("&dailyrainin=").fixed(fxMulDiv(wsp->rainday, 1000, 254), 3);
+        url.str("&winddir=").u32(wsp->winddir);
+        url.str("&windspeedmph=").fixed(fxMulDiv(wsp->windspeed1m, KMH_TO_MPH_NUM, KMH_TO_MPH_DEN), 1);
+        url.str("&windgustmph=").fixed(fxMulDiv(wsp->windgust1m, KMH_TO_MPH_NUM, KMH_TO_MPH_DEN), 1);
+        url.str("&UV=").u32(wsp->UVI);
+        if (wsp->msgformat == MSG_WH2300)
+            url.str("&solarradiation=").fixed(wsp->solar, 1);
+    }
+
+    virtual void fieldsDomoticzTemp(FmtBuf &url)
+    {
+        //svalue=TEMP;HUM;HUM_STAT
+        url.fixed(wsp->temperature, 1).chr(';').u32(wsp->humidity).chr(';').u32(humStat(wsp->temperature, wsp->humidity));
+    }
+
+    virtual void fieldsDomoticzWind(FmtBuf &url)
+    {
+        //svalue=WB;WD;WS;WG;22;24
+        //WS and WG are in 0.1 m/s
+        url.u32(wsp->winddir).str(";;");
+        url.fixed(fxMulDiv(wsp->windspeed, 10 * KMH_TO_MS_NUM, KMH_TO_MS_DEN), 1).chr(';');
+        url.fixed(fxMulDiv(wsp->windgust, 10 * KMH_TO_MS_NUM, KMH_TO_MS_DEN), 1).chr(';');
+        url.fixed(wsp->temperature, 1).chr(';').fixed(wsp->windchill, 1);
+    }
+
+    virtual void fieldsDomoticzRain(FmtBuf &url)
+    {
+        //svalue=RAINRATE;RAINCOUNTER
+        //RAINRATE is in 0.01 mm/h
+        url.u32(wsp->rainrate * 10).chr(';').fixed(wsp->rain, 1);
+    }
+
+    virtual void fieldsDomoticzLight(FmtBuf &url)
+    {
+        //svalue=VALUE
+        url.u32(wsp->lightlux);
+    }
+
+    virtual void fieldsDomoticzUV(FmtBuf &url)
+    {
+        //svalue=UV;TEMP
+        url.u32(wsp->UVI).chr(';').fixed(wsp->temperature, 1);
     }
 
-    virtual std::string urlWindguru(const char *wgUID, const char *wgPW)
-    {
-        ///upload/api.php?uid=stationXY&salt=20180214171400&hash=c9441d30280f4f6f4946fe2b2d360df5&wind_avg=12.5&wind_dir=165&temperature=20.5
-        //std::string salt = "20180214171400";
-        //std::string key =  "20180214171400stationXYsupersecret"; //test string gives MD5: c9441d30280f4f6f4946fe2b2d360df5
-        std::string salt = "@ABC" + std::to_string(millis()) + "XYZ@";
-        std::string key = salt + wgUID + wgPW;
-        char *key2 = const_cast<char *>(key.c_str());
-        unsigned char *hash = MD5::make_hash(key2);
-        char *md5hash = MD5::make_digest(hash, 16);
-        //printf("MD5 %s %s\n", key2, md5hash);
-        free(hash);
-
-        std::string s = "";
-        return s + "/upload/api.php?uid=" + wgUID +
-               "&salt=" + salt +
-               "&hash=" + md5hash +
-               "&interval=60" +
-               "&wind_avg=" + std::to_string(0.540 * wsp->windspeed1m) +
-               "&wind_max=" + std::to_string(0.540 * wsp->windgust1m) +
-               "&wind_direction=" + std::to_string(wsp->winddir) +
-               "&temperature=" + std::to_string(wsp->temperature);
-               //"&rh=" + std::to_string(wsp->humidity); //Humidity can be reported, but particular WS is unreliable with RH.
+    virtual void fieldsWindguru(FmtBuf &url)
+    {
+        //patch the salt digits in the precompiled key and hash it in place
+        char *digits = wgKey + sizeof(WG_SALT_PREFIX) - 1;
+        uint32_t v = millis();
+        for (int i = WG_SALT_DIGITS - 1; i >= 0; i--)
+        {
+            digits[i] = '0' + v % 10;
+            v /= 10;
+        }
+        char md5hash[33];
+        md5Hex((const uint8_t *)wgKey, wgKeyLen, md5hash);
+        //printf("MD5 %s %s\n", wgKey, md5hash);
+
+        url.str("&salt=").str(wgKey, WG_SALT_LEN);
+        url.str("&hash=").str(md5hash);
+        url.str("&wind_avg=").fixed(fxMulDiv(wsp->windspeed1m, KMH_TO_KNOTS_NUM, KMH_TO_KNOTS_DEN), 1);
+        url.str("&wind_max=").fixed(fxMulDiv(wsp->windgust1m, KMH_TO_KNOTS_NUM, KMH_TO_KNOTS_DEN), 1);
+        url.str("&wind_direction=").u32(wsp->winddir);
+        url.str("&temperature=").fixed(wsp->temperature, 1);
+        //url.str("&rh=").u32(wsp->humidity); //Humidity can be reported, but particular WS is unreliable with RH.
     }
 
     virtual void update(WSBase *data, uint8_t *pktbuf)
     {
+        //before the copy, the windows below use the checked readings
+        checkQuality(data);
+
         //copy data to this station
         *wsp = *data;
 
-        //apply calibration factors
-        wsp->windspeed *= windfactor;
-        wsp->windgust *= windfactor;
+        calibrate();
 
         mreportable = true;
         lastSeen = millis();
@@ -307,58 +528,85 @@ struct WSSetting
         //wsp->printtype();
         //data->printtype();
 
+        //windows on the monotonic arrival time in seconds, exact before SNTP sync and across clock steps
+        time_t now = data->rxUs / 1000000;
+        fp.add(sample(data));
+
         //update last hour rain
-        double rainprevhour = data->rain;
-        rainhist.insert(std::make_pair(data->at.tv_sec, data->rain));
-        std::map<time_t, double>::iterator it = rainhist.begin();
-        while (it != rainhist.end() && it->first < data->at.tv_sec - 3600)
+        uint32_t rainprevhour = data->rain;
+        rainhist.insert(std::make_pair(now, data->rain));
+        std::map<time_t, uint32_t>::iterator it = rainhist.begin();
+        while (it != rainhist.end() && it->first < now - 3600)
         {
             //do not use stale data
-            if (it->first > data->at.tv_sec - 7200)
+            if (it->first > now - 7200)
                 rainprevhour = it->second;
-            //printf("rainloop %ld,%f\n", it->first, it->second);
+            //printf("rainloop %ld,%d\n", it->first, it->second);
             it = rainhist.erase(it);
         }
-        wsp->rain1h = data->rain - rainprevhour;
+        wsp->rain1h = (int32_t)(data->rain - rainprevhour);
         //printf("rainhist size %d\n", rainhist.size());
         //printf("rain1h %f\n", wsp->rain1h);
 
+        //rain rate from the last sample before the window, over at least the window
+        it = rainhist.lower_bound(now - WS_RAINRATE_SEC);
+        if (it != rainhist.begin())
+            --it;
+        time_t span = now - it->first > WS_RAINRATE_SEC ? now - it->first : WS_RAINRATE_SEC;
+        wsp->rainrate = (data->rain - it->second) * 3600 / span;
+
+        //daily rain from the first packet after local midnight, since boot until the first midnight
+        int16_t yday = -1;
+        if (data->at.tv_sec >= WS_CLOCK_VALID_SEC)
+        {
+            struct tm local;
+            time_t t = data->at.tv_sec;
+            localtime_r(&t, &local);
+            yday = local.tm_yday;
+        }
+        if (rainDay == WS_RAINDAY_NONE || (rainDay >= 0 && yday >= 0 && yday != rainDay))
+            rainDayStart = data->rain;
+        if (yday >= 0 || rainDay == WS_RAINDAY_NONE)
+            rainDay = yday;
+
         //calculate average windspeed for last minute
-        int count = 0;
-        double windsum = 0.0;
-        windhist.insert(std::make_pair(data->at.tv_sec, data->windspeed));
-        it = windhist.begin();
-        while (it != windhist.end())
-        {
-            //printf("windloop %ld,%f\n", it->first, it->second);
-            if (it->first < data->at.tv_sec - 60)
-                it = windhist.erase(it);
+        uint32_t count = 0;
+        uint32_t windsum = 0;
+        windhist.insert(std::make_pair(now, data->windspeed));
+        std::map<time_t, uint16_t>::iterator wit = windhist.begin();
+        while (wit != windhist.end())
+        {
+            //printf("windloop %ld,%d\n", wit->first, wit->second);
+            if (wit->first < now - 60)
+                wit = windhist.erase(wit);
             else
             {
                 count++;
-                windsum += it->second;
-                ++it;
+                windsum += wit->second;
+                ++wit;
             }
         }
-        wsp->windspeed1m = windsum / count;
-        //printf("windspeed1m %f\n", wsp->windspeed1m);
+        wsp->windspeed1m = (windsum + count / 2) / count;
+        //printf("windspeed1m %d\n", wsp->windspeed1m);
 
         //calculate max windgust for last minute
         wsp->windgust1m = 0;
-        gusthist.insert(std::make_pair(data->at.tv_sec, data->windgust));
-        it = gusthist.begin();
-        while (it != gusthist.end())
+        gusthist.insert(std::make_pair(now, data->windgust));
+        wit = gusthist.begin();
+        while (wit != gusthist.end())
         {
-            if (it->first < data->at.tv_sec - 60)
-                it = gusthist.erase(it);
+            if (wit->first < now - 60)
+                wit = gusthist.erase(wit);
             else
             {
-                if (it->second > wsp->windgust1m)
-                    wsp->windgust1m = it->second;
-                ++it;
+                if (wit->second > wsp->windgust1m)
+                    wsp->windgust1m = wit->second;
+                ++wit;
             }
         }
-        //printf("windmax1m %f\n", wsp->windgust1m);
+        //printf("windmax1m %d\n", wsp->windgust1m);
+
+        derive();
     }
 };
 
@@ -390,12 +638,13 @@ struct WSBR1800 : public WSSetting //public BR1800, public WSSetting
 struct WSWH1080 : public WSSetting //public WH1080, public WSSetting
 {
     //transmissions are a burst of up to 6 identical messages
-    char packets[6][10];
+    uint8_t packets[6][LEN_WS4000]; //raw frames, binary so compared with memcmp
     unsigned long ts[6];
     int equal[6];
     int burstCount;
+    int64_t lastRxUs; //monotonic arrival of the last packet of the burst
 
-    WSWH1080()
+    WSWH1080() : burstCount(0), lastRxUs(0)
     {
         printf("WSWH1080()\n");
         mreportable = false;
@@ -404,12 +653,14 @@ struct WSWH1080 : public WSSetting //public WH1080, public WSSetting
     void validatePackets() {
         printf("WH1080 received %d packets with crc ok in burst", burstCount);
         if (burstCount > 1) {
-            for (int i = 0; i < burstCount - 1; i++)
+            uint8_t len = (wsp->msgformat == MSG_WS3000 ? LEN_WS3000 : LEN_WS4000);
+            //count the other packets equal to each packet
+            for (int i = 0; i < burstCount; i++)
             {
                 equal[i] = 0;
-                for (int j = 1; j < burstCount; j++)
+                for (int j = 0; j < burstCount; j++)
                 {
-                    if (strncmp(packets[0], packets[j], 9) == 0)
+                    if (j != i && memcmp(packets[i], packets[j], len) == 0)
                     {
                         equal[i]++;
                     }
@@ -425,15 +676,17 @@ struct WSWH1080 : public WSSetting //public WH1080, public WSSetting
             }
             printf("WH1080 maximum number of equal packets %d of %d in burst, found at index %d", maxEqual, burstCount, maxEqualIdx);
             //redecode packet as the last one may not be the best one.
-            uint8_t len = (wsp->msgformat == MSG_WS3000 ? LEN_WS3000 : LEN_WS4000);
-            wsp->decode(wsp->msgformat, (uint8_t *)packets[maxEqualIdx], len);
+            wsp->decode(wsp->msgformat, packets[maxEqualIdx], len);
+            checkQuality(wsp);
+            calibrate();
+            derive();
         }
     }
 
     virtual bool reportable()
     {
         //printf("WH1080 reportable()\n");
-        if (mreportable && lastSeen - millis() > 200)
+        if (mreportable && esp_timer_get_time() - lastRxUs > WH1080_BURST_END_US)
         {
             //decide which response is the correct
             validatePackets();
@@ -447,14 +700,19 @@ struct WSWH1080 : public WSSetting //public WH1080, public WSSetting
     virtual void update(WSBase *data, uint8_t *pktbuf)
     {
         //store ws objects and pktbuf in arrays
-        if (millis() - lastSeen > 500) {
+        if (data->rxUs - lastRxUs > WH1080_BURST_GAP_US) {
             //reset packets when previous packet at least early than 500ms ago.
             burstCount = 0;
         }
+        lastRxUs = data->rxUs;
         //Add packet to storage unless to many packets in burst
-        ts[burstCount] = millis();
-        strncpy(packets[burstCount], (char *)pktbuf, 9);
-        burstCount++;
+        if (burstCount < 6)
+        {
+            ts[burstCount] = data->rxUs / 1000;
+            memcpy(packets[burstCount], pktbuf, sizeof(packets[0]));
+            burstCount++;
+        }
+        WSSetting::update(data, pktbuf);
     }
 };
 
@@ -526,19 +784,29 @@ public:
 // WSConfig manages the storage of data upload parameters
 // A singleton object needs to be allocated during set-up and remain
 // in-memory "forever" because the client libs refer to its storage.
+// Every station slot is stored as its own record in a ConfigStore, so a
+// /wsconfig or /wsdelete message only rewrites that one record, and a power
+// loss during the write leaves the previous record of the slot intact.
 class WSConfig
 {
 public:
     // Configuration parameters that need to remain allocated for the duration of the app because
     // other classes, such as .... rely on that.
+    // nullptr for a free slot, so memory grows with the configured stations only
     WSSetting *stations[MAX_WS];
 
     WSConfig()
-        : initialized(false)
+        : initialized(false), store(WS_STORE_DIR), pendingNext(0)
     {
         for (int i = 0; i < MAX_WS; i++)
         {
-            stations[i] = new WSSetting();
+            stations[i] = nullptr;
+            dirty[i] = false;
+        }
+        for (int i = 0; i < FP_PENDING_MAX; i++)
+        {
+            pending[i].wsType = 0xffff;
+            pending[i].wsID = 0xffff;
         }
     }
 
@@ -546,7 +814,7 @@ public:
     {
         for (int i = 0; i < MAX_WS; i++)
         {
-            if (stations[i]->wsType == wsType && stations[i]->wsID == wsID)
+            if (stations[i] && stations[i]->wsType == wsType && stations[i]->wsID == wsID)
                 return i;
         }
         return 0xff;
@@ -558,40 +826,99 @@ public:
         return (idx < MAX_WS) ? stations[idx] : nullptr;
     };
 
-    void add(std::string sjson)
+    uint8_t freeSlot()
     {
-        //through MQTT message
-        WSSetting newWS;
-        newWS.deserialize(sjson);
-        uint8_t idx = ilookup(newWS.wsType, newWS.wsID);
-        if (idx < MAX_WS)
+        for (int i = 0; i < MAX_WS; i++)
         {
-            printf("WSConfig::add: station updated at index %d\n", idx);
+            if (!stations[i])
+                return i;
         }
-        else
+        return 0xff;
+    };
+
+    //An unknown ID of a configured type may be a configured station that picked a new ID
+    //at a battery change. When the fingerprint of the ID matches exactly one silent station
+    //of that type for FP_REBIND_BURSTS bursts in a row, the station is rebound to the ID.
+    //Returns the slot of the rebound station, else 0xff. O(stations) per packet.
+    uint8_t repair(const WSBase *ws)
+    {
+        bool configured = false;
+        for (int i = 0; i < MAX_WS; i++)
         {
-            printf("WSConfig::add: station not found\n");
-            //find first free slot
-            idx = ilookup(0xffff, 0xffff);
-            if (idx < MAX_WS)
-            {
-                printf("WSConfig::add: at first free entry at %d\n", idx);
-            }
-            else
+            if (stations[i] && stations[i]->wsType == ws->msgformat)
+                configured = true;
+        }
+        if (!configured)
+            return 0xff;
+
+        FpSample s = WSSetting::sample(ws);
+        FpPending *p = nullptr;
+        for (int i = 0; i < FP_PENDING_MAX; i++)
+        {
+            if (pending[i].wsType == ws->msgformat && pending[i].wsID == ws->stationID)
+                p = &pending[i];
+        }
+        if (!p)
+        {
+            //replace the oldest unknown ID
+            p = &pending[pendingNext];
+            pendingNext = (pendingNext + 1) % FP_PENDING_MAX;
+            *p = FpPending();
+            p->wsType = ws->msgformat;
+            p->wsID = ws->stationID;
+            p->candidate = 0xff;
+            p->matches = 0;
+        }
+        bool newBurst = p->fp.burstCount() == 0 || s.rxUs - p->fp.lastArrival() >= CADENCE_BURST_US;
+        p->fp.add(s);
+        if (!newBurst || !p->fp.known())
+            return 0xff;
+
+        uint8_t found = 0xff;
+        int candidates = 0;
+        for (int i = 0; i < MAX_WS; i++)
+        {
+            WSSetting *st = stations[i];
+            //a station that is still heard keeps its ID
+            if (!st || st->wsType != ws->msgformat || s.rxUs - st->fp.lastArrival() < FP_SILENT_US)
+                continue;
+            uint8_t checked;
+            uint8_t score = st->fp.match(p->fp, checked);
+            if (checked >= 3 && score == checked)
             {
-                idx = MAX_WS - 1;
-                printf("WSConfig::add: no free slot, overwrite last entry at %d\n", idx);
+                found = i;
+                candidates++;
             }
         }
+        if (candidates != 1)
+        {
+            p->matches = 0;
+            return 0xff;
+        }
+        p->matches = p->candidate == found ? p->matches + 1 : 1;
+        p->candidate = found;
+        if (p->matches < FP_REBIND_BURSTS)
+            return 0xff;
+
+        printf("WSConfig::repair: station at index %d rebound from ID %d to %d\n", found, stations[found]->wsID, ws->stationID);
+        stations[found]->wsID = ws->stationID;
+        stations[found]->fp = p->fp;
+        p->wsType = 0xffff;
+        p->wsID = 0xffff;
+        saveStation(found);
+        return found;
+    };
 
+    //Station setting of the derived class for wsType
+    static WSSetting *create(uint16_t wsType)
+    {
         WSSetting *WSS;
-        switch (newWS.wsType)
+        switch (wsType)
         {
         case 0x24:
         {
             WSBR1800 *WS = new WSBR1800();
-            if (WS->wsp)
-                delete WS->wsp;
+            delete WS->wsp;
             WS->wsp = new BR1800();
             WSS = WS;
             break;
@@ -600,8 +927,7 @@ public:
         case 0x2A:
         {
             WSWH1080 *WS = new WSWH1080();
-            if (WS->wsp)
-                delete WS->wsp;
+            delete WS->wsp;
             WS->wsp = new WH1080();
             WSS = WS;
             break;
@@ -610,68 +936,91 @@ public:
             WSUnknown *WS = new WSUnknown();
             WSS = WS;
         }
-
-        WSS->deserialize(sjson);
-
-        if (stations[idx]->wsp)
-            delete stations[idx]->wsp;
-        if (stations[idx])
-            delete stations[idx];
-        stations[idx] = WSS;
-        save();
+        return WSS;
     };
 
-    void remove(std::string sjson)
+    //Add or update stations through an MQTT message: a station object or an array of them.
+    //A station that exists is updated with the keys in the message, as a JSON merge patch
+    //(RFC 7386): a key with null returns to its default. Its runtime state stays.
+    //The changed slots are written by flush().
+    void add(const char *sjson)
     {
-        //through MQTT message
-        WSSetting delWS;
-        delWS.deserialize(sjson);
-        if (delWS.wsType == 0xffff or delWS.wsID == 0xffff)
+        DynamicJsonDocument json(WS_JSON_DOC + 2 * strlen(sjson));
+        DeserializationError err = deserializeJson(json, sjson);
+        if (err)
         {
-            printf("WSConfig::remove: unexpected wsType or wsID\n");
+            printf("WSConfig::add: JSON deserialization error: %s\n", err.c_str());
+            return;
         }
-        uint8_t idx = ilookup(delWS.wsType, delWS.wsID);
-        if (idx < MAX_WS)
+        if (json.is<JsonArray>())
         {
-            printf("WSConfig::remove: station remove at at index %d\n", idx);
-            if (stations[idx]->wsp)
-                delete stations[idx]->wsp;
-            if (stations[idx])
-                delete stations[idx];
-            stations[idx] = new WSSetting(); //emptyWS;
-            save();
+            for (JsonVariant v : json.as<JsonArray>())
+                addStation(v.as<JsonObject>());
         }
         else
-        {
-            printf("WSConfig::remove: station not found\n");
-        };
+            addStation(json.as<JsonObject>());
     };
 
-    //Save to SPI Flash
-    void save()
+    //Remove stations through an MQTT message: {"wsType":40,"wsID":123} or an array of them
+    void remove(const char *sjson)
     {
-        //const int capacity = JSON_ARRAY_SIZE(MAX_WS) + JSON_OBJECT_SIZE(10);
-        //DynamicJsonDocument json(2 * capacity);
-        DynamicJsonDocument json(4096);
+        DynamicJsonDocument json(WS_JSON_DOC + 2 * strlen(sjson));
+        DeserializationError err = deserializeJson(json, sjson);
+        if (err)
+        {
+            printf("WSConfig::remove: JSON deserialization error: %s\n", err.c_str());
+            return;
+        }
+        if (json.is<JsonArray>())
+        {
+            for (JsonVariant v : json.as<JsonArray>())
+                removeStation(v.as<JsonObject>());
+        }
+        else
+            removeStation(json.as<JsonObject>());
+    };
 
+    //Write the slots changed since the last flush, once per batch of messages
+    void flush()
+    {
         for (int i = 0; i < MAX_WS; i++)
         {
-            printf("%d, type %d\n", stations[i]->wsID, stations[i]->wsType);
-            JsonObject ojson = json.createNestedObject();
-            stations[i]->serialize(ojson); //Populate the JsonObject
-            printf("%d, type %d-ex\n", stations[i]->wsID, stations[i]->wsType);
+            if (dirty[i])
+                saveStation(i);
         }
+    };
 
-        File configFile = SPIFFS.open("/stationconfig.json", FILE_WRITE);
-        if (!configFile)
+    //Save the record of station slot idx to SPI Flash, a free slot is saved as {}
+    void saveStation(uint8_t idx)
+    {
+        static char buf[WS_RECORD_MAX];
+        size_t len;
+        if (stations[idx])
         {
-            printf("failed to write stationconfig.json\n");
+            DynamicJsonDocument json(WS_JSON_DOC);
+            stations[idx]->serialize(json.to<JsonObject>());
+            len = serializeJson(json, buf, sizeof(buf));
+            if (len == 0 || len >= sizeof(buf) - 1)
+            {
+                printf("WSConfig::saveStation: station %d does not fit in a record\n", idx);
+                return;
+            }
         }
         else
         {
-            serializeJson(json, configFile);
-            configFile.close();
-            printf("Saved stationconfig file\n");
+            len = FmtBuf(buf, sizeof(buf)).str("{}").length();
+        }
+        dirty[idx] = false;
+        if (store.write(idx, buf, len))
+            printf("Saved station config %d\n", idx);
+    };
+
+    //Save all stations to SPI Flash
+    void save()
+    {
+        for (int i = 0; i < MAX_WS; i++)
+        {
+            saveStation(i);
         }
     };
 
@@ -693,64 +1042,180 @@ public:
             }
         }
 
-        File configFile = SPIFFS.open("/stationconfig.json", FILE_READ);
-        if (configFile && configFile.size() > 10)
+        //each record is parsed once, into a single document
+        static char buf[WS_RECORD_MAX];
+        DynamicJsonDocument json(WS_JSON_DOC);
+        uint8_t records = 0;
+        for (int i = 0; i < MAX_WS; i++)
         {
-            // load as json
-            size_t size = configFile.size();
-            printf("stationconfig file size is %d\n", size);
-            DynamicJsonDocument json(4096);
-            DeserializationError err = deserializeJson(json, configFile);
-            configFile.close();
+            int len = store.read(i, buf, sizeof(buf));
+            if (len < 0)
+                continue;
+            records++;
+            DeserializationError err = deserializeJson(json, buf, len);
             if (err)
             {
-                printf("failed to parse stationconfig.json: %s\n\n\n\n", err.c_str());
-#if 1
-                File cf = SPIFFS.open("/stationconfig.json", FILE_READ);
-                printf("Contents (%d):\n\n\n <<", cf.size());
-                for (int ch = cf.read(); ch != -1; ch = cf.read())
-                {
-                    if (ch >= ' ' && ch <= '~')
-                        putchar(ch);
-                    else
-                        putchar('~');
-                }
-                printf(">>\n");
-                cf.close();
-#endif
-                return;
+                printf("failed to parse station config %d: %s\n", i, err.c_str());
+                continue;
             }
+            loadStation(i, json.as<JsonObject>());
+        }
 
-            File cf = SPIFFS.open("/stationconfig.json", FILE_READ);
-            printf("Stationconfig file Contents (%d): <<", cf.size());
-            for (int ch = cf.read(); ch != -1; ch = cf.read())
-            {
-                if (ch >= ' ' && ch <= '~')
-                    putchar(ch);
-                else
-                    putchar('~');
-            }
-            printf(">>\n");
-            cf.close();
+        if (records == 0)
+        {
+            if (SPIFFS.exists(WS_LEGACY_FILE))
+                migrate();
+            else
+                printf("No station config found.\n");
+        }
+        initialized = true;
+    };
 
-            for (int i = 0; i < MAX_WS; i++)
-            {
-                stations[i]->deserialize(json[i].as<JsonObject>());
-            };
+    //private:
+
+    bool initialized; // true once the config has been read
+
+private:
+    ConfigStore<MAX_WS> store;
+
+    //unknown ID of a configured type, a candidate for re-pairing
+    struct FpPending
+    {
+        uint16_t wsType;
+        uint16_t wsID;
+        Fingerprint fp;
+        uint8_t candidate; //slot of the matching silent station
+        uint8_t matches;   //bursts in a row that matched the candidate
+    };
+    FpPending pending[FP_PENDING_MAX];
+    uint8_t pendingNext;
+    bool dirty[MAX_WS]; //slots to write on flush()
+
+    void addStation(JsonObject ojson)
+    {
+        uint16_t wsType = ojson["wsType"] | 0xffff;
+        uint16_t wsID = ojson["wsID"] | 0xffff;
+        uint8_t idx = ilookup(wsType, wsID);
+        if (idx < MAX_WS)
+        {
+            printf("WSConfig::add: station updated at index %d\n", idx);
+            //the current configuration with the message merged in, the station object stays
+            DynamicJsonDocument merged(WS_MERGE_DOC);
+            JsonObject mjson = merged.to<JsonObject>();
+            stations[idx]->serialize(mjson);
+            mergePatch(mjson, ojson);
+            stations[idx]->deserialize(mjson);
+            dirty[idx] = true;
+            return;
+        }
+
+        printf("WSConfig::add: station not found\n");
+        //find first free slot
+        idx = freeSlot();
+        if (idx < MAX_WS)
+        {
+            printf("WSConfig::add: at first free entry at %d\n", idx);
         }
         else
         {
-            if (configFile)
-                configFile.close();
-            Serial.println("No config file found.");
+            idx = MAX_WS - 1;
+            printf("WSConfig::add: no free slot, overwrite last entry at %d\n", idx);
+        }
+        WSSetting *WSS = create(wsType);
+        WSS->deserialize(ojson);
+        release(idx);
+        stations[idx] = WSS;
+        dirty[idx] = true;
+    };
 
-            //store a file with unitialized entries
-            save();
+    void removeStation(JsonObject ojson)
+    {
+        uint16_t wsType = ojson["wsType"] | 0xffff;
+        uint16_t wsID = ojson["wsID"] | 0xffff;
+        if (wsType == 0xffff or wsID == 0xffff)
+        {
+            printf("WSConfig::remove: unexpected wsType or wsID\n");
         }
-        initialized = true;
+        uint8_t idx = ilookup(wsType, wsID);
+        if (idx < MAX_WS)
+        {
+            printf("WSConfig::remove: station remove at at index %d\n", idx);
+            release(idx);
+            dirty[idx] = true;
+        }
+        else
+        {
+            printf("WSConfig::remove: station not found\n");
+        };
     };
 
-    //private:
+    //JSON merge patch (RFC 7386) of patch into target: null removes a key, objects are merged
+    static void mergePatch(JsonObject target, JsonObject patch)
+    {
+        for (JsonPair kv : patch)
+        {
+            const char *key = kv.key().c_str();
+            if (kv.value().isNull())
+                target.remove(key);
+            else if (kv.value().is<JsonObject>())
+            {
+                JsonObject sub = target[key].as<JsonObject>();
+                if (sub.isNull())
+                {
+                    target.remove(key);
+                    sub = target.createNestedObject(key);
+                }
+                mergePatch(sub, kv.value().as<JsonObject>());
+            }
+            else
+                target[key] = kv.value();
+        }
+    };
 
-    bool initialized; // true once the config has been read
+    //delete the station of slot idx and free the slot
+    void release(uint8_t idx)
+    {
+        if (stations[idx])
+        {
+            delete stations[idx]->wsp;
+            delete stations[idx];
+            stations[idx] = nullptr;
+        }
+    };
+
+    //load the station of slot idx, an empty record leaves the slot free
+    void loadStation(uint8_t idx, JsonObject ojson)
+    {
+        uint16_t wsType = ojson["wsType"] | 0xffff;
+        uint16_t wsID = ojson["wsID"] | 0xffff;
+        if (wsType == 0xffff && wsID == 0xffff)
+            return;
+        release(idx);
+        stations[idx] = create(wsType);
+        stations[idx]->deserialize(ojson);
+    };
+
+    //Convert the single stationconfig.json of previous firmware to records, it is kept as .bak
+    void migrate()
+    {
+        File configFile = SPIFFS.open(WS_LEGACY_FILE, FILE_READ);
+        if (!configFile)
+            return;
+        DynamicJsonDocument json(4096);
+        DeserializationError err = deserializeJson(json, configFile);
+        configFile.close();
+        if (err)
+        {
+            printf("failed to parse %s: %s\n", WS_LEGACY_FILE, err.c_str());
+            return;
+        }
+        JsonArray array = json.as<JsonArray>();
+        for (int i = 0; i < MAX_WS && i < (int)array.size(); i++)
+        {
+            loadStation(i, array[i].as<JsonObject>());
+        }
+        save();
+        SPIFFS.rename(WS_LEGACY_FILE, WS_LEGACY_FILE ".bak");
+        printf("Migrated %s to station records\n", WS_LEGACY_FILE);
+    };
 };
@@ -0,0 +1,454 @@
+// TLS client with session resumption and public key pinning
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// A full TLS handshake costs 1-2 seconds of CPU and tens of KB of heap on the ESP32.
+// TLSClient keeps the negotiated session (session ticket or session ID) per host,
+// so the next upload to the same host does an abbreviated handshake.
+// Instead of chain verification the SHA-256 of the server public key is pinned
+// on the first full handshake and checked on every following full handshake.
+// A server that presents another key is refused until the pin is changed
+// explicitly with setPin(), through the /tlspin MQTT command. The pins are kept
+// in RAM: after a reboot the first full handshake pins again.
+
+#ifndef TLSCLIENT_H
+#define TLSCLIENT_H
+
+#include <Arduino.h>
+#include <Client.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/sha256.h>
+#include <mbedtls/x509_crt.h>
+#include <lwip/sockets.h>
+#include <lwip/netdb.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#ifndef TLS_CACHE_MAX
+#define TLS_CACHE_MAX 4
+#endif
+#define TLS_HOST_MAX 50
+#define TLS_HANDSHAKE_TIMEOUT_MS 5000
+//read timeout once connected, keeps available() from blocking
+#define TLS_READ_TIMEOUT_MS 10
+
+//handshake statistics, reported in the stats JSON
+struct TLSStats
+{
+    uint32_t full;        //full handshakes
+    uint32_t resumed;     //abbreviated handshakes with a cached session
+    uint32_t failed;      //connect or handshake failures
+    uint32_t pinMismatch; //full handshakes refused because the server key differs from the pin
+    uint32_t lastMs;      //duration of the last handshake
+    uint32_t maxFullMs;
+    uint32_t maxResumedMs;
+};
+
+//per host session and pinned public key
+struct TLSCacheEntry
+{
+    char host[TLS_HOST_MAX];
+    uint16_t port;
+    bool hasSession;
+    mbedtls_ssl_session session;
+    bool pinned;
+    uint8_t pin[32];
+    uint32_t usedAt;
+};
+
+class TLSClient : public Client
+{
+public:
+    static TLSStats stats;
+
+    TLSClient() : _connected(false), _sslInit(false), _entry(nullptr) {}
+    virtual ~TLSClient() { stop(); }
+
+    int connect(IPAddress ip, uint16_t port)
+    {
+        return connect(ip.toString().c_str(), port);
+    }
+
+    int connect(const char *host, uint16_t port)
+    {
+        return connect(host, port, TLS_HANDSHAKE_TIMEOUT_MS);
+    }
+
+    //timeoutMs bounds the TCP connect and the handshake together
+    int connect(const char *host, uint16_t port, int32_t timeoutMs)
+    {
+        stop();
+        if (!initRNG())
+            return 0;
+
+        uint32_t t0 = millis();
+        _entry = cacheEntry(host, port);
+
+        mbedtls_net_init(&_net);
+        mbedtls_ssl_init(&_ssl);
+        _sslInit = true;
+        if (!tcpConnect(host, port, timeoutMs) ||
+            mbedtls_ssl_setup(&_ssl, &_conf) != 0 ||
+            mbedtls_ssl_set_hostname(&_ssl, host) != 0)
+        {
+            return fail("connect");
+        }
+        int32_t left = timeoutMs - (int32_t)(millis() - t0);
+        if (left <= 0)
+            return fail("connect timeout");
+        mbedtls_ssl_set_bio(&_ssl, &_net, mbedtls_net_send, mbedtls_net_recv, mbedtls_net_recv_timeout);
+        mbedtls_ssl_conf_read_timeout(&_conf, left);
+
+        if (_entry->hasSession)
+            mbedtls_ssl_set_session(&_ssl, &_entry->session);
+
+        int ret;
+        while ((ret = mbedtls_ssl_handshake(&_ssl)) != 0)
+        {
+            if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+            {
+                //a rejected session must not be offered again
+                forgetSession();
+                return fail("handshake", ret);
+            }
+            if ((int32_t)(millis() - t0) > timeoutMs)
+            {
+                forgetSession();
+                return fail("handshake timeout");
+            }
+        }
+
+        //the session is resumed when the master secret is the one of the cached session
+        mbedtls_ssl_session negotiated;
+        mbedtls_ssl_session_init(&negotiated);
+        mbedtls_ssl_get_session(&_ssl, &negotiated);
+        bool resumed = _entry->hasSession && memcmp(negotiated.master, _entry->session.master, sizeof(negotiated.master)) == 0;
+
+        if (!resumed && !checkPin())
+        {
+            mbedtls_ssl_session_free(&negotiated);
+            return fail("public key pin mismatch");
+        }
+
+        //keep the (possibly renewed) session for the next connection
+        mbedtls_ssl_session_free(&_entry->session);
+        _entry->session = negotiated;
+        _entry->hasSession = true;
+        _entry->usedAt = millis();
+
+        uint32_t ms = millis() - t0;
+        stats.lastMs = ms;
+        if (resumed)
+        {
+            stats.resumed++;
+            if (ms > stats.maxResumedMs)
+                stats.maxResumedMs = ms;
+        }
+        else
+        {
+            stats.full++;
+            if (ms > stats.maxFullMs)
+                stats.maxFullMs = ms;
+        }
+        printf("TLS %s: %s handshake in %dms\n", host, resumed ? "resumed" : "full", ms);
+
+        mbedtls_ssl_conf_read_timeout(&_conf, TLS_READ_TIMEOUT_MS);
+        _connected = true;
+        return 1;
+    }
+
+    //Pin the SHA-256 of the public key of host:port, or with pin nullptr clear the pin so
+    //the next full handshake pins the key the server presents. The cached session is
+    //dropped, the next connection does a full handshake and checks the new pin.
+    static bool setPin(const char *host, uint16_t port, const uint8_t *pin)
+    {
+        if (!initRNG())
+            return false;
+        TLSCacheEntry *entry = cacheEntry(host, port);
+        mbedtls_ssl_session_free(&entry->session);
+        mbedtls_ssl_session_init(&entry->session);
+        entry->hasSession = false;
+        entry->pinned = pin != nullptr;
+        if (pin)
+            memcpy(entry->pin, pin, sizeof(entry->pin));
+        printf("TLS %s:%u: %s\n", host, port, pin ? "public key pinned" : "pin cleared, the next key is pinned");
+        return true;
+    }
+
+    //64 hex digits into the 32 bytes of a pin
+    static bool parsePin(const char *hex, uint8_t *pin)
+    {
+        for (int i = 0; i < 64; i++)
+        {
+            char c = hex[i];
+            int d = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (d < 0)
+                return false;
+            if (i & 1)
+                pin[i / 2] |= d;
+            else
+                pin[i / 2] = d << 4;
+        }
+        return hex[64] == 0 || hex[64] == ' ' || hex[64] == '\n' || hex[64] == '\r';
+    }
+
+    size_t write(uint8_t b)
+    {
+        return write(&b, 1);
+    }
+
+    size_t write(const uint8_t *buf, size_t size)
+    {
+        size_t sent = 0;
+        while (_connected && sent < size)
+        {
+            int ret = mbedtls_ssl_write(&_ssl, buf + sent, size - sent);
+            if (ret > 0)
+                sent += ret;
+            else if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+                _connected = false;
+        }
+        return sent;
+    }
+
+    int available()
+    {
+        if (!_connected)
+            return 0;
+        if (mbedtls_ssl_get_bytes_avail(&_ssl) == 0)
+        {
+            //process the next record, times out after TLS_READ_TIMEOUT_MS
+            int ret = mbedtls_ssl_read(&_ssl, nullptr, 0);
+            if (ret == 0 || ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY ||
+                (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE && ret != MBEDTLS_ERR_SSL_TIMEOUT))
+            {
+                if (mbedtls_ssl_get_bytes_avail(&_ssl) == 0)
+                    _connected = false;
+            }
+        }
+        return mbedtls_ssl_get_bytes_avail(&_ssl);
+    }
+
+    int read()
+    {
+        uint8_t b;
+        return (read(&b, 1) == 1) ? b : -1;
+    }
+
+    int read(uint8_t *buf, size_t size)
+    {
+        if (!available())
+            return -1;
+        int ret = mbedtls_ssl_read(&_ssl, buf, size);
+        return (ret > 0) ? ret : -1;
+    }
+
+    int peek()
+    {
+        return -1;
+    }
+
+    void flush() {}
+
+    void stop()
+    {
+        if (_sslInit)
+        {
+            if (_connected)
+                mbedtls_ssl_close_notify(&_ssl);
+            mbedtls_ssl_free(&_ssl);
+            mbedtls_net_free(&_net);
+            _sslInit = false;
+        }
+        _connected = false;
+    }
+
+    uint8_t connected()
+    {
+        return _connected || (_sslInit && mbedtls_ssl_get_bytes_avail(&_ssl) > 0);
+    }
+
+    operator bool()
+    {
+        return connected();
+    }
+
+private:
+    bool _connected;
+    bool _sslInit;
+    mbedtls_net_context _net;
+    mbedtls_ssl_context _ssl;
+    TLSCacheEntry *_entry;
+
+    //shared between all connections, initialized once
+    static bool _rngInit;
+    static mbedtls_entropy_context _entropy;
+    static mbedtls_ctr_drbg_context _drbg;
+    static mbedtls_ssl_config _conf;
+    static TLSCacheEntry _cache[TLS_CACHE_MAX];
+
+    static bool initRNG()
+    {
+        if (_rngInit)
+            return true;
+        mbedtls_entropy_init(&_entropy);
+        mbedtls_ctr_drbg_init(&_drbg);
+        mbedtls_ssl_config_init(&_conf);
+        if (mbedtls_ctr_drbg_seed(&_drbg, mbedtls_entropy_func, &_entropy, nullptr, 0) != 0 ||
+            mbedtls_ssl_config_defaults(&_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0)
+        {
+            printf("TLS: mbedtls initialization failed\n");
+            return false;
+        }
+        //the server is authenticated by its pinned public key instead of the certificate chain
+        mbedtls_ssl_conf_authmode(&_conf, MBEDTLS_SSL_VERIFY_NONE);
+        mbedtls_ssl_conf_rng(&_conf, mbedtls_ctr_drbg_random, &_drbg);
+        mbedtls_ssl_conf_session_tickets(&_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+        for (int i = 0; i < TLS_CACHE_MAX; i++)
+        {
+            _cache[i].host[0] = 0;
+            _cache[i].hasSession = false;
+            _cache[i].pinned = false;
+            mbedtls_ssl_session_init(&_cache[i].session);
+        }
+        _rngInit = true;
+        return true;
+    }
+
+    //cache entry of host:port: a free entry is taken, else the least recently used
+    //one without a pin, a pin is only dropped when all entries are pinned
+    static TLSCacheEntry *cacheEntry(const char *host, uint16_t port)
+    {
+        TLSCacheEntry *lru = nullptr;
+        for (int i = 0; i < TLS_CACHE_MAX; i++)
+        {
+            TLSCacheEntry *e = &_cache[i];
+            if (e->host[0] && e->port == port && strcmp(e->host, host) == 0)
+                return e;
+            if (!lru || evictBefore(e, lru))
+                lru = e;
+        }
+        if (lru->pinned)
+            printf("TLS %s:%u: pin dropped, cache full\n", lru->host, lru->port);
+        mbedtls_ssl_session_free(&lru->session);
+        mbedtls_ssl_session_init(&lru->session);
+        strncpy(lru->host, host, sizeof(lru->host) - 1);
+        lru->host[sizeof(lru->host) - 1] = 0;
+        lru->port = port;
+        lru->hasSession = false;
+        lru->pinned = false;
+        lru->usedAt = millis();
+        return lru;
+    }
+
+    static bool evictBefore(const TLSCacheEntry *a, const TLSCacheEntry *b)
+    {
+        if ((a->host[0] == 0) != (b->host[0] == 0))
+            return a->host[0] == 0;
+        if (a->pinned != b->pinned)
+            return !a->pinned;
+        return (int32_t)(a->usedAt - b->usedAt) < 0;
+    }
+
+    //TCP connect bounded by timeoutMs, mbedtls_net_connect waits for the lwIP
+    //default of a minute or more when the server does not answer
+    bool tcpConnect(const char *host, uint16_t port, int32_t timeoutMs)
+    {
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        char portstr[6];
+        snprintf(portstr, sizeof(portstr), "%u", port);
+        struct addrinfo *addr;
+        if (getaddrinfo(host, portstr, &hints, &addr) != 0 || !addr)
+            return false;
+        int fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (fd < 0)
+        {
+            freeaddrinfo(addr);
+            return false;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        int ret = ::connect(fd, addr->ai_addr, addr->ai_addrlen);
+        freeaddrinfo(addr);
+        if (ret != 0 && errno == EINPROGRESS)
+        {
+            fd_set fds;
+            FD_ZERO(&fds);
+            FD_SET(fd, &fds);
+            struct timeval tv;
+            tv.tv_sec = timeoutMs / 1000;
+            tv.tv_usec = (timeoutMs % 1000) * 1000;
+            int err = -1;
+            socklen_t errlen = sizeof(err);
+            if (select(fd + 1, nullptr, &fds, nullptr, &tv) == 1 &&
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == 0 && err == 0)
+                ret = 0;
+        }
+        if (ret != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        //mbedtls reads with its own timeout, the socket blocks again
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+        _net.fd = fd;
+        return true;
+    }
+
+    void forgetSession()
+    {
+        if (_entry && _entry->hasSession)
+        {
+            mbedtls_ssl_session_free(&_entry->session);
+            mbedtls_ssl_session_init(&_entry->session);
+            _entry->hasSession = false;
+        }
+    }
+
+    //Pin the server public key on the first full handshake, check it on the next ones.
+    //A mismatch refuses the connection and keeps the pin: a key rotation of the
+    //server needs setPin(), a man in the middle must not get the next upload.
+    bool checkPin()
+    {
+        const mbedtls_x509_crt *crt = mbedtls_ssl_get_peer_cert(&_ssl);
+        if (!crt)
+            return false;
+        uint8_t hash[32];
+        mbedtls_sha256_ret(crt->pk_raw.p, crt->pk_raw.len, hash, 0);
+        if (_entry->pinned && memcmp(hash, _entry->pin, sizeof(hash)) != 0)
+        {
+            stats.pinMismatch++;
+            //the key presented, for the /tlspin command when the change is legitimate
+            char hex[65];
+            for (int i = 0; i < 32; i++)
+                snprintf(hex + 2 * i, 3, "%02x", hash[i]);
+            printf("TLS %s:%u: public key %s does not match the pin\n", _entry->host, _entry->port, hex);
+            forgetSession();
+            return false;
+        }
+        memcpy(_entry->pin, hash, sizeof(hash));
+        _entry->pinned = true;
+        return true;
+    }
+
+    int fail(const char *what, int ret = 0)
+    {
+        stats.failed++;
+        printf("TLS %s: %s failed (-0x%04x)\n", _entry ? _entry->host : "", what, -ret);
+        stop();
+        return 0;
+    }
+};
+
+TLSStats TLSClient::stats = {};
+bool TLSClient::_rngInit = false;
+mbedtls_entropy_context TLSClient::_entropy;
+mbedtls_ctr_drbg_context TLSClient::_drbg;
+mbedtls_ssl_config TLSClient::_conf;
+TLSCacheEntry TLSClient::_cache[TLS_CACHE_MAX];
+
+#endif
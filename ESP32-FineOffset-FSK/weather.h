@@ -1,8 +1,9 @@
 #include <string>
+#include <sys/time.h>
+#include <esp_timer.h>
 
-#include "ftoa.h"
-#include <ArduinoJson.h>
-#include <md5.h>
+#include "fmtbuf.h"
+#include "metrics.h"
 
 #define MSG_WH2300 36
 #define MSG_WS4000 40
@@ -11,6 +12,56 @@
 #define LEN_WS4000 10
 #define LEN_WS3000 9
 
+//the wall clock is not set before this time (2017)
+#define WS_CLOCK_VALID_SEC 1500000000
+
+//Fixed-point representation of the decoded fields.
+//The ESP32 has no double precision FPU, so decoding and the rolling statistics
+//are done in integers. Conversion to float is only done when formatting output.
+#define WS_TEMP_SCALE 10 //temperature in 0.1 Celsius
+#define WS_WIND_SCALE 10 //wind speed and gust in 0.1 km/h
+#define WS_RAIN_SCALE 10 //rainfall in 0.1 mm
+
+//Conversion of raw sensor counts as a rational num/den in the fixed-point units above
+//BR1800 wind speed: 1.12 * 0.125 m/s * 3.6 = 0.504 km/h per count
+#define BR1800_WIND_NUM 504
+#define BR1800_WIND_DEN 100
+//BR1800 wind gust: 1.12 m/s * 3.6 = 4.032 km/h per count
+#define BR1800_GUST_NUM 4032
+#define BR1800_GUST_DEN 100
+//WH1080 wind speed and gust: 0.34 m/s * 3.6 = 1.224 km/h per count
+#define WH1080_WIND_NUM 1224
+#define WH1080_WIND_DEN 100
+//Fine Offset rain bucket: 0.3 mm per count
+#define FO_RAIN_NUM 3
+#define FO_RAIN_DEN 1
+//rain in 0.1 mm at which the counter field wraps: 12 bits for WH1080, 16 bits for BR1800
+#define WH1080_RAIN_WRAP (4096 * FO_RAIN_NUM / FO_RAIN_DEN)
+#define BR1800_RAIN_WRAP (65536 * FO_RAIN_NUM / FO_RAIN_DEN)
+//BR1800 light: 0.1 lux per count
+#define BR1800_LUX_NUM 1
+#define BR1800_LUX_DEN 10
+
+//scale a raw count to fixed-point with rounding
+static inline uint32_t fxScale(uint32_t raw, uint32_t num, uint32_t den)
+{
+    return (raw * num + den / 2) / den;
+}
+
+//Output unit conversions as num/den, applied with fxMulDiv on the fixed-point values
+#define KMH_TO_KNOTS_NUM 540
+#define KMH_TO_KNOTS_DEN 1000
+#define KMH_TO_MPH_NUM 6214
+#define KMH_TO_MPH_DEN 10000
+#define KMH_TO_MS_NUM 10
+#define KMH_TO_MS_DEN 36
+//0.0079 W/m^2 per lux, result in 0.1 W/m^2
+#define LUX_TO_WM2_NUM 79
+#define LUX_TO_WM2_DEN 1000
+
+//maximum length of the MQTT JSON payload of a station
+#define WS_PAYLOAD_MAX 512
+
 class WSBase
 {
 public:
@@ -19,28 +70,37 @@ public:
     uint16_t stationID = 0xffff;
 
     //data
-    double temperature; //in Celscius
-    uint16_t humidity;  //relative %
-    uint16_t winddir;   //in degrees North = 0
-    double windspeed;   //in km/h
-    double windgust;    //in km/h
-    double lightlux;    //in Lux
-    double rain;        //in mm
-    uint16_t UVraw;     //a.u.
-    uint8_t UVI;        //index 0-13
-    bool low_battery;   //true is low battery
+    int16_t temperature; //in 0.1 Celsius
+    uint16_t humidity;   //relative %
+    uint16_t winddir;    //in degrees North = 0
+    uint16_t windspeed;  //in 0.1 km/h
+    uint16_t windgust;   //in 0.1 km/h
+    uint32_t lightlux;   //in Lux
+    uint32_t rain;       //in 0.1 mm
+    uint16_t UVraw;      //a.u.
+    uint8_t UVI;         //index 0-13
+    bool low_battery;    //true is low battery
 
     //calculated fields
-    double windspeed1m; //in km/h
-    double windgust1m;  //in km/h
-    double rain1h;      //in mm
+    uint16_t windspeed1m; //in 0.1 km/h
+    uint16_t windgust1m;  //in 0.1 km/h
+    int32_t rain1h;       //in 0.1 mm
+    uint8_t quality;      //QualityFlag of the readings replaced by the plausibility filter
+    int16_t dewpoint;     //in 0.1 Celsius
+    int16_t heatindex;    //in 0.1 Celsius
+    int16_t windchill;    //in 0.1 Celsius
+    int16_t feelslike;    //apparent temperature in 0.1 Celsius
+    uint32_t solar;       //in 0.1 W/m^2
+    uint32_t rainday;     //since local midnight in 0.1 mm
+    uint32_t rainrate;    //over the last 10 minutes in 0.1 mm/h
 
     //RF receive
     int32_t afc;       // in Hz
     uint8_t rssi;      // in dBm
     uint8_t lna;       // in step
     uint8_t snr;       // in dB
-    struct timeval at; // arrival timestamp
+    int64_t rxUs;      // arrival, esp_timer_get_time(): monotonic us since boot, used for all windows
+    struct timeval at; // arrival wall clock, set by setWallClock() when the packet is published
 
     //default constructor
     WSBase()
@@ -48,24 +108,33 @@ public:
         msgformat = 0xFFFF;
         stationID = 0xFFFF;
 
-        temperature = 0.0;
+        temperature = 0;
         humidity = 0;
         winddir = 0;
-        windspeed = 0.0;
-        windgust = 0.0;
-        lightlux = 0.0;
-        rain = 0.0;
+        windspeed = 0;
+        windgust = 0;
+        lightlux = 0;
+        rain = 0;
         UVraw = 0;
         UVI = 0;
         low_battery = false;
-        windspeed1m = 0.0;
-        windgust1m = 0.0;
-        rain1h = 0.0;
+        windspeed1m = 0;
+        windgust1m = 0;
+        rain1h = 0;
+        quality = 0;
+        dewpoint = 0;
+        heatindex = 0;
+        windchill = 0;
+        feelslike = 0;
+        solar = 0;
+        rainday = 0;
+        rainrate = 0;
 
         afc = 0;
         rssi = 0;
         lna = 0;
         snr = 0;
+        rxUs = 0;
         at = (struct timeval){0};
     }
 
@@ -74,7 +143,7 @@ public:
     {
         //identity
         msgformat = ws.msgformat;
-        stationID = stationID;
+        stationID = ws.stationID;
 
         //data
         temperature = ws.temperature;
@@ -92,12 +161,21 @@ public:
         windspeed1m = ws.windspeed1m;
         windgust1m = ws.windgust1m;
         rain1h = ws.rain1h;
+        quality = ws.quality;
+        dewpoint = ws.dewpoint;
+        heatindex = ws.heatindex;
+        windchill = ws.windchill;
+        feelslike = ws.feelslike;
+        solar = ws.solar;
+        rainday = ws.rainday;
+        rainrate = ws.rainrate;
 
         //RF receive
         afc = ws.afc;
         rssi = ws.rssi;
         lna = ws.lna;
         snr = ws.snr;
+        rxUs = ws.rxUs;
         at = ws.at;
     }
 
@@ -130,20 +208,30 @@ public:
         windspeed1m = ws.windspeed1m;
         windgust1m = ws.windgust1m;
         rain1h = ws.rain1h;
+        quality = ws.quality;
+        dewpoint = ws.dewpoint;
+        heatindex = ws.heatindex;
+        windchill = ws.windchill;
+        feelslike = ws.feelslike;
+        solar = ws.solar;
+        rainday = ws.rainday;
+        rainrate = ws.rainrate;
 
         //RF receive
         afc = ws.afc;
         rssi = ws.rssi;
         lna = ws.lna;
         snr = ws.snr;
+        rxUs = ws.rxUs;
         at = ws.at;
 
         return *this;
     }
 
-    void setRFStats(struct timeval rxAt, uint8_t rxrssi, uint8_t rxsnr, uint8_t rxlna, int32_t rxafc)
+    void setRFStats(int64_t rxAtUs, uint8_t rxrssi, uint8_t rxsnr, uint8_t rxlna, int32_t rxafc)
     {
-        at = rxAt;
+        rxUs = rxAtUs;
+        at = (struct timeval){0};
         rssi = rxrssi;
         snr = rxsnr;
         lna = rxlna;
@@ -154,51 +242,74 @@ public:
         printf("Instance of WSBase\n");
     };
 
-    virtual std::string mqttPayload()
+    //Set the wall clock time of arrival from the current time and the age of the packet.
+    //Returns false while the clock is not set. A later SNTP step does not move rxUs.
+    bool setWallClock()
     {
-        std::string sjson;
-        DynamicJsonDocument djson(2048);
-        djson["ts"] = at.tv_sec;
-        djson["stType"] = msgformat;
-        djson["stID"] = stationID;
-        djson["T"] = temperature;
-        djson["rh"] = humidity;
-        djson["winddir"] = winddir;
-        djson["wind"] = windspeed;
-        djson["wind1m"] = windspeed1m;
-        djson["gust"] = windgust;
-        djson["gust1m"] = windgust1m;
-        djson["rain"] = rain;
-        djson["rain1h"] = rain1h;
-        djson["lux"] = lightlux;
-        djson["UV"] = UVraw;
-        djson["UVI"] = UVI;
-        djson["battery"] = ((low_battery ? 0 : 100));
-        djson["rssi"] = rssi / -2.0;
-        djson["snr"] = snr;
-        djson["lna"] = lna;
-        djson["afc"] = afc;
-
-        if (serializeJson(djson, sjson) == 0)
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        if (now.tv_sec < WS_CLOCK_VALID_SEC)
+            return false;
+        int64_t us = (int64_t)now.tv_sec * 1000000 + now.tv_usec - (esp_timer_get_time() - rxUs);
+        at.tv_sec = us / 1000000;
+        at.tv_usec = us % 1000000;
+        return true;
+    };
+
+    //JSON payload for MQTT written into buf, returns the length
+    virtual size_t mqttPayload(char *buf, size_t size)
+    {
+        FmtBuf json(buf, size);
+        json.str("{\"ts\":").i32(at.tv_sec);
+        json.str(",\"stType\":").u32(msgformat);
+        json.str(",\"stID\":").u32(stationID);
+        json.str(",\"T\":").fixed(temperature, 1);
+        json.str(",\"rh\":").u32(humidity);
+        json.str(",\"winddir\":").u32(winddir);
+        json.str(",\"wind\":").fixed(windspeed, 1);
+        json.str(",\"wind1m\":").fixed(windspeed1m, 1);
+        json.str(",\"gust\":").fixed(windgust, 1);
+        json.str(",\"gust1m\":").fixed(windgust1m, 1);
+        json.str(",\"rain\":").fixed(rain, 1);
+        json.str(",\"rain1h\":").fixed(rain1h, 1);
+        json.str(",\"lux\":").u32(lightlux);
+        json.str(",\"UV\":").u32(UVraw);
+        json.str(",\"UVI\":").u32(UVI);
+        json.str(",\"battery\":").u32(low_battery ? 0 : 100);
+        json.str(",\"dewpoint\":").fixed(dewpoint, 1);
+        json.str(",\"heatindex\":").fixed(heatindex, 1);
+        json.str(",\"windchill\":").fixed(windchill, 1);
+        json.str(",\"feelslike\":").fixed(feelslike, 1);
+        json.str(",\"solar\":").fixed(solar, 1);
+        json.str(",\"rainday\":").fixed(rainday, 1);
+        json.str(",\"rainrate\":").fixed(rainrate, 1);
+        json.str(",\"qf\":").u32(quality);
+        json.str(",\"rssi\":").fixed(-5 * rssi, 1);
+        json.str(",\"snr\":").u32(snr);
+        json.str(",\"lna\":").u32(lna);
+        json.str(",\"afc\":").i32(afc);
+        json.chr('}');
+
+        if (json.overflow())
         {
             printf("WSBase JSON serialization error");
         }
-        return sjson;
+        return json.length();
     };
 
     virtual void print()
     {
-        char fstr[30];
+        char fstr[16];
         printf("ID: %02x, ", stationID);
-        printf("T=%8s°C, ", ftoa(temperature, fstr, 1));
+        printf("T=%8s°C, ", FmtBuf(fstr, sizeof(fstr)).fixed(temperature, 1).c_str());
         printf("relH=%3d%%, ", humidity);
-        printf("Wvel=%5skm/h, ", ftoa(windspeed, fstr, 1));
-        printf("Wmax=%5skm/h, ", ftoa(windgust, fstr, 1));
+        printf("Wvel=%5skm/h, ", FmtBuf(fstr, sizeof(fstr)).fixed(windspeed, 1).c_str());
+        printf("Wmax=%5skm/h, ", FmtBuf(fstr, sizeof(fstr)).fixed(windgust, 1).c_str());
         printf("Wdir=%3d°, ", winddir);
-        printf("Rain=%6smm, ", ftoa(rain, fstr, 1));
+        printf("Rain=%6smm, ", FmtBuf(fstr, sizeof(fstr)).fixed(rain, 1).c_str());
         printf("UV=%5d, ", UVraw);
         printf("UVindex=%2d, ", UVI);
-        printf("Light=%6sW/m^2, ", ftoa(0.0079 * lightlux, fstr, 1));
+        printf("Light=%6sW/m^2, ", FmtBuf(fstr, sizeof(fstr)).fixed(fxMulDiv(lightlux, LUX_TO_WM2_NUM, LUX_TO_WM2_DEN), 1).c_str());
         (low_battery) ? printf("low battery") : printf("battery ok");
         printf("\n");
     }
@@ -242,6 +353,10 @@ public:
         - B: 8 bit Bitsum (sum without carry, XOR) of the 16 data bytes
         */
 
+        //the data bytes up to the CRC
+        if (len < LEN_WH2300 - 1)
+            return false;
+
         // station id
         stationID = buf[1];
         // winddirection
@@ -249,8 +364,7 @@ public:
         //low battery bit
         low_battery = (buf[3] & 0x08) >> 3;
         // temperature
-        int16_t temp = (((buf[3] & 0x07) << 8) | buf[4]) - 400;
-        temperature = temp * 0.1;
+        temperature = (((buf[3] & 0x07) << 8) | buf[4]) - 400;
         //humidity
         humidity = buf[5];
         //wind speed in km/h
@@ -258,18 +372,18 @@ public:
         //calibration revelaed that windspeed was reported factor 1.27 too high
         //new windspeedcorrectionfactor = 1.12 / 1.27 = 0.88.
         //1/1.12 = 0.89, close to calibrated 0.88. Was original factor applied wrongly?
-        windspeed = (((buf[3] & 0x10) << 4) | buf[6]) * 1.12 * 0.125 * 3.6;
+        windspeed = fxScale(((buf[3] & 0x10) << 4) | buf[6], BR1800_WIND_NUM, BR1800_WIND_DEN);
         //windspeed correction is applied in stationconfig.h
         //windspeed = (((buf[3] & 0x10) << 4) | buf[6]) * 0.88 * 0.125 * 3.6;
         //wind gust in km/h
-        windgust = buf[7] * 1.12 * 3.6;
+        windgust = fxScale(buf[7], BR1800_GUST_NUM, BR1800_GUST_DEN);
         //windgust = buf[7] * 0.88 * 3.6;
         //rainfall
-        rain = ((buf[8] << 8) | buf[9]) * 0.3;
+        rain = fxScale((buf[8] << 8) | buf[9], FO_RAIN_NUM, FO_RAIN_DEN);
         //uv intensity
         UVraw = (buf[10] << 8) | buf[11];
         //light intensity
-        lightlux = ((buf[12] << 16) | (buf[13] << 8) | buf[14]) / 10.0;
+        lightlux = fxScale((buf[12] << 16) | (buf[13] << 8) | buf[14], BR1800_LUX_NUM, BR1800_LUX_DEN);
 
         //WH24 tabel
         // UV value   UVI
@@ -336,6 +450,9 @@ public:
     bool decode(uint8_t fmt, uint8_t *sbuf, uint8_t len)
     {
         //const char *compass[] = {"N  ", "NNE", "NE ", "ENE", "E  ", "ESE", "SE ", "SSE", "S  ", "SSW", "SW ", "WSW", "W  ", "WNW", "NW ", "NNW"};
+        //the data bytes up to the CRC, the WS4000 has the wind direction in a ninth byte
+        if (len < (fmt == MSG_WS4000 ? LEN_WS4000 : LEN_WS3000) - 1)
+            return false;
         // station id
         stationID = ((sbuf[0] & 0x0F) << 4) | (sbuf[1] >> 4);
         // temperature in C
@@ -343,15 +460,15 @@ public:
         int16_t temp = ((sbuf[1] & 0x07) << 8) | sbuf[2];
         if (sign)
             temp = (~temp) + sign;
-        temperature = temp * 0.1;
+        temperature = temp;
         //humidity
         humidity = sbuf[3] & 0x7F;
         //wind speed in km/h
-        windspeed = sbuf[4] * 0.34 * 3.6;
+        windspeed = fxScale(sbuf[4], WH1080_WIND_NUM, WH1080_WIND_DEN);
         //wind gust in km/h
-        windgust = sbuf[5] * 0.34 * 3.6;
+        windgust = fxScale(sbuf[5], WH1080_WIND_NUM, WH1080_WIND_DEN);
         //rainfall in mm
-        rain = (((sbuf[6] & 0x0F) << 8) | sbuf[7]) * 0.3;
+        rain = fxScale(((sbuf[6] & 0x0F) << 8) | sbuf[7], FO_RAIN_NUM, FO_RAIN_DEN);
 
         if (fmt == MSG_WS4000)
         {
@@ -377,15 +494,15 @@ public:
 
     virtual void print()
     {
-        char fstr[30];
+        char fstr[16];
         printf("%d\n\n", stationID);
         printf("ID: %02x, ", stationID);
-        printf("T=%8s°C, ", ftoa(temperature, fstr, 1));
+        printf("T=%8s°C, ", FmtBuf(fstr, sizeof(fstr)).fixed(temperature, 1).c_str());
         printf("relH=%3d%%, ", humidity);
-        printf("Wvel=%5skm/h, ", ftoa(windspeed, fstr, 1));
-        printf("Wmax=%5skm/h, ", ftoa(windgust, fstr, 1));
+        printf("Wvel=%5skm/h, ", FmtBuf(fstr, sizeof(fstr)).fixed(windspeed, 1).c_str());
+        printf("Wmax=%5skm/h, ", FmtBuf(fstr, sizeof(fstr)).fixed(windgust, 1).c_str());
         printf("Wdir=%3d°, ", winddir);
-        printf("Rain=%6smm, ", ftoa(rain, fstr, 1));
+        printf("Rain=%6smm, ", FmtBuf(fstr, sizeof(fstr)).fixed(rain, 1).c_str());
         (low_battery) ? printf("low battery") : printf("battery ok");
         printf("\n");
     }
@@ -415,6 +532,9 @@ public:
 
     bool decode(uint8_t fmt, uint8_t *sbuf, uint8_t len)
     {
+        //the radio delivers up to 66 bytes, only the frame up to the checks is kept
+        if (len > sizeof(buf))
+            len = sizeof(buf);
         for (int i = 0; i < len; i++)
         {
             buf[i] = sbuf[i];
@@ -423,29 +543,27 @@ public:
         return false;
     };
 
-    virtual std::string mqttPayload()
+    virtual size_t mqttPayload(char *pbuf, size_t size)
     {
-        char hexstr[3 * length + 1];
-        hexstr[3 * length] = 0;
+        FmtBuf json(pbuf, size);
+        json.str("{\"ts\":").i32(at.tv_sec);
+        json.str(",\"stType\":").u32(msgformat);
+        json.str(",\"stID\":").u32(stationID);
+        json.str(",\"buf\":\"");
         for (int j = 0; j < length; j++)
-            sprintf(&hexstr[3 * j], " %02X", buf[j]);
-
-        std::string sjson;
-        DynamicJsonDocument djson(2048);
-        djson["ts"] = at.tv_sec;
-        djson["stType"] = msgformat;
-        djson["stID"] = stationID;
-        djson["buf"] = hexstr;
-        djson["rssi"] = rssi / -2.0;
-        djson["snr"] = snr;
-        djson["lna"] = lna;
-        djson["afc"] = afc;
-
-        if (serializeJson(djson, sjson) == 0)
+            json.chr(' ').hex2(buf[j]);
+        json.chr('"');
+        json.str(",\"rssi\":").fixed(-5 * rssi, 1);
+        json.str(",\"snr\":").u32(snr);
+        json.str(",\"lna\":").u32(lna);
+        json.str(",\"afc\":").i32(afc);
+        json.chr('}');
+
+        if (json.overflow())
         {
             printf("WSBase JSON serialization error");
         }
-        return sjson;
+        return json.length();
     };
     virtual void print()
     {
@@ -458,12 +576,28 @@ public:
     }
 };
 
+//message families for the crc failure counts
+enum WSFamily
+{
+    WSF_WS3000,
+    WSF_WS4000,
+    WSF_WH2300,
+    WSF_UNKNOWN, //no valid crc at any length
+    WSF_COUNT
+};
+
+static const char *const wsFamilyNames[WSF_COUNT] = {"ws3000", "ws4000", "wh2300", "unknown"};
+
 //Singleton class interpeting the raw buffer to determine type of weatherstation
 class WeatherStationProcessor
 {
-    uint32_t nWsSignals = 0;
-    uint32_t nWsSignalsOK = 0;
+public:
+    //updated by the radio task, read by the UI for the crc failure ratio
+    Counter nWsSignals;
+    Counter nWsSignalsOK;
+    Counter crcFail[WSF_COUNT];
 
+    //public for the host tools, they do not depend on the state of the processor
     uint8_t _crc8(volatile uint8_t *addr, uint8_t len)
     {
         uint8_t crc = 0;
@@ -495,14 +629,13 @@ class WeatherStationProcessor
         return checksum;
     }
 
-public:
-    WSBase *processWSPacket(uint8_t *buf, int length, struct timeval rxAt, int8_t rxrssi, uint8_t rxsnr, uint8_t rxlna, int32_t rxafc)
+    WSBase *processWSPacket(uint8_t *buf, int length, int64_t rxUs, int8_t rxrssi, uint8_t rxsnr, uint8_t rxlna, int32_t rxafc)
     {
         WSBase *wsObject = nullptr;
 
         if (length > 7)
         {
-            nWsSignals++;
+            nWsSignals.inc();
             uint8_t crc_ok = 0;
             bool checksum_ok = false;
             uint8_t mt = buf[0] >> 4;
@@ -515,9 +648,11 @@ public:
             case 0x5:
             case 0x6:
             {
-                crc_ok = buf[8] == _crc8(&buf[0], 8);
+                crc_ok = length >= LEN_WS3000 && buf[8] == _crc8(&buf[0], 8);
                 if (crc_ok)
-                    nWsSignalsOK++;
+                    nWsSignalsOK.inc();
+                else
+                    crcFail[WSF_WS3000].inc();
                 printf(crc_ok ? "crc  ok " : "crc nok \n");
                 if (crc_ok)
                 {
@@ -529,9 +664,11 @@ public:
             case 0x0A:
             case 0x0B:
             {
-                crc_ok = buf[9] == _crc8(&buf[0], 9);
+                crc_ok = length >= LEN_WS4000 && buf[9] == _crc8(&buf[0], 9);
                 if (crc_ok)
-                    nWsSignalsOK++;
+                    nWsSignalsOK.inc();
+                else
+                    crcFail[WSF_WS4000].inc();
                 printf(crc_ok ? "crc  ok " : "crc nok\n");
                 if (crc_ok)
                 {
@@ -542,10 +679,13 @@ public:
             }
             case 0x24:
             {
-                crc_ok = buf[15] == _crc8(&buf[0], 15);
-                checksum_ok = buf[16] == _checksum(&buf[0], 16);
+                //a short packet is not checked against stale bytes of the previous one
+                crc_ok = length > LEN_WH2300 && buf[15] == _crc8(&buf[0], 15);
+                checksum_ok = length > LEN_WH2300 && buf[16] == _checksum(&buf[0], 16);
                 if (crc_ok && checksum_ok)
-                    nWsSignalsOK++;
+                    nWsSignalsOK.inc();
+                else
+                    crcFail[WSF_WH2300].inc();
                 printf(checksum_ok ? "crc + checksum  ok " : "crc + checksum nok\n");
                 crc_ok &= checksum_ok;
                 if (crc_ok)
@@ -570,21 +710,30 @@ public:
                             unkLen++;
                         }
                         //report out on succesful crc of unknown weather station
-                        UnknownFineOffset *unknown = new UnknownFineOffset(0xFF, length, buf);
+                        UnknownFineOffset *unknown = new UnknownFineOffset(0xFF, unkLen, buf);
                         wsObject = unknown;
                         break;
                     }
                 }
 
+                if (!wsObject)
+                    crcFail[WSF_UNKNOWN].inc();
                 break; //crc_ok=0;
             }
         }
 
         if (wsObject)
         {
-            wsObject->setRFStats(rxAt, rxrssi, rxsnr, rxlna, rxafc);
+            wsObject->setRFStats(rxUs, rxrssi, rxsnr, rxlna, rxafc);
         }
 
         return wsObject;
     }
 };
+
+//decoded packet handed from the radio task to the network task, which deletes ws
+struct WSRecord
+{
+    WSBase *ws;
+    uint8_t pkt[LEN_WH2300 + 1]; //raw packet of the longest decoded format
+};
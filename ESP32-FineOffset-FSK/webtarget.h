@@ -0,0 +1,129 @@
+// Upload targets with precompiled HTTP request templates
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// The request of each target is compiled once when the station configuration
+// changes. An upload copies the template and patches in the measurement fields,
+// so there is no String concatenation or heap allocation per upload.
+
+#ifndef WEBTARGET_H
+#define WEBTARGET_H
+
+#include <stdint.h>
+#include <mbedtls/md5.h>
+#include "fmtbuf.h"
+
+enum WebTargetType
+{
+    WT_WUNDERGROUND,
+    WT_DZ_TEMP,
+    WT_DZ_WIND,
+    WT_DZ_RAIN,
+    WT_DZ_LIGHT,
+    WT_DZ_UV,
+    WT_WINDGURU,
+    WT_COUNT
+};
+
+//metric labels
+static const char *const webTargetNames[WT_COUNT] = {"wunderground", "dzTemp", "dzWind", "dzRain", "dzLight", "dzUV", "windguru"};
+
+#define WT_TEMPLATE_MAX 320
+//template plus measurement fields
+#define WT_REQUEST_MAX (WT_TEMPLATE_MAX + 160)
+
+#define WT_HOST_MAX 50
+#define WT_USER_AGENT "G6EJDFailureDetectionFunction"
+
+//last upload of a target, not serialized
+//the ok and fail counts per target type are the uploadOk and uploadFail counters of the metrics registry
+struct WebStats
+{
+    int16_t lastStatus;  //HTTP status of the last upload, 0 when there was no valid response
+    uint32_t lastMs;     //duration of the last upload including connect
+    uint32_t maxMs;      //longest upload
+    uint32_t lastAt;     //millis() at the last upload
+
+    WebStats() : lastStatus(0), lastMs(0), maxMs(0), lastAt(0) {}
+
+    void record(int16_t status, uint32_t ms, uint32_t at)
+    {
+        lastStatus = status;
+        lastMs = ms;
+        if (ms > maxMs)
+            maxMs = ms;
+        lastAt = at;
+    }
+};
+
+struct WebTarget
+{
+    bool enabled;
+    char host[WT_HOST_MAX];
+    uint16_t port;
+    bool secure;
+
+    //request template, the measurement fields are inserted at fieldsAt
+    char tmpl[WT_TEMPLATE_MAX];
+    uint16_t fieldsAt;
+    uint16_t tmplLen;
+
+    WebStats stats;
+
+    WebTarget() : enabled(false), port(0), secure(false), fieldsAt(0), tmplLen(0)
+    {
+        host[0] = 0;
+        tmpl[0] = 0;
+    }
+
+    //start compiling: returns a FmtBuf for the request line up to the fields
+    FmtBuf begin(const char *thost, uint16_t tport, bool tsecure)
+    {
+        FmtBuf(host, sizeof(host)).str(thost);
+        port = tport;
+        secure = tsecure;
+        FmtBuf head(tmpl, sizeof(tmpl));
+        head.str("GET ");
+        return head;
+    }
+
+    //finish compiling: mark the fields position and append the rest of the request
+    bool end(FmtBuf &head, const char *tail = "")
+    {
+        fieldsAt = head.length();
+        head.str(tail);
+        head.str(" HTTP/1.1\r\nHost: ").str(host);
+        head.str("\r\nUser-Agent: " WT_USER_AGENT "\r\nConnection: close\r\n\r\n");
+        tmplLen = head.length();
+        enabled = !head.overflow();
+        if (!enabled)
+            printf("WebTarget: request template for %s too long\n", host);
+        return enabled;
+    }
+
+    //head of the template, the caller appends the fields and then the tail
+    void head(FmtBuf &req) const
+    {
+        req.str(tmpl, fieldsAt);
+    }
+
+    void tail(FmtBuf &req) const
+    {
+        req.str(tmpl + fieldsAt, tmplLen - fieldsAt);
+    }
+};
+
+//MD5 over a fixed buffer as 32 lowercase hex digits plus terminating zero, no heap allocation
+static inline void md5Hex(const uint8_t *msg, size_t len, char *hex)
+{
+    static const char hexdigit[] = "0123456789abcdef";
+    uint8_t hash[16];
+    mbedtls_md5_ret(msg, len, hash);
+    for (int i = 0; i < 16; i++)
+    {
+        hex[2 * i] = hexdigit[hash[i] >> 4];
+        hex[2 * i + 1] = hexdigit[hash[i] & 0x0F];
+    }
+    hex[32] = 0;
+}
+
+#endif
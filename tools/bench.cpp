@@ -0,0 +1,454 @@
+// Micro benchmarks of the hot functions of the firmware
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Runs the decoders, station update, the payload and request builders and the
+// HTTP response parser of the firmware on a PC, one case per function and input. Each case is
+// calibrated to BENCH_MIN_NS per repetition and repeated BENCH_REPS times, the
+// median is reported, in ns and in cycles of the time stamp counter. The /double
+// cases are the double decoders of cyclebench.h, the target runs the same
+// comparison at boot when built with -DCYCLE_BENCH. The snprintf and std::to_string
+// cases are the formatting FmtBuf replaced, on the same numbers and on the
+// Wunderground URL. The allocations of operator new per iteration are counted
+// for every case. The results are written as JSON in the format of Google
+// Benchmark, so its compare.py can track regressions between two runs.
+//
+// Build (ArduinoJson 6 from the PlatformIO libdeps, mbedtls for the MD5 of Windguru):
+//   g++ -O2 -std=gnu++11 -Itools/host -IESP32-FineOffset-FSK -I.pio/libdeps/heltec_usb/ArduinoJson/src
+//       tools/bench.cpp -lmbedcrypto -o bench
+// Use:
+//   bench [-f filter] [-t seconds] [-o results.json] [-c]
+//   -f  only the cases with this text in the name
+//   -t  time of one repetition in seconds, default 0.05
+//   -o  write the results as JSON to this file
+//   -c  print the cycle table of the target, cycleBench() of cyclebench.h, instead
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Arduino.h>
+#include "weather.h"
+#include "stationconfig.h"
+#include "httpresponse.h"
+#include "cyclebench.h"
+
+#define BENCH_MIN_NS 50000000
+#define BENCH_REPS 5
+#define BENCH_FRAME_LEN (LEN_WH2300 + 1) //PayloadLength of SX1276ws
+
+//keep a value the compiler would otherwise optimize away
+template <typename T>
+static inline void keep(const T &v)
+{
+    asm volatile("" : : "r,m"(v) : "memory");
+}
+
+//allocations of operator new, the bytes are taken from malloc, not inlined so
+//the compiler does not pair malloc and delete
+static uint64_t newCalls = 0;
+
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    newCalls++;
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void *ptr) noexcept { free(ptr); }
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete[](void *ptr) noexcept { operator delete(ptr); }
+
+struct BenchResult
+{
+    std::string name;
+    uint64_t iterations;
+    double realNs; //median of the repetitions, per iteration
+    double cycles; //time stamp counter, median per iteration
+    double allocs; //operator new per iteration
+    double cpuNs;
+    double minNs;
+    double maxNs;
+};
+
+static std::vector<BenchResult> results;
+static const char *filter = nullptr;
+static double repNs = BENCH_MIN_NS;
+static FILE *out = stdout;
+
+//time stamp counter, 0 where there is none
+static inline uint64_t tscNow()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static double cpuNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//run f iterations times, returns the wall time in ns
+template <typename F>
+static double timeRun(F &f, uint64_t iterations, double &cpuNs, double &cycles)
+{
+    double c0 = cpuNow();
+    auto t0 = std::chrono::steady_clock::now();
+    uint64_t tsc0 = tscNow();
+    for (uint64_t i = 0; i < iterations; i++)
+        f();
+    cycles = tscNow() - tsc0;
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    cpuNs = cpuNow() - c0;
+    return ns;
+}
+
+template <typename F>
+static void bench(const char *name, F f)
+{
+    if (filter && !strstr(name, filter))
+        return;
+    //calibrate the iterations of a repetition
+    double cpuNs, cycles;
+    uint64_t iterations = 1;
+    double ns = timeRun(f, iterations, cpuNs, cycles);
+    while (ns < repNs / 10)
+    {
+        iterations *= ns > 0 && repNs / 10 / ns < 10 ? 2 : 10;
+        ns = timeRun(f, iterations, cpuNs, cycles);
+    }
+    iterations = std::max<uint64_t>(1, iterations * repNs / ns);
+
+    std::vector<double> real, cpu, cyc;
+    uint64_t newBefore = newCalls;
+    for (int r = 0; r < BENCH_REPS; r++)
+    {
+        real.push_back(timeRun(f, iterations, cpuNs, cycles) / iterations);
+        cpu.push_back(cpuNs / iterations);
+        cyc.push_back(cycles / iterations);
+    }
+    double allocs = (double)(newCalls - newBefore) / (iterations * BENCH_REPS);
+    std::sort(real.begin(), real.end());
+    std::sort(cpu.begin(), cpu.end());
+    std::sort(cyc.begin(), cyc.end());
+    BenchResult res = {name, iterations, real[BENCH_REPS / 2], cyc[BENCH_REPS / 2], allocs, cpu[BENCH_REPS / 2], real.front(),
+                       real.back()};
+    results.push_back(res);
+    fprintf(out, "%-40s %12.1f %12.1f %10.2f %12.1f %12.1f %12llu\n", name, res.realNs, res.cycles, res.allocs, res.minNs,
+            res.maxNs, (unsigned long long)iterations);
+    fflush(out);
+}
+
+//Google Benchmark JSON
+static bool writeJson(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return false;
+    char date[32], host[64] = "";
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    gethostname(host, sizeof(host) - 1);
+    fprintf(f, "{\n  \"context\": {\n");
+    fprintf(f, "    \"date\": \"%s\",\n    \"host_name\": \"%s\",\n    \"executable\": \"bench\",\n", date, host);
+    fprintf(f, "    \"num_cpus\": %u,\n    \"mhz_per_cpu\": 0,\n", std::thread::hardware_concurrency());
+#ifdef __OPTIMIZE__
+    fprintf(f, "    \"library_build_type\": \"release\"\n");
+#else
+    fprintf(f, "    \"library_build_type\": \"debug\"\n");
+#endif
+    fprintf(f, "  },\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult &r = results[i];
+        fprintf(f, "    {\n      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n      \"run_type\": \"iteration\",\n",
+                r.name.c_str(), r.name.c_str());
+        fprintf(f, "      \"repetitions\": %d,\n      \"iterations\": %llu,\n", BENCH_REPS, (unsigned long long)r.iterations);
+        fprintf(f, "      \"real_time\": %.3f,\n      \"cpu_time\": %.3f,\n", r.realNs, r.cpuNs);
+        fprintf(f, "      \"cycles\": %.1f,\n      \"allocs\": %.2f,\n", r.cycles, r.allocs);
+        fprintf(f, "      \"min_time\": %.3f,\n      \"max_time\": %.3f,\n      \"time_unit\": \"ns\"\n", r.minNs, r.maxNs);
+        fprintf(f, "    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+WeatherStationProcessor wsProcessor;
+
+//frame with a valid CRC, and checksum for WH24, the tail padded as by the radio
+static void makeFrame(uint8_t *frame, const uint8_t *data, int len, bool sum)
+{
+    memset(frame, 0x5A, BENCH_FRAME_LEN);
+    memcpy(frame, data, len);
+    frame[len] = wsProcessor._crc8(frame, len);
+    if (sum)
+        frame[len + 1] = wsProcessor._checksum(frame, len + 1);
+}
+
+//station with all upload targets, as configured through MQTT
+static WSSetting *uploadStation(uint16_t wsType, WSBase *data)
+{
+    WSSetting *st = WSConfig::create(wsType);
+    st->wsType = wsType;
+    st->wsID = data->stationID;
+    st->wunderground = true;
+    strncpy(st->wuID, "IUTRECH1", sizeof(st->wuID) - 1);
+    strncpy(st->wuPW, "secret", sizeof(st->wuPW) - 1);
+    st->domoticz = true;
+    strncpy(st->dzURL, "192.168.1.10", sizeof(st->dzURL) - 1);
+    st->dzPort = 8080;
+    st->dzSecure = false;
+    strncpy(st->dzID, "dXNlcg==", sizeof(st->dzID) - 1);
+    strncpy(st->dzPW, "cGFzcw==", sizeof(st->dzPW) - 1);
+    st->dzTHidx = 101;
+    st->dzWidx = 102;
+    st->dzRidx = 103;
+    st->dzLidx = 104;
+    st->dzUVidx = 105;
+    st->windguru = true;
+    strncpy(st->wgUID, "stationXY", sizeof(st->wgUID) - 1);
+    strncpy(st->wgPW, "supersecret", sizeof(st->wgPW) - 1);
+    st->compileTargets();
+    st->update(data, nullptr);
+    return st;
+}
+
+int main(int argc, char **argv)
+{
+    const char *jsonPath = nullptr;
+    for (int a = 1; a < argc; a++)
+    {
+        if (!strcmp(argv[a], "-f") && a + 1 < argc)
+            filter = argv[++a];
+        else if (!strcmp(argv[a], "-t") && a + 1 < argc)
+            repNs = atof(argv[++a]) * 1e9;
+        else if (!strcmp(argv[a], "-o") && a + 1 < argc)
+            jsonPath = argv[++a];
+        else if (!strcmp(argv[a], "-c"))
+        {
+            cycleBench();
+            return 0;
+        }
+        else
+        {
+            printf("usage: %s [-f filter] [-t seconds] [-o results.json] [-c]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    //the results go to the original stdout, the log of the firmware is discarded
+    out = fdopen(dup(fileno(stdout)), "w");
+    if (!freopen("/dev/null", "w", stdout))
+        return 1;
+    fprintf(out, "%-40s %12s %12s %10s %12s %12s %12s\n", "case", "ns/op", "cycles/op", "allocs/op", "min", "max", "iterations");
+
+    //frames of each family
+    static const uint8_t ws3000Data[] = {0x5A, 0x12, 0x34, 0x56, 0x07, 0x08, 0x09, 0x20};
+    static const uint8_t ws4000Data[] = {0xA5, 0xA2, 0x0B, 0x3C, 0x04, 0x09, 0x01, 0x2A, 0x06};
+    static const uint8_t wh24Data[] = {0x24, 0x3C, 0xB4, 0x82, 0x2E, 0x3F, 0x05, 0x09, 0x00, 0x51, 0x01, 0x7C, 0x00, 0x4E, 0x20};
+    static const uint8_t unknownData[] = {0x31, 0x47, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88};
+    uint8_t ws3000[BENCH_FRAME_LEN], ws4000[BENCH_FRAME_LEN], wh24[BENCH_FRAME_LEN], unknown[BENCH_FRAME_LEN], bad[BENCH_FRAME_LEN];
+    makeFrame(ws3000, ws3000Data, sizeof(ws3000Data), false);
+    makeFrame(ws4000, ws4000Data, sizeof(ws4000Data), false);
+    makeFrame(wh24, wh24Data, sizeof(wh24Data), true);
+    makeFrame(unknown, unknownData, sizeof(unknownData), false);
+    memcpy(bad, wh24, sizeof(bad));
+    bad[5] ^= 0x01;
+
+    //integrity checks
+    bench("crc8/8", [&]() { keep(wsProcessor._crc8(ws3000, 8)); });
+    bench("crc8/15", [&]() { keep(wsProcessor._crc8(wh24, 15)); });
+    bench("checksum/16", [&]() { keep(wsProcessor._checksum(wh24, 16)); });
+
+    //decoders
+    BR1800 br1800;
+    WH1080 wh1080;
+    bench("BR1800::decode", [&]() { br1800.decode(MSG_WH2300, wh24, LEN_WH2300); keep(br1800.temperature); });
+    bench("WH1080::decode/ws3000", [&]() { wh1080.decode(MSG_WS3000, ws3000, LEN_WS3000); keep(wh1080.temperature); });
+    bench("WH1080::decode/ws4000", [&]() { wh1080.decode(MSG_WS4000, ws4000, LEN_WS4000); keep(wh1080.temperature); });
+    //the double arithmetic the fixed-point decoders replaced
+    CbDoubleReading reading;
+    bench("BR1800::decode/double", [&]() { cbDecodeBR1800Double(wh24, reading); keep(reading); });
+    bench("WH1080::decode/double", [&]() { cbDecodeWH1080Double(ws3000, reading); keep(reading); });
+
+    //radio path: check, decode and allocate, the network task deletes
+    struct
+    {
+        const char *name;
+        uint8_t *frame;
+    } families[] = {{"processWSPacket/ws3000", ws3000}, {"processWSPacket/ws4000", ws4000},
+                    {"processWSPacket/wh24", wh24}, {"processWSPacket/unknown", unknown}, {"processWSPacket/badcrc", bad}};
+    for (auto &fam : families)
+    {
+        uint8_t *frame = fam.frame;
+        bench(fam.name, [&]() {
+            WSBase *ws = wsProcessor.processWSPacket(frame, BENCH_FRAME_LEN, esp_timer_get_time(), 120, 30, 1, -1200);
+            keep(ws);
+            delete ws;
+        });
+    }
+
+    WSBase *wsWH24 = wsProcessor.processWSPacket(wh24, BENCH_FRAME_LEN, esp_timer_get_time(), 120, 30, 1, -1200);
+    WSBase *wsWS3000 = wsProcessor.processWSPacket(ws3000, BENCH_FRAME_LEN, esp_timer_get_time(), 120, 30, 1, 800);
+    WSBase *wsUnknown = wsProcessor.processWSPacket(unknown, BENCH_FRAME_LEN, esp_timer_get_time(), 120, 30, 1, 0);
+    if (!wsWH24 || !wsWS3000 || !wsUnknown)
+    {
+        fprintf(out, "bench: test frames do not decode\n");
+        return 1;
+    }
+
+    //station update with the rain history holding depth entries: one packet per 3600/depth s
+    static const int depths[] = {75, 225, 900, 3600};
+    for (int depth : depths)
+    {
+        WSSetting *st = WSConfig::create(MSG_WH2300);
+        int64_t stepUs = 3600000000LL / depth;
+        for (int i = 0; i <= depth; i++)
+        {
+            wsWH24->rxUs += stepUs;
+            st->update(wsWH24, wh24);
+        }
+        char name[48];
+        snprintf(name, sizeof(name), "WSSetting::update/history:%d", depth);
+        bench(name, [&]() {
+            wsWH24->rxUs += stepUs;
+            st->update(wsWH24, wh24);
+        });
+        delete st->wsp;
+        delete st;
+    }
+
+    //burst of 6 repeats of a WH1080
+    WSWH1080 *burst = (WSWH1080 *)WSConfig::create(MSG_WS3000);
+    for (int i = 0; i < 6; i++)
+    {
+        wsWS3000->rxUs += 60000;
+        burst->update(wsWS3000, ws3000);
+    }
+    bench("WSWH1080::validatePackets", [&]() { burst->validatePackets(); keep(burst->wsp->temperature); });
+
+    //MQTT payloads
+    char payload[WS_PAYLOAD_MAX];
+    wsWH24->setWallClock();
+    wsUnknown->setWallClock();
+    bench("mqttPayload/wh24", [&]() { keep(wsWH24->mqttPayload(payload, sizeof(payload))); });
+    bench("mqttPayload/ws3000", [&]() { keep(wsWS3000->mqttPayload(payload, sizeof(payload))); });
+    bench("mqttPayload/unknown", [&]() { keep(wsUnknown->mqttPayload(payload, sizeof(payload))); });
+
+    //upload requests of each target
+    WSSetting *uploads = uploadStation(MSG_WH2300, wsWH24);
+    char request[WT_REQUEST_MAX];
+    for (int t = 0; t < WT_COUNT; t++)
+    {
+        char name[48];
+        snprintf(name, sizeof(name), "request/%s", webTargetNames[t]);
+        bench(name, [&]() { keep(uploads->request(t, request, sizeof(request))); });
+    }
+
+    //HTTP responses of the upload targets, in one piece and split in two at every offset
+    static const char *responses[][2] = {
+        {"wunderground", "HTTP/1.1 200 OK\r\nDate: Mon, 12 Oct 2020 10:00:00 GMT\r\nContent-Type: text/plain\r\n"
+                         "Content-Length: 8\r\nConnection: close\r\n\r\nsuccess\n"},
+        {"chunked", "HTTP/1.1 200 OK\r\nContent-Type: application/json;charset=UTF-8\r\nTransfer-Encoding: chunked\r\n\r\n"
+                    "16\r\n{\n   \"status\" : \"OK\",\n\r\n17\r\n   \"title\" : \"Update\"\n}\r\n0\r\n\r\n"},
+        {"continue", "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nOK"}};
+    for (auto &resp : responses)
+    {
+        const uint8_t *data = (const uint8_t *)resp[1];
+        size_t size = strlen(resp[1]);
+        HttpResponse check;
+        if (check.feed(data, size) != size || !check.done())
+        {
+            fprintf(out, "bench: test response %s does not parse\n", resp[0]);
+            return 1;
+        }
+        char name[48];
+        snprintf(name, sizeof(name), "HttpResponse::feed/%s", resp[0]);
+        bench(name, [&]() {
+            HttpResponse response;
+            response.feed(data, size);
+            keep(response.status);
+        });
+        //one iteration parses the response size times
+        snprintf(name, sizeof(name), "HttpResponse::feed/%s/splits", resp[0]);
+        bench(name, [&]() {
+            for (size_t split = 0; split < size; split++)
+            {
+                HttpResponse response;
+                response.feed(data, split);
+                response.feed(data + split, size - split);
+                keep(response.status);
+            }
+        });
+    }
+
+    //formatting and helpers
+    char text[32];
+    int32_t v = -123456;
+    bench("FmtBuf::fixed/1", [&]() { keep(FmtBuf(text, sizeof(text)).fixed(v, 1).length()); });
+    bench("FmtBuf::fixed/3", [&]() { keep(FmtBuf(text, sizeof(text)).fixed(v, 3).length()); });
+    bench("FmtBuf::u32", [&]() { keep(FmtBuf(text, sizeof(text)).u32(4000000000u).length()); });
+    //the formatting FmtBuf replaced
+    bench("snprintf/fixed/1", [&]() { keep(snprintf(text, sizeof(text), "%.1f", v * 0.1)); });
+    bench("snprintf/fixed/3", [&]() { keep(snprintf(text, sizeof(text), "%.3f", v * 0.001)); });
+    bench("snprintf/u32", [&]() { keep(snprintf(text, sizeof(text), "%u", 4000000000u)); });
+    bench("std::to_string/fixed/1", [&]() { keep(std::to_string(v * 0.1f).size()); });
+    bench("std::to_string/u32", [&]() { keep(std::to_string(4000000000u).size()); });
+
+    //the Wunderground URL with FmtBuf, snprintf and std::string as before FmtBuf
+    const WSBase *w = uploads->wsp;
+    static const char *urlHead = "/weatherstation/updateweatherstation.php?ID=IUTRECH1&PASSWORD=secret&dateutc=now";
+    char url[WT_REQUEST_MAX];
+    bench("url/wunderground/FmtBuf", [&]() {
+        FmtBuf u(url, sizeof(url));
+        u.str(urlHead);
+        uploads->fieldsWunderground(u);
+        u.str("&action=updateraw");
+        keep(u.length());
+    });
+    bench("url/wunderground/snprintf", [&]() {
+        keep(snprintf(url, sizeof(url),
+                      "%s&tempf=%.1f&humidity=%u&dewptf=%.1f&rainin=%.3f&dailyrainin=%.3f&winddir=%u&windspeedmph=%.1f"
+                      "&windgustmph=%.1f&UV=%u&solarradiation=%.1f&action=updateraw",
+                      urlHead, w->temperature * 0.18 + 32, w->humidity, w->dewpoint * 0.18 + 32, w->rain1h / 254.0,
+                      w->rainday / 254.0, w->winddir, w->windspeed1m * 0.0621371, w->windgust1m * 0.0621371, w->UVI,
+                      w->solar * 0.1));
+    });
+    bench("url/wunderground/std::string", [&]() {
+        std::string s;
+        s = s + urlHead + "&tempf=" + std::to_string(w->temperature * 0.18f + 32) + "&humidity=" + std::to_string(w->humidity) +
+            "&dewptf=" + std::to_string(w->dewpoint * 0.18f + 32) + "&rainin=" + std::to_string(w->rain1h / 254.0f) +
+            "&dailyrainin=" + std::to_string(w->rainday / 254.0f) + "&winddir=" + std::to_string(w->winddir) +
+            "&windspeedmph=" + std::to_string(w->windspeed1m * 0.0621371f) +
+            "&windgustmph=" + std::to_string(w->windgust1m * 0.0621371f) + "&UV=" + std::to_string(w->UVI) +
+            "&solarradiation=" + std::to_string(w->solar * 0.1f) + "&action=updateraw";
+        keep(s.size());
+    });
+    uint16_t wind = 0;
+    bench("beaufort", [&]() {
+        wind = (wind + 37) % 1300;
+        keep(beaufort(wind));
+    });
+
+    fflush(stdout);
+    if (jsonPath && !writeJson(jsonPath))
+    {
+        fprintf(out, "bench: cannot write %s\n", jsonPath);
+        return 1;
+    }
+    return 0;
+}
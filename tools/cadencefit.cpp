@@ -0,0 +1,272 @@
+// Test of the cadence fit and the fingerprint on synthetic arrival times
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Generates the arrival times of stations with a known period, crystal drift,
+// timestamp jitter and lost bursts, feeds them to Cadence and Fingerprint of
+// cadence.h and fingerprint.h and checks the fit against the truth:
+//  - the period, and so the drift, within the error a least squares fit of the
+//    received bursts can have: 6 sigma of the slope for uniform jitter plus
+//    the rounding to whole us
+//  - the jitter estimate at most the jitter of the timestamps
+//  - the next arrival predicted within the jitter and the period error
+//  - the repeats of a WH1080 burst do not count as bursts, and the fit starts
+//    over only after a lock on a multiple of the period
+//  - a silence of more than CADENCE_GAP_US starts a new fit
+//  - a second transmitter with the same ID, off the phase of the station and
+//    with another crystal, collides; the station itself never does
+//  - the same station after a battery change, with a new phase, matches on
+//    its period
+// Jitter of 50 us is that of the SyncAddress interrupt timestamp, 2000 us that
+// of a timestamp taken after polling the FIFO. A burst is either received from
+// its first frame or lost as a whole. While every interval received spans a
+// multiple m of the period, m the greatest common divisor of the numbers of the
+// bursts in the fit, the fit can only find m times the period: it is checked
+// against that, and the prediction and collisions only once m is 1.
+//
+// Build:
+//   g++ -O2 -std=gnu++11 -IESP32-FineOffset-FSK tools/cadencefit.cpp -o cadencefit
+// Use:
+//   cadencefit [-r runs] [-s seed]
+//   -r  stations per scenario, default 1000
+//   -s  random seed, default 1
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+
+#include "cadence.h"
+#include "fingerprint.h"
+
+#define CF_BURSTS 40          //bursts per station
+#define CF_DRIFT_PPM 50       //crystal tolerance of a station
+#define CF_REPEATS 6          //frames of a WH1080 burst
+#define CF_REPEAT_US 60000    //start to start of the frames of a burst
+#define CF_SIGMA 6            //tolerance of the fit in standard deviations
+
+struct Scenario
+{
+    const char *name;
+    uint32_t nominalUs; //transmit interval of the family
+    uint32_t jitterUs;  //timestamps uniform within +-jitterUs
+    double loss;        //fraction of bursts lost
+    uint8_t repeats;    //frames per burst
+};
+
+static const Scenario scenarios[] = {
+    {"wh24-16s-interrupt", 16000000, 50, 0.05, 1},
+    {"wh24-16s-polled", 16000000, 2000, 0.05, 1},
+    {"wh1080-48s-interrupt", 48000000, 50, 0.05, CF_REPEATS},
+    {"wh1080-48s-polled", 48000000, 2000, 0.05, CF_REPEATS},
+    {"wh24-16s-lossy", 16000000, 2000, 0.4, 1},
+};
+
+static std::mt19937_64 rng;
+static int failures = 0;
+
+static int gcd(int a, int b)
+{
+    while (b)
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+//the multiple of the period the last n received bursts determine
+static int multiple(const int *ks, int received, int n)
+{
+    int m = 0;
+    for (int i = received - n + 1; i < received; i++)
+        m = gcd(m, ks[i] - ks[i - 1]);
+    return m ? m : 1;
+}
+
+static double uniform(double lo, double hi)
+{
+    return std::uniform_real_distribution<double>(lo, hi)(rng);
+}
+
+static void fail(const Scenario &sc, int run, const char *what, double expected, double got)
+{
+    if (failures++ < 20)
+        printf("  %s run %d: %s, expected %.1f got %.1f\n", sc.name, run, what, expected, got);
+}
+
+//a transmitter: its true period and the time of burst k
+struct Transmitter
+{
+    double periodUs;
+    double phaseUs;
+    int32_t afc;
+
+    int64_t at(int k, uint32_t jitterUs) const
+    {
+        return (int64_t)llround(phaseUs + k * periodUs + uniform(-(double)jitterUs, jitterUs));
+    }
+};
+
+//allowed error of the fitted period in us, n received bursts, uniform jitter
+static double periodTolerance(uint8_t n, uint32_t jitterUs)
+{
+    double sigma = jitterUs / sqrt(3.0);
+    //slope of a least squares fit over n consecutive bursts, the lost ones only widen the spread
+    double spread = sqrt(n * ((double)n * n - 1) / 12);
+    return CF_SIGMA * sigma / spread + 1;
+}
+
+struct Errors
+{
+    double periodUs;
+    double driftPpm;
+    uint32_t jitterUs;
+    double phaseUs;
+};
+
+static void runStation(const Scenario &sc, int run, Errors &worst)
+{
+    Transmitter station;
+    double ppm = uniform(-CF_DRIFT_PPM, CF_DRIFT_PPM);
+    station.periodUs = sc.nominalUs * (1 + ppm * 1e-6);
+    station.phaseUs = uniform(1e6, 1e9);
+    station.afc = (int32_t)uniform(-8000, 8000);
+
+    //another station with the same ID, off phase and with another crystal
+    Transmitter other;
+    other.periodUs = sc.nominalUs * (1 + uniform(-CF_DRIFT_PPM, CF_DRIFT_PPM) * 1e-6);
+    other.phaseUs = station.phaseUs + uniform(2 * FP_PHASE_US, sc.nominalUs - 2 * FP_PHASE_US);
+    other.afc = station.afc + (rng() & 1 ? 1 : -1) * (int32_t)uniform(FP_AFC_HZ + 500, 8000);
+
+    Fingerprint fp;
+    int ks[CF_BURSTS];
+    int received = 0;
+    int64_t lastUs = 0;
+    for (int k = 0; k < CF_BURSTS; k++)
+    {
+        if (uniform(0, 1) < sc.loss)
+            continue;
+        int64_t t = station.at(k, sc.jitterUs);
+        const Cadence &cad = fp.cadence;
+        uint8_t before = cad.bursts();
+        int m = multiple(ks, received, before);
+
+        //prediction of this burst from the fit so far
+        if (cad.locked() && m == 1)
+        {
+            double periodErr = fabs(cad.periodUs() - station.periodUs);
+            double allowed = 2.0 * sc.jitterUs + 1 + (double)(t - lastUs) / station.periodUs * (periodErr + 1);
+            double phase = fabs((double)cad.phaseErrorUs(t));
+            if (phase > allowed)
+                fail(sc, run, "phase error of the next burst", allowed, phase);
+            if (phase > worst.phaseUs)
+                worst.phaseUs = phase;
+
+            //a burst of the other station is a collision, one of the station itself never
+            FpSample s = {other.at(k, sc.jitterUs), other.afc, 100, 200, 50};
+            if (s.rxUs - lastUs > CADENCE_BURST_US && s.rxUs - lastUs < 2 * (int64_t)cad.periodUs() && !fp.collides(s))
+                fail(sc, run, "other station not seen as a collision", 1, 0);
+            FpSample own = {t, station.afc, 100, 200, 50};
+            if (fp.collides(own))
+                fail(sc, run, "station collides with itself", 0, 1);
+        }
+
+        for (int r = 0; r < sc.repeats; r++)
+        {
+            FpSample s = {t + r * CF_REPEAT_US, station.afc, 100, 200, 50};
+            fp.add(s);
+        }
+        ks[received++] = k;
+        lastUs = t;
+
+        //one more burst, or a new fit after a lock on a multiple
+        uint8_t expected = before < CADENCE_HISTORY ? before + 1 : CADENCE_HISTORY;
+        if (cad.bursts() != expected && !(cad.bursts() == 1 && m > 1 && before >= CADENCE_LOCK))
+            fail(sc, run, "bursts counted", expected, cad.bursts());
+        if (!cad.locked())
+            continue;
+        m = multiple(ks, received, cad.bursts());
+        double tol = m * periodTolerance(cad.bursts(), sc.jitterUs);
+        double err = fabs(cad.periodUs() - m * station.periodUs);
+        if (err > tol)
+            fail(sc, run, "period error in us", tol, err);
+        if (err > worst.periodUs)
+            worst.periodUs = err;
+        if (m > 1)
+            continue;
+        double driftErr = fabs(cad.driftPpm(sc.nominalUs) - ppm);
+        if (driftErr > tol / sc.nominalUs * 1e6 + 1)
+            fail(sc, run, "drift error in ppm", tol / sc.nominalUs * 1e6 + 1, driftErr);
+        if (driftErr > worst.driftPpm)
+            worst.driftPpm = driftErr;
+        if (cad.jitterUs() > sc.jitterUs + 1)
+            fail(sc, run, "jitter estimate in us", sc.jitterUs, cad.jitterUs());
+        if (cad.jitterUs() > worst.jitterUs)
+            worst.jitterUs = cad.jitterUs();
+    }
+    if (!fp.cadence.locked() || multiple(ks, received, fp.cadence.bursts()) > 1)
+    {
+        fail(sc, run, "not locked after the bursts", CF_BURSTS, received);
+        return;
+    }
+
+    //a battery change: a new ID and phase, the crystal stays
+    Fingerprint after;
+    double restartUs = lastUs + 600e6 + uniform(0, sc.nominalUs);
+    for (int k = 0; k < CADENCE_HISTORY; k++)
+    {
+        int64_t t = (int64_t)llround(restartUs + k * station.periodUs + uniform(-(double)sc.jitterUs, sc.jitterUs));
+        FpSample s = {t, station.afc, 100, 200, 50};
+        after.add(s);
+    }
+    uint8_t checked;
+    uint8_t score = fp.match(after, checked);
+    if (checked < 3 || score != checked)
+        fail(sc, run, "station after a battery change does not match", checked, score);
+
+    //silent for longer than CADENCE_GAP_US, the fit starts over
+    Cadence cad = fp.cadence;
+    cad.add(lastUs + CADENCE_GAP_US + 1000000);
+    if (cad.bursts() != 1 || cad.locked())
+        fail(sc, run, "fit kept after a silence", 1, cad.bursts());
+}
+
+int main(int argc, char **argv)
+{
+    int runs = 1000;
+    uint64_t seed = 1;
+    for (int a = 1; a < argc; a++)
+    {
+        if (!strcmp(argv[a], "-r") && a + 1 < argc)
+            runs = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-s") && a + 1 < argc)
+            seed = strtoull(argv[++a], nullptr, 0);
+        else
+        {
+            printf("usage: %s [-r runs] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+    rng.seed(seed);
+
+    printf("%-22s %12s %12s %12s %12s\n", "scenario", "period us", "drift ppm", "jitter us", "phase us");
+    for (const Scenario &sc : scenarios)
+    {
+        Errors worst = {0, 0, 0, 0};
+        int before = failures;
+        for (int run = 0; run < runs; run++)
+            runStation(sc, run, worst);
+        printf("%-22s %12.1f %12.2f %12u %12.0f  %s\n", sc.name, worst.periodUs, worst.driftPpm, worst.jitterUs, worst.phaseUs,
+               failures == before ? "ok" : "FAIL");
+    }
+    printf("largest errors over %d stations per scenario\n", runs);
+    if (failures)
+    {
+        printf("cadencefit: %d failures\n", failures);
+        return 1;
+    }
+    printf("cadencefit: ok\n");
+    return 0;
+}
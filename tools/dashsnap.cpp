@@ -0,0 +1,253 @@
+// Snapshot test of the OLED dashboard pages
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Renders every page of dashpages.h with fixed values into the host
+// framebuffer of tools/host/heltec.h and compares the screen with the
+// snapshot in tools/snapshots/<page>.txt, 64 rows of 128 pixels, '#' lit.
+// A changed layout or label shows as a failed page, rerun with -u to accept
+// the new rendering and review the snapshot diff.
+//
+// OledView only redraws the fields that changed. After the snapshots every
+// page is updated with other values, and the incrementally redrawn screen must
+// equal a full render of the same values.
+//
+// Build:
+//   g++ -O2 -std=gnu++11 -Itools/host -IESP32-FineOffset-FSK tools/dashsnap.cpp -o dashsnap
+// Use, from the root of the repository:
+//   dashsnap [-u] [-d directory] [-p page]
+//   -u  write the snapshots instead of comparing
+//   -d  directory of the snapshots, default tools/snapshots
+//   -p  only the pages with this text in the name
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+#include "weather.h"
+#include "dashboard.h"
+#include "dashpages.h"
+
+struct Page
+{
+    const char *name;
+    std::function<void(DashPages &)> render;  //the snapshot
+    std::function<void(DashPages &)> update;  //other values, for the incremental redraw
+};
+
+static std::string screenText(const SSD1306Wire &display)
+{
+    std::string text;
+    for (int y = 0; y < HOST_OLED_HEIGHT; y++)
+    {
+        for (int x = 0; x < HOST_OLED_WIDTH; x++)
+            text += display.screen[y][x] ? '#' : '.';
+        text += '\n';
+    }
+    return text;
+}
+
+//render from a blank display, as when the page is shown
+static std::string renderFresh(const std::function<void(DashPages &)> &render)
+{
+    SSD1306Wire display;
+    OledView view;
+    DashPages pages(view);
+    render(pages);
+    view.flush(&display, true);
+    return screenText(display);
+}
+
+static bool readFile(const std::string &path, std::string &text)
+{
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f)
+        return false;
+    char buf[1024];
+    size_t n;
+    text.clear();
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        text.append(buf, n);
+    fclose(f);
+    return true;
+}
+
+//print the first differing rows, the snapshot above the rendering
+static void printDiff(const std::string &want, const std::string &got)
+{
+    size_t row = 0, a = 0, b = 0;
+    int shown = 0;
+    while (a < want.size() && b < got.size() && shown < 4)
+    {
+        size_t ea = want.find('\n', a), eb = got.find('\n', b);
+        std::string la = want.substr(a, ea - a), lb = got.substr(b, eb - b);
+        if (la != lb)
+        {
+            printf("  row %2u want %s\n  row %2u got  %s\n", (unsigned)row, la.c_str(), (unsigned)row, lb.c_str());
+            shown++;
+        }
+        if (ea == std::string::npos || eb == std::string::npos)
+            break;
+        a = ea + 1;
+        b = eb + 1;
+        row++;
+    }
+}
+
+static WSBase station(uint16_t msgformat, uint16_t id)
+{
+    WSBase ws;
+    ws.msgformat = msgformat;
+    ws.stationID = id;
+    ws.temperature = -25;
+    ws.humidity = 87;
+    ws.winddir = 292;
+    ws.windspeed = 123;
+    ws.windgust = 185;
+    ws.windspeed1m = 118;
+    ws.windgust1m = 234;
+    ws.rain = 3105;
+    ws.rain1h = 12;
+    ws.UVI = 3;
+    ws.lightlux = 45210;
+    ws.rssi = 180;
+    return ws;
+}
+
+static DashStation fieldsStation(const char *list)
+{
+    DashStation ds;
+    ds.ws = station(MSG_WH2300, 0xB4);
+    dashParseFields(list, ds.fields);
+    ds.receivedAt = 1;
+    return ds;
+}
+
+int main(int argc, char **argv)
+{
+    bool update = false;
+    std::string dir = "tools/snapshots";
+    const char *filter = nullptr;
+    for (int a = 1; a < argc; a++)
+    {
+        if (!strcmp(argv[a], "-u"))
+            update = true;
+        else if (!strcmp(argv[a], "-d") && a + 1 < argc)
+            dir = argv[++a];
+        else if (!strcmp(argv[a], "-p") && a + 1 < argc)
+            filter = argv[++a];
+        else
+        {
+            printf("usage: %s [-u] [-d directory] [-p page]\n", argv[0]);
+            return 1;
+        }
+    }
+    //the stale page shows local time
+    setenv("TZ", "UTC0", 1);
+    tzset();
+
+    WSBase calm = station(MSG_WS3000, 0x23);
+    WSBase storm = station(MSG_WS3000, 0x23);
+    storm.windspeed = 1034;
+    storm.winddir = 45;
+    storm.temperature = 183;
+    DashStation four = fieldsStation("wind,temp,rain1h,uv");
+    DashStation two = fieldsStation("temp,hum");
+    DashStation one = fieldsStation("gust");
+
+    std::vector<Page> pages = {
+        {"boot", [](DashPages &p) { p.test(true); }, [](DashPages &p) { p.test(false); }},
+        {"wind", [&](DashPages &p) { p.wind(calm, 0, true, true); }, [&](DashPages &p) { p.wind(storm, 0, true, true); }},
+        {"wind-offline", [&](DashPages &p) { p.wind(storm, 0, false, false); }, [&](DashPages &p) { p.wind(calm, 0, true, false); }},
+        {"fields-4", [&](DashPages &p) { p.fields(four, 1); },
+         [&](DashPages &p) {
+             DashStation ds = four;
+             ds.ws.windspeed = 1034;
+             ds.ws.temperature = -123;
+             p.fields(ds, 1);
+         }},
+        {"fields-2", [&](DashPages &p) { p.fields(two, 2); },
+         [&](DashPages &p) {
+             DashStation ds = two;
+             ds.ws.humidity = 100;
+             p.fields(ds, 2);
+         }},
+        {"fields-1", [&](DashPages &p) { p.fields(one, 3); },
+         [&](DashPages &p) {
+             DashStation ds = one;
+             ds.ws.windgust = 7;
+             p.fields(ds, 3);
+         }},
+        {"stale", [](DashPages &p) { p.stale(1600000000, true, false); }, [](DashPages &p) { p.stale(1600003723, false, false); }},
+        {"rf", [](DashPages &p) { p.rf(-105, 42, 35, 2); }, [](DashPages &p) { p.rf(-98, 1234, 1000, 0); }},
+        {"network", [](DashPages &p) { p.network("gateway", "192.168.1.20", true, -67); },
+         [](DashPages &p) { p.network("gateway", "192.168.1.20", false, -71); }},
+        {"network-offline", [](DashPages &p) { p.network(nullptr, nullptr, false, 0); },
+         [](DashPages &p) { p.network("a-much-longer-ssid-name", "10.0.0.2", true, -80); }},
+    };
+
+    int failed = 0, checked = 0;
+    for (const Page &page : pages)
+    {
+        if (filter && !strstr(page.name, filter))
+            continue;
+        checked++;
+        std::string got = renderFresh(page.render);
+        std::string path = dir + "/" + page.name + ".txt";
+        if (update)
+        {
+            FILE *f = fopen(path.c_str(), "w");
+            if (!f || fwrite(got.data(), 1, got.size(), f) != got.size() || fclose(f) != 0)
+            {
+                printf("%-16s cannot write %s\n", page.name, path.c_str());
+                return 1;
+            }
+            printf("%-16s written\n", page.name);
+        }
+        else
+        {
+            std::string want;
+            if (!readFile(path, want))
+            {
+                printf("%-16s FAIL no snapshot %s\n", page.name, path.c_str());
+                failed++;
+            }
+            else if (want != got)
+            {
+                printf("%-16s FAIL differs from %s\n", page.name, path.c_str());
+                printDiff(want, got);
+                failed++;
+            }
+            else
+                printf("%-16s ok\n", page.name);
+        }
+
+        //incremental redraw of the page with other values
+        SSD1306Wire display;
+        OledView view;
+        DashPages pages(view);
+        page.render(pages);
+        view.flush(&display, true);
+        page.update(pages);
+        view.flush(&display, true);
+        std::string fresh = renderFresh(page.update);
+        if (screenText(display) != fresh)
+        {
+            printf("%-16s FAIL incremental redraw differs from a full render\n", page.name);
+            printDiff(fresh, screenText(display));
+            failed++;
+        }
+    }
+
+    if (failed)
+    {
+        printf("dashsnap: %d of %d pages failed\n", failed, checked);
+        return 1;
+    }
+    printf("dashsnap: %d pages ok\n", checked);
+    return 0;
+}
@@ -0,0 +1,544 @@
+// Software FSK demodulator for recorded IQ captures
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Replaces the SX1276 on a PC: recorded IQ samples are demodulated and the
+// frames are fed to the decoders of the firmware (weather.h), so sensitivity and
+// decoder changes can be tested without hardware.
+//
+// Per channel the stream is processed in blocks:
+//  - mix the channel to baseband and low pass filter + decimate (FIR)
+//  - FM discriminator: (I[n-1]Q[n] - Q[n-1]I[n]) / |z[n]|^2
+//  - squelch on the power against the tracked noise floor
+//  - clock recovery at 17.241 kbps: bit slicer with a zero crossing DPLL
+//  - sync correlator on preamble + sync word AA 2D D4, as programmed in SX1276ws
+//  - frame of FSK_FRAME_LEN bytes with RSSI, SNR and frequency offset
+// The FIR and the discriminator have AVX2, SSE and NEON kernels.
+// Files and channels are processed in parallel, one job per file and channel.
+//
+// Build:
+//   g++ -O3 -march=native -std=gnu++11 -pthread -Itools/host -IESP32-FineOffset-FSK tools/fskdemod.cpp -o fskdemod
+// Use:
+//   fskdemod [-r rate] [-f offset]... [-F cu8|cs16] [-q] file...
+//   -r  sample rate in Hz, default 1024000
+//   -f  channel frequency relative to the center of the capture in Hz, default 0, repeat for more channels
+//   -F  sample format, default from the file extension, else cu8 (rtl_sdr)
+//   -q  do not print the decoded fields, only the frames and the MQTT payloads
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "weather.h"
+
+#define FSK_BITRATE 17241
+#define FSK_FRAME_LEN (LEN_WH2300 + 1) //PayloadLength of SX1276ws
+#define FSK_SYNC 0xAA2DD4              //last preamble byte and the 2 sync bytes
+#define FSK_CHANNEL_BW 100000          //low pass cutoff in Hz, deviation is about 40 kHz
+#define FSK_TAPS 32
+#define FSK_MIN_RATE 200000 //decimated rate, at least 10 samples per bit
+#define FSK_BLOCK 65536     //input samples per block
+#define FSK_SQUELCH 4.0f    //power against the noise floor to open the squelch (6 dB)
+#define FSK_DPLL_GAIN 0.3f
+
+enum SampleFormat
+{
+    SF_CU8,
+    SF_CS16
+};
+
+struct DemodConfig
+{
+    double rate;
+    SampleFormat format;
+    bool quiet;
+};
+
+//===== SIMD kernels
+
+//dot product of n floats
+static inline float dot(const float *a, const float *b, int n)
+{
+    int i = 0;
+    float sum = 0;
+#if defined(__AVX2__)
+    __m256 acc = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8)
+        acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    sum = _mm_cvtss_f32(s);
+#elif defined(__SSE2__)
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    sum = _mm_cvtss_f32(acc);
+#elif defined(__ARM_NEON)
+    float32x4_t acc = vdupq_n_f32(0);
+    for (; i + 4 <= n; i += 4)
+        acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    float32x2_t s = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    sum = vget_lane_f32(vpadd_f32(s, s), 0);
+#endif
+    for (; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+//FM discriminator and power of n samples, i[-1] and q[-1] must be valid
+static inline void discriminate(const float *i, const float *q, float *freq, float *power, int n)
+{
+    int k = 0;
+#if defined(__AVX2__)
+    const __m256 eps = _mm256_set1_ps(1e-12f);
+    for (; k + 8 <= n; k += 8)
+    {
+        __m256 i0 = _mm256_loadu_ps(i + k - 1), q0 = _mm256_loadu_ps(q + k - 1);
+        __m256 i1 = _mm256_loadu_ps(i + k), q1 = _mm256_loadu_ps(q + k);
+        __m256 p = _mm256_fmadd_ps(i1, i1, _mm256_mul_ps(q1, q1));
+        __m256 x = _mm256_fmsub_ps(i0, q1, _mm256_mul_ps(q0, i1));
+        _mm256_storeu_ps(freq + k, _mm256_div_ps(x, _mm256_add_ps(p, eps)));
+        _mm256_storeu_ps(power + k, p);
+    }
+#elif defined(__SSE2__)
+    const __m128 eps = _mm_set1_ps(1e-12f);
+    for (; k + 4 <= n; k += 4)
+    {
+        __m128 i0 = _mm_loadu_ps(i + k - 1), q0 = _mm_loadu_ps(q + k - 1);
+        __m128 i1 = _mm_loadu_ps(i + k), q1 = _mm_loadu_ps(q + k);
+        __m128 p = _mm_add_ps(_mm_mul_ps(i1, i1), _mm_mul_ps(q1, q1));
+        __m128 x = _mm_sub_ps(_mm_mul_ps(i0, q1), _mm_mul_ps(q0, i1));
+        _mm_storeu_ps(freq + k, _mm_div_ps(x, _mm_add_ps(p, eps)));
+        _mm_storeu_ps(power + k, p);
+    }
+#elif defined(__ARM_NEON)
+    const float32x4_t eps = vdupq_n_f32(1e-12f);
+    for (; k + 4 <= n; k += 4)
+    {
+        float32x4_t i0 = vld1q_f32(i + k - 1), q0 = vld1q_f32(q + k - 1);
+        float32x4_t i1 = vld1q_f32(i + k), q1 = vld1q_f32(q + k);
+        float32x4_t p = vmlaq_f32(vmulq_f32(q1, q1), i1, i1);
+        float32x4_t x = vmlsq_f32(vmulq_f32(i0, q1), q0, i1);
+        float32x4_t r = vrecpeq_f32(vaddq_f32(p, eps));
+        r = vmulq_f32(vrecpsq_f32(vaddq_f32(p, eps), r), r);
+        vst1q_f32(freq + k, vmulq_f32(x, r));
+        vst1q_f32(power + k, p);
+    }
+#endif
+    for (; k < n; k++)
+    {
+        float p = i[k] * i[k] + q[k] * q[k];
+        freq[k] = (i[k - 1] * q[k] - q[k - 1] * i[k]) / (p + 1e-12f);
+        power[k] = p;
+    }
+}
+
+//===== Demodulator of one channel
+
+class FskDemod
+{
+public:
+    uint32_t frames;
+    uint32_t decoded;
+
+    FskDemod(const DemodConfig &cfg, double offset, const char *name, std::mutex &out)
+        : frames(0), decoded(0), config(cfg), channel(name), outLock(out)
+    {
+        decim = 1;
+        while (cfg.rate / (decim * 2) >= FSK_MIN_RATE)
+            decim *= 2;
+        rate = cfg.rate / decim;
+        sps = (float)(rate / FSK_BITRATE);
+
+        //windowed sinc low pass, taps reversed for the dot product
+        float sum = 0;
+        for (int k = 0; k < FSK_TAPS; k++)
+        {
+            double m = k - (FSK_TAPS - 1) / 2.0;
+            double fc = FSK_CHANNEL_BW / cfg.rate;
+            double h = m == 0 ? 2 * fc : sin(2 * M_PI * fc * m) / (M_PI * m);
+            h *= 0.54 - 0.46 * cos(2 * M_PI * k / (FSK_TAPS - 1));
+            taps[FSK_TAPS - 1 - k] = (float)h;
+            sum += (float)h;
+        }
+        for (int k = 0; k < FSK_TAPS; k++)
+            taps[k] /= sum;
+
+        ncoStep = -2 * M_PI * offset / cfg.rate;
+        ncoPhase = 0;
+        consumed = 0;
+        //history of the filter and the discriminator
+        bi.assign(FSK_TAPS, 0);
+        bq.assign(FSK_TAPS, 0);
+        di.assign(1, 0);
+        dq.assign(1, 0);
+
+        noise = 1e-6f;
+        dc = 0;
+        dcRad = 0;
+        afcRad = 0;
+        memset(dcBits, 0, sizeof(dcBits));
+        memset(radBits, 0, sizeof(radBits));
+        bitIndex = 0;
+        squelch = false;
+        phase = 0;
+        level = 0;
+        shift = 0;
+        frameBits = -1;
+        inverted = false;
+    }
+
+    //feed interleaved IQ samples, scaled to [-1, 1]
+    void process(const float *iq, size_t n)
+    {
+        //mix to baseband into the planar filter buffers, after the history
+        size_t base = bi.size();
+        bi.resize(base + n);
+        bq.resize(base + n);
+        double c = cos(ncoPhase), s = sin(ncoPhase);
+        const double cs = cos(ncoStep), sn = sin(ncoStep);
+        for (size_t k = 0; k < n; k++)
+        {
+            float x = iq[2 * k], y = iq[2 * k + 1];
+            bi[base + k] = (float)(x * c - y * s);
+            bq[base + k] = (float)(x * s + y * c);
+            double t = c * cs - s * sn;
+            s = s * cs + c * sn;
+            c = t;
+        }
+        ncoPhase = fmod(ncoPhase + ncoStep * n, 2 * M_PI);
+
+        //filter and decimate
+        size_t out = 0;
+        size_t dbase = di.size();
+        size_t last = bi.size() - FSK_TAPS;
+        size_t k = 0;
+        for (; k <= last; k += decim)
+        {
+            di.push_back(dot(&bi[k], taps, FSK_TAPS));
+            dq.push_back(dot(&bq[k], taps, FSK_TAPS));
+            out++;
+        }
+        bi.erase(bi.begin(), bi.begin() + k);
+        bq.erase(bq.begin(), bq.begin() + k);
+
+        //discriminate and slice
+        freq.resize(out);
+        power.resize(out);
+        discriminate(&di[dbase], &dq[dbase], freq.data(), power.data(), out);
+        for (size_t j = 0; j < out; j++)
+            sample(freq[j], power[j]);
+        di.erase(di.begin(), di.end() - 1);
+        dq.erase(dq.begin(), dq.end() - 1);
+    }
+
+private:
+    DemodConfig config;
+    const char *channel;
+    std::mutex &outLock;
+    WeatherStationProcessor wsProcessor;
+
+    int decim;
+    double rate; //after decimation
+    float sps;   //samples per bit
+    float taps[FSK_TAPS];
+    double ncoStep, ncoPhase;
+    uint64_t consumed; //decimated samples processed
+
+    std::vector<float> bi, bq, di, dq, freq, power;
+
+    //squelch and frequency offset
+    float noise; //noise floor power
+    float dc;     //frequency offset in discriminator units, the slicer threshold
+    float dcRad;  //frequency offset in radians per sample
+    float afcRad; //offset of the current frame
+    float dcBits[32], radBits[32]; //offsets at the last bits, the preamble is 24 bits back at sync
+    uint8_t bitIndex;
+    bool squelch;
+
+    //bit clock
+    float phase; //samples since the last bit boundary
+    int level;
+
+    //frame
+    uint32_t shift;
+    int frameBits; //-1 while searching for the sync word
+    bool inverted;
+    uint8_t frame[FSK_FRAME_LEN];
+    double framePower;
+    uint32_t frameSamples;
+    uint64_t frameAt;
+
+    void sample(float f, float p)
+    {
+        consumed++;
+        bool open = p > noise * FSK_SQUELCH;
+        if (!open && frameBits < 0)
+        {
+            //track the noise floor and reset the bit clock
+            noise += (p - noise) * 1e-3f;
+            squelch = false;
+            return;
+        }
+        if (!squelch)
+        {
+            squelch = true;
+            dc = f;
+            dcRad = asinf(f < -1 ? -1 : f > 1 ? 1 : f);
+            phase = 0;
+        }
+        if (frameBits < 0)
+        {
+            //preamble is balanced: average over a few bits
+            //the discriminator is about sin() of the phase step
+            dc += (f - dc) / (4 * sps);
+            dcRad += (asinf(f < -1 ? -1 : f > 1 ? 1 : f) - dcRad) / (4 * sps);
+        }
+        else
+        {
+            framePower += p;
+            frameSamples++;
+        }
+
+        int s = f - dc > 0;
+        if (s != level)
+        {
+            //a transition is a bit boundary, move the clock towards it
+            float err = phase < sps / 2 ? phase : phase - sps;
+            phase -= FSK_DPLL_GAIN * err;
+            level = s;
+        }
+        float before = phase;
+        phase += 1;
+        if (before < sps / 2 && phase >= sps / 2)
+            bit(s);
+        if (phase >= sps)
+            phase -= sps;
+    }
+
+    void bit(int b)
+    {
+        shift = shift << 1 | b;
+        if (frameBits < 0)
+        {
+            dcBits[bitIndex % 32] = dc;
+            radBits[bitIndex % 32] = dcRad;
+            bitIndex++;
+            if ((shift & 0xFFFFFF) == FSK_SYNC || (~shift & 0xFFFFFF) == FSK_SYNC)
+            {
+                //the offset at the end of the preamble byte, the sync word is not balanced
+                dc = dcBits[(bitIndex - 17) % 32];
+                afcRad = radBits[(bitIndex - 17) % 32];
+                inverted = (~shift & 0xFFFFFF) == FSK_SYNC;
+                frameBits = 0;
+                memset(frame, 0, sizeof(frame));
+                framePower = 0;
+                frameSamples = 0;
+                frameAt = consumed;
+            }
+            return;
+        }
+        if (inverted)
+            b = !b;
+        frame[frameBits / 8] |= b << (7 - frameBits % 8);
+        if (++frameBits == FSK_FRAME_LEN * 8)
+        {
+            emit();
+            frameBits = -1;
+        }
+    }
+
+    void emit()
+    {
+        frames++;
+        double p = framePower / (frameSamples ? frameSamples : 1);
+        double rssiDb = 10 * log10(p + 1e-20);
+        double snrDb = 10 * log10(p / noise);
+        //offset estimated on the balanced preamble
+        double afc = afcRad * rate / (2 * M_PI);
+        double at = (double)frameAt / rate;
+
+        //radio units: RSSI in -0.5 dB steps, SNR in dB
+        int rssi = (int)lround(-2 * rssiDb);
+        rssi = rssi < 0 ? 0 : rssi > 127 ? 127 : rssi;
+        int snr = (int)lround(snrDb);
+        snr = snr < 0 ? 0 : snr > 255 ? 255 : snr;
+
+        std::lock_guard<std::mutex> lock(outLock);
+        printf("%s %.6fs rssi %.1f dBFS snr %.1f dB afc %.0f Hz:", channel, at, rssiDb, snrDb, afc);
+        for (int k = 0; k < FSK_FRAME_LEN; k++)
+            printf(" %02x", frame[k]);
+        printf("\n");
+
+        WSBase *ws = wsProcessor.processWSPacket(frame, FSK_FRAME_LEN, (int64_t)(at * 1000000), rssi, snr, 0, (int32_t)afc);
+        if (ws && !config.quiet)
+            ws->print();
+        if (ws)
+        {
+            decoded++;
+            char payload[WS_PAYLOAD_MAX];
+            ws->mqttPayload(payload, sizeof(payload));
+            printf("%s %s\n", channel, payload);
+            delete ws;
+        }
+    }
+};
+
+//===== Jobs
+
+struct Job
+{
+    std::string file;
+    double offset;
+    std::string name;
+    uint64_t samples;
+    uint32_t frames;
+    uint32_t decoded;
+    double seconds;
+};
+
+static void runJob(Job &job, const DemodConfig &cfg, std::mutex &out)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    FILE *f = fopen(job.file.c_str(), "rb");
+    if (!f)
+    {
+        std::lock_guard<std::mutex> lock(out);
+        printf("%s: cannot open\n", job.file.c_str());
+        return;
+    }
+    FskDemod demod(cfg, job.offset, job.name.c_str(), out);
+    size_t width = cfg.format == SF_CU8 ? 1 : 2;
+    std::vector<uint8_t> raw(FSK_BLOCK * 2 * width);
+    std::vector<float> iq(FSK_BLOCK * 2);
+    size_t n;
+    while ((n = fread(raw.data(), 2 * width, FSK_BLOCK, f)) > 0)
+    {
+        if (cfg.format == SF_CU8)
+        {
+            for (size_t k = 0; k < 2 * n; k++)
+                iq[k] = (raw[k] - 127.5f) / 127.5f;
+        }
+        else
+        {
+            const int16_t *s = (const int16_t *)raw.data();
+            for (size_t k = 0; k < 2 * n; k++)
+                iq[k] = s[k] / 32768.0f;
+        }
+        demod.process(iq.data(), n);
+        job.samples += n;
+    }
+    fclose(f);
+    job.frames = demod.frames;
+    job.decoded = demod.decoded;
+    job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static const char *kernel()
+{
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSE2__)
+    return "sse2";
+#elif defined(__ARM_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    DemodConfig cfg = {1024000, SF_CU8, false};
+    bool formatSet = false;
+    std::vector<double> offsets;
+    std::vector<std::string> files;
+    for (int a = 1; a < argc; a++)
+    {
+        if (!strcmp(argv[a], "-r") && a + 1 < argc)
+            cfg.rate = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-f") && a + 1 < argc)
+            offsets.push_back(atof(argv[++a]));
+        else if (!strcmp(argv[a], "-F") && a + 1 < argc)
+        {
+            cfg.format = !strcmp(argv[++a], "cs16") ? SF_CS16 : SF_CU8;
+            formatSet = true;
+        }
+        else if (!strcmp(argv[a], "-q"))
+            cfg.quiet = true;
+        else if (argv[a][0] == '-')
+        {
+            printf("usage: %s [-r rate] [-f offset]... [-F cu8|cs16] [-q] file...\n", argv[0]);
+            return 1;
+        }
+        else
+            files.push_back(argv[a]);
+    }
+    if (files.empty())
+    {
+        printf("usage: %s [-r rate] [-f offset]... [-F cu8|cs16] [-q] file...\n", argv[0]);
+        return 1;
+    }
+    if (offsets.empty())
+        offsets.push_back(0);
+    if (!formatSet && files[0].size() > 5 && files[0].compare(files[0].size() - 5, 5, ".cs16") == 0)
+        cfg.format = SF_CS16;
+
+    std::vector<Job> jobs;
+    for (const std::string &file : files)
+    {
+        for (double offset : offsets)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "[%d]", (int)jobs.size());
+            jobs.push_back({file, offset, name, 0, 0, 0, 0});
+        }
+    }
+
+    //one worker per core, each takes the next job
+    std::mutex out;
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    unsigned cores = std::thread::hardware_concurrency();
+    unsigned n = cores && cores < jobs.size() ? cores : jobs.size();
+    auto t0 = std::chrono::steady_clock::now();
+    for (unsigned w = 0; w < n; w++)
+    {
+        workers.push_back(std::thread([&]() {
+            for (size_t j; (j = next++) < jobs.size();)
+                runJob(jobs[j], cfg, out);
+        }));
+    }
+    for (std::thread &t : workers)
+        t.join();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    uint64_t samples = 0;
+    printf("\n===== %s kernels, %u threads\n", kernel(), n);
+    for (const Job &job : jobs)
+    {
+        double captured = job.samples / cfg.rate;
+        printf("%s %s %+.0f Hz: %u frames, %u decoded, %.1fs of IQ in %.2fs, %.1fx real time\n",
+               job.name.c_str(), job.file.c_str(), job.offset, job.frames, job.decoded,
+               captured, job.seconds, job.seconds > 0 ? captured / job.seconds : 0);
+        samples += job.samples;
+    }
+    printf("total %.1f Msamples in %.2fs, %.1f Msamples/s\n", samples / 1e6, wall, wall > 0 ? samples / 1e6 / wall : 0);
+    return 0;
+}
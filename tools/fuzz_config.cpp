@@ -0,0 +1,136 @@
+// Fuzz harness of the station configuration
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// The input is a sequence of lines, each a message to WSConfig as received on
+// the /wsconfig and /wsdelete MQTT topics or a file found on SPI Flash:
+//   add <json>           WSConfig::add, a station object or an array of them
+//   remove <json>        WSConfig::remove
+//   record <slot> <json> a station record in the ConfigStore, as an older firmware wrote it
+//   legacy <json>        the single stationconfig.json of previous firmware
+//   load                 WSConfig::load, from the records or else the legacy file
+//   flush                WSConfig::flush, write the changed slots
+// Other lines are ignored. After the messages the changed slots are written and
+// a second WSConfig loads them, as at the next boot. Unless the input wrote a
+// record or legacy file of its own, every station it loads must be the station
+// of that slot in the first. The SPIFFS of tools/host/SPIFFS.h is kept in
+// memory and formatted for every input.
+//
+// ArduinoJson is a pinned copy of the single header release, fetched once, so a
+// finding replays against the same parser (ArduinoJson@6 of platformio.ini floats):
+//   mkdir -p .pio/fuzz && curl -sSL -o .pio/fuzz/ArduinoJson.h
+//       https://github.com/bblanchon/ArduinoJson/releases/download/v6.21.5/ArduinoJson-v6.21.5.h
+// Build with libFuzzer (mbedtls for the MD5 of Windguru):
+//   clang++ -g -O1 -std=gnu++11 -fsanitize=fuzzer,address,undefined -Itools/host -IESP32-FineOffset-FSK
+//       -I.pio/fuzz tools/fuzz_config.cpp -lmbedcrypto -o fuzz_config
+//   fuzz_config -max_len=4096 -dict=tools/corpus/config.dict tools/corpus/config
+// Build with gcc, the driver of tools/host/fuzzmain.h:
+//   g++ -g -O1 -std=gnu++11 -fsanitize=address,undefined -DFUZZ_MAIN -Itools/host -IESP32-FineOffset-FSK
+//       -I.pio/fuzz tools/fuzz_config.cpp -lmbedcrypto -o fuzz_config
+//   fuzz_config -t 60 tools/corpus/config
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include <Arduino.h>
+#include "weather.h"
+#include "stationconfig.h"
+
+static bool startsWith(const std::string &line, const char *word, std::string &rest)
+{
+    size_t n = strlen(word);
+    if (line.compare(0, n, word) != 0 || (line.size() > n && line[n] != ' '))
+        return false;
+    rest = line.size() > n ? line.substr(n + 1) : std::string();
+    return true;
+}
+
+static void releaseAll(WSConfig &config)
+{
+    for (int i = 0; i < MAX_WS; i++)
+    {
+        if (config.stations[i])
+        {
+            delete config.stations[i]->wsp;
+            delete config.stations[i];
+            config.stations[i] = nullptr;
+        }
+    }
+}
+
+//returns true for a file written by the input itself
+static bool message(WSConfig &config, const std::string &line)
+{
+    std::string rest;
+    if (startsWith(line, "add", rest))
+        config.add(rest.c_str());
+    else if (startsWith(line, "remove", rest))
+        config.remove(rest.c_str());
+    else if (startsWith(line, "record", rest))
+    {
+        char *json;
+        unsigned long slot = strtoul(rest.c_str(), &json, 10);
+        if (slot < MAX_WS)
+        {
+            ConfigStore<MAX_WS> store(WS_STORE_DIR);
+            store.write(slot, json, strlen(json));
+        }
+        return true;
+    }
+    else if (startsWith(line, "legacy", rest))
+    {
+        File f = SPIFFS.open(WS_LEGACY_FILE, FILE_WRITE);
+        f.write((const uint8_t *)rest.data(), rest.size());
+        f.close();
+        return true;
+    }
+    else if (startsWith(line, "load", rest))
+    {
+        //the stations of a load replace the ones in memory, as at boot
+        releaseAll(config);
+        config.load();
+    }
+    else if (startsWith(line, "flush", rest))
+        config.flush();
+    return false;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    SPIFFS.format();
+    std::string input((const char *)data, size);
+
+    WSConfig config;
+    bool files = false;
+    size_t at = 0;
+    while (at <= input.size())
+    {
+        size_t end = input.find('\n', at);
+        if (end == std::string::npos)
+            end = input.size();
+        //a message is a C string, as the MQTT callback passes it
+        files |= message(config, std::string(input.c_str() + at, strnlen(input.c_str() + at, end - at)));
+        at = end + 1;
+    }
+    config.flush();
+
+    //the next boot loads what was written
+    WSConfig boot;
+    boot.load();
+    for (int i = 0; i < MAX_WS; i++)
+    {
+        WSSetting *a = config.stations[i], *b = boot.stations[i];
+        if (!files && b && (!a || a->wsType != b->wsType || a->wsID != b->wsID))
+            abort();
+    }
+
+    releaseAll(config);
+    releaseAll(boot);
+    return 0;
+}
+
+#ifdef FUZZ_MAIN
+#include <fuzzmain.h>
+#endif
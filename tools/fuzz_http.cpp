@@ -0,0 +1,95 @@
+// Fuzz harness of the streaming HTTP response parser
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// The input is a server response as received by UploadToWebAPI() in main.cpp.
+// It is fed to HttpResponse in one piece, byte by byte and split in two at
+// every offset. The parser must give the same result for every split, never
+// consume bytes after it is done, and stay within its line buffer.
+//
+// Build with libFuzzer:
+//   clang++ -g -O1 -std=gnu++11 -fsanitize=fuzzer,address,undefined -IESP32-FineOffset-FSK
+//       tools/fuzz_http.cpp -o fuzz_http
+//   fuzz_http -max_len=2048 tools/corpus/http
+// Build with gcc, the driver of tools/host/fuzzmain.h:
+//   g++ -g -O1 -std=gnu++11 -fsanitize=address,undefined -DFUZZ_MAIN -Itools/host -IESP32-FineOffset-FSK
+//       tools/fuzz_http.cpp -o fuzz_http
+//   fuzz_http -t 60 tools/corpus/http
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "httpresponse.h"
+
+//splits are tried at every offset up to this length, beyond it at a stride
+#define FUZZ_HTTP_SPLIT_ALL 512
+
+struct HttpResult
+{
+    HttpResponse::State state;
+    int status;
+    int32_t contentLength;
+    bool chunked;
+    uint32_t bodyBytes;
+    size_t consumed;
+};
+
+static HttpResult parse(const uint8_t *data, size_t size, size_t split)
+{
+    HttpResponse response;
+    size_t consumed = 0;
+    size_t parts[2] = {split, size - split};
+    for (size_t p = 0; p < 2; p++)
+    {
+        if (response.done() || response.error())
+            break;
+        size_t n = response.feed(data + consumed, parts[p]);
+        //only a complete or invalid response leaves bytes unconsumed
+        if (n > parts[p] || (n < parts[p] && !response.done() && !response.error()))
+            abort();
+        consumed += n;
+        if (n < parts[p])
+            break;
+    }
+    HttpResult r = {response.state, response.status, response.contentLength, response.chunked, response.bodyBytes, consumed};
+    return r;
+}
+
+static bool same(const HttpResult &a, const HttpResult &b)
+{
+    return a.state == b.state && a.status == b.status && a.contentLength == b.contentLength &&
+           a.chunked == b.chunked && a.bodyBytes == b.bodyBytes && a.consumed == b.consumed;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    HttpResult whole = parse(data, size, size);
+    if (whole.state == HttpResponse::ST_DONE && (whole.status < 100 || whole.status > 999 || (whole.status < 200 && whole.status != 101)))
+        abort(); //an interim status is never the final one
+
+    size_t stride = size <= FUZZ_HTTP_SPLIT_ALL ? 1 : size / FUZZ_HTTP_SPLIT_ALL + 1;
+    for (size_t split = 0; split < size; split += stride)
+    {
+        if (!same(whole, parse(data, size, split)))
+            abort();
+    }
+
+    //byte by byte, as a slow connection delivers it
+    HttpResponse bytes;
+    size_t consumed = 0;
+    while (consumed < size && bytes.feed(data + consumed, 1) == 1)
+        consumed++;
+    HttpResult r = {bytes.state, bytes.status, bytes.contentLength, bytes.chunked, bytes.bodyBytes, consumed};
+    if (!same(whole, r))
+        abort();
+
+    //the server closes the connection
+    bytes.finish();
+    if (!bytes.done() && !bytes.error())
+        abort();
+    return 0;
+}
+
+#ifdef FUZZ_MAIN
+#include <fuzzmain.h>
+#endif
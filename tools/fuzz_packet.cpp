@@ -0,0 +1,111 @@
+// Fuzz harness of the packet decoders of the radio path
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// The input is a frame as delivered by the radio. It runs the path of rfLoop()
+// and wsLoop() in main.cpp:
+//   processWSPacket -> WSSetting::update -> mqttPayload
+// and every decoder of weather.h on the same bytes, whatever the family code.
+// The frame is copied to a buffer of exactly its length, so a decoder that
+// reads beyond the frame is reported by AddressSanitizer. A payload must fit
+// in WS_PAYLOAD_MAX and be terminated at the returned length.
+// The seed frames in tools/corpus/packet are synthetic: laid out by hand after
+// the decoders of weather.h with a valid CRC, not captured from a station.
+//
+// ArduinoJson is a pinned copy of the single header release, fetched once, so a
+// finding replays against the same parser (ArduinoJson@6 of platformio.ini floats):
+//   mkdir -p .pio/fuzz && curl -sSL -o .pio/fuzz/ArduinoJson.h
+//       https://github.com/bblanchon/ArduinoJson/releases/download/v6.21.5/ArduinoJson-v6.21.5.h
+// Build with libFuzzer:
+//   clang++ -g -O1 -std=gnu++11 -fsanitize=fuzzer,address,undefined -Itools/host -IESP32-FineOffset-FSK
+//       -I.pio/fuzz tools/fuzz_packet.cpp -lmbedcrypto -o fuzz_packet
+//   fuzz_packet -max_len=66 tools/corpus/packet
+// Build with gcc, the driver of tools/host/fuzzmain.h:
+//   g++ -g -O1 -std=gnu++11 -fsanitize=address,undefined -DFUZZ_MAIN -Itools/host -IESP32-FineOffset-FSK
+//       -I.pio/fuzz tools/fuzz_packet.cpp -lmbedcrypto -o fuzz_packet
+//   fuzz_packet -t 60 -m 66 tools/corpus/packet
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <Arduino.h>
+#include "weather.h"
+#include "stationconfig.h"
+
+//the radio delivers up to 66 bytes (FIFO of the SX1276)
+#define FUZZ_PACKET_MAX 66
+//packets of a WH1080 burst, then a packet of the next burst
+#define FUZZ_PACKET_UPDATES 7
+
+static WeatherStationProcessor wsProcessor;
+
+static void checkPayload(WSBase *ws)
+{
+    char payload[WS_PAYLOAD_MAX];
+    ws->setWallClock();
+    size_t n = ws->mqttPayload(payload, sizeof(payload));
+    if (n >= sizeof(payload) || strlen(payload) != n)
+        abort();
+}
+
+//a decoder on its own, buf holds exactly len bytes
+static void decodeWith(WSBase &ws, uint8_t fmt, const uint8_t *data, size_t size)
+{
+    std::vector<uint8_t> buf(data, data + size);
+    ws.msgformat = fmt;
+    if (ws.decode(fmt, buf.data(), (uint8_t)size))
+        checkPayload(&ws);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size > FUZZ_PACKET_MAX)
+        return 0;
+
+    //the radio path, on a copy of the frame of exactly its length
+    std::vector<uint8_t> frame(data, data + size);
+    WSBase *ws = wsProcessor.processWSPacket(frame.data(), (int)size, 1000000, 120, 30, 1, -1200);
+    if (ws)
+    {
+        if (size < 8)
+            abort(); //too short for any family
+        checkPayload(ws);
+
+        //the network task keeps the raw packet in the WSRecord, padded to its size
+        WSRecord record;
+        memset(record.pkt, 0, sizeof(record.pkt));
+        memcpy(record.pkt, data, size < sizeof(record.pkt) ? size : sizeof(record.pkt));
+        WSSetting *st = WSConfig::create(ws->msgformat);
+        st->wsType = ws->msgformat;
+        st->wsID = ws->stationID;
+        for (int i = 0; i < FUZZ_PACKET_UPDATES; i++)
+        {
+            //repeats 60 ms apart, the last one a burst later
+            ws->rxUs += i < FUZZ_PACKET_UPDATES - 1 ? 60000 : 48000000;
+            st->update(ws, record.pkt);
+        }
+        checkPayload(st->wsp);
+        delete st->wsp;
+        delete st;
+        delete ws;
+    }
+
+    //every decoder, as a station of another family would be decoded
+    BR1800 br1800;
+    decodeWith(br1800, MSG_WH2300, data, size);
+    WH1080 ws3000;
+    decodeWith(ws3000, MSG_WS3000, data, size);
+    WH1080 ws4000;
+    decodeWith(ws4000, MSG_WS4000, data, size);
+    UnknownFineOffset unknown;
+    decodeWith(unknown, 0xFF, data, size);
+    if (size)
+        checkPayload(&unknown);
+    return 0;
+}
+
+#ifdef FUZZ_MAIN
+#include <fuzzmain.h>
+#endif
@@ -0,0 +1,37 @@
+// Host stand-in for the parts of the Arduino core used by the station code
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Enough for stationconfig.h and weather.h to build on a PC for the host tools.
+// The time functions follow esp_timer_get_time(), so they run on virtual time
+// when a simulation sets hostSimUs.
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <esp_timer.h>
+
+static inline unsigned long millis()
+{
+    return (unsigned long)(esp_timer_get_time() / 1000);
+}
+
+static inline unsigned long micros()
+{
+    return (unsigned long)esp_timer_get_time();
+}
+
+static inline void delay(uint32_t ms)
+{
+    if (hostSimUs >= 0)
+        hostSimUs += (int64_t)ms * 1000;
+    else
+        usleep(ms * 1000);
+}
+
+#endif
@@ -0,0 +1,48 @@
+// Host stand-in for the Client interface of the Arduino core
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// The methods tlsclient.h implements, so TLSClient builds on a PC for the
+// host tools. IPAddress::toString() gives the dotted quad as a std::string.
+
+#ifndef HOST_CLIENT_H
+#define HOST_CLIENT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+class IPAddress
+{
+public:
+    IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : octets{a, b, c, d} {}
+
+    std::string toString() const
+    {
+        char s[16];
+        snprintf(s, sizeof(s), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+        return s;
+    }
+
+private:
+    uint8_t octets[4];
+};
+
+class Client
+{
+public:
+    virtual ~Client() {}
+    virtual int connect(IPAddress ip, uint16_t port) = 0;
+    virtual int connect(const char *host, uint16_t port) = 0;
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size) = 0;
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int read(uint8_t *buf, size_t size) = 0;
+    virtual int peek() = 0;
+    virtual void flush() = 0;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+    virtual operator bool() = 0;
+};
+
+#endif
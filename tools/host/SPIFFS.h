@@ -0,0 +1,126 @@
+// Host stand-in for SPIFFS, files are kept in memory
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Implements the calls of configstore.h and stationconfig.h, so the station
+// configuration can be saved and loaded by the host tools without flash.
+// A file is shared by its handles, a write is seen by a later open.
+
+#ifndef HOST_SPIFFS_H
+#define HOST_SPIFFS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <memory>
+#include <string>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+class File
+{
+public:
+    File() : pos(0) {}
+    File(std::shared_ptr<std::string> contents, size_t at) : data(contents), pos(at) {}
+
+    operator bool() const { return (bool)data; }
+    size_t size() const { return data ? data->size() : 0; }
+    int available() const { return data ? (int)(data->size() - pos) : 0; }
+    void close() { data.reset(); }
+    void flush() {}
+
+    bool seek(uint32_t at)
+    {
+        if (!data || at > data->size())
+            return false;
+        pos = at;
+        return true;
+    }
+
+    int peek() const { return available() > 0 ? (uint8_t)(*data)[pos] : -1; }
+
+    int read()
+    {
+        int c = peek();
+        if (c >= 0)
+            pos++;
+        return c;
+    }
+
+    size_t read(uint8_t *buf, size_t len)
+    {
+        size_t n = available() < (int)len ? available() : len;
+        if (n)
+            memcpy(buf, data->data() + pos, n);
+        pos += n;
+        return n;
+    }
+
+    //reader of ArduinoJson
+    size_t readBytes(char *buf, size_t len) { return read((uint8_t *)buf, len); }
+
+    size_t write(const uint8_t *buf, size_t len)
+    {
+        if (!data)
+            return 0;
+        data->replace(pos, len, (const char *)buf, len);
+        pos += len;
+        return len;
+    }
+
+    size_t write(uint8_t c) { return write(&c, 1); }
+
+private:
+    std::shared_ptr<std::string> data;
+    size_t pos;
+};
+
+class SPIFFSFS
+{
+public:
+    bool begin(bool formatOnFail) { return true; }
+
+    //erase all files
+    bool format()
+    {
+        files.clear();
+        return true;
+    }
+
+    File open(const char *path, const char *mode)
+    {
+        std::shared_ptr<std::string> &f = files[path];
+        if (*mode == 'w' || !f)
+        {
+            if (*mode == 'r')
+            {
+                files.erase(path);
+                return File();
+            }
+            f = std::make_shared<std::string>();
+        }
+        return File(f, *mode == 'a' ? f->size() : 0);
+    }
+
+    bool exists(const char *path) { return files.count(path) > 0; }
+    bool remove(const char *path) { return files.erase(path) > 0; }
+
+    bool rename(const char *from, const char *to)
+    {
+        auto it = files.find(from);
+        if (it == files.end())
+            return false;
+        std::shared_ptr<std::string> f = it->second;
+        files.erase(it);
+        files[to] = f;
+        return true;
+    }
+
+private:
+    std::map<std::string, std::shared_ptr<std::string>> files;
+};
+
+static SPIFFSFS SPIFFS;
+
+#endif
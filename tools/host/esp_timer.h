@@ -0,0 +1,26 @@
+// Host stand-in for the ESP-IDF esp_timer API
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Lets the firmware decoders in weather.h build on a PC for the host tools.
+// millis() of the Arduino.h stand-in is derived from it.
+
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+
+#include <stdint.h>
+#include <time.h>
+
+//a simulation sets this to run the firmware on virtual time, -1 for the host clock
+static int64_t hostSimUs = -1;
+
+//monotonic time in us, as on the ESP32
+static inline int64_t esp_timer_get_time()
+{
+    if (hostSimUs >= 0)
+        return hostSimUs;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#endif
@@ -0,0 +1,217 @@
+// Stand-alone driver of the fuzz harnesses, for compilers without libFuzzer
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// A harness defines LLVMFuzzerTestOneInput() and is built with clang and
+// -fsanitize=fuzzer,address,undefined, libFuzzer then provides main(). With
+// gcc, or for a quick replay of the corpus, build it with -DFUZZ_MAIN and
+// -fsanitize=address,undefined, this file provides a main() that:
+//  - runs every file of the corpus directories and files on the command line
+//  - then mutates random corpus entries for the given time: bit flips, byte
+//    values, inserts, erases and splices of two entries
+//  - reports the executions per second as libFuzzer does
+// The input being run is kept in crash-<pid>, so a sanitizer report can be
+// replayed by giving that file. It is removed at a clean exit. There is no
+// coverage feedback, new inputs are not added to the corpus.
+//
+// Use:
+//   fuzz_x [-t seconds] [-s seed] [-m maxlen] corpus...
+//   -t  mutation time in seconds, default 10, 0 only replays the corpus
+//   -s  random seed, default 1
+//   -m  largest input, default 4096
+
+#ifndef HOST_FUZZMAIN_H
+#define HOST_FUZZMAIN_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static char fuzzCrashPath[32];
+
+//keep the input in the crash file before it runs
+static void fuzzSave(const std::vector<uint8_t> &input)
+{
+    FILE *f = fopen(fuzzCrashPath, "wb");
+    if (!f)
+        return;
+    if (!input.empty())
+        fwrite(input.data(), 1, input.size(), f);
+    fclose(f);
+}
+
+static void fuzzRun(const std::vector<uint8_t> &input)
+{
+    fuzzSave(input);
+    //a copy of the exact length, so ASan sees a read past the end
+    uint8_t *data = (uint8_t *)malloc(input.size() ? input.size() : 1);
+    if (!input.empty())
+        memcpy(data, input.data(), input.size());
+    LLVMFuzzerTestOneInput(data, input.size());
+    free(data);
+}
+
+static bool fuzzReadFile(const std::string &path, std::vector<uint8_t> &data)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+    data.clear();
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(f);
+    return true;
+}
+
+//the file, or the files of the directory
+static void fuzzLoad(const char *path, std::vector<std::vector<uint8_t>> &corpus)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        fprintf(stderr, "fuzz: cannot open %s\n", path);
+        return;
+    }
+    std::vector<uint8_t> data;
+    if (!S_ISDIR(st.st_mode))
+    {
+        if (fuzzReadFile(path, data))
+            corpus.push_back(data);
+        return;
+    }
+    DIR *dir = opendir(path);
+    if (!dir)
+        return;
+    struct dirent *e;
+    while ((e = readdir(dir)) != nullptr)
+    {
+        std::string file = std::string(path) + "/" + e->d_name;
+        if (e->d_name[0] != '.' && stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode) && fuzzReadFile(file, data))
+            corpus.push_back(data);
+    }
+    closedir(dir);
+}
+
+static void fuzzMutate(std::vector<uint8_t> &input, const std::vector<std::vector<uint8_t>> &corpus, size_t maxLen, std::mt19937 &rng)
+{
+    static const uint8_t interesting[] = {0x00, 0x01, 0x7F, 0x80, 0xFF, '"', '{', '}', '[', ']', ',', ':', '\r', '\n', '0', '9'};
+    int count = 1 + rng() % 4;
+    for (int m = 0; m < count; m++)
+    {
+        size_t n = input.size();
+        switch (rng() % 6)
+        {
+        case 0: //bit flip
+            if (n)
+                input[rng() % n] ^= 1 << (rng() % 8);
+            break;
+        case 1: //random byte
+            if (n)
+                input[rng() % n] = rng();
+            break;
+        case 2: //interesting byte
+            if (n)
+                input[rng() % n] = interesting[rng() % sizeof(interesting)];
+            break;
+        case 3: //insert
+            if (n < maxLen)
+                input.insert(input.begin() + (n ? rng() % (n + 1) : 0), (uint8_t)rng());
+            break;
+        case 4: //erase a range
+            if (n)
+            {
+                size_t at = rng() % n;
+                size_t len = 1 + rng() % (n - at);
+                input.erase(input.begin() + at, input.begin() + at + len);
+            }
+            break;
+        case 5: //splice: replace the tail with the tail of another entry
+        {
+            const std::vector<uint8_t> &other = corpus[rng() % corpus.size()];
+            if (other.empty())
+                break;
+            size_t at = n ? rng() % n : 0;
+            size_t from = rng() % other.size();
+            input.resize(at);
+            input.insert(input.end(), other.begin() + from, other.end());
+            break;
+        }
+        }
+    }
+    if (input.size() > maxLen)
+        input.resize(maxLen);
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = 10;
+    uint32_t seed = 1;
+    size_t maxLen = 4096;
+    std::vector<std::vector<uint8_t>> corpus;
+    for (int a = 1; a < argc; a++)
+    {
+        if (!strcmp(argv[a], "-t") && a + 1 < argc)
+            seconds = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-s") && a + 1 < argc)
+            seed = strtoul(argv[++a], nullptr, 0);
+        else if (!strcmp(argv[a], "-m") && a + 1 < argc)
+            maxLen = strtoul(argv[++a], nullptr, 0);
+        else if (argv[a][0] == '-')
+        {
+            printf("usage: %s [-t seconds] [-s seed] [-m maxlen] corpus...\n", argv[0]);
+            return 1;
+        }
+        else
+            fuzzLoad(argv[a], corpus);
+    }
+    if (corpus.empty())
+        corpus.push_back(std::vector<uint8_t>());
+    snprintf(fuzzCrashPath, sizeof(fuzzCrashPath), "crash-%d", (int)getpid());
+
+    //the log of the firmware is discarded, the report goes to stderr
+    if (!freopen("/dev/null", "w", stdout))
+        return 1;
+
+    auto t0 = std::chrono::steady_clock::now();
+    uint64_t execs = 0;
+    for (const std::vector<uint8_t> &input : corpus)
+    {
+        fuzzRun(input);
+        execs++;
+    }
+    fprintf(stderr, "fuzz: %u corpus inputs replayed\n", (unsigned)corpus.size());
+
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> input;
+    double elapsed = 0;
+    while (elapsed < seconds)
+    {
+        //check the clock every 256 runs
+        for (int i = 0; i < 256; i++)
+        {
+            input = corpus[rng() % corpus.size()];
+            fuzzMutate(input, corpus, maxLen, rng);
+            fuzzRun(input);
+            execs++;
+        }
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    }
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    fprintf(stderr, "fuzz: %llu runs in %.1fs, %.0f exec/s\n", (unsigned long long)execs, elapsed,
+            elapsed > 0 ? execs / elapsed : 0.0);
+    unlink(fuzzCrashPath);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,181 @@
+// Host stand-in for the Heltec OLED, renders into an in-memory framebuffer
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Implements the SSD1306Wire calls of oledview.h on a 128x64 framebuffer, so
+// the dashboard pages can be rendered and compared with snapshots on a PC.
+// The ArialMT fonts are not available on the host. The stand-in fonts have
+// the height of the ArialMT font in the same header byte, and draw a 5x7
+// glyph scaled to about its size. Text is UTF-8, as on the device.
+// display() copies the framebuffer to the screen, what the OLED shows.
+
+#ifndef HOST_HELTEC_H
+#define HOST_HELTEC_H
+
+#include <stdint.h>
+#include <string.h>
+#include <Arduino.h>
+
+#define HOST_OLED_WIDTH 128
+#define HOST_OLED_HEIGHT 64
+
+enum OLEDDISPLAY_TEXT_ALIGNMENT
+{
+    TEXT_ALIGN_LEFT = 0,
+    TEXT_ALIGN_RIGHT = 1,
+    TEXT_ALIGN_CENTER = 2,
+    TEXT_ALIGN_CENTER_BOTH = 3
+};
+
+enum OLEDDISPLAY_COLOR
+{
+    BLACK = 0,
+    WHITE = 1,
+    INVERSE = 2
+};
+
+//font header as the ArialMT fonts: width, height, first char, char count,
+//followed by the stand-in glyph scale x and y, advance and top offset
+static const uint8_t ArialMT_Plain_10[] = {10, 13, 32, 224, 1, 1, 6, 3};
+static const uint8_t ArialMT_Plain_16[] = {16, 19, 32, 224, 2, 2, 11, 2};
+static const uint8_t ArialMT_Plain_24[] = {24, 28, 32, 224, 2, 3, 13, 3};
+
+//5x7 glyphs of ASCII 32..126, a column per byte, bit 0 is the top row
+static const uint8_t hostGlyphs[95][5] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x5F, 0x00, 0x00}, {0x00, 0x07, 0x00, 0x07, 0x00}, {0x14, 0x7F, 0x14, 0x7F, 0x14}, // !"#
+    {0x24, 0x2A, 0x7F, 0x2A, 0x12}, {0x23, 0x13, 0x08, 0x64, 0x62}, {0x36, 0x49, 0x55, 0x22, 0x50}, {0x00, 0x05, 0x03, 0x00, 0x00}, //$%&'
+    {0x00, 0x1C, 0x22, 0x41, 0x00}, {0x00, 0x41, 0x22, 0x1C, 0x00}, {0x14, 0x08, 0x3E, 0x08, 0x14}, {0x08, 0x08, 0x3E, 0x08, 0x08}, //()*+
+    {0x00, 0x50, 0x30, 0x00, 0x00}, {0x08, 0x08, 0x08, 0x08, 0x08}, {0x00, 0x60, 0x60, 0x00, 0x00}, {0x20, 0x10, 0x08, 0x04, 0x02}, //,-./
+    {0x3E, 0x51, 0x49, 0x45, 0x3E}, {0x00, 0x42, 0x7F, 0x40, 0x00}, {0x42, 0x61, 0x51, 0x49, 0x46}, {0x21, 0x41, 0x45, 0x4B, 0x31}, //0123
+    {0x18, 0x14, 0x12, 0x7F, 0x10}, {0x27, 0x45, 0x45, 0x45, 0x39}, {0x3C, 0x4A, 0x49, 0x49, 0x30}, {0x01, 0x71, 0x09, 0x05, 0x03}, //4567
+    {0x36, 0x49, 0x49, 0x49, 0x36}, {0x06, 0x49, 0x49, 0x29, 0x1E}, {0x00, 0x36, 0x36, 0x00, 0x00}, {0x00, 0x56, 0x36, 0x00, 0x00}, //89:;
+    {0x08, 0x14, 0x22, 0x41, 0x00}, {0x14, 0x14, 0x14, 0x14, 0x14}, {0x00, 0x41, 0x22, 0x14, 0x08}, {0x02, 0x01, 0x51, 0x09, 0x06}, //<=>?
+    {0x32, 0x49, 0x79, 0x41, 0x3E}, {0x7E, 0x11, 0x11, 0x11, 0x7E}, {0x7F, 0x49, 0x49, 0x49, 0x36}, {0x3E, 0x41, 0x41, 0x41, 0x22}, //@ABC
+    {0x7F, 0x41, 0x41, 0x22, 0x1C}, {0x7F, 0x49, 0x49, 0x49, 0x41}, {0x7F, 0x09, 0x09, 0x09, 0x01}, {0x3E, 0x41, 0x49, 0x49, 0x7A}, //DEFG
+    {0x7F, 0x08, 0x08, 0x08, 0x7F}, {0x00, 0x41, 0x7F, 0x41, 0x00}, {0x20, 0x40, 0x41, 0x3F, 0x01}, {0x7F, 0x08, 0x14, 0x22, 0x41}, //HIJK
+    {0x7F, 0x40, 0x40, 0x40, 0x40}, {0x7F, 0x02, 0x0C, 0x02, 0x7F}, {0x7F, 0x04, 0x08, 0x10, 0x7F}, {0x3E, 0x41, 0x41, 0x41, 0x3E}, //LMNO
+    {0x7F, 0x09, 0x09, 0x09, 0x06}, {0x3E, 0x41, 0x51, 0x21, 0x5E}, {0x7F, 0x09, 0x19, 0x29, 0x46}, {0x46, 0x49, 0x49, 0x49, 0x31}, //PQRS
+    {0x01, 0x01, 0x7F, 0x01, 0x01}, {0x3F, 0x40, 0x40, 0x40, 0x3F}, {0x1F, 0x20, 0x40, 0x20, 0x1F}, {0x3F, 0x40, 0x38, 0x40, 0x3F}, //TUVW
+    {0x63, 0x14, 0x08, 0x14, 0x63}, {0x07, 0x08, 0x70, 0x08, 0x07}, {0x61, 0x51, 0x49, 0x45, 0x43}, {0x00, 0x7F, 0x41, 0x41, 0x00}, //XYZ[
+    {0x02, 0x04, 0x08, 0x10, 0x20}, {0x00, 0x41, 0x41, 0x7F, 0x00}, {0x04, 0x02, 0x01, 0x02, 0x04}, {0x40, 0x40, 0x40, 0x40, 0x40}, //\]^_
+    {0x00, 0x01, 0x02, 0x04, 0x00}, {0x20, 0x54, 0x54, 0x54, 0x78}, {0x7F, 0x48, 0x44, 0x44, 0x38}, {0x38, 0x44, 0x44, 0x44, 0x20}, //`abc
+    {0x38, 0x44, 0x44, 0x48, 0x7F}, {0x38, 0x54, 0x54, 0x54, 0x18}, {0x08, 0x7E, 0x09, 0x01, 0x02}, {0x0C, 0x52, 0x52, 0x52, 0x3E}, //defg
+    {0x7F, 0x08, 0x04, 0x04, 0x78}, {0x00, 0x44, 0x7D, 0x40, 0x00}, {0x20, 0x40, 0x44, 0x3D, 0x00}, {0x7F, 0x10, 0x28, 0x44, 0x00}, //hijk
+    {0x00, 0x41, 0x7F, 0x40, 0x00}, {0x7C, 0x04, 0x18, 0x04, 0x78}, {0x7C, 0x08, 0x04, 0x04, 0x78}, {0x38, 0x44, 0x44, 0x44, 0x38}, //lmno
+    {0x7C, 0x14, 0x14, 0x14, 0x08}, {0x08, 0x14, 0x14, 0x18, 0x7C}, {0x7C, 0x08, 0x04, 0x04, 0x08}, {0x48, 0x54, 0x54, 0x54, 0x20}, //pqrs
+    {0x04, 0x3F, 0x44, 0x40, 0x20}, {0x3C, 0x40, 0x40, 0x20, 0x7C}, {0x1C, 0x20, 0x40, 0x20, 0x1C}, {0x3C, 0x40, 0x30, 0x40, 0x3C}, //tuvw
+    {0x44, 0x28, 0x10, 0x28, 0x44}, {0x0C, 0x50, 0x50, 0x50, 0x3C}, {0x44, 0x64, 0x54, 0x4C, 0x44}, {0x00, 0x08, 0x36, 0x41, 0x00}, //xyz{
+    {0x00, 0x00, 0x7F, 0x00, 0x00}, {0x00, 0x41, 0x36, 0x08, 0x00}, {0x10, 0x08, 0x08, 0x10, 0x08},                                  //|}~
+};
+
+//glyphs of the Latin-1 characters used by the firmware, and of any other character
+static const uint8_t hostGlyphDegree[5] = {0x00, 0x06, 0x09, 0x09, 0x06};
+static const uint8_t hostGlyphLaquo[5] = {0x08, 0x14, 0x2A, 0x14, 0x22};
+static const uint8_t hostGlyphRaquo[5] = {0x22, 0x14, 0x2A, 0x14, 0x08};
+static const uint8_t hostGlyphOther[5] = {0x7F, 0x41, 0x41, 0x41, 0x7F};
+
+class SSD1306Wire
+{
+public:
+    uint8_t buffer[HOST_OLED_HEIGHT][HOST_OLED_WIDTH]; //being drawn, 1 is a lit pixel
+    uint8_t screen[HOST_OLED_HEIGHT][HOST_OLED_WIDTH]; //pushed by display()
+    uint32_t frames;
+
+    SSD1306Wire() : frames(0), color(WHITE), align(TEXT_ALIGN_LEFT), font(ArialMT_Plain_10)
+    {
+        clear();
+        memset(screen, 0, sizeof(screen));
+    }
+
+    void clear() { memset(buffer, 0, sizeof(buffer)); }
+
+    void display()
+    {
+        memcpy(screen, buffer, sizeof(screen));
+        frames++;
+    }
+
+    void setColor(OLEDDISPLAY_COLOR c) { color = c; }
+    void setTextAlignment(OLEDDISPLAY_TEXT_ALIGNMENT a) { align = a; }
+    void setFont(const uint8_t *f) { font = f; }
+
+    void setPixel(int x, int y)
+    {
+        if (x < 0 || x >= HOST_OLED_WIDTH || y < 0 || y >= HOST_OLED_HEIGHT)
+            return;
+        uint8_t &p = buffer[y][x];
+        p = color == WHITE ? 1 : color == BLACK ? 0 : !p;
+    }
+
+    void fillRect(int x, int y, int width, int height)
+    {
+        for (int j = y; j < y + height; j++)
+            for (int i = x; i < x + width; i++)
+                setPixel(i, j);
+    }
+
+    uint16_t getStringWidth(const char *text, uint16_t length)
+    {
+        uint16_t n = 0;
+        for (uint16_t i = 0; i < length; i++)
+        {
+            if (((uint8_t)text[i] & 0xC0) != 0x80)
+                n++;
+        }
+        return n * font[6];
+    }
+
+    void drawString(int x, int y, const char *text)
+    {
+        int width = getStringWidth(text, strlen(text));
+        if (align == TEXT_ALIGN_RIGHT)
+            x -= width;
+        else if (align == TEXT_ALIGN_CENTER || align == TEXT_ALIGN_CENTER_BOTH)
+            x -= width / 2;
+        if (align == TEXT_ALIGN_CENTER_BOTH)
+            y -= font[1] / 2;
+        const uint8_t *p = (const uint8_t *)text;
+        while (*p)
+        {
+            drawGlyph(x, y + font[7], glyph(p));
+            x += font[6];
+        }
+    }
+
+private:
+    OLEDDISPLAY_COLOR color;
+    OLEDDISPLAY_TEXT_ALIGNMENT align;
+    const uint8_t *font;
+
+    //glyph of the UTF-8 character at p, p is moved past it
+    static const uint8_t *glyph(const uint8_t *&p)
+    {
+        uint32_t c = *p++;
+        if (c >= 0xC0)
+        {
+            int more = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : 1;
+            c &= 0x3F >> more;
+            while (more-- && (*p & 0xC0) == 0x80)
+                c = (c << 6) | (*p++ & 0x3F);
+        }
+        if (c >= 32 && c < 127)
+            return hostGlyphs[c - 32];
+        if (c == 0xB0)
+            return hostGlyphDegree;
+        if (c == 0xAB)
+            return hostGlyphLaquo;
+        if (c == 0xBB)
+            return hostGlyphRaquo;
+        return hostGlyphOther;
+    }
+
+    void drawGlyph(int x, int y, const uint8_t *g)
+    {
+        uint8_t sx = font[4], sy = font[5];
+        for (int col = 0; col < 5; col++)
+            for (int row = 0; row < 7; row++)
+                if (g[col] & (1 << row))
+                    fillRect(x + col * sx, y + row * sy, sx, sy);
+    }
+};
+
+#endif
@@ -0,0 +1,11 @@
+// Host stand-in for the lwIP name resolution API
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// getaddrinfo() and freeaddrinfo() of POSIX.
+
+#ifndef HOST_LWIP_NETDB_H
+#define HOST_LWIP_NETDB_H
+
+#include <netdb.h>
+
+#endif
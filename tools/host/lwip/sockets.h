@@ -0,0 +1,17 @@
+// Host stand-in for the lwIP sockets API
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// lwIP on the ESP32 follows the BSD sockets API, the host tools use POSIX.
+
+#ifndef HOST_LWIP_SOCKETS_H
+#define HOST_LWIP_SOCKETS_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#endif
@@ -0,0 +1,598 @@
+// Synthetic RF traffic generator and load test of the packet pipeline
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Simulates a band with many Fine Offset stations and runs every frame through
+// the code of the firmware, as wsLoop() in main.cpp does:
+//   processWSPacket -> WSConfig::ilookup/repair -> Fingerprint::collides
+//   -> WSSetting::update -> reportable -> ChangeFilter::due -> mqttPayload
+// MQTT, uploads and the OLED are left out, the payload is only written.
+//
+// Traffic model, on virtual time so an hour of traffic runs in seconds:
+//  - families WS3000 and WS4000 (WH1080, burst of 6 repeats every 48s),
+//    WH24/BR1800 (single frame every 16s) and unknown families with a valid CRC
+//  - per station a random phase, crystal drift, RSSI and AFC, drifting readings
+//    and a rain counter that wraps
+//  - frames that overlap on air are corrupted unless 6 dB stronger (capture),
+//    a fraction of the frames gets a bit error, and the radio syncs on noise
+//  - sensor glitches with a valid CRC: a temperature, gust or rain counter spike
+// The frames are written as the radio delivers them: 17 bytes, the tail padded.
+//
+// Reported: throughput, latency percentiles per stage and for the whole
+// pipeline, and the heap: live bytes, peak, allocations per packet and the
+// growth over the second half of the run, which must be flat. The rain history
+// of a station holds an hour, so the run must be longer than two hours.
+//
+// Build (ArduinoJson 6 from the PlatformIO libdeps, mbedtls for the MD5 of Windguru):
+//   g++ -O2 -std=gnu++11 -DMAX_WS=64 -Itools/host -IESP32-FineOffset-FSK -I.pio/libdeps/heltec_usb/ArduinoJson/src
+//       tools/loadgen.cpp -lmbedcrypto -o loadgen
+// Use:
+//   loadgen [-n stations] [-c configured] [-t seconds] [-e biterrors] [-g glitches] [-u unknown] [-z noise] [-s seed] [-v]
+//   -n  stations on the band, default 50
+//   -c  stations configured on the gateway, default all of a known family up to MAX_WS
+//   -t  simulated time in seconds, default 7200
+//   -e  fraction of frames with a bit error, default 0.02
+//   -g  fraction of bursts with a sensor glitch, default 0.002
+//   -u  fraction of stations of an unknown family, default 0.1
+//   -z  noise frames per second, default 0.5
+//   -s  random seed, default 1
+//   -v  keep the log of the firmware, default discarded
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <new>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include <Arduino.h>
+#include "weather.h"
+#include "stationconfig.h"
+
+#define LG_FRAME_LEN (LEN_WH2300 + 1) //PayloadLength of SX1276ws
+#define LG_AIRTIME_US 11200           //preamble, sync word and frame at 17.241 kbps
+#define LG_CAPTURE 12                 //6 dB in 0.5 dB RSSI steps, the stronger frame survives
+#define LG_WH1080_PERIOD_US 48000000
+#define LG_WH1080_REPEATS 6
+#define LG_WH1080_REPEAT_US 60000 //start to start of the frames of a burst
+#define LG_BR1800_PERIOD_US 16000000
+#define LG_DRIFT_PPM 50
+#define LG_JITTER_US 2000
+#define LG_AFC_HZ 8000 //crystal offset of a station
+#define LG_LOOP_US (WH1080_BURST_END_US + 10000) //network loop after the last frame of a burst
+
+//===== heap accounting, every allocation of the process
+
+static size_t heapLive = 0;
+static size_t heapPeak = 0;
+static uint64_t heapAllocs = 0;
+
+//the size is kept in front of the block, not inlined so the compiler does not pair malloc and delete
+#define LG_HEAP_HEADER 16
+
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    uint8_t *p = (uint8_t *)malloc(size + LG_HEAP_HEADER);
+    if (!p)
+        throw std::bad_alloc();
+    *(size_t *)p = size;
+    heapLive += size;
+    if (heapLive > heapPeak)
+        heapPeak = heapLive;
+    heapAllocs++;
+    return p + LG_HEAP_HEADER;
+}
+
+__attribute__((noinline)) void operator delete(void *ptr) noexcept
+{
+    if (!ptr)
+        return;
+    uint8_t *p = (uint8_t *)ptr - LG_HEAP_HEADER;
+    heapLive -= *(size_t *)p;
+    free(p);
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete[](void *ptr) noexcept { operator delete(ptr); }
+
+//===== frame synthesis
+
+enum Family
+{
+    FAM_WS3000,
+    FAM_WS4000,
+    FAM_BR1800,
+    FAM_UNKNOWN,
+    FAM_COUNT
+};
+
+static const char *const familyNames[FAM_COUNT] = {"ws3000", "ws4000", "wh24", "unknown"};
+//wsType of a configured station
+static const uint16_t familyTypes[FAM_COUNT] = {MSG_WS3000, MSG_WS4000, MSG_WH2300, 0xFF};
+
+static uint8_t crc8(const uint8_t *buf, int len)
+{
+    //CRC-8 poly 0x31, as _crc8 of WeatherStationProcessor
+    uint8_t crc = 0;
+    while (len--)
+    {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++)
+            crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+    }
+    return crc;
+}
+
+static uint8_t checksum(const uint8_t *buf, int len)
+{
+    uint8_t sum = 0;
+    while (len--)
+        sum += *buf++;
+    return sum;
+}
+
+struct Station
+{
+    Family family;
+    uint8_t id;
+    int64_t periodUs; //including the drift of the crystal
+    uint8_t rssi;     //in 0.5 dB steps below 0 dBm
+    int32_t afc;
+    //readings in the units of the frames
+    int16_t temperature; //0.1 Celsius
+    uint8_t humidity;
+    uint8_t wind;
+    uint8_t gust;
+    uint16_t winddir;
+    uint16_t rain; //counter, wraps at the width of the field
+    bool lowBattery;
+    uint8_t frame[LG_FRAME_LEN];
+    int len; //bytes covered by the CRC and checksum
+
+    //new readings for the next burst
+    void step(std::mt19937 &rng)
+    {
+        std::uniform_int_distribution<int> d(-2, 2);
+        temperature = std::max(-300, std::min(450, temperature + d(rng)));
+        humidity = std::max(10, std::min(99, humidity + d(rng)));
+        wind = std::max(0, std::min(40, wind + d(rng)));
+        gust = std::max((int)wind, std::min(80, gust + d(rng)));
+        winddir = (winddir + 360 + d(rng) * 5) % 360;
+        if (rng() % 8 == 0)
+            rain++;
+    }
+
+    void encode(std::mt19937 &rng)
+    {
+        for (int i = 0; i < LG_FRAME_LEN; i++)
+            frame[i] = rng();
+        uint16_t t = temperature < 0 ? -temperature : temperature;
+        switch (family)
+        {
+        case FAM_WS3000:
+        case FAM_WS4000:
+            frame[0] = (family == FAM_WS3000 ? 0x50 : 0xA0) | id >> 4;
+            frame[1] = (id & 0x0F) << 4 | (temperature < 0) << 3 | (t >> 8 & 0x07);
+            frame[2] = t;
+            frame[3] = humidity;
+            frame[4] = wind;
+            frame[5] = gust;
+            frame[6] = rain >> 8 & 0x0F;
+            frame[7] = rain;
+            if (family == FAM_WS3000)
+                len = LEN_WS3000;
+            else
+            {
+                frame[8] = lowBattery << 4 | winddir * 16 / 360;
+                len = LEN_WS4000;
+            }
+            frame[len - 1] = crc8(frame, len - 1);
+            break;
+        case FAM_BR1800:
+        {
+            uint16_t tt = temperature + 400;
+            frame[0] = 0x24;
+            frame[1] = id;
+            frame[2] = winddir;
+            frame[3] = (winddir & 0x100) >> 1 | lowBattery << 3 | (tt >> 8 & 0x07);
+            frame[4] = tt;
+            frame[5] = humidity;
+            frame[6] = wind;
+            frame[7] = gust / 8; //gust counts are 8 times the wind speed counts
+            frame[8] = rain >> 8;
+            frame[9] = rain;
+            frame[10] = 0;
+            frame[11] = 200;
+            frame[12] = 0;
+            frame[13] = 0x4E;
+            frame[14] = 0x20;
+            frame[15] = crc8(frame, 15);
+            frame[16] = checksum(frame, 16);
+            len = LEN_WH2300 + 1;
+            break;
+        }
+        default:
+            //family code not decoded by the firmware, CRC after 10 bytes
+            frame[0] = 0x30 | id >> 4;
+            frame[1] = id << 4 | (humidity & 0x0F);
+            len = 11;
+            frame[len - 1] = crc8(frame, len - 1);
+            break;
+        }
+    }
+};
+
+//a frame on air at a time, or a run of the network loop
+struct Event
+{
+    int64_t us;
+    int station; //-1 for noise, -2 for the network loop
+    uint8_t repeat;
+
+    bool operator>(const Event &o) const { return us > o.us; }
+};
+
+//===== statistics
+
+struct Stage
+{
+    const char *name;
+    std::vector<uint32_t> ns;
+
+    void report(FILE *out)
+    {
+        if (ns.empty())
+            return;
+        std::sort(ns.begin(), ns.end());
+        uint64_t sum = 0;
+        for (uint32_t v : ns)
+            sum += v;
+        size_t n = ns.size();
+        fprintf(out, "  %-8s %8zu %8llu %8u %8u %8u %8u %8u\n", name, n, (unsigned long long)(sum / n),
+                ns[n / 2], ns[n * 9 / 10], ns[n * 99 / 100], ns[n * 999 / 1000], ns[n - 1]);
+    }
+};
+
+static inline uint32_t elapsedNs(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+}
+
+struct Counts
+{
+    uint64_t frames, noise, corrupted, overlapped, captured, glitched;
+    uint64_t decoded, configured, unconfigured, rebind, collision, replaced, reported, suppressed, payloadBytes;
+    uint64_t family[FAM_COUNT];
+};
+
+WeatherStationProcessor wsProcessor;
+WSConfig wsConfig;
+
+int main(int argc, char **argv)
+{
+    int nStations = 50;
+    int nConfigured = -1;
+    double seconds = 7200;
+    double bitErrors = 0.02;
+    double glitches = 0.002;
+    double unknownShare = 0.1;
+    double noiseRate = 0.5;
+    unsigned seed = 1;
+    bool verbose = false;
+    for (int a = 1; a < argc; a++)
+    {
+        if (!strcmp(argv[a], "-n") && a + 1 < argc)
+            nStations = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-c") && a + 1 < argc)
+            nConfigured = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-t") && a + 1 < argc)
+            seconds = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-e") && a + 1 < argc)
+            bitErrors = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-g") && a + 1 < argc)
+            glitches = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-u") && a + 1 < argc)
+            unknownShare = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-z") && a + 1 < argc)
+            noiseRate = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-s") && a + 1 < argc)
+            seed = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-v"))
+            verbose = true;
+        else
+        {
+            printf("usage: %s [-n stations] [-c configured] [-t seconds] [-e biterrors] [-g glitches] [-u unknown] [-z noise] [-s seed] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (nStations < 1 || nStations > 256)
+    {
+        printf("loadgen: 1 to 256 stations, the IDs are 8 bits\n");
+        return 1;
+    }
+
+    //the report goes to the original stdout, the log of the firmware is discarded
+    FILE *out = fdopen(dup(fileno(stdout)), "w");
+    if (!verbose && !freopen("/dev/null", "w", stdout))
+        return 1;
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    hostSimUs = 0;
+
+    //stations on the band, the IDs are unique per family
+    std::vector<Station> stations(nStations);
+    for (int i = 0; i < nStations; i++)
+    {
+        Station &s = stations[i];
+        s.family = uniform(rng) < unknownShare ? FAM_UNKNOWN : (Family)(i % FAM_UNKNOWN);
+        s.id = i;
+        int64_t nominal = s.family == FAM_WS3000 || s.family == FAM_WS4000 ? LG_WH1080_PERIOD_US : LG_BR1800_PERIOD_US;
+        s.periodUs = nominal + nominal * (int64_t)(rng() % (2 * LG_DRIFT_PPM + 1) - LG_DRIFT_PPM) / 1000000;
+        s.rssi = 60 + rng() % 140;
+        s.afc = (int32_t)(rng() % (2 * LG_AFC_HZ + 1)) - LG_AFC_HZ;
+        s.temperature = (int16_t)(rng() % 400) - 100;
+        s.humidity = 30 + rng() % 60;
+        s.wind = rng() % 20;
+        s.gust = s.wind + rng() % 10;
+        s.winddir = rng() % 360;
+        s.rain = rng();
+        s.lowBattery = rng() % 20 == 0;
+        s.len = 0;
+    }
+
+    //configure the first stations of a known family, directly: the configuration is not part of the packet path
+    if (nConfigured < 0)
+        nConfigured = MAX_WS;
+    int configured = 0;
+    for (int i = 0; i < nStations && configured < nConfigured && configured < MAX_WS; i++)
+    {
+        if (stations[i].family == FAM_UNKNOWN)
+            continue;
+        WSSetting *ws = WSConfig::create(familyTypes[stations[i].family]);
+        ws->wsType = familyTypes[stations[i].family];
+        ws->wsID = stations[i].id;
+        ws->compileTargets();
+        wsConfig.stations[configured++] = ws;
+    }
+
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+    int64_t endUs = (int64_t)(seconds * 1000000);
+    for (int i = 0; i < nStations; i++)
+        events.push({(int64_t)(rng() % stations[i].periodUs), i, 0});
+    if (noiseRate > 0)
+        events.push({(int64_t)(-log(1 - uniform(rng)) / noiseRate * 1000000), -1, 0});
+
+    //latencies are kept for all frames, reserved up front to keep them out of the heap figures
+    double expected = noiseRate * seconds + 1000;
+    for (const Station &s : stations)
+        expected += seconds * 1000000 / s.periodUs * (s.family == FAM_WS3000 || s.family == FAM_WS4000 ? LG_WH1080_REPEATS : 1);
+    Stage decode = {"decode"}, station = {"station"}, report = {"report"}, total = {"total"};
+    decode.ns.reserve(expected * 1.1);
+    station.ns.reserve(expected * 1.1);
+    report.ns.reserve(expected * 1.1);
+    total.ns.reserve(expected * 1.1);
+
+    Counts n;
+    memset(&n, 0, sizeof(n));
+    int64_t airEndUs = 0;
+    uint8_t airRssi = 0;
+    size_t heapStart = heapLive, heapHalf = 0;
+    uint64_t allocsStart = heapAllocs;
+    bool half = false;
+    uint8_t frame[LG_FRAME_LEN];
+    char payload[WS_PAYLOAD_MAX];
+    std::map<uint32_t, ChangeFilter> unconfFilters; //by msgformat << 16 | stationID
+    uint16_t unconfDeadband[MF_COUNT];
+    mqttDefaultDeadbands(unconfDeadband);
+    auto run0 = std::chrono::steady_clock::now();
+
+    while (!events.empty() && events.top().us < endUs)
+    {
+        Event e = events.top();
+        events.pop();
+        if (!half && e.us >= endUs / 2)
+        {
+            heapHalf = heapLive;
+            half = true;
+        }
+
+        if (e.station == -2)
+        {
+            //network loop: report updated stations
+            hostSimUs = e.us;
+            auto t0 = std::chrono::steady_clock::now();
+            for (int i = 0; i < MAX_WS; i++)
+            {
+                WSSetting *thisStation = wsConfig.stations[i];
+                if (thisStation && thisStation->reportable() && thisStation->wsp)
+                {
+                    WSBase *wsp = thisStation->wsp;
+                    uint32_t changeMask = MF_CHANGE_MASK & mqttFieldMask(thisStation->wsType);
+                    if (!thisStation->reportFilter.due(*wsp, thisStation->deadband, changeMask,
+                                                       (int64_t)thisStation->heartbeat * 1000000))
+                    {
+                        n.suppressed++;
+                        continue;
+                    }
+                    thisStation->reportFilter.commit(*wsp);
+                    wsp->setWallClock();
+                    n.payloadBytes += wsp->mqttPayload(payload, sizeof(payload));
+                    n.reported++;
+                    thisStation->lastReported = millis();
+                }
+            }
+            report.ns.push_back(elapsedNs(t0));
+            continue;
+        }
+
+        //frame on air
+        uint8_t rssi;
+        if (e.station == -1)
+        {
+            for (int i = 0; i < LG_FRAME_LEN; i++)
+                frame[i] = rng();
+            rssi = 200 + rng() % 20;
+            n.noise++;
+            events.push({e.us + (int64_t)(-log(1 - uniform(rng)) / noiseRate * 1000000), -1, 0});
+        }
+        else
+        {
+            Station &s = stations[e.station];
+            bool wh1080 = s.family == FAM_WS3000 || s.family == FAM_WS4000;
+            if (e.repeat == 0)
+            {
+                s.step(rng);
+                if (s.family != FAM_UNKNOWN && uniform(rng) < glitches)
+                {
+                    //the whole burst carries the glitch, the readings of the station go on
+                    Station g = s;
+                    int kind = rng() % 3;
+                    if (kind == 0)
+                        g.temperature = -400;
+                    else if (kind == 1)
+                        g.gust = 200;
+                    else
+                        g.rain += 1000;
+                    g.encode(rng);
+                    memcpy(s.frame, g.frame, sizeof(s.frame));
+                    s.len = g.len;
+                    n.glitched++;
+                }
+                else
+                    s.encode(rng);
+                int64_t jitter = (int64_t)(rng() % (2 * LG_JITTER_US + 1)) - LG_JITTER_US;
+                events.push({e.us + s.periodUs + jitter, e.station, 0});
+            }
+            if (wh1080 && e.repeat + 1 < LG_WH1080_REPEATS)
+                events.push({e.us + LG_WH1080_REPEAT_US, e.station, (uint8_t)(e.repeat + 1)});
+            memcpy(frame, s.frame, sizeof(frame));
+            rssi = s.rssi + rng() % 9 - 4;
+            if (uniform(rng) < bitErrors)
+            {
+                frame[rng() % s.len] ^= 1 << rng() % 8;
+                n.corrupted++;
+            }
+            n.frames++;
+            n.family[s.family]++;
+        }
+
+        //overlap with the previous frame on air, the radio locks onto the stronger one
+        if (e.us < airEndUs)
+        {
+            if (rssi + LG_CAPTURE <= airRssi)
+                n.captured++;
+            else
+            {
+                frame[rng() % 8] ^= 0x10;
+                n.overlapped++;
+            }
+        }
+        if (e.us + LG_AIRTIME_US > airEndUs)
+        {
+            airEndUs = e.us + LG_AIRTIME_US;
+            airRssi = rssi;
+        }
+
+        //received at the end of the frame
+        int64_t rxUs = e.us + LG_AIRTIME_US;
+        hostSimUs = rxUs;
+        int32_t afc = e.station >= 0 ? stations[e.station].afc + (int32_t)(rng() % 601) - 300 : 0;
+        uint8_t snr = rssi < 220 ? (220 - rssi) / 2 : 0;
+
+        auto t0 = std::chrono::steady_clock::now();
+        WSBase *ws = wsProcessor.processWSPacket(frame, LG_FRAME_LEN, rxUs, rssi, snr, 1, afc);
+        uint32_t decodeNs = elapsedNs(t0);
+        decode.ns.push_back(decodeNs);
+        if (!ws)
+        {
+            total.ns.push_back(decodeNs);
+            continue;
+        }
+        n.decoded++;
+
+        //as wsLoop() in main.cpp
+        auto t1 = std::chrono::steady_clock::now();
+        ws->setWallClock();
+        ws->print();
+        uint8_t idx = wsConfig.ilookup(ws->msgformat, ws->stationID);
+        if (idx >= MAX_WS)
+        {
+            idx = wsConfig.repair(ws);
+            if (idx < MAX_WS)
+                n.rebind++;
+        }
+        WSSetting *thisStation = (idx < MAX_WS) ? wsConfig.stations[idx] : nullptr;
+        if (thisStation && thisStation->fp.collides(WSSetting::sample(ws)))
+        {
+            n.collision++;
+            thisStation->collisionUs = ws->rxUs;
+            thisStation = nullptr;
+        }
+        if (thisStation)
+        {
+            thisStation->update(ws, frame);
+            n.configured++;
+            if (ws->quality)
+                n.replaced++;
+            events.push({rxUs + LG_LOOP_US, -2, 0});
+        }
+        else
+        {
+            //change filter of unconfigured stations as unconfiguredDue() in main.cpp
+            ChangeFilter &filter = unconfFilters[((uint32_t)ws->msgformat << 16) | ws->stationID];
+            if (!mqttDecoded(ws->msgformat) ||
+                filter.due(*ws, unconfDeadband, MF_CHANGE_MASK & mqttFieldMask(ws->msgformat), WS_HEARTBEAT_SEC * 1000000LL))
+            {
+                filter.commit(*ws);
+                n.payloadBytes += ws->mqttPayload(payload, sizeof(payload));
+                n.unconfigured++;
+            }
+            else
+                n.suppressed++;
+        }
+        delete ws;
+        uint32_t stationNs = elapsedNs(t1);
+        station.ns.push_back(stationNs);
+        total.ns.push_back(decodeNs + stationNs);
+    }
+    double runS = elapsedNs(run0) / 1e9;
+    fflush(stdout);
+
+    uint64_t received = n.frames + n.noise;
+    fprintf(out, "loadgen: %d stations, %d configured (MAX_WS %d), %.0f s simulated, seed %u\n",
+            nStations, configured, MAX_WS, seconds, seed);
+    fprintf(out, "frames   %llu:", (unsigned long long)n.frames);
+    for (int f = 0; f < FAM_COUNT; f++)
+        fprintf(out, " %s %llu", familyNames[f], (unsigned long long)n.family[f]);
+    fprintf(out, ", noise %llu\n", (unsigned long long)n.noise);
+    fprintf(out, "damaged  bit error %llu, overlap %llu, captured %llu, glitched bursts %llu\n",
+            (unsigned long long)n.corrupted, (unsigned long long)n.overlapped, (unsigned long long)n.captured,
+            (unsigned long long)n.glitched);
+    fprintf(out, "crc fail");
+    for (int f = 0; f < WSF_COUNT; f++)
+        fprintf(out, " %s %u", wsFamilyNames[f], wsProcessor.crcFail[f].get());
+    fprintf(out, "\n");
+    fprintf(out, "pipeline decoded %llu, configured %llu, unconfigured %llu, reported %llu, suppressed %llu, rebind %llu, collision %llu, payload %llu B\n",
+            (unsigned long long)n.decoded, (unsigned long long)n.configured, (unsigned long long)n.unconfigured,
+            (unsigned long long)n.reported, (unsigned long long)n.suppressed, (unsigned long long)n.rebind,
+            (unsigned long long)n.collision, (unsigned long long)n.payloadBytes);
+    fprintf(out, "quality  %llu packets with readings replaced\n", (unsigned long long)n.replaced);
+    fprintf(out, "rate     %.0f frames/s on air, %.0f frames/s processed in %.3f s, %.0fx real time\n",
+            received / seconds, received / runS, runS, seconds / runS);
+    fprintf(out, "latency  %8s %8s %8s %8s %8s %8s %8s %8s (ns)\n", "count", "mean", "p50", "p90", "p99", "p99.9", "max", "");
+    decode.report(out);
+    station.report(out);
+    report.report(out);
+    total.report(out);
+    fprintf(out, "heap     live %zu B at start, %zu B at half, %zu B at end, peak %zu B, %.2f allocations per frame\n",
+            heapStart, heapHalf, heapLive, heapPeak, received ? (double)(heapAllocs - allocsStart) / received : 0.0);
+    if (half && heapLive > heapHalf)
+        fprintf(out, "heap     grew %zu B over the second half\n", heapLive - heapHalf);
+    fclose(out);
+    return 0;
+}
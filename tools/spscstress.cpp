@@ -0,0 +1,203 @@
+// Concurrent stress test of the SPSC queue between the radio and network tasks
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// One producer thread and one consumer thread push sequenced WSRecords through
+// an SPSCQueue<WSRecord, 32>, the queue of main.cpp, with the hand-off protocol
+// of the firmware:
+//  - the producer allocates the WSBase, the consumer deletes it
+//  - the consumer peeks a record, may leave it queued (waiting for SNTP in
+//    stampRecord), and pops it later; the pop must return the peeked record
+//  - a third thread reads size(), as the stats of the network task do
+// The sequence number is written in ws->rxUs and in every byte of pkt, so a
+// torn copy of a slot is found as well as a lost, duplicated or reordered one.
+//
+// Two phases:
+//  lossless  the producer retries while the queue is full, every record must
+//            arrive exactly once and in order
+//  drop      the producer drops a record when the queue is full, as rfLoop()
+//            does; the received records must be in order without duplicates,
+//            and received plus dropped must be the number sent
+//
+// Build, with ThreadSanitizer (or -fsanitize=address,undefined):
+//   g++ -g -O2 -std=gnu++11 -fsanitize=thread -pthread -Itools/host -IESP32-FineOffset-FSK
+//       tools/spscstress.cpp -o spscstress
+// Use:
+//   spscstress [-n records] [-s seed]
+//   -n  records per phase, default 2000000
+//   -s  random seed of the consumer and producer pauses, default 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+
+#include <Arduino.h>
+#include "weather.h"
+#include "spscqueue.h"
+
+static SPSCQueue<WSRecord, 32> queue;
+static std::atomic<bool> running;
+static uint32_t seed = 1;
+
+static std::atomic<uint32_t> errors(0);
+
+static void error(const char *what, uint64_t expected, uint64_t got)
+{
+    if (errors++ < 10)
+        fprintf(stderr, "spscstress: %s, expected %llu got %llu\n", what, (unsigned long long)expected, (unsigned long long)got);
+}
+
+//byte i of the packet of record seq
+static inline uint8_t pktByte(uint64_t seq, size_t i)
+{
+    return (uint8_t)(seq >> (8 * (i % 4))) ^ (uint8_t)i;
+}
+
+static void producer(uint64_t count, bool drop, uint64_t *dropped)
+{
+    std::mt19937 rng(seed);
+    for (uint64_t seq = 0; seq < count; seq++)
+    {
+        WSRecord record;
+        record.ws = new UnknownFineOffset();
+        record.ws->rxUs = seq;
+        for (size_t i = 0; i < sizeof(record.pkt); i++)
+            record.pkt[i] = pktByte(seq, i);
+        while (!queue.push(record))
+        {
+            if (drop)
+            {
+                delete record.ws;
+                (*dropped)++;
+                break;
+            }
+            std::this_thread::yield();
+        }
+        //bursts and pauses, so the queue runs both full and empty
+        if ((rng() & 0x3FF) == 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(rng() % 200));
+        //the radio is slower than the network task, only a burst overflows the queue
+        else if (drop && (rng() & 0xFF) > 8)
+            std::this_thread::yield();
+    }
+}
+
+//returns the number of records received
+static uint64_t consumer(uint64_t count, bool drop, const std::atomic<bool> &producerDone)
+{
+    std::mt19937 rng(seed * 7 + 1);
+    uint64_t received = 0;
+    int64_t last = -1;
+    for (;;)
+    {
+        WSRecord peeked, record;
+        if (!queue.peek(peeked))
+        {
+            if (producerDone.load(std::memory_order_acquire) && queue.empty())
+                break;
+            std::this_thread::yield();
+            continue;
+        }
+        //leave it queued now and then, as a packet waiting for SNTP
+        if ((rng() & 0x1F) == 0)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        if (!queue.pop(record))
+        {
+            error("pop after peek failed", 1, 0);
+            break;
+        }
+        if (record.ws != peeked.ws || memcmp(record.pkt, peeked.pkt, sizeof(record.pkt)) != 0)
+            error("pop differs from peek", peeked.ws->rxUs, record.ws->rxUs);
+
+        int64_t seq = record.ws->rxUs;
+        if (drop ? seq <= last : seq != last + 1)
+            error(drop ? "duplicate or reordered record" : "lost, duplicated or reordered record", last + 1, seq);
+        for (size_t i = 0; i < sizeof(record.pkt); i++)
+        {
+            if (record.pkt[i] != pktByte(seq, i))
+            {
+                error("torn packet copy", seq, i);
+                break;
+            }
+        }
+        last = seq;
+        received++;
+        delete record.ws;
+        if ((rng() & 0x3FF) == 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(rng() % 200));
+    }
+    if (!drop && received != count)
+        error("records received", count, received);
+    return received;
+}
+
+//reads the queue size as the stats of the network task do
+static void observer(uint64_t *maxSize)
+{
+    while (running.load(std::memory_order_acquire))
+    {
+        size_t n = queue.size();
+        if (n > queue.capacity())
+            error("size beyond capacity", queue.capacity(), n);
+        if (n > *maxSize)
+            *maxSize = n;
+        std::this_thread::yield();
+    }
+}
+
+static void phase(const char *name, uint64_t count, bool drop)
+{
+    std::atomic<bool> producerDone(false);
+    uint64_t dropped = 0, received = 0, maxSize = 0;
+    running.store(true);
+    auto t0 = std::chrono::steady_clock::now();
+    std::thread obs(observer, &maxSize);
+    std::thread cons([&]() { received = consumer(count, drop, producerDone); });
+    std::thread prod([&]() {
+        producer(count, drop, &dropped);
+        producerDone.store(true, std::memory_order_release);
+    });
+    prod.join();
+    cons.join();
+    running.store(false);
+    obs.join();
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if (received + dropped != count)
+        error("received and dropped", count, received + dropped);
+    printf("%-9s %10llu sent %10llu received %8llu dropped  max queued %2llu  %.1fs, %.0f records/s\n", name,
+           (unsigned long long)count, (unsigned long long)received, (unsigned long long)dropped,
+           (unsigned long long)maxSize, s, received / s);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t count = 2000000;
+    for (int a = 1; a < argc; a++)
+    {
+        if (!strcmp(argv[a], "-n") && a + 1 < argc)
+            count = strtoull(argv[++a], nullptr, 0);
+        else if (!strcmp(argv[a], "-s") && a + 1 < argc)
+            seed = strtoul(argv[++a], nullptr, 0);
+        else
+        {
+            printf("usage: %s [-n records] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    phase("lossless", count, false);
+    phase("drop", count, true);
+    if (errors)
+    {
+        printf("spscstress: %u errors\n", errors.load());
+        return 1;
+    }
+    printf("spscstress: ok\n");
+    return 0;
+}
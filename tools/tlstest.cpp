@@ -0,0 +1,265 @@
+// Test of session resumption and public key pinning of TLSClient
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Runs TLSClient of tlsclient.h against a local openssl s_server with a
+// self-signed certificate, as UploadToWebAPI() in main.cpp connects to a target:
+//  - with the pin set as by the /tlspin command, the first connection does a
+//    full handshake that matches it
+//  - the next ones resume the cached session, an HTTP request gets its answer
+//  - a restarted server with the same key rejects the session: a full
+//    handshake, the pinned key matches
+//  - a server with a new key is refused, also on the next connection: the
+//    pin is kept
+//  - setPin() with the new key, the connection succeeds and resumes again
+//  - a cleared pin: the next full handshake pins the key presented, the old
+//    key is then refused
+//  - a refused port and a server that never answers the handshake fail
+//    within the timeout of the connect
+// The TLSStats counters must follow each step. The keys are generated with the
+// openssl command in a temporary directory, the pins are the SHA-256 of the
+// public key as openssl computes it.
+//
+// Build (mbedtls 2.x headers and libraries, e.g. libmbedtls-dev):
+//   g++ -O2 -std=gnu++11 -Itools/host -IESP32-FineOffset-FSK tools/tlstest.cpp
+//       -lmbedtls -lmbedx509 -lmbedcrypto -o tlstest
+// Use:
+//   tlstest [-p port] [-n resumes] [-o openssl] [-v]
+//   -p  port of the local server, default 44330
+//   -n  resumed connections to time, default 20
+//   -o  openssl command, default openssl
+//   -v  keep the log of TLSClient, default discarded
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+#include "tlsclient.h"
+
+#define TT_TIMEOUT_MS 2000
+#define TT_STALL_TIMEOUT_MS 500
+#define TT_READY_MS 5000
+
+static const char *openssl = "openssl";
+static char dir[] = "/tmp/tlstestXXXXXX";
+static int failures = 0;
+static FILE *out = stdout;
+
+static void check(bool ok, const char *what)
+{
+    fprintf(out, "%-60s %s\n", what, ok ? "ok" : "FAIL");
+    if (!ok)
+        failures++;
+}
+
+//a self-signed certificate for localhost with a new P-256 key
+static bool makeKey(const char *name)
+{
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd),
+             "%s req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes -days 1 -subj /CN=localhost "
+             "-keyout %s/%s.key -out %s/%s.crt >/dev/null 2>&1",
+             openssl, dir, name, dir, name);
+    return system(cmd) == 0;
+}
+
+//openssl s_server on port with the key name, answers a GET with a status page
+static pid_t startServer(uint16_t port, const char *name)
+{
+    char portstr[8], key[256], crt[256];
+    snprintf(portstr, sizeof(portstr), "%u", port);
+    snprintf(key, sizeof(key), "%s/%s.key", dir, name);
+    snprintf(crt, sizeof(crt), "%s/%s.crt", dir, name);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        if (!freopen("/dev/null", "w", stdout) || !freopen("/dev/null", "w", stderr))
+            _exit(127);
+        execlp(openssl, openssl, "s_server", "-accept", portstr, "-cert", crt, "-key", key, "-www", "-quiet",
+               (char *)nullptr);
+        _exit(127);
+    }
+    //ready once the port accepts a connection
+    for (uint32_t t0 = millis(); pid > 0 && millis() - t0 < TT_READY_MS; delay(50))
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(port);
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bool up = ::connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0;
+        ::close(fd);
+        if (up)
+            return pid;
+    }
+    fprintf(out, "tlstest: %s s_server did not start on port %u\n", openssl, port);
+    return -1;
+}
+
+static void stopServer(pid_t pid)
+{
+    if (pid <= 0)
+        return;
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+}
+
+//a request over the connection, true when the answer is a 200
+static bool get(TLSClient &client)
+{
+    static const char *request = "GET / HTTP/1.0\r\nHost: localhost\r\n\r\n";
+    if (client.write((const uint8_t *)request, strlen(request)) != strlen(request))
+        return false;
+    char answer[64];
+    size_t n = 0;
+    for (uint32_t t0 = millis(); client.connected() && n < sizeof(answer) - 1 && millis() - t0 < TT_TIMEOUT_MS;)
+    {
+        int r = client.read((uint8_t *)answer + n, sizeof(answer) - 1 - n);
+        if (r > 0)
+            n += r;
+    }
+    answer[n] = 0;
+    return strncmp(answer, "HTTP/1.0 200", 12) == 0;
+}
+
+//a connection, its handshake must end with stats as expected
+static bool connectOnce(uint16_t port, bool expectOk, uint32_t full, uint32_t resumed, uint32_t mismatch)
+{
+    TLSClient client;
+    int ok = client.connect("localhost", port, TT_TIMEOUT_MS);
+    bool answered = ok && get(client);
+    client.stop();
+    const TLSStats &s = TLSClient::stats;
+    return (ok != 0) == expectOk && answered == expectOk && s.full == full && s.resumed == resumed &&
+           s.pinMismatch == mismatch;
+}
+
+//the pin of the key name: SHA-256 of the DER public key, as mbedtls hashes pk_raw
+static bool pinOf(const char *name, uint8_t *pin)
+{
+    char cmd[512], line[160];
+    snprintf(cmd, sizeof(cmd), "%s x509 -in %s/%s.crt -pubkey -noout | %s pkey -pubin -outform DER | %s dgst -sha256 -hex",
+             openssl, dir, name, openssl, openssl);
+    FILE *p = popen(cmd, "r");
+    if (!p)
+        return false;
+    bool ok = fgets(line, sizeof(line), p) != nullptr;
+    pclose(p);
+    const char *hex = ok ? strstr(line, "= ") : nullptr;
+    return hex && TLSClient::parsePin(hex + 2, pin);
+}
+
+int main(int argc, char **argv)
+{
+    uint16_t port = 44330;
+    int resumes = 20;
+    bool verbose = false;
+    for (int a = 1; a < argc; a++)
+    {
+        if (!strcmp(argv[a], "-p") && a + 1 < argc)
+            port = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-n") && a + 1 < argc)
+            resumes = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-o") && a + 1 < argc)
+            openssl = argv[++a];
+        else if (!strcmp(argv[a], "-v"))
+            verbose = true;
+        else
+        {
+            printf("usage: %s [-p port] [-n resumes] [-o openssl] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+    uint8_t pinA[32], pinB[32];
+    if (!mkdtemp(dir) || !makeKey("a") || !makeKey("b") || !pinOf("a", pinA) || !pinOf("b", pinB))
+    {
+        printf("tlstest: cannot make the keys with %s\n", openssl);
+        return 1;
+    }
+
+    //the results go to the original stdout, the log of TLSClient is discarded
+    out = fdopen(dup(fileno(stdout)), "w");
+    if (!verbose && !freopen("/dev/null", "w", stdout))
+        return 1;
+
+    pid_t server = startServer(port, "a");
+    if (server < 0)
+        return 1;
+    TLSClient::setPin("localhost", port, pinA);
+    check(connectOnce(port, true, 1, 0, 0), "first connection: full handshake, configured pin matches");
+    check(connectOnce(port, true, 1, 1, 0), "second connection: session resumed");
+    uint32_t fullMs = TLSClient::stats.maxFullMs;
+    bool allResumed = true;
+    for (int i = 0; i < resumes; i++)
+        allResumed &= connectOnce(port, true, 1, 2 + i, 0);
+    check(allResumed, "following connections: session resumed");
+
+    //a new server process does not know the session
+    stopServer(server);
+    server = startServer(port, "a");
+    uint32_t resumed = TLSClient::stats.resumed;
+    check(connectOnce(port, true, 2, resumed, 0), "restart, same key: full handshake, pin matches");
+    check(connectOnce(port, true, 2, resumed + 1, 0), "restart, same key: session resumed");
+
+    //a new key is refused until the pin is changed, the refused handshakes are not counted as full
+    stopServer(server);
+    server = startServer(port, "b");
+    uint32_t failed = TLSClient::stats.failed;
+    check(connectOnce(port, false, 2, resumed + 1, 1), "new key: pin mismatch, connection refused");
+    check(connectOnce(port, false, 2, resumed + 1, 2) && TLSClient::stats.failed == failed + 2,
+          "new key again: refused, the pin is kept");
+    TLSClient::setPin("localhost", port, pinB);
+    check(connectOnce(port, true, 3, resumed + 1, 2), "new key pinned: full handshake");
+    check(connectOnce(port, true, 3, resumed + 2, 2), "new key pinned: session resumed");
+
+    //a cleared pin is taken from the next full handshake
+    TLSClient::setPin("localhost", port, nullptr);
+    check(connectOnce(port, true, 4, resumed + 2, 2), "pin cleared: full handshake pins the key");
+    stopServer(server);
+    server = startServer(port, "a");
+    check(connectOnce(port, false, 4, resumed + 2, 3), "pin cleared: the old key is refused");
+    stopServer(server);
+
+    //nothing listens on the port
+    TLSClient client;
+    check(!client.connect("localhost", port, TT_TIMEOUT_MS), "refused port: connect fails");
+    //a server that accepts the TCP connection and never answers the handshake
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0 && listen(fd, 1) == 0)
+    {
+        uint32_t t0 = millis();
+        int ok = client.connect("localhost", port, TT_STALL_TIMEOUT_MS);
+        uint32_t ms = millis() - t0;
+        check(!ok && ms < 2 * TT_STALL_TIMEOUT_MS, "stalled server: handshake fails within the timeout");
+    }
+    else
+        check(false, "stalled server: listen on the port");
+    ::close(fd);
+
+    const TLSStats &s = TLSClient::stats;
+    fprintf(out, "handshakes: %u full, %u resumed, %u failed, %u pin mismatch, full at most %ums, resumed at most %ums\n", s.full,
+           s.resumed, s.failed, s.pinMismatch, fullMs, s.maxResumedMs);
+
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0)
+        fprintf(out, "tlstest: %s not removed\n", dir);
+    if (failures)
+    {
+        fprintf(out, "tlstest: %d failures\n", failures);
+        return 1;
+    }
+    fprintf(out, "tlstest: ok\n");
+    return 0;
+}
@@ -0,0 +1,290 @@
+// Soak test of the upload path, the heap must stay flat
+// Copyright (c) 2020 SevenWatt.com, all rights reserved
+//
+// Runs uploads of a station with every target enabled through the code of the
+// firmware, as wsLoop() and UploadToWebAPI() in main.cpp do:
+//   WSSetting::update -> WSSetting::request (templates, Windguru MD5)
+//   -> HttpResponse::feed -> WebStats::record
+// on virtual time, one upload per target every 60 s. The connection is left out,
+// the response of the server is fed in the 256 byte reads of UploadToWebAPI().
+// Now and then a server answers 500, closes early or the configuration changes
+// through /wsconfig and the templates are compiled again.
+//
+// The heap in use (mallinfo2, so malloc of C code such as mbedtls is included)
+// is taken after a warm-up of SOAK_WARMUP uploads, when the rain history of an
+// hour is full, and then at every tenth of the run. Each must equal the heap
+// after the warm-up, a leak of a single byte per upload fails the test.
+// Building the requests and parsing the responses must not call operator new
+// at all, the station update is left out of that count.
+//
+// Build without sanitizers, their allocator is not seen by mallinfo2
+// (mbedtls for the MD5 of Windguru, the ArduinoJson headers for stationconfig.h):
+//   g++ -O2 -std=gnu++11 -Itools/host -IESP32-FineOffset-FSK -I.pio/libdeps/heltec_usb/ArduinoJson/src
+//       tools/uploadsoak.cpp -lmbedcrypto -o uploadsoak
+// Use:
+//   uploadsoak [-n uploads] [-s seed] [-v]
+//   -n  uploads of each target, default 1000000
+//   -s  random seed, default 1
+//   -v  keep the log of the firmware, default discarded
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <new>
+#include <random>
+
+#include <Arduino.h>
+#include "weather.h"
+#include "stationconfig.h"
+#include "httpresponse.h"
+
+#define SOAK_WARMUP 10000
+#define SOAK_PERIOD_US 60000000LL
+#define SOAK_CHECKPOINTS 10
+#define SOAK_RXBUF 256 //read buffer of UploadToWebAPI()
+
+//===== allocations of operator new, the bytes are taken from the allocator
+
+static uint64_t newCalls = 0;
+
+void *operator new(size_t size)
+{
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    newCalls++;
+    return p;
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+
+static size_t heapInUse()
+{
+    return mallinfo2().uordblks;
+}
+
+//===== server responses
+
+static const char *const responseOk[WT_COUNT] = {
+    //wunderground
+    "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 8\r\nConnection: close\r\n\r\nsuccess\n",
+    //domoticz, the same for each device
+    "HTTP/1.1 200 OK\r\nContent-Type: application/json;charset=UTF-8\r\nTransfer-Encoding: chunked\r\n\r\n"
+    "16\r\n{\n   \"status\" : \"OK\",\n\r\n17\r\n   \"title\" : \"Update\"\n}\r\n0\r\n\r\n",
+    nullptr, nullptr, nullptr, nullptr,
+    //windguru
+    "HTTP/1.1 200 OK\r\nServer: nginx\r\nContent-Type: text/html; charset=UTF-8\r\nConnection: close\r\n\r\nOK"};
+
+static const char *responseError = "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 21\r\n\r\nInternal Server Error";
+
+//the status of the response, fed as UploadToWebAPI() reads it, 0 without a valid response
+static int16_t serve(const char *text, size_t cut)
+{
+    HttpResponse response;
+    size_t len = strlen(text);
+    if (cut < len)
+        len = cut; //the server closes the connection early
+    size_t at = 0;
+    while (at < len && !response.done() && !response.error())
+    {
+        size_t n = len - at < SOAK_RXBUF ? len - at : SOAK_RXBUF;
+        response.feed((const uint8_t *)text + at, n);
+        at += n;
+    }
+    if (!response.done() && !response.error())
+        response.finish();
+    return response.done() ? response.status : 0;
+}
+
+//===== station
+
+static void configure(WSSetting *st, uint32_t generation)
+{
+    st->wunderground = true;
+    snprintf(st->wuID, sizeof(st->wuID), "IUTRECH%u", generation % 10);
+    strncpy(st->wuPW, "secret", sizeof(st->wuPW) - 1);
+    st->domoticz = true;
+    strncpy(st->dzURL, "192.168.1.10", sizeof(st->dzURL) - 1);
+    st->dzPort = 8080;
+    st->dzSecure = false;
+    strncpy(st->dzID, "dXNlcg==", sizeof(st->dzID) - 1);
+    strncpy(st->dzPW, "cGFzcw==", sizeof(st->dzPW) - 1);
+    st->dzTHidx = 101;
+    st->dzWidx = 102;
+    st->dzRidx = 103;
+    st->dzLidx = 104;
+    st->dzUVidx = 105 + generation % 3;
+    st->windguru = true;
+    strncpy(st->wgUID, "stationXY", sizeof(st->wgUID) - 1);
+    strncpy(st->wgPW, "supersecret", sizeof(st->wgPW) - 1);
+    st->compileTargets();
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t uploads = 1000000;
+    uint32_t seed = 1;
+    bool verbose = false;
+    for (int a = 1; a < argc; a++)
+    {
+        if (!strcmp(argv[a], "-n") && a + 1 < argc)
+            uploads = strtoull(argv[++a], nullptr, 0);
+        else if (!strcmp(argv[a], "-s") && a + 1 < argc)
+            seed = strtoul(argv[++a], nullptr, 0);
+        else if (!strcmp(argv[a], "-v"))
+            verbose = true;
+        else
+        {
+            printf("usage: %s [-n uploads] [-s seed] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (uploads < SOAK_WARMUP + SOAK_CHECKPOINTS)
+        uploads = SOAK_WARMUP + SOAK_CHECKPOINTS;
+
+    //the results go to the original stdout, the log of the firmware is discarded
+    FILE *out = fdopen(dup(fileno(stdout)), "w");
+    if (!verbose && !freopen("/dev/null", "w", stdout))
+        return 1;
+
+    //the MD5 of the example in compileTargets(), a stubbed mbedtls fails here
+    static const char *key = "20180214171400stationXYsupersecret";
+    char md5hash[33];
+    md5Hex((const uint8_t *)key, strlen(key), md5hash);
+    if (strcmp(md5hash, "c9441d30280f4f6f4946fe2b2d360df5") != 0)
+    {
+        fprintf(out, "uploadsoak: MD5 of the Windguru example is %s, link the real mbedtls\n", md5hash);
+        return 1;
+    }
+
+    hostSimUs = 0;
+    std::mt19937 rng(seed);
+    BR1800 data;
+    data.msgformat = MSG_WH2300;
+    data.stationID = 0xB4;
+    data.humidity = 54;
+    data.winddir = 292;
+    data.rain = 1289;
+    uint8_t pkt[LEN_WH2300 + 1] = {0x24, 0xB4};
+    WSSetting *st = WSConfig::create(MSG_WH2300);
+    st->wsType = MSG_WH2300;
+    st->wsID = data.stationID;
+    uint32_t generation = 0;
+    configure(st, generation);
+
+    //the first line allocates the buffer of out before the warm-up
+    fprintf(out, "uploadsoak: %llu uploads of each target, the heap is taken after %d\n", (unsigned long long)uploads,
+            SOAK_WARMUP);
+    fflush(out);
+
+    Counter uploadOk[WT_COUNT], uploadFail[WT_COUNT];
+    char request[WT_REQUEST_MAX];
+    size_t heapWarm = 0, heapMax = 0;
+    uint64_t requestNew = 0, requests = 0, requestBytes = 0;
+    int failed = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint64_t u = 0; u < uploads; u++)
+    {
+        //a packet of the station, readings drift
+        hostSimUs += SOAK_PERIOD_US;
+        data.rxUs = hostSimUs;
+        data.temperature = (int16_t)(rng() % 700) - 200;
+        data.windspeed = rng() % 600;
+        data.windgust = data.windspeed + rng() % 200;
+        data.lightlux = rng() % 120000;
+        data.UVI = rng() % 14;
+        if ((rng() & 7) == 0)
+            data.rain += 3;
+        st->update(&data, pkt);
+
+        //a configuration change through /wsconfig
+        if (u % 10007 == 10006)
+            configure(st, ++generation);
+
+        uint64_t newBefore = newCalls;
+        for (int t = 0; t < WT_COUNT; t++)
+        {
+            if (!st->targets[t].enabled)
+                continue;
+            size_t len = st->request(t, request, sizeof(request));
+            if (len == 0 || len >= sizeof(request) - 1 || strlen(request) != len)
+            {
+                if (failed++ < 10)
+                    fprintf(out, "uploadsoak: request %s of upload %llu has length %zu\n", webTargetNames[t],
+                            (unsigned long long)u, len);
+            }
+            requests++;
+            requestBytes += len;
+
+            const char *text = responseOk[t] ? responseOk[t] : responseOk[WT_DZ_TEMP];
+            uint32_t r = rng() % 100;
+            if (r == 0)
+                text = responseError;
+            size_t cut = r == 1 ? rng() % strlen(text) : (size_t)-1;
+            uint32_t at = millis();
+            int16_t status = serve(text, cut);
+            st->targets[t].stats.record(status, rng() % 800, at);
+            if (status >= 200 && status < 300)
+                uploadOk[t].inc();
+            else
+                uploadFail[t].inc();
+        }
+        if (u >= SOAK_WARMUP)
+            requestNew += newCalls - newBefore;
+
+        if (u + 1 == SOAK_WARMUP)
+        {
+            heapWarm = heapMax = heapInUse();
+            if (heapWarm == 0)
+            {
+                fprintf(out, "uploadsoak: mallinfo2 does not see the allocator, build without sanitizers\n");
+                return 1;
+            }
+        }
+        else if (u + 1 > SOAK_WARMUP && (u + 1 - SOAK_WARMUP) % ((uploads - SOAK_WARMUP) / SOAK_CHECKPOINTS) == 0)
+        {
+            size_t heap = heapInUse();
+            if (heap > heapMax)
+                heapMax = heap;
+            fprintf(out, "upload %9llu  heap in use %zu B\n", (unsigned long long)(u + 1), heap);
+            if (heap != heapWarm)
+            {
+                fprintf(out, "uploadsoak: heap changed by %lld B since the warm-up\n", (long long)heap - (long long)heapWarm);
+                failed++;
+            }
+        }
+    }
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    delete st->wsp;
+    delete st;
+
+    uint64_t ok = 0, fail = 0;
+    for (int t = 0; t < WT_COUNT; t++)
+    {
+        ok += uploadOk[t].get();
+        fail += uploadFail[t].get();
+    }
+    fprintf(out, "uploads  %llu of each target, %llu requests of %.0f B on average, %llu ok, %llu failed, %.1fs\n",
+            (unsigned long long)uploads, (unsigned long long)requests, requests ? (double)requestBytes / requests : 0.0,
+            (unsigned long long)ok, (unsigned long long)fail, s);
+    fprintf(out, "heap     %zu B in use after the warm-up, at most %zu B after it, %llu operator new in the uploads after it\n",
+            heapWarm, heapMax, (unsigned long long)requestNew);
+    //the requests are built in the buffer of the caller, the templates are compiled on a configuration change
+    if (requestNew)
+    {
+        fprintf(out, "uploadsoak: the upload path allocated\n");
+        failed++;
+    }
+    if (failed)
+    {
+        fprintf(out, "uploadsoak: FAIL\n");
+        return 1;
+    }
+    fprintf(out, "uploadsoak: ok, the heap is flat\n");
+    return 0;
+}